@@ -0,0 +1,138 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "ustreamer-client.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include "uslibs/types.h"
+#include "uslibs/errors.h"
+#include "uslibs/tools.h"
+#include "uslibs/memsinksh.h"
+#include "uslibs/memsinkcl.h"
+
+
+struct us_client_t {
+	us_memsinkcl_s	*cl;
+	ldf				lock_timeout;
+	bool			key_required;
+	bool			bitrate_set;
+	uint			bitrate;
+};
+
+
+unsigned us_client_get_abi_version(void) {
+	return US_CLIENT_ABI_VERSION;
+}
+
+us_client_s *us_client_open(const char *obj) {
+	const uz data_size = us_memsink_calculate_size(obj);
+	if (data_size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	const int fd = shm_open(obj, O_RDWR, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	us_client_s *client;
+	US_CALLOC(client, 1);
+	client->lock_timeout = 1;
+	if ((client->cl = us_memsinkcl_init(fd, data_size)) == NULL) { // The client takes the fd
+		const int error = errno;
+		free(client);
+		errno = error;
+		return NULL;
+	}
+	return client;
+}
+
+void us_client_close(us_client_s *client) {
+	us_memsinkcl_destroy(client->cl);
+	free(client);
+}
+
+int us_client_get_fd(us_client_s *client) {
+	return us_memsinkcl_get_notify_fd(client->cl);
+}
+
+int us_client_acquire(us_client_s *client, us_client_frame_s *frame, double timeout) {
+	us_memsinkcl_clear_notify_fd(client->cl);
+
+	const int retval = us_memsinkcl_acquire(client->cl, client->lock_timeout, timeout);
+	if (retval == US_ERROR_NO_DATA) {
+		return US_CLIENT_NO_DATA;
+	} else if (retval < 0) {
+		return -1;
+	}
+
+	us_memsink_shared_s *const mem = client->cl->mem;
+	*frame = (us_client_frame_s){
+		.data = us_memsink_get_data(mem),
+		.used = mem->used,
+		.id = mem->id,
+		.width = mem->width,
+		.height = mem->height,
+		.format = mem->format,
+		.stride = mem->stride,
+		.online = mem->online,
+		.key = mem->key,
+		.gop = mem->gop,
+		.grab_ts = mem->grab_ts,
+		.encode_begin_ts = mem->encode_begin_ts,
+		.encode_end_ts = mem->encode_end_ts,
+	};
+
+	if (mem->key) {
+		client->key_required = false;
+	}
+	if (client->key_required) {
+		mem->key_requested = true;
+	}
+	if (client->bitrate_set) {
+		mem->bitrate_requested = client->bitrate;
+	}
+	return 0;
+}
+
+int us_client_release(us_client_s *client) {
+	return us_memsinkcl_release(client->cl);
+}
+
+void us_client_request_key(us_client_s *client) {
+	client->key_required = true;
+}
+
+void us_client_set_bitrate(us_client_s *client, unsigned bitrate) {
+	client->bitrate = bitrate;
+	client->bitrate_set = true;
+}
+
+void us_client_set_lock_timeout(us_client_s *client, double timeout) {
+	client->lock_timeout = timeout;
+}
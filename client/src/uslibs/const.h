@@ -0,0 +1 @@
+../../../src/libs/const.h
\ No newline at end of file
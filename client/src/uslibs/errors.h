@@ -0,0 +1 @@
+../../../src/libs/errors.h
\ No newline at end of file
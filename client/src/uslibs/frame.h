@@ -0,0 +1 @@
+../../../src/libs/frame.h
\ No newline at end of file
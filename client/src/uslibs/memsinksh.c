@@ -0,0 +1 @@
+../../../src/libs/memsinksh.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../../src/libs/memsinksh.h
\ No newline at end of file
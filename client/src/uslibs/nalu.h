@@ -0,0 +1 @@
+../../../src/libs/nalu.h
\ No newline at end of file
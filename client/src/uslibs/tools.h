@@ -0,0 +1 @@
+../../../src/libs/tools.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../src/libs/types.h
\ No newline at end of file
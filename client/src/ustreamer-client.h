@@ -0,0 +1,108 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// The stable C API for the memsink consumers. It doesn't depend on the layout
+// of the shared memory, so the applications don't need to be rebuilt
+// when the memsink protocol is changed. Link it with `pkg-config --libs ustreamer-client`.
+//
+// All the functions return -1 and set errno on error. EPROTO means that the sink
+// was created by an incompatible version of uStreamer.
+//
+// The client is not thread-safe, use one client per thread.
+
+#define US_CLIENT_ABI_VERSION	1
+
+#define US_CLIENT_NO_DATA		-2
+
+#ifdef US_CLIENT_BUILD
+#	define US_CLIENT_API __attribute__((visibility("default")))
+#else
+#	define US_CLIENT_API
+#endif
+
+
+typedef struct us_client_t us_client_s;
+
+typedef struct {
+	const uint8_t	*data;
+	size_t			used;
+	uint64_t		id;
+
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		format; // V4L2_PIX_FMT_*
+	uint32_t		stride;
+	bool			online;
+	bool			key;
+	uint32_t		gop;
+
+	double			grab_ts; // CLOCK_MONOTONIC
+	double			encode_begin_ts;
+	double			encode_end_ts;
+
+	uint32_t		reserved[16]; // For the future fields, the size of the struct is a part of ABI
+} us_client_frame_s;
+
+
+US_CLIENT_API unsigned us_client_get_abi_version(void);
+
+// The object name must end with ".jpeg", ".h264" or ".raw" (or with ":" instead of ".")
+US_CLIENT_API us_client_s *us_client_open(const char *obj);
+US_CLIENT_API void us_client_close(us_client_s *client);
+
+// The file descriptor becomes readable when the sink may have a new frame,
+// then us_client_acquire() with zero timeout should be called.
+// It's for select(), poll(), epoll and the event loops.
+US_CLIENT_API int us_client_get_fd(us_client_s *client);
+
+// Waits for a new frame for the timeout in seconds, zero means a single check.
+// Returns 0 and the frame referring to the shared memory without copying,
+// or US_CLIENT_NO_DATA on timeout. The sink is locked until us_client_release(),
+// so the frame should be processed or copied as fast as possible.
+US_CLIENT_API int us_client_acquire(us_client_s *client, us_client_frame_s *frame, double timeout);
+US_CLIENT_API int us_client_release(us_client_s *client);
+
+// H264 only: asks the encoder for a keyframe, the request is sent by us_client_acquire()
+// until the keyframe is received.
+US_CLIENT_API void us_client_request_key(us_client_s *client);
+
+// H264 only: asks the encoder to limit the bitrate in Kbps, 0 = no limit
+US_CLIENT_API void us_client_set_bitrate(us_client_s *client, unsigned bitrate);
+
+// The timeout in seconds for the lock of the sink, default: 1
+US_CLIENT_API void us_client_set_lock_timeout(us_client_s *client, double timeout);
+
+
+#ifdef __cplusplus
+}
+#endif
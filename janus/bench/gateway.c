@@ -0,0 +1,280 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "gateway.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <glib.h>
+#include <janus/debug.h>
+#include <janus/log.h>
+#include <janus/config.h>
+#include <janus/rtp.h>
+#include <janus/rtcp.h>
+#include <janus/plugins/plugin.h>
+
+#include "../../src/libs/types.h"
+#include "../../src/libs/array.h"
+
+
+// ***** Logging *****
+
+int janus_log_level = LOG_INFO;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+
+void janus_vprintf(const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+
+// ***** Config *****
+
+// The only config is in the memory and it's filled by the benchmark options
+typedef struct {
+	janus_config_category	section;
+	janus_config_item		option;
+} _option_s;
+
+static u64						_g_config = 0; // The plugin uses only a pointer to it
+static _option_s				_g_options[16] = {0};
+static uint						_g_n_options = 0;
+static janus_config_category	_g_empty_section = {0};
+
+int us_bench_config_set(const char *section, const char *option, const char *value) {
+	if (_g_n_options >= US_ARRAY_LEN(_g_options)) {
+		return -1;
+	}
+	_option_s *const item = &_g_options[_g_n_options];
+	item->section.type = janus_config_type_category;
+	item->section.name = section;
+	item->option.type = janus_config_type_item;
+	item->option.name = option;
+	item->option.value = value;
+	++_g_n_options;
+	return 0;
+}
+
+janus_config *janus_config_parse(const char *config_file) {
+	(void)config_file;
+	return (janus_config*)&_g_config;
+}
+
+void janus_config_print(janus_config *config) {
+	(void)config;
+	for (uint index = 0; index < _g_n_options; ++index) {
+		fprintf(stderr, "-- config: %s.%s = %s\n",
+			_g_options[index].section.name, _g_options[index].option.name, _g_options[index].option.value);
+	}
+}
+
+void janus_config_destroy(janus_config *config) {
+	(void)config;
+}
+
+janus_config_container *janus_config_get_create(
+	janus_config *config, janus_config_container *parent, janus_config_type type, const char *name) {
+
+	(void)config;
+	if (parent == NULL && type == janus_config_type_category) {
+		for (uint index = 0; index < _g_n_options; ++index) {
+			if (!strcmp(_g_options[index].section.name, name)) {
+				return &_g_options[index].section;
+			}
+		}
+	}
+	return &_g_empty_section;
+}
+
+janus_config_container *janus_config_get(
+	janus_config *config, janus_config_container *parent, janus_config_type type, const char *name) {
+
+	(void)config;
+	if (parent != NULL && parent->name != NULL && type == janus_config_type_item) {
+		for (uint index = 0; index < _g_n_options; ++index) {
+			const _option_s *const item = &_g_options[index];
+			if (!strcmp(item->section.name, parent->name) && !strcmp(item->option.name, name)) {
+				return (janus_config_container*)&item->option;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+// ***** Plugin API *****
+
+janus_plugin_result *janus_plugin_result_new(janus_plugin_result_type type, const char *text, json_t *content) {
+	janus_plugin_result *result = calloc(1, sizeof(janus_plugin_result));
+	if (result != NULL) {
+		result->type = type;
+		result->text = text;
+		result->content = content;
+	}
+	return result;
+}
+
+void janus_plugin_result_destroy(janus_plugin_result *result) {
+	if (result != NULL) {
+		if (result->content != NULL) {
+			json_decref(result->content);
+		}
+		free(result);
+	}
+}
+
+void janus_plugin_rtp_extensions_reset(janus_plugin_rtp_extensions *extensions) {
+	if (extensions != NULL) {
+		memset(extensions, 0, sizeof(janus_plugin_rtp_extensions));
+		extensions->audio_level = -1;
+		extensions->video_rotation = -1;
+		extensions->min_delay = -1;
+		extensions->max_delay = -1;
+	}
+}
+
+
+// ***** RTP/RTCP *****
+
+char *janus_rtp_payload(char *buf, int len, int *plen) {
+	if (buf == NULL || len < 12) {
+		return NULL;
+	}
+	const u8 *const data = (const u8*)buf;
+	int offset = 12 + (data[0] & 0x0F) * 4; // CSRC
+	if ((data[0] & 0x10) && offset + 4 <= len) { // Extension
+		offset += 4 + (((int)data[offset + 2] << 8) | data[offset + 3]) * 4;
+	}
+	if (offset > len) {
+		return NULL;
+	}
+	if (plen != NULL) {
+		*plen = len - offset;
+	}
+	return buf + offset;
+}
+
+// Walks through the compound packet and calls the handler for each RTCP packet
+#define _RTCP_ITERATE(x_buf, x_len, ...) { \
+		const u8 *m_data = (const u8*)(x_buf); \
+		int m_left = (x_len); \
+		while (m_left >= 4) { \
+			const uint fmt = m_data[0] & 0x1F; \
+			const uint pt = m_data[1]; \
+			const int size = ((((int)m_data[2] << 8) | m_data[3]) + 1) * 4; \
+			if (size > m_left) { \
+				break; \
+			} \
+			const u8 *const data = m_data; \
+			(void)fmt; (void)pt; (void)data; \
+			__VA_ARGS__ \
+			m_data += size; \
+			m_left -= size; \
+		} \
+	}
+
+#define _RTCP_RTPFB	205
+#define _RTCP_PSFB	206
+
+gboolean janus_rtcp_has_pli(char *packet, int len) {
+	_RTCP_ITERATE(packet, len, {
+		if (pt == _RTCP_PSFB && fmt == 1) {
+			return TRUE;
+		}
+	});
+	return FALSE;
+}
+
+gboolean janus_rtcp_has_fir(char *packet, int len) {
+	_RTCP_ITERATE(packet, len, {
+		if (pt == _RTCP_PSFB && fmt == 4) {
+			return TRUE;
+		}
+	});
+	return FALSE;
+}
+
+uint32_t janus_rtcp_get_remb(char *packet, int len) {
+	_RTCP_ITERATE(packet, len, {
+		if (pt == _RTCP_PSFB && fmt == 15 && size >= 20 && !memcmp(data + 12, "REMB", 4)) {
+			const uint exp = data[17] >> 2;
+			const u32 mantissa = (((u32)data[17] & 0x03) << 16) | ((u32)data[18] << 8) | data[19];
+			return mantissa << exp;
+		}
+	});
+	return 0;
+}
+
+GSList *janus_rtcp_get_nacks(char *packet, int len) {
+	GSList *list = NULL;
+	_RTCP_ITERATE(packet, len, {
+		if (pt == _RTCP_RTPFB && fmt == 1) {
+			for (int offset = 12; offset + 4 <= size; offset += 4) {
+				const u16 pid = ((u16)data[offset] << 8) | data[offset + 1];
+				const u16 blp = ((u16)data[offset + 2] << 8) | data[offset + 3];
+				list = g_slist_append(list, GUINT_TO_POINTER(pid));
+				for (uint bit = 0; bit < 16; ++bit) {
+					if (blp & (1 << bit)) {
+						list = g_slist_append(list, GUINT_TO_POINTER((u16)(pid + bit + 1)));
+					}
+				}
+			}
+		}
+	});
+	return list;
+}
+
+void us_bench_rtcp_write_nack(u8 *buf, u16 seq) {
+	// Generic NACK for a single packet: RFC 4585, section 6.2.1
+	memset(buf, 0, US_BENCH_RTCP_NACK_SIZE);
+	buf[0] = 0x80 | 1;
+	buf[1] = _RTCP_RTPFB;
+	buf[3] = US_BENCH_RTCP_NACK_SIZE / 4 - 1;
+	buf[12] = seq >> 8;
+	buf[13] = seq & 0xFF;
+}
+
+void us_bench_rtcp_write_remb(u8 *buf, u32 bitrate) {
+	// https://datatracker.ietf.org/doc/html/draft-alvestrand-rmcat-remb-03
+	uint exp = 0;
+	while ((bitrate >> exp) > 0x3FFFF) {
+		++exp;
+	}
+	const u32 mantissa = bitrate >> exp;
+	memset(buf, 0, US_BENCH_RTCP_REMB_SIZE);
+	buf[0] = 0x80 | 15;
+	buf[1] = _RTCP_PSFB;
+	buf[3] = US_BENCH_RTCP_REMB_SIZE / 4 - 1;
+	memcpy(buf + 12, "REMB", 4);
+	buf[16] = 1; // Number of SSRCs
+	buf[17] = (exp << 2) | (mantissa >> 16);
+	buf[18] = (mantissa >> 8) & 0xFF;
+	buf[19] = mantissa & 0xFF;
+}
@@ -0,0 +1,39 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../../src/libs/types.h"
+
+
+// A stand-in for the functions and variables which are exported by the Janus
+// core binary and used by the plugin. The benchmark is linked with -rdynamic,
+// so the dlopen()ed plugin is resolved against them.
+
+#define US_BENCH_RTCP_NACK_SIZE	16
+#define US_BENCH_RTCP_REMB_SIZE	24
+
+
+int us_bench_config_set(const char *section, const char *option, const char *value);
+
+void us_bench_rtcp_write_nack(u8 *buf, u16 seq);
+void us_bench_rtcp_write_remb(u8 *buf, u32 bitrate);
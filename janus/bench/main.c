@@ -0,0 +1,564 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <getopt.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <assert.h>
+
+#include <sys/resource.h>
+
+#include <pthread.h>
+#include <jansson.h>
+#include <janus/debug.h>
+#include <janus/plugins/plugin.h>
+
+#include "../../src/libs/const.h"
+#include "../../src/libs/types.h"
+#include "../../src/libs/tools.h"
+#include "../../src/libs/array.h"
+#include "../../src/libs/threading.h"
+#include "../../src/libs/logging.h"
+#include "../../src/libs/signal.h"
+#include "../../src/libs/options.h"
+
+#include "gateway.h"
+#include "producer.h"
+
+
+enum _OPT_VALUES {
+	_O_PLUGIN = 'p',
+	_O_SINK = 's',
+	_O_NO_PRODUCER = 'n',
+	_O_SESSIONS = 'c',
+	_O_DURATION = 'd',
+	_O_INTERVAL = 'i',
+
+	_O_HELP = 'h',
+	_O_VERSION = 'v',
+
+	_O_FPS = 10000,
+	_O_GOP,
+	_O_FRAME_SIZE,
+	_O_LOSS,
+	_O_REMB,
+	_O_VERBOSE,
+};
+
+static const struct option _LONG_OPTS[] = {
+	{"plugin",		required_argument,	NULL,	_O_PLUGIN},
+	{"sink",		required_argument,	NULL,	_O_SINK},
+	{"no-producer",	no_argument,		NULL,	_O_NO_PRODUCER},
+	{"sessions",	required_argument,	NULL,	_O_SESSIONS},
+	{"duration",	required_argument,	NULL,	_O_DURATION},
+	{"interval",	required_argument,	NULL,	_O_INTERVAL},
+	{"fps",			required_argument,	NULL,	_O_FPS},
+	{"gop",			required_argument,	NULL,	_O_GOP},
+	{"frame-size",	required_argument,	NULL,	_O_FRAME_SIZE},
+	{"loss",		required_argument,	NULL,	_O_LOSS},
+	{"remb",		required_argument,	NULL,	_O_REMB},
+	{"verbose",		no_argument,		NULL,	_O_VERBOSE},
+
+	{"help",		no_argument,		NULL,	_O_HELP},
+	{"version",		no_argument,		NULL,	_O_VERSION},
+
+	{NULL, 0, NULL, 0},
+};
+
+
+typedef struct {
+	janus_plugin_session	handle; // Must be the first, the callbacks get a pointer to it
+
+	atomic_ullong	packets;
+	atomic_ullong	bytes;
+	atomic_ullong	frames;
+	atomic_ullong	dropped;
+	atomic_ullong	retransmitted;
+	atomic_ullong	latency_sum; // In 90 kHz units, like RTP timestamps
+	atomic_ullong	latency_count;
+	atomic_uint		latency_max;
+
+	pthread_mutex_t	mutex; // For the fields below
+	unsigned		seed;
+	bool			has_seq;
+	u16				max_seq;
+	u16				nacks[64];
+	uint			n_nacks;
+} _session_s;
+
+typedef struct {
+	u64		packets;
+	u64		bytes;
+	u64		frames;
+	u64		dropped;
+	u64		retransmitted;
+	u64		latency_sum;
+	u64		latency_count;
+	uint	latency_max;
+} _totals_s;
+
+
+static volatile bool	_g_stop = false;
+static janus_plugin		*_g_plugin = NULL;
+static uint				_g_loss = 0; // Hundredths of a percent
+static atomic_ullong	_g_events = 0;
+
+
+static void _signal_handler(int signum);
+
+static int _push_event(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
+static void _relay_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet);
+static gboolean _events_is_enabled(void);
+
+static void *_feedback_thread(void *v_sessions);
+static void _collect_totals(_session_s *sessions, uint n_sessions, _totals_s *totals, bool reset_max);
+static void _get_cpu_rss(ldf *cpu, ldf *rss_mb);
+
+static void _help(FILE *fp);
+
+
+static janus_callbacks _g_gw = {
+	.push_event = _push_event,
+	.relay_rtp = _relay_rtp,
+	.events_is_enabled = _events_is_enabled,
+};
+
+typedef struct {
+	_session_s	*sessions;
+	uint		n_sessions;
+	uint		remb;
+} _feedback_context_s;
+
+
+int main(int argc, char *argv[]) {
+	US_LOGGING_INIT;
+	US_THREAD_RENAME("main");
+
+	const char *plugin_path = "./libjanus_ustreamer.so";
+	const char *sink_name = "ustreamer::bench::h264";
+	bool no_producer = false;
+	uint n_sessions = 10;
+	uint duration = 10;
+	uint interval = 1;
+	uint fps = 30;
+	uint gop = 30;
+	uint frame_size = 20000;
+	ldf loss = 0;
+	uint remb = 0;
+
+#	define OPT_SET(_dest, _value) { \
+			_dest = _value; \
+			break; \
+		}
+
+#	define OPT_NUMBER(_name, _dest, _min, _max, _base) { \
+			errno = 0; char *_end = NULL; long long _tmp = strtoll(optarg, &_end, _base); \
+			if (errno || *_end || _tmp < _min || _tmp > _max) { \
+				printf("Invalid value for '%s=%s': min=%lld, max=%lld\n", _name, optarg, (long long)_min, (long long)_max); \
+				return 1; \
+			} \
+			_dest = _tmp; \
+			break; \
+		}
+
+#	define OPT_LDOUBLE(_name, _dest, _min, _max) { \
+			errno = 0; char *_end = NULL; long double _tmp = strtold(optarg, &_end); \
+			if (errno || *_end || _tmp < _min || _tmp > _max) { \
+				printf("Invalid value for '%s=%s': min=%Lf, max=%Lf\n", _name, optarg, (long double)_min, (long double)_max); \
+				return 1; \
+			} \
+			_dest = _tmp; \
+			break; \
+		}
+
+	char short_opts[128];
+	us_build_short_options(_LONG_OPTS, short_opts, 128);
+
+	for (int ch; (ch = getopt_long(argc, argv, short_opts, _LONG_OPTS, NULL)) >= 0;) {
+		switch (ch) {
+			case _O_PLUGIN:			OPT_SET(plugin_path, optarg);
+			case _O_SINK:			OPT_SET(sink_name, optarg);
+			case _O_NO_PRODUCER:	OPT_SET(no_producer, true);
+			case _O_SESSIONS:		OPT_NUMBER("--sessions", n_sessions, 1, 10000, 0);
+			case _O_DURATION:		OPT_NUMBER("--duration", duration, 1, 86400, 0);
+			case _O_INTERVAL:		OPT_NUMBER("--interval", interval, 1, 3600, 0);
+			case _O_FPS:			OPT_NUMBER("--fps", fps, 1, 120, 0);
+			case _O_GOP:			OPT_NUMBER("--gop", gop, 1, 1000, 0);
+			case _O_FRAME_SIZE:		OPT_NUMBER("--frame-size", frame_size, 100, 1024 * 1024, 0);
+			case _O_LOSS:			OPT_LDOUBLE("--loss", loss, 0, 50);
+			case _O_REMB:			OPT_NUMBER("--remb", remb, 0, 1000000, 0);
+			case _O_VERBOSE:		us_g_log_level = US_LOG_LEVEL_VERBOSE; OPT_SET(janus_log_level, LOG_VERB);
+
+			case _O_HELP:		_help(stdout); return 0;
+			case _O_VERSION:	puts(US_VERSION); return 0;
+
+			case 0:		break;
+			default:	return 1;
+		}
+	}
+
+#	undef OPT_LDOUBLE
+#	undef OPT_NUMBER
+#	undef OPT_SET
+
+	_g_loss = loss * 100;
+
+	int retval = 1;
+	us_bench_producer_s *prod = NULL;
+	void *dl = NULL;
+	_session_s *sessions = NULL;
+	uint n_created = 0;
+	pthread_t feedback_tid;
+	bool feedback_created = false;
+
+	us_install_signals_handler(_signal_handler, true);
+
+	assert(!us_bench_config_set("video", "sink", sink_name));
+
+	if (!no_producer) {
+		if ((prod = us_bench_producer_init(sink_name, fps, gop, frame_size)) == NULL) {
+			goto error;
+		}
+	}
+
+	if ((dl = dlopen(plugin_path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		US_LOG_ERROR("Can't load plugin: %s", dlerror());
+		goto error;
+	}
+	janus_plugin *(*create)(void) = (janus_plugin *(*)(void))dlsym(dl, "create");
+	if (create == NULL) {
+		US_LOG_ERROR("Can't find the plugin entry point: %s", dlerror());
+		goto error;
+	}
+	_g_plugin = create();
+	if (_g_plugin->init(&_g_gw, "/nonexistent") < 0) {
+		US_LOG_ERROR("Can't initialize plugin");
+		_g_plugin = NULL;
+		goto error;
+	}
+
+	US_CALLOC(sessions, n_sessions);
+	for (; n_created < n_sessions; ++n_created) {
+		_session_s *const sess = &sessions[n_created];
+		US_MUTEX_INIT(sess->mutex);
+		sess->seed = n_created + 1;
+
+		int err = 0;
+		_g_plugin->create_session(&sess->handle, &err);
+		if (err != 0) {
+			US_LOG_ERROR("Can't create session %u", n_created);
+			US_MUTEX_DESTROY(sess->mutex);
+			goto error;
+		}
+
+		json_t *const msg = json_pack("{s:s}", "request", "watch");
+		// The transaction and the message are owned by the plugin now
+		janus_plugin_result *const result = _g_plugin->handle_message(&sess->handle, us_strdup("bench"), msg, NULL);
+		janus_plugin_result_destroy(result);
+		_g_plugin->setup_media(&sess->handle);
+	}
+	US_LOG_INFO("Created %u sessions; relaying ...", n_sessions);
+
+	_feedback_context_s feedback_ctx = {.sessions = sessions, .n_sessions = n_sessions, .remb = remb};
+	if (_g_loss > 0 || remb > 0) {
+		US_THREAD_CREATE(feedback_tid, _feedback_thread, &feedback_ctx);
+		feedback_created = true;
+	}
+
+	const ldf begin_ts = us_get_now_monotonic();
+	ldf prev_ts = begin_ts;
+	ldf prev_cpu;
+	ldf rss_mb;
+	_get_cpu_rss(&prev_cpu, &rss_mb);
+	_totals_s prev = {0};
+	u64 prev_produced = 0;
+
+	printf("# %8s %8s %8s %10s %8s %8s %8s %8s %8s %8s\n",
+		"time", "src_fps", "fps", "mbit/s", "lat_avg", "lat_max", "dropped", "resent", "cpu%", "rss_mb");
+	while (!_g_stop && us_get_now_monotonic() < begin_ts + duration) {
+		sleep(interval);
+
+		const ldf now_ts = us_get_now_monotonic();
+		const ldf took = now_ts - prev_ts;
+		ldf cpu;
+		_get_cpu_rss(&cpu, &rss_mb);
+		_totals_s totals;
+		_collect_totals(sessions, n_sessions, &totals, true);
+		const u64 produced = (prod != NULL ? atomic_load(&prod->produced) : 0);
+		const u64 count = totals.latency_count - prev.latency_count;
+
+		printf("  %8.1Lf %8.1Lf %8.1Lf %10.2Lf %8.2Lf %8.2Lf %8" PRIu64 " %8" PRIu64 " %8.1Lf %8.1Lf\n",
+			now_ts - begin_ts,
+			(ldf)(produced - prev_produced) / took,
+			(ldf)(totals.frames - prev.frames) / n_sessions / took,
+			(ldf)(totals.bytes - prev.bytes) * 8 / took / 1000000,
+			(count > 0 ? (ldf)(totals.latency_sum - prev.latency_sum) / count / 90 : 0),
+			(ldf)totals.latency_max / 90,
+			totals.dropped - prev.dropped,
+			totals.retransmitted - prev.retransmitted,
+			(cpu - prev_cpu) / took * 100,
+			rss_mb);
+		fflush(stdout);
+
+		prev = totals;
+		prev_ts = now_ts;
+		prev_cpu = cpu;
+		prev_produced = produced;
+	}
+
+	{
+		const ldf took = us_get_now_monotonic() - begin_ts;
+		ldf min_fps = -1;
+		ldf max_fps = 0;
+		for (uint index = 0; index < n_sessions; ++index) {
+			const ldf sess_fps = (ldf)atomic_load(&sessions[index].frames) / took;
+			min_fps = (min_fps < 0 ? sess_fps : US_MIN(min_fps, sess_fps));
+			max_fps = US_MAX(max_fps, sess_fps);
+		}
+		_totals_s totals;
+		_collect_totals(sessions, n_sessions, &totals, false);
+		printf("# sessions=%u, duration=%.1Lf, fps_min=%.1Lf, fps_max=%.1Lf, packets=%" PRIu64
+			", dropped=%" PRIu64 ", resent=%" PRIu64 ", events=%llu\n",
+			n_sessions, took, min_fps, max_fps, totals.packets,
+			totals.dropped, totals.retransmitted, atomic_load(&_g_events));
+
+		json_t *const info = _g_plugin->query_session(&sessions[0].handle);
+		if (info != NULL) {
+			char *const dump = json_dumps(info, JSON_COMPACT);
+			printf("# session[0]: %s\n", dump);
+			free(dump);
+			json_decref(info);
+		}
+	}
+	retval = 0;
+
+error:
+	_g_stop = true;
+	if (feedback_created) {
+		US_THREAD_JOIN(feedback_tid);
+	}
+	for (uint index = 0; index < n_created; ++index) {
+		int err = 0;
+		_g_plugin->hangup_media(&sessions[index].handle);
+		_g_plugin->destroy_session(&sessions[index].handle, &err);
+		US_MUTEX_DESTROY(sessions[index].mutex);
+	}
+	free(sessions);
+	if (_g_plugin != NULL) {
+		_g_plugin->destroy();
+	}
+	if (dl != NULL) {
+		dlclose(dl);
+	}
+	US_DELETE(prod, us_bench_producer_destroy);
+	US_LOGGING_DESTROY;
+	return retval;
+}
+
+
+static void _signal_handler(int signum) {
+	char *const name = us_signum_to_string(signum);
+	US_LOG_INFO_NOLOCK("===== Stopping by %s =====", name);
+	free(name);
+	_g_stop = true;
+}
+
+static int _push_event(janus_plugin_session *handle, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep) {
+	(void)handle;
+	(void)plugin;
+	(void)transaction;
+	(void)message;
+	(void)jsep;
+	atomic_fetch_add(&_g_events, 1);
+	return 0;
+}
+
+static void _relay_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet) {
+	if (!packet->video || packet->length < 12) {
+		return;
+	}
+	_session_s *const sess = (_session_s*)handle;
+	const u8 *const data = (const u8*)packet->buffer;
+	const u16 seq = ((u16)data[2] << 8) | data[3];
+	const u32 pts = ((u32)data[4] << 24) | ((u32)data[5] << 16) | ((u32)data[6] << 8) | data[7];
+	const bool marked = (data[1] & 0x80);
+
+	US_MUTEX_LOCK(sess->mutex);
+	// Anything not newer than the newest packet is a retransmission
+	const bool retransmitted = (sess->has_seq && (s16)(seq - sess->max_seq) <= 0);
+	if (!retransmitted && _g_loss > 0 && (uint)(rand_r(&sess->seed) % 10000) < _g_loss) {
+		if (sess->n_nacks < (uint)US_ARRAY_LEN(sess->nacks)) {
+			sess->nacks[sess->n_nacks] = seq;
+			++sess->n_nacks;
+		}
+		sess->has_seq = true;
+		sess->max_seq = seq;
+		US_MUTEX_UNLOCK(sess->mutex);
+		atomic_fetch_add(&sess->dropped, 1);
+		return;
+	}
+	if (!retransmitted) {
+		sess->has_seq = true;
+		sess->max_seq = seq;
+	}
+	US_MUTEX_UNLOCK(sess->mutex);
+
+	atomic_fetch_add(&sess->packets, 1);
+	atomic_fetch_add(&sess->bytes, packet->length);
+	if (retransmitted) {
+		atomic_fetch_add(&sess->retransmitted, 1);
+		return;
+	}
+	if (marked) {
+		atomic_fetch_add(&sess->frames, 1);
+	}
+
+	// The plugin uses the monotonic clock for RTP timestamps, so it's a latency
+	// from the packetization of the frame to the sending of the packet.
+	const u32 now_pts = us_get_now_monotonic_u64() * 9 / 100;
+	const u32 latency = now_pts - pts;
+	atomic_fetch_add(&sess->latency_sum, latency);
+	atomic_fetch_add(&sess->latency_count, 1);
+	if (latency > atomic_load(&sess->latency_max)) {
+		atomic_store(&sess->latency_max, latency); // A race here is not important
+	}
+}
+
+static gboolean _events_is_enabled(void) {
+	return FALSE;
+}
+
+static void *_feedback_thread(void *v_ctx) {
+	US_THREAD_SETTLE("bench_fb");
+	const _feedback_context_s *const ctx = v_ctx;
+
+	ldf remb_ts = 0;
+	while (!_g_stop) {
+		usleep(20000); // Like a browser does with NACKs
+
+		const bool send_remb = (ctx->remb > 0 && remb_ts + 1 < us_get_now_monotonic());
+		if (send_remb) {
+			remb_ts = us_get_now_monotonic();
+		}
+
+		for (uint index = 0; index < ctx->n_sessions; ++index) {
+			_session_s *const sess = &ctx->sessions[index];
+			u16 nacks[US_ARRAY_LEN(sess->nacks)];
+			US_MUTEX_LOCK(sess->mutex);
+			const uint n_nacks = sess->n_nacks;
+			memcpy(nacks, sess->nacks, n_nacks * sizeof(u16));
+			sess->n_nacks = 0;
+			US_MUTEX_UNLOCK(sess->mutex);
+
+			for (uint nack = 0; nack < n_nacks; ++nack) {
+				u8 buf[US_BENCH_RTCP_NACK_SIZE];
+				us_bench_rtcp_write_nack(buf, nacks[nack]);
+				janus_plugin_rtcp rtcp = {.mindex = 0, .video = TRUE, .buffer = (char*)buf, .length = sizeof(buf)};
+				_g_plugin->incoming_rtcp(&sess->handle, &rtcp);
+			}
+			if (send_remb) {
+				u8 buf[US_BENCH_RTCP_REMB_SIZE];
+				us_bench_rtcp_write_remb(buf, ctx->remb * 1000);
+				janus_plugin_rtcp rtcp = {.mindex = 0, .video = TRUE, .buffer = (char*)buf, .length = sizeof(buf)};
+				_g_plugin->incoming_rtcp(&sess->handle, &rtcp);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void _collect_totals(_session_s *sessions, uint n_sessions, _totals_s *totals, bool reset_max) {
+	memset(totals, 0, sizeof(_totals_s));
+	for (uint index = 0; index < n_sessions; ++index) {
+		_session_s *const sess = &sessions[index];
+		totals->packets += atomic_load(&sess->packets);
+		totals->bytes += atomic_load(&sess->bytes);
+		totals->frames += atomic_load(&sess->frames);
+		totals->dropped += atomic_load(&sess->dropped);
+		totals->retransmitted += atomic_load(&sess->retransmitted);
+		totals->latency_sum += atomic_load(&sess->latency_sum);
+		totals->latency_count += atomic_load(&sess->latency_count);
+		const uint latency_max = (reset_max ? atomic_exchange(&sess->latency_max, 0) : atomic_load(&sess->latency_max));
+		totals->latency_max = US_MAX(totals->latency_max, latency_max);
+	}
+}
+
+static void _get_cpu_rss(ldf *cpu, ldf *rss_mb) {
+	// The whole process, including the producer thread
+	struct rusage usage;
+	assert(!getrusage(RUSAGE_SELF, &usage));
+	*cpu = (ldf)usage.ru_utime.tv_sec + (ldf)usage.ru_utime.tv_usec / 1000000
+		+ (ldf)usage.ru_stime.tv_sec + (ldf)usage.ru_stime.tv_usec / 1000000;
+
+	*rss_mb = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp != NULL) {
+		unsigned long long size;
+		unsigned long long resident;
+		if (fscanf(fp, "%llu %llu", &size, &resident) == 2) {
+			*rss_mb = (ldf)resident * sysconf(_SC_PAGESIZE) / 1024 / 1024;
+		}
+		fclose(fp);
+	}
+}
+
+static void _help(FILE *fp) {
+#	define SAY(_msg, ...) fprintf(fp, _msg "\n", ##__VA_ARGS__)
+	SAY("\nuStreamer-janus-bench - Benchmark the Janus plugin without Janus");
+	SAY("═════════════════════════════════════════════════════════════════");
+	SAY("Version: %s; license: GPLv3", US_VERSION);
+	SAY("Copyright (C) 2018-2024 Maxim Devaev <mdevaev@gmail.com>\n");
+	SAY("Example:");
+	SAY("════════");
+	SAY("    ustreamer-janus-bench --plugin ./libjanus_ustreamer.so --sessions 50 --loss 1 --remb 3000\n");
+	SAY("Plugin options:");
+	SAY("═══════════════");
+	SAY("    -p|--plugin <path>  ───── Path to the plugin. Default: ./libjanus_ustreamer.so.\n");
+	SAY("    -s|--sink <name>  ─────── Memory sink ID. Default: ustreamer::bench::h264.\n");
+	SAY("    -n|--no-producer  ─────── Don't write the synthetic frames to the sink,");
+	SAY("                              use the running uStreamer with --h264-sink instead.\n");
+	SAY("Producer options:");
+	SAY("═════════════════");
+	SAY("    --fps <N>  ─────────── Frames per second. Default: 30.\n");
+	SAY("    --gop <N>  ─────────── Interval between the keyframes. Default: 30.\n");
+	SAY("    --frame-size <N>  ──── Size of the P-frame in bytes, the keyframes are 4x bigger. Default: 20000.\n");
+	SAY("Sessions options:");
+	SAY("═════════════════");
+	SAY("    -c|--sessions <N>  ─── Number of the synthetic sessions. Default: 10.\n");
+	SAY("    -d|--duration <sec>  ─ Duration of the benchmark. Default: 10.\n");
+	SAY("    -i|--interval <sec>  ─ Interval between the reports. Default: 1.\n");
+	SAY("    --loss <percent>  ──── Drop this share of video packets and send NACKs for them (float). Default: 0.\n");
+	SAY("    --remb <Kbps>  ─────── Send REMB with this bandwidth estimate every second. Default: 0 (disabled).\n");
+	SAY("    --verbose  ─────────── Enable verbose messages. Default: disabled.\n");
+	SAY("Help options:");
+	SAY("═════════════");
+	SAY("    -h|--help  ─────── Print this text and exit.\n");
+	SAY("    -v|--version  ──── Print version and exit.\n");
+#	undef SAY
+}
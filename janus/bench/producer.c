@@ -0,0 +1,143 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "producer.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <linux/videodev2.h>
+
+#include "../../src/libs/types.h"
+#include "../../src/libs/tools.h"
+#include "../../src/libs/threading.h"
+#include "../../src/libs/logging.h"
+#include "../../src/libs/frame.h"
+#include "../../src/libs/memsink.h"
+
+
+static void *_producer_thread(void *v_prod);
+static void _make_frame(us_frame_s *frame, bool key, uz size);
+
+
+us_bench_producer_s *us_bench_producer_init(const char *sink_name, uint fps, uint gop, uz frame_size) {
+	us_bench_producer_s *prod;
+	US_CALLOC(prod, 1);
+	prod->fps = fps;
+	prod->gop = gop;
+	prod->frame_size = frame_size;
+	prod->frame = us_frame_init();
+	atomic_init(&prod->produced, 0);
+	atomic_init(&prod->keys, 0);
+	atomic_init(&prod->stop, false);
+
+	if ((prod->sink = us_memsink_init_opened("bench", sink_name, true, 0660, true, 10, 1)) == NULL) {
+		goto error;
+	}
+	US_THREAD_CREATE(prod->tid, _producer_thread, prod);
+	return prod;
+
+error:
+	us_bench_producer_destroy(prod);
+	return NULL;
+}
+
+void us_bench_producer_destroy(us_bench_producer_s *prod) {
+	if (prod->sink != NULL) {
+		atomic_store(&prod->stop, true);
+		US_THREAD_JOIN(prod->tid);
+		us_memsink_destroy(prod->sink);
+	}
+	us_frame_destroy(prod->frame);
+	free(prod);
+}
+
+static void *_producer_thread(void *v_prod) {
+	US_THREAD_SETTLE("bench_prod");
+	us_bench_producer_s *const prod = v_prod;
+
+	const ldf interval = (ldf)1 / prod->fps;
+	ldf next_ts = us_get_now_monotonic();
+	uint gop_index = 0;
+	bool key_requested = false;
+
+	while (!atomic_load(&prod->stop)) {
+		const bool key = (gop_index == 0 || key_requested);
+		_make_frame(prod->frame, key, prod->frame_size);
+		prod->frame->gop = prod->gop;
+		prod->frame->grab_ts = us_get_now_monotonic();
+		prod->frame->encode_begin_ts = prod->frame->grab_ts;
+		prod->frame->encode_end_ts = prod->frame->grab_ts;
+
+		if (us_memsink_server_put(prod->sink, prod->frame, &key_requested) < 0) {
+			break;
+		}
+		atomic_fetch_add(&prod->produced, 1);
+		if (key) {
+			atomic_fetch_add(&prod->keys, 1);
+			gop_index = 0;
+		}
+		gop_index = (gop_index + 1) % US_MAX(prod->gop, (uint)1);
+
+		next_ts += interval;
+		const ldf now_ts = us_get_now_monotonic();
+		if (next_ts > now_ts) {
+			usleep((next_ts - now_ts) * 1000000);
+		} else {
+			next_ts = now_ts; // Don't try to catch up
+		}
+	}
+	return NULL;
+}
+
+static void _make_frame(us_frame_s *frame, bool key, uz size) {
+	// The payload is filled by non-zero bytes, so there are no false start codes.
+	static const u8 sps[] = {0, 0, 0, 1, 0x67, 0x42, 0xC0, 0x1F, 0xDA, 0x01, 0x40, 0x16, 0xEC, 0x04, 0x40};
+	static const u8 pps[] = {0, 0, 0, 1, 0x68, 0xCE, 0x3C, 0x80};
+	static const u8 idr[] = {0, 0, 0, 1, 0x65};
+	static const u8 slice[] = {0, 0, 0, 1, 0x41};
+
+	frame->used = 0;
+	if (key) {
+		us_frame_append_data(frame, sps, sizeof(sps));
+		us_frame_append_data(frame, pps, sizeof(pps));
+		us_frame_append_data(frame, idr, sizeof(idr));
+		size *= 4; // The keyframes are much bigger in the real world
+	} else {
+		us_frame_append_data(frame, slice, sizeof(slice));
+	}
+	const uz header_size = frame->used;
+	size = US_MAX(size, header_size + 1);
+	us_frame_realloc_data(frame, size);
+	memset(frame->data + header_size, 0xAA, size - header_size);
+	frame->used = size;
+
+	frame->width = 1280;
+	frame->height = 720;
+	frame->format = V4L2_PIX_FMT_H264;
+	frame->stride = 0;
+	frame->online = true;
+	frame->key = key;
+}
@@ -0,0 +1,53 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "../../src/libs/types.h"
+#include "../../src/libs/frame.h"
+#include "../../src/libs/memsink.h"
+
+
+// Writes synthetic H264 frames to the memsink like uStreamer does.
+// The plugin doesn't decode the video, so only the NAL structure is valid.
+
+typedef struct {
+	us_memsink_s	*sink;
+	us_frame_s		*frame;
+	uint			fps;
+	uint			gop;
+	uz				frame_size;
+
+	atomic_ullong	produced;
+	atomic_ullong	keys;
+
+	pthread_t		tid;
+	atomic_bool		stop;
+} us_bench_producer_s;
+
+
+us_bench_producer_s *us_bench_producer_init(const char *sink_name, uint fps, uint gop, uz frame_size);
+void us_bench_producer_destroy(us_bench_producer_s *prod);
@@ -60,10 +60,12 @@ bool us_acap_probe(const char *name) {
 	return true;
 }
 
-us_acap_s *us_acap_init(const char *name, uint pcm_hz) {
+us_acap_s *us_acap_init(const char *name, uint pcm_hz, bool dtx, uint fec_loss, us_au_stats_s *stats) {
 	us_acap_s *acap;
 	US_CALLOC(acap, 1);
 	acap->pcm_hz = pcm_hz;
+	acap->dtx = dtx;
+	acap->stats = stats;
 	US_RING_INIT_WITH_ITEMS(acap->pcm_ring, 8, us_au_pcm_init);
 	US_RING_INIT_WITH_ITEMS(acap->enc_ring, 8, us_au_encoded_init);
 	atomic_init(&acap->stop, false);
@@ -120,10 +122,19 @@ us_acap_s *us_acap_init(const char *name, uint pcm_hz) {
 		assert(!opus_encoder_ctl(acap->enc, OPUS_SET_BITRATE(128000)));
 		assert(!opus_encoder_ctl(acap->enc, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND)));
 		assert(!opus_encoder_ctl(acap->enc, OPUS_SET_SIGNAL(OPUS_SIGNAL_MUSIC)));
-		// OPUS_SET_INBAND_FEC(1), OPUS_SET_PACKET_LOSS_PERC(10): see rtpa.c
+		if (dtx) {
+			// Almost nothing is sent during the silence, see _encoder_thread()
+			assert(!opus_encoder_ctl(acap->enc, OPUS_SET_DTX(1)));
+		}
+		if (fec_loss > 0) {
+			// The expected loss makes the encoder to spend some bitrate for the FEC data
+			assert(!opus_encoder_ctl(acap->enc, OPUS_SET_INBAND_FEC(1)));
+			assert(!opus_encoder_ctl(acap->enc, OPUS_SET_PACKET_LOSS_PERC(US_MIN(fec_loss, (uint)100))));
+		}
 	}
 
-	US_JLOG_INFO("acap", "Capture configured on %uHz; capturing ...", acap->pcm_hz);
+	US_JLOG_INFO("acap", "Capture configured on %uHz (DTX=%d, FEC loss=%u%%); capturing ...",
+		acap->pcm_hz, dtx, fec_loss);
 	acap->tids_created = true;
 	US_THREAD_CREATE(acap->enc_tid, _encoder_thread, acap);
 	US_THREAD_CREATE(acap->pcm_tid, _pcm_thread, acap);
@@ -221,7 +232,9 @@ static void *_encoder_thread(void *v_acap) {
 			assert(acap->pcm_hz != US_RTP_OPUS_HZ);
 			u32 in_count = acap->pcm_frames;
 			u32 out_count = US_AU_HZ_TO_FRAMES(US_RTP_OPUS_HZ);
+			const u64 begin_us = us_au_get_cpu_us();
 			speex_resampler_process_interleaved_int(acap->res, in->data, &in_count, in_res, &out_count);
+			us_au_stage_account(&acap->stats->resample, begin_us);
 			in_ptr = in_res;
 		} else {
 			assert(acap->pcm_hz == US_RTP_OPUS_HZ);
@@ -236,11 +249,15 @@ static void *_encoder_thread(void *v_acap) {
 		}
 		us_au_encoded_s *const out = acap->enc_ring->items[out_ri];
 
+		const u64 begin_us = us_au_get_cpu_us();
 		const int size = opus_encode(acap->enc, in_ptr, US_AU_HZ_TO_FRAMES(US_RTP_OPUS_HZ), out->data, US_ARRAY_LEN(out->data));
+		us_au_stage_account(&acap->stats->encode, begin_us);
 		us_ring_consumer_release(acap->pcm_ring, in_ri);
 
 		if (size > 0) {
-			out->used = size;
+			// With DTX the packets of 2 bytes or less are not needed to be transmitted,
+			// the empty ones are skipped by us_acap_get_encoded(). The timestamp is going on.
+			out->used = (acap->dtx && size <= 2 ? 0 : size);
 			out->pts = acap->pts;
 			// https://datatracker.ietf.org/doc/html/rfc7587#section-4.2
 			acap->pts += US_AU_HZ_TO_FRAMES(US_RTP_OPUS_HZ);
@@ -32,6 +32,8 @@
 #include "uslibs/types.h"
 #include "uslibs/ring.h"
 
+#include "au.h"
+
 
 typedef struct {
 	snd_pcm_t			*dev;
@@ -41,6 +43,8 @@ typedef struct {
 	snd_pcm_hw_params_t	*dev_params;
 	SpeexResamplerState	*res;
 	OpusEncoder			*enc;
+	bool				dtx;
+	us_au_stats_s		*stats;
 
 	us_ring_s		*pcm_ring;
 	us_ring_s		*enc_ring;
@@ -55,7 +59,7 @@ typedef struct {
 
 bool us_acap_probe(const char *name);
 
-us_acap_s *us_acap_init(const char *name, uint pcm_hz);
+us_acap_s *us_acap_init(const char *name, uint pcm_hz, bool dtx, uint fec_loss, us_au_stats_s *stats);
 void us_acap_destroy(us_acap_s *acap);
 
 int us_acap_get_encoded(us_acap_s *acap, u8 *data, uz *size, u64 *pts);
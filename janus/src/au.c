@@ -23,7 +23,18 @@
 #include "au.h"
 
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
 
+#if defined(__ARM_NEON)
+#	include <arm_neon.h>
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+
+#include "uslibs/types.h"
 #include "uslibs/tools.h"
 
 
@@ -37,34 +48,32 @@ void us_au_pcm_destroy(us_au_pcm_s *pcm) {
 	free(pcm);
 }
 
-void us_au_pcm_mix(us_au_pcm_s *dest, us_au_pcm_s *src) {
-	const uz size = src->frames * US_RTP_OPUS_CH * 2; // 2 for 16 bit
+void us_au_pcm_mix(us_au_pcm_s *dest, const us_au_pcm_s *src) {
+	const uz samples = src->frames * US_RTP_OPUS_CH;
 	if (src->frames == 0) {
 		return;
 	} else if (dest->frames == 0) {
-		memcpy(dest->data, src->data, size);
+		memcpy(dest->data, src->data, samples * sizeof(s16));
 		dest->frames = src->frames;
 	} else if (dest->frames == src->frames) {
-		// https://stackoverflow.com/questions/12089662
-		for (uz index = 0; index < size; ++index) {
-			int a = dest->data[index];
-			int b = src->data[index];
-			int m;
-
-			a += 32768;
-			b += 32768;
-
-			if ((a < 32768) && (b < 32768)) {
-				m = a * b / 32768;
-			} else {
-				m = 2 * (a + b) - (a * b) / 32768 - 65536;
-			}
-			if (m == 65536) {
-				m = 65535;
-			}
-			m -= 32768;
-
-			dest->data[index] = m;
+		// Plain saturating sum, like the hardware mixers do
+		s16 *const a = dest->data;
+		const s16 *const b = src->data;
+		uz index = 0;
+#		if defined(__ARM_NEON)
+		for (; index + 8 <= samples; index += 8) {
+			vst1q_s16(a + index, vqaddq_s16(vld1q_s16(a + index), vld1q_s16(b + index)));
+		}
+#		elif defined(__SSE2__)
+		for (; index + 8 <= samples; index += 8) {
+			const __m128i va = _mm_loadu_si128((const __m128i *)(a + index));
+			const __m128i vb = _mm_loadu_si128((const __m128i *)(b + index));
+			_mm_storeu_si128((__m128i *)(a + index), _mm_adds_epi16(va, vb));
+		}
+#		endif
+		for (; index < samples; ++index) {
+			const int m = (int)a[index] + (int)b[index];
+			a[index] = US_MAX(US_MIN(m, 32767), -32768);
 		}
 	}
 }
@@ -78,3 +87,28 @@ us_au_encoded_s *us_au_encoded_init(void) {
 void us_au_encoded_destroy(us_au_encoded_s *enc) {
 	free(enc);
 }
+
+u64 us_au_get_cpu_us(void) {
+	// CPU time of the calling thread, so the stages are not affected by the scheduler
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts));
+	return (u64)ts.tv_sec * 1000000 + (u64)ts.tv_nsec / 1000;
+}
+
+void us_au_stage_account(us_au_stage_s *stage, u64 begin_us) {
+	// Each stage has the only writing thread
+	const u64 took_us = us_au_get_cpu_us() - begin_us;
+	atomic_fetch_add(&stage->count, 1);
+	atomic_fetch_add(&stage->total_us, took_us);
+	if (took_us > atomic_load(&stage->max_us)) {
+		atomic_store(&stage->max_us, took_us);
+	}
+}
+
+void us_au_stage_get_stats(us_au_stage_s *stage, u64 *count, ldf *avg, ldf *max) {
+	// The max value is reset on each reading
+	*count = atomic_load(&stage->count);
+	const u64 total_us = atomic_load(&stage->total_us);
+	*avg = (*count > 0 ? (ldf)total_us / *count / 1000000 : 0);
+	*max = (ldf)atomic_exchange(&stage->max_us, 0) / 1000000;
+}
@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include <stdatomic.h>
+
 #include "uslibs/types.h"
 
 #include "rtp.h"
@@ -51,10 +53,27 @@ typedef struct {
 	u64		pts;
 } us_au_encoded_s;
 
+// CPU time spent by a single processing stage of the audio path
+typedef struct {
+	atomic_ullong	count;
+	atomic_ullong	total_us;
+	atomic_ullong	max_us;
+} us_au_stage_s;
+
+typedef struct {
+	us_au_stage_s	resample;
+	us_au_stage_s	encode;
+	us_au_stage_s	mix;
+} us_au_stats_s;
+
 
 us_au_pcm_s *us_au_pcm_init(void);
 void us_au_pcm_destroy(us_au_pcm_s *pcm);
-void us_au_pcm_mix(us_au_pcm_s *a, us_au_pcm_s *b);
+void us_au_pcm_mix(us_au_pcm_s *dest, const us_au_pcm_s *src);
 
 us_au_encoded_s *us_au_encoded_init(void);
 void us_au_encoded_destroy(us_au_encoded_s *enc);
+
+u64 us_au_get_cpu_us(void);
+void us_au_stage_account(us_au_stage_s *stage, u64 begin_us);
+void us_au_stage_get_stats(us_au_stage_s *stage, u64 *count, ldf *avg, ldf *max);
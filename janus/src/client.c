@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdatomic.h>
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 
 #include <pthread.h>
@@ -42,15 +43,41 @@
 #include "logging.h"
 #include "au.h"
 #include "rtp.h"
+#include "rtpring.h"
+#include "pacer.h"
+#include "layer.h"
+#include "config.h"
+
+
+// The video mapping is used for the retransmissions after the layer switching:
+//   - bits 0-15: the offset which is added to the sequence numbers of the layer;
+//   - bits 16-31: the first sent sequence number after the switching;
+//   - bits 32-39: the current layer;
+//   - bit 40: the layer was switched at least once.
+#define _MAPPING_MAKE(x_offset, x_first, x_layer, x_switched) ( \
+		(u64)(u16)(x_offset) \
+		| ((u64)(u16)(x_first) << 16) \
+		| ((u64)((x_layer) & 0xFF) << 32) \
+		| ((u64)!!(x_switched) << 40) \
+	)
+#define _MAPPING_OFFSET(x_mapping)		((u16)((x_mapping) & 0xFFFF))
+#define _MAPPING_FIRST(x_mapping)		((u16)(((x_mapping) >> 16) & 0xFFFF))
+#define _MAPPING_LAYER(x_mapping)		((uint)(((x_mapping) >> 32) & 0xFF))
+#define _MAPPING_SWITCHED(x_mapping)	((bool)(((x_mapping) >> 40) & 1))
 
 
 static void *_video_thread(void *v_client);
 static void *_acap_thread(void *v_client);
-static void *_video_or_acap_thread(void *v_client, bool video);
 static void *_aplay_thread(void *v_client);
 
+static void _relay_rtp(us_janus_client_s *client, us_rtp_s *rtp);
+
+
+us_janus_client_s *us_janus_client_init(
+	janus_callbacks *gw, janus_plugin_session *session,
+	const us_config_s *config, us_video_layer_s **video_layers, uint n_video_layers) {
+
 
-us_janus_client_s *us_janus_client_init(janus_callbacks *gw, janus_plugin_session *session) {
 	us_janus_client_s *client;
 	US_CALLOC(client, 1);
 	client->gw = gw;
@@ -62,7 +89,20 @@ us_janus_client_s *us_janus_client_init(janus_callbacks *gw, janus_plugin_sessio
 
 	atomic_init(&client->stop, false);
 
-	US_RING_INIT_WITH_ITEMS(client->video_ring, 2048, us_rtp_init);
+	client->video_layers = video_layers;
+	client->n_video_layers = n_video_layers;
+	atomic_init(&client->video_layer_target, 0);
+	atomic_init(&client->video_mapping, _MAPPING_MAKE(0, 0, 0, false));
+	us_rtp_ring_cursor_reset(video_layers[0]->ring, &client->video_cursor);
+	if (config->video_pacing_bitrate > 0) {
+		client->video_pacer = us_pacer_init(config->video_pacing_bitrate, config->video_pacing_burst);
+	}
+	client->video_nack_max_age = (ldf)config->video_nack_max_age / 1000;
+	atomic_init(&client->video_retransmitted, 0);
+	atomic_init(&client->video_nack_missed, 0);
+	client->video_max_lag = (ldf)config->video_max_lag / 1000;
+	atomic_init(&client->video_lag_packets, 0);
+	atomic_init(&client->video_lag_frames, 0);
 	US_THREAD_CREATE(client->video_tid, _video_thread, client);
 
 	US_RING_INIT_WITH_ITEMS(client->acap_ring, 64, us_rtp_init);
@@ -79,7 +119,7 @@ void us_janus_client_destroy(us_janus_client_s *client) {
 	atomic_store(&client->stop, true);
 
 	US_THREAD_JOIN(client->video_tid);
-	US_RING_DELETE_WITH_ITEMS(client->video_ring, us_rtp_destroy);
+	US_DELETE(client->video_pacer, us_pacer_destroy);
 
 	US_THREAD_JOIN(client->acap_tid);
 	US_RING_DELETE_WITH_ITEMS(client->acap_ring, us_rtp_destroy);
@@ -92,18 +132,16 @@ void us_janus_client_destroy(us_janus_client_s *client) {
 }
 
 void us_janus_client_send(us_janus_client_s *client, const us_rtp_s *rtp) {
-	if (
-		atomic_load(&client->transmit)
-		&& (rtp->video || atomic_load(&client->transmit_acap))
-	) {
-		us_ring_s *const ring = (rtp->video ? client->video_ring : client->acap_ring);
+	// Video goes through the shared ring, see us_rtp_ring_put()
+	assert(!rtp->video);
+	if (atomic_load(&client->transmit) && atomic_load(&client->transmit_acap)) {
+		us_ring_s *const ring = client->acap_ring;
 		const int ri = us_ring_producer_acquire(ring, 0);
 		if (ri < 0) {
-			US_JLOG_ERROR("client", "Session %p %s ring is full",
-				client->session, (rtp->video ? "video" : "acap"));
+			US_JLOG_ERROR("client", "Session %p acap ring is full", client->session);
 			return;
 		}
-		memcpy(ring->items[ri], rtp, sizeof(us_rtp_s));
+		us_rtp_copy(rtp, ring->items[ri]);
 		us_ring_producer_release(ring, ri);
 	}
 }
@@ -153,19 +191,192 @@ void us_janus_client_recv(us_janus_client_s *client, janus_plugin_rtp *packet) {
 	}
 }
 
+bool us_janus_client_retransmit(us_janus_client_s *client, u16 seq) {
+	// Returns false if the packet is gone, so the caller should request a keyframe
+	if (!atomic_load(&client->transmit) || client->video_nack_max_age <= 0) {
+		return false;
+	}
+
+	const u64 mapping = atomic_load(&client->video_mapping);
+	if (_MAPPING_SWITCHED(mapping) && (u16)(seq - _MAPPING_FIRST(mapping)) >= 0x8000) {
+		// The packet was sent before the last layer switch
+		atomic_fetch_add(&client->video_nack_missed, 1);
+		return false;
+	}
+	us_video_layer_s *const layer = client->video_layers[_MAPPING_LAYER(mapping)];
+
+	const int ri = us_rtp_ring_acquire_seq(layer->ring, seq - _MAPPING_OFFSET(mapping), client->video_nack_max_age);
+	if (ri < 0) {
+		atomic_fetch_add(&client->video_nack_missed, 1);
+		return false;
+	}
+	us_rtp_s rtp;
+	us_rtp_copy(layer->ring->slots[ri].rtp, &rtp);
+	us_rtp_ring_release(layer->ring, ri);
+	us_rtp_rewrite_header(&rtp, client->video_layers[0]->rtpv->rtp->ssrc, seq);
+
+	// The pacer is not used here: the retransmission is needed as soon as possible,
+	// and the pacer belongs to the video thread.
+	_relay_rtp(client, &rtp);
+	atomic_fetch_add(&client->video_retransmitted, 1);
+	return true;
+}
+
+void us_janus_client_select_layer(us_janus_client_s *client, bool slow_link) {
+	// Must be called under the plugin video lock
+	if (client->n_video_layers <= 1) {
+		return;
+	}
+
+	const uint current = atomic_load(&client->video_layer_target);
+	uint target = current;
+	if (slow_link) {
+		target = US_MIN(current + 1, client->n_video_layers - 1);
+	} else if (client->video_remb > 0) {
+		// The best layer which fits into the estimation with 25% of headroom.
+		// Layers without measured bitrate are not running now and are skipped.
+		bool known = false;
+		target = client->n_video_layers - 1;
+		for (uint index = 0; index < client->n_video_layers; ++index) {
+			const uint bitrate = atomic_load(&client->video_layers[index]->bitrate);
+			if (bitrate > 0) {
+				known = true;
+				if (bitrate + bitrate / 4 <= client->video_remb) {
+					target = index;
+					break;
+				}
+			}
+		}
+		if (!known) {
+			return;
+		}
+	}
+
+	const ldf now_ts = us_get_now_monotonic();
+	if (target < current && client->video_layer_down_ts + 10 > now_ts) {
+		return; // Don't go up too early after the congestion
+	}
+	if (target > current) {
+		client->video_layer_down_ts = now_ts;
+	}
+	if (target != current) {
+		US_JLOG_INFO("client", "Session %p is switching video layer %u -> %u (%s) ...",
+			client->session, current, target, client->video_layers[target]->sink_name);
+		atomic_store(&client->video_layer_target, target);
+	}
+}
+
+uint us_janus_client_get_layer(us_janus_client_s *client) {
+	return _MAPPING_LAYER(atomic_load(&client->video_mapping));
+}
+
 static void *_video_thread(void *v_client) {
 	US_THREAD_SETTLE("us_cx_vid");
-	return _video_or_acap_thread(v_client, true);
+
+	us_janus_client_s *const client = v_client;
+	us_video_layer_s *const *const layers = client->video_layers;
+
+	// All layers are sent under SSRC of the first one. The sequence numbers
+	// are shifted on switching to continue the previous layer. The timestamps
+	// are made from the same monotonic clock for all layers, so they are kept.
+	const u32 ssrc = layers[0]->rtpv->rtp->ssrc;
+	uint layer = 0;
+	u16 seq_offset = 0;
+	u16 seq_next = 0;
+
+	uint switch_layer = layer;
+	us_rtp_cursor_s switch_cursor = {0};
+
+	// The cursor is always waiting for a keyframe after the reset,
+	// so we need to request it on the start and on the unmute.
+	bool paused = true;
+
+	u64 lost = 0;
+	u64 dropped = 0;
+	while (!atomic_load(&client->stop)) {
+		if (paused && atomic_load(&client->transmit)) {
+			atomic_store(&layers[layer]->key_required, true);
+			paused = false;
+		}
+
+		const uint target = atomic_load(&client->video_layer_target);
+		if (target == layer) {
+			switch_layer = layer; // Cancelled
+		} else if (target != switch_layer) {
+			// The new layer can be used only from its keyframe
+			us_rtp_ring_cursor_reset(layers[target]->ring, &switch_cursor);
+			atomic_store(&layers[target]->key_required, true);
+			switch_layer = target;
+		}
+
+		int ri = -1;
+		if (switch_layer != layer) {
+			ri = us_rtp_ring_acquire(layers[switch_layer]->ring, &switch_cursor, 0, client->video_max_lag);
+			if (ri >= 0) {
+				layer = switch_layer;
+				client->video_cursor = switch_cursor;
+				lost = client->video_cursor.lost;
+				dropped = client->video_cursor.frames_dropped;
+				seq_offset = seq_next - layers[layer]->ring->slots[ri].rtp->seq;
+				atomic_store(&client->video_mapping, _MAPPING_MAKE(seq_offset, seq_next, layer, true));
+				US_JLOG_INFO("client", "Session %p switched video layer to %u", client->session, layer);
+			}
+		}
+		us_rtp_ring_s *const ring = layers[layer]->ring;
+		if (ri < 0) {
+			ri = us_rtp_ring_acquire(ring, &client->video_cursor, (switch_layer != layer ? 0.005 : 0.1), client->video_max_lag);
+		}
+
+		if (client->video_cursor.key_required) {
+			US_JLOG_ERROR("client", "Session %p video is lagging; skipping to the next keyframe ...", client->session);
+			atomic_store(&layers[layer]->key_required, true);
+			client->video_cursor.key_required = false;
+		}
+		if (client->video_cursor.lost != lost) {
+			atomic_fetch_add(&client->video_lag_packets, client->video_cursor.lost - lost);
+			lost = client->video_cursor.lost;
+		}
+		if (client->video_cursor.frames_dropped != dropped) {
+			atomic_fetch_add(&client->video_lag_frames, client->video_cursor.frames_dropped - dropped);
+			dropped = client->video_cursor.frames_dropped;
+		}
+		if (ri < 0) {
+			continue;
+		}
+		// Janus core temporarily flips the extension bit of the header while relaying,
+		// so the shared datagram can't be passed as is. Also we shouldn't hold the slot
+		// while pacing. Only the used part is copied.
+		us_rtp_s rtp;
+		us_rtp_copy(ring->slots[ri].rtp, &rtp);
+		us_rtp_ring_release(ring, ri);
+
+		if (!atomic_load(&client->transmit)) {
+			// Resume from the next keyframe without counting the skipped ones
+			client->video_cursor.wait_key = true;
+			client->video_cursor.started = false;
+			paused = true;
+			continue;
+		}
+		us_rtp_rewrite_header(&rtp, ssrc, rtp.seq + seq_offset);
+		seq_next = rtp.seq + 1;
+
+		if (client->video_pacer != NULL) {
+			const ldf delay = us_pacer_get_delay(client->video_pacer, rtp.used);
+			if (delay > 0) {
+				usleep(delay * 1000000);
+			}
+			us_pacer_account_delay(client->video_pacer, delay);
+		}
+		_relay_rtp(client, &rtp);
+	}
+	return NULL;
 }
 
 static void *_acap_thread(void *v_client) {
 	US_THREAD_SETTLE("us_cx_ac");
-	return _video_or_acap_thread(v_client, false);
-}
 
-static void *_video_or_acap_thread(void *v_client, bool video) {
 	us_janus_client_s *const client = v_client;
-	us_ring_s *const ring = (video ? client->video_ring : client->acap_ring);
+	us_ring_s *const ring = client->acap_ring;
 	assert(ring != NULL);
 
 	while (!atomic_load(&client->stop)) {
@@ -174,56 +385,57 @@ static void *_video_or_acap_thread(void *v_client, bool video) {
 			continue;
 		}
 		us_rtp_s rtp;
-		memcpy(&rtp, ring->items[ri], sizeof(us_rtp_s));
+		us_rtp_copy(ring->items[ri], &rtp);
 		us_ring_consumer_release(ring, ri);
 
-		if (
-			atomic_load(&client->transmit)
-			&& (video || atomic_load(&client->transmit_acap))
-		) {
-			janus_plugin_rtp packet = {
-				.video = rtp.video,
-				.buffer = (char*)rtp.datagram,
-				.length = rtp.used,
-#				if JANUS_PLUGIN_API_VERSION >= 100
-				// The uStreamer Janus plugin places video in stream index 0 and audio
-				// (if available) in stream index 1.
-				.mindex = (rtp.video ? 0 : 1),
-#				endif
-			};
-			janus_plugin_rtp_extensions_reset(&packet.extensions);
-
-			/*if (rtp->zero_playout_delay) {
-				// https://github.com/pikvm/pikvm/issues/784
-				packet.extensions.min_delay = 0;
-				packet.extensions.max_delay = 0;
-			} else {
-				packet.extensions.min_delay = 0;
-				// 10s - Chromium/WebRTC default
-				// 3s - Firefox default
-				packet.extensions.max_delay = 300; // == 3s, i.e. 10ms granularity
-			}*/
-
-			if (rtp.video) {
-				uint video_orient = atomic_load(&client->video_orient);
-				if (video_orient != 0) {
-					// The extension rotates the video clockwise, but want it counterclockwise.
-					// It's more intuitive for people who have seen a protractor at least once in their life.
-					if (video_orient == 90) {
-						video_orient = 270;
-					} else if (video_orient == 270) {
-						video_orient = 90;
-					}
-					packet.extensions.video_rotation = video_orient;
-				}
-			}
-
-			client->gw->relay_rtp(client->session, &packet);
+		if (atomic_load(&client->transmit) && atomic_load(&client->transmit_acap)) {
+			_relay_rtp(client, &rtp);
 		}
 	}
 	return NULL;
 }
 
+static void _relay_rtp(us_janus_client_s *client, us_rtp_s *rtp) {
+	janus_plugin_rtp packet = {
+		.video = rtp->video,
+		.buffer = (char*)rtp->datagram,
+		.length = rtp->used,
+#		if JANUS_PLUGIN_API_VERSION >= 100
+		// The uStreamer Janus plugin places video in stream index 0 and audio
+		// (if available) in stream index 1.
+		.mindex = (rtp->video ? 0 : 1),
+#		endif
+	};
+	janus_plugin_rtp_extensions_reset(&packet.extensions);
+
+	/*if (rtp->zero_playout_delay) {
+		// https://github.com/pikvm/pikvm/issues/784
+		packet.extensions.min_delay = 0;
+		packet.extensions.max_delay = 0;
+	} else {
+		packet.extensions.min_delay = 0;
+		// 10s - Chromium/WebRTC default
+		// 3s - Firefox default
+		packet.extensions.max_delay = 300; // == 3s, i.e. 10ms granularity
+	}*/
+
+	if (rtp->video) {
+		uint video_orient = atomic_load(&client->video_orient);
+		if (video_orient != 0) {
+			// The extension rotates the video clockwise, but want it counterclockwise.
+			// It's more intuitive for people who have seen a protractor at least once in their life.
+			if (video_orient == 90) {
+				video_orient = 270;
+			} else if (video_orient == 270) {
+				video_orient = 90;
+			}
+			packet.extensions.video_rotation = video_orient;
+		}
+	}
+
+	client->gw->relay_rtp(client->session, &packet);
+}
+
 static void *_aplay_thread(void *v_client) {
 	US_THREAD_SETTLE("us_cx_ap");
 
@@ -253,7 +465,9 @@ static void *_aplay_thread(void *v_client) {
 		}
 		us_au_pcm_s *out = client->aplay_pcm_ring->items[out_ri];
 
+		const u64 begin_us = us_au_get_cpu_us();
 		const int frames = opus_decode(dec, in->data, in->used, out->data, US_AU_HZ_TO_FRAMES(US_RTP_OPUS_HZ), 0);
+		us_au_stage_account(&client->aplay_decode, begin_us);
 		us_ring_consumer_release(client->aplay_enc_ring, in_ri);
 
 		if (frames > 0) {
@@ -32,6 +32,11 @@
 #include "uslibs/ring.h"
 
 #include "rtp.h"
+#include "rtpring.h"
+#include "pacer.h"
+#include "au.h"
+#include "layer.h"
+#include "config.h"
 
 
 typedef struct {
@@ -47,19 +52,38 @@ typedef struct {
 	pthread_t				aplay_tid;
 	atomic_bool				stop;
 
-	us_ring_s				*video_ring;
+	us_video_layer_s		**video_layers; // Shared between all clients
+	uint					n_video_layers;
+	atomic_uint				video_layer_target;
+	ldf						video_layer_down_ts; // Guarded by the plugin video lock
+	atomic_ullong			video_mapping; // See _video_thread()
+	us_rtp_cursor_s			video_cursor;
+	us_pacer_s				*video_pacer; // Can be NULL
+	uint					video_remb; // Kbps, 0 = unknown; guarded by the plugin video lock
+	ldf						video_nack_max_age; // Seconds, 0 = disabled
+	atomic_ullong			video_retransmitted;
+	atomic_ullong			video_nack_missed;
+	ldf						video_max_lag; // Seconds, 0 = only the ring capacity
+	atomic_ullong			video_lag_packets; // Skipped because of lagging
+	atomic_ullong			video_lag_frames;
 	us_ring_s				*acap_ring;
 
 	us_ring_s				*aplay_enc_ring;
 	u16						aplay_seq_next;
 	us_ring_s				*aplay_pcm_ring;
+	us_au_stage_s			aplay_decode;
 
     US_LIST_DECLARE;
 } us_janus_client_s;
 
 
-us_janus_client_s *us_janus_client_init(janus_callbacks *gw, janus_plugin_session *session);
+us_janus_client_s *us_janus_client_init(
+	janus_callbacks *gw, janus_plugin_session *session,
+	const us_config_s *config, us_video_layer_s **video_layers, uint n_video_layers);
 void us_janus_client_destroy(us_janus_client_s *client);
 
 void us_janus_client_send(us_janus_client_s *client, const us_rtp_s *rtp);
 void us_janus_client_recv(us_janus_client_s *client, janus_plugin_rtp *packet);
+bool us_janus_client_retransmit(us_janus_client_s *client, u16 seq);
+void us_janus_client_select_layer(us_janus_client_s *client, bool slow_link);
+uint us_janus_client_get_layer(us_janus_client_s *client);
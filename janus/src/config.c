@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <errno.h>
 
 #include <janus/config.h>
 #include <janus/plugins/plugin.h>
@@ -36,7 +38,9 @@
 
 
 static char *_get_value(janus_config *jcfg, const char *section, const char *option);
-// static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def);
+static int _get_uint(janus_config *jcfg, const char *section, const char *option, uint def, uint *value);
+static int _get_layers(janus_config *jcfg, us_config_s *config);
+static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def);
 
 
 us_config_s *us_config_init(const char *config_dir_path) {
@@ -56,15 +60,35 @@ us_config_s *us_config_init(const char *config_dir_path) {
 	}
 	janus_config_print(jcfg);
 
-	if ((config->video_sink_name = _get_value(jcfg, "video", "sink")) == NULL) {
+	if ((config->video_sinks[0] = _get_value(jcfg, "video", "sink")) == NULL) {
 		US_JLOG_ERROR("config", "Missing config value: video.sink");
 		goto error;
 	}
+	config->n_video_sinks = 1;
+	if (_get_layers(jcfg, config) < 0) {
+		goto error;
+	}
+	if (_get_uint(jcfg, "video", "pacing_bitrate", 0, &config->video_pacing_bitrate) < 0) {
+		goto error;
+	}
+	if (_get_uint(jcfg, "video", "pacing_burst", 10, &config->video_pacing_burst) < 0) {
+		goto error;
+	}
+	if (_get_uint(jcfg, "video", "nack_max_age", 0, &config->video_nack_max_age) < 0) {
+		goto error;
+	}
+	if (_get_uint(jcfg, "video", "max_lag", 500, &config->video_max_lag) < 0) {
+		goto error;
+	}
 	if ((config->acap_dev_name = _get_value(jcfg, "acap", "device")) != NULL) {
 		if ((config->tc358743_dev_path = _get_value(jcfg, "acap", "tc358743")) == NULL) {
 			US_JLOG_INFO("config", "Missing config value: acap.tc358743");
 			goto error;
 		}
+		config->acap_dtx = _get_bool(jcfg, "acap", "dtx", false);
+		if (_get_uint(jcfg, "acap", "fec_loss", 0, &config->acap_fec_loss) < 0) {
+			goto error;
+		}
 		if ((config->aplay_dev_name = _get_value(jcfg, "aplay", "device")) != NULL) {
 			char *path = _get_value(jcfg, "aplay", "check");
 			if (path != NULL) {
@@ -77,6 +101,8 @@ us_config_s *us_config_init(const char *config_dir_path) {
 		}
 	}
 
+	config->admin_stats = _get_bool(jcfg, "admin", "stats", false);
+
 	goto ok;
 
 error:
@@ -89,7 +115,9 @@ ok:
 }
 
 void us_config_destroy(us_config_s *config) {
-	US_DELETE(config->video_sink_name, free);
+	for (uint index = 0; index < config->n_video_sinks; ++index) {
+		free(config->video_sinks[index]);
+	}
 	US_DELETE(config->acap_dev_name, free);
 	US_DELETE(config->tc358743_dev_path, free);
 	US_DELETE(config->aplay_dev_name, free);
@@ -105,7 +133,46 @@ static char *_get_value(janus_config *jcfg, const char *section, const char *opt
 	return us_strdup(option_obj->value);
 }
 
-/*static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def) {
+static int _get_uint(janus_config *jcfg, const char *section, const char *option, uint def, uint *value) {
+	char *const tmp = _get_value(jcfg, section, option);
+	*value = def;
+	if (tmp != NULL) {
+		char *end = NULL;
+		errno = 0;
+		const unsigned long long parsed = strtoull(tmp, &end, 10);
+		if (errno != 0 || *end != '\0' || parsed > UINT_MAX) {
+			US_JLOG_ERROR("config", "Invalid config value: %s.%s=%s", section, option, tmp);
+			free(tmp);
+			return -1;
+		}
+		*value = parsed;
+		free(tmp);
+	}
+	return 0;
+}
+
+static int _get_layers(janus_config *jcfg, us_config_s *config) {
+	// Comma-separated list of the additional H264 sinks, from the highest quality to the lowest
+	char *const tmp = _get_value(jcfg, "video", "layers");
+	if (tmp == NULL) {
+		return 0;
+	}
+	int retval = 0;
+	char *saveptr = NULL;
+	for (char *item = strtok_r(tmp, ", ", &saveptr); item != NULL; item = strtok_r(NULL, ", ", &saveptr)) {
+		if (config->n_video_sinks >= US_VIDEO_LAYERS_MAX) {
+			US_JLOG_ERROR("config", "Too many video layers, max=%u", US_VIDEO_LAYERS_MAX);
+			retval = -1;
+			break;
+		}
+		config->video_sinks[config->n_video_sinks] = us_strdup(item);
+		++config->n_video_sinks;
+	}
+	free(tmp);
+	return retval;
+}
+
+static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def) {
 	char *const tmp = _get_value(jcfg, section, option);
 	bool value = def;
 	if (tmp != NULL) {
@@ -113,4 +180,4 @@ static char *_get_value(janus_config *jcfg, const char *section, const char *opt
 		free(tmp);
 	}
 	return value;
-}*/
+}
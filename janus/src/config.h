@@ -22,14 +22,28 @@
 
 #pragma once
 
+#include "uslibs/types.h"
+
+
+#define US_VIDEO_LAYERS_MAX 4
+
 
 typedef struct {
-	char	*video_sink_name;
+	char	*video_sinks[US_VIDEO_LAYERS_MAX]; // video.sink and then video.layers
+	uint	n_video_sinks;
+	uint	video_pacing_bitrate; // Kbps, 0 = disabled
+	uint	video_pacing_burst; // Milliseconds
+	uint	video_nack_max_age; // Milliseconds, 0 = disabled
+	uint	video_max_lag; // Milliseconds, 0 = disabled
 
 	char	*acap_dev_name;
 	char	*tc358743_dev_path;
+	bool	acap_dtx;
+	uint	acap_fec_loss; // Percents, 0 = disabled
 
 	char	*aplay_dev_name;
+
+	bool	admin_stats; // Detailed query_session instead of the plain "session_found"
 } us_config_s;
 
 
@@ -0,0 +1,68 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "layer.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "uslibs/types.h"
+#include "uslibs/tools.h"
+
+#include "rtpv.h"
+#include "rtpring.h"
+
+
+us_video_layer_s *us_video_layer_init(const char *sink_name, uint index) {
+	us_video_layer_s *layer;
+	US_CALLOC(layer, 1);
+	layer->sink_name = us_strdup(sink_name);
+	layer->index = index;
+	layer->ring = us_rtp_ring_init(2048);
+	layer->rtpv = us_rtpv_init(layer->ring);
+	atomic_init(&layer->key_required, false);
+	atomic_init(&layer->bitrate, 0);
+	atomic_init(&layer->sink_tid_created, false);
+	return layer;
+}
+
+void us_video_layer_destroy(us_video_layer_s *layer) {
+	us_rtpv_destroy(layer->rtpv);
+	us_rtp_ring_destroy(layer->ring);
+	free(layer->sink_name);
+	free(layer);
+}
+
+void us_video_layer_account(us_video_layer_s *layer, uz size) {
+	// The bitrate of the layer is measured on the fly to choose
+	// the layer for the session by its bandwidth estimation.
+	const ldf now_ts = us_get_now_monotonic();
+	layer->bitrate_bytes += size;
+	if (layer->bitrate_ts <= 0) {
+		layer->bitrate_ts = now_ts;
+	} else if (layer->bitrate_ts + 2 <= now_ts) {
+		const uint bitrate = layer->bitrate_bytes * 8 / 1000 / (now_ts - layer->bitrate_ts);
+		atomic_store(&layer->bitrate, bitrate);
+		layer->bitrate_bytes = 0;
+		layer->bitrate_ts = now_ts;
+	}
+}
@@ -0,0 +1,58 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "uslibs/types.h"
+
+#include "rtpv.h"
+#include "rtpring.h"
+
+
+// A single H264 memsink and its packets. The first layer is video.sink
+// and it has the best quality, other ones are from video.layers.
+
+typedef struct {
+	char			*sink_name;
+	uint			index;
+	us_rtp_ring_s	*ring;
+	us_rtpv_s		*rtpv;
+
+	atomic_bool		key_required;
+	atomic_uint		bitrate; // Measured, Kbps
+
+	uz				bitrate_bytes; // Only for the sink thread
+	ldf				bitrate_ts;
+
+	pthread_t		sink_tid;
+	atomic_bool		sink_tid_created;
+} us_video_layer_s;
+
+
+us_video_layer_s *us_video_layer_init(const char *sink_name, uint index);
+void us_video_layer_destroy(us_video_layer_s *layer);
+
+void us_video_layer_account(us_video_layer_s *layer, uz size);
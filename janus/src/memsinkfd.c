@@ -22,6 +22,7 @@
 
 #include "memsinkfd.h"
 
+#include <string.h>
 #include <unistd.h>
 
 #include <linux/videodev2.h>
@@ -35,46 +36,22 @@
 #include "logging.h"
 
 
-int us_memsink_fd_wait_frame(int fd, us_memsink_shared_s *mem, u64 last_id) {
-	const ldf deadline_ts = us_get_now_monotonic() + 1; // wait_timeout
-	ldf now_ts;
-	do {
-		const int result = us_flock_timedwait_monotonic(fd, 1); // lock_timeout
-		now_ts = us_get_now_monotonic();
-		if (result < 0 && errno != EWOULDBLOCK) {
-			US_JLOG_PERROR("video", "Can't lock memsink");
-			return -1;
-		} else if (result == 0) {
-			if (mem->magic == US_MEMSINK_MAGIC && mem->version == US_MEMSINK_VERSION && mem->id != last_id) {
-				return 0;
-			}
-			if (flock(fd, LOCK_UN) < 0) {
-				US_JLOG_PERROR("video", "Can't unlock memsink");
-				return -1;
-			}
-		}
-		usleep(1000); // lock_polling
-	} while (now_ts < deadline_ts);
-	return US_ERROR_NO_DATA;
-}
-
-int us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, us_frame_s *frame, u64 *frame_id, bool key_required) {
-	us_frame_set_data(frame, us_memsink_get_data(mem), mem->used);
+int us_memsink_fd_get_frame(us_memsink_shared_s *mem, us_frame_s *frame, bool key_required, uint bitrate) {
+	// Must be called after successful us_memsinkcl_acquire().
+	// The frame refers to the shared memory and is valid until us_memsinkcl_release().
+	memset(frame, 0, sizeof(us_frame_s));
+	frame->data = us_memsink_get_data(mem);
+	frame->used = mem->used;
+	frame->dma_fd = -1;
 	US_FRAME_COPY_META(mem, frame);
-	*frame_id = mem->id;
-	mem->last_client_ts = us_get_now_monotonic();
 	if (key_required) {
 		mem->key_requested = true;
 	}
+	mem->bitrate_requested = bitrate;
 
-	bool retval = 0;
 	if (frame->format != V4L2_PIX_FMT_H264) {
 		US_JLOG_ERROR("video", "Got non-H264 frame from memsink");
-		retval = -1;
-	}
-	if (flock(fd, LOCK_UN) < 0) {
-		US_JLOG_PERROR("video", "Can't unlock memsink");
-		retval = -1;
+		return -1;
 	}
-	return retval;
+	return 0;
 }
@@ -27,5 +27,4 @@
 #include "uslibs/memsinksh.h"
 
 
-int us_memsink_fd_wait_frame(int fd, us_memsink_shared_s *mem, u64 last_id);
-int us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, us_frame_s *frame, u64 *frame_id, bool key_required);
+int us_memsink_fd_get_frame(us_memsink_shared_s *mem, us_frame_s *frame, bool key_required, uint bitrate);
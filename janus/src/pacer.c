@@ -0,0 +1,103 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "pacer.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "uslibs/types.h"
+#include "uslibs/tools.h"
+
+#include "rtp.h"
+
+
+// WebRTC sends with 2.5x of the target bitrate to drain keyframes fast enough
+#define _RATE_FACTOR	2.5
+// Don't accumulate more latency than this if the stream is faster than the pacer
+#define _MAX_BACKLOG	0.05
+
+
+static ldf _get_now(void);
+
+
+us_pacer_s *us_pacer_init(uint bitrate, uint burst_ms) {
+	us_pacer_s *pacer;
+	US_CALLOC(pacer, 1);
+	pacer->rate = (ldf)bitrate * 1000 / 8 * _RATE_FACTOR;
+	pacer->burst = US_MAX(pacer->rate * burst_ms / 1000, (ldf)US_RTP_DATAGRAM_SIZE);
+	pacer->max_backlog = _MAX_BACKLOG;
+	pacer->level_ts = _get_now();
+	atomic_init(&pacer->delayed, 0);
+	atomic_init(&pacer->delay_total_us, 0);
+	atomic_init(&pacer->delay_max_us, 0);
+	return pacer;
+}
+
+void us_pacer_destroy(us_pacer_s *pacer) {
+	free(pacer);
+}
+
+ldf us_pacer_get_delay(us_pacer_s *pacer, uz size) {
+	const ldf now_ts = _get_now();
+	pacer->level -= (now_ts - pacer->level_ts) * pacer->rate;
+	if (pacer->level < 0) {
+		pacer->level = 0;
+	}
+	pacer->level_ts = now_ts;
+	pacer->level += size;
+
+	if (pacer->level <= pacer->burst) {
+		return 0;
+	}
+	ldf delay = (pacer->level - pacer->burst) / pacer->rate;
+	if (delay > pacer->max_backlog) {
+		pacer->level = pacer->burst + pacer->rate * pacer->max_backlog;
+		delay = pacer->max_backlog;
+	}
+	return delay;
+}
+
+void us_pacer_account_delay(us_pacer_s *pacer, ldf delay) {
+	if (delay <= 0) {
+		return;
+	}
+	const u64 delay_us = delay * 1000000;
+	atomic_fetch_add(&pacer->delayed, 1);
+	atomic_fetch_add(&pacer->delay_total_us, delay_us);
+	if (atomic_load(&pacer->delay_max_us) < delay_us) {
+		atomic_store(&pacer->delay_max_us, delay_us);
+	}
+}
+
+void us_pacer_get_stats(us_pacer_s *pacer, u64 *delayed, ldf *delay_avg, ldf *delay_max) {
+	// The max value is reset on each reading
+	*delayed = atomic_load(&pacer->delayed);
+	const u64 total_us = atomic_load(&pacer->delay_total_us);
+	*delay_avg = (*delayed > 0 ? (ldf)total_us / *delayed / 1000000 : 0);
+	*delay_max = (ldf)atomic_exchange(&pacer->delay_max_us, 0) / 1000000;
+}
+
+static ldf _get_now(void) {
+	// us_get_now_monotonic() has only millisecond resolution
+	return (ldf)us_get_now_monotonic_u64() / 1000000;
+}
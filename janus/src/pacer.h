@@ -0,0 +1,51 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include "uslibs/types.h"
+
+
+// Leaky bucket: the bucket drains with the pacing rate, and each packet
+// fills it with its size. A packet which doesn't fit waits for the drain.
+typedef struct {
+	ldf		rate; // Bytes per second
+	ldf		burst; // Bytes
+	ldf		max_backlog; // Seconds
+
+	ldf		level;
+	ldf		level_ts;
+
+	atomic_ullong	delayed;
+	atomic_ullong	delay_total_us;
+	atomic_ullong	delay_max_us;
+} us_pacer_s;
+
+
+us_pacer_s *us_pacer_init(uint bitrate, uint burst_ms);
+void us_pacer_destroy(us_pacer_s *pacer);
+
+ldf us_pacer_get_delay(us_pacer_s *pacer, uz size);
+void us_pacer_account_delay(us_pacer_s *pacer, ldf delay);
+void us_pacer_get_stats(us_pacer_s *pacer, u64 *delayed, ldf *delay_avg, ldf *delay_max);
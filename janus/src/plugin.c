@@ -46,6 +46,8 @@
 #include "uslibs/list.h"
 #include "uslibs/ring.h"
 #include "uslibs/memsinksh.h"
+#include "uslibs/memsinkcl.h"
+#include "uslibs/nalu.h"
 #include "uslibs/tc358743.h"
 
 #include "const.h"
@@ -54,7 +56,9 @@
 #include "au.h"
 #include "acap.h"
 #include "rtp.h"
+#include "rtpring.h"
 #include "rtpv.h"
+#include "layer.h"
 #include "rtpa.h"
 #include "memsinkfd.h"
 #include "config.h"
@@ -67,14 +71,11 @@ static const useconds_t	_g_watchers_polling = 100000;
 
 static us_janus_client_s	*_g_clients = NULL;
 static janus_callbacks		*_g_gw = NULL;
-static us_ring_s			*_g_video_ring = NULL;
-static us_rtpv_s			*_g_rtpv = NULL;
+static us_video_layer_s		*_g_video_layers[US_VIDEO_LAYERS_MAX] = {0};
+static uint					_g_n_video_layers = 0;
 static us_rtpa_s			*_g_rtpa = NULL; // Also indicates "audio capture is available"
+static us_au_stats_s		_g_au_stats = {0};
 
-static pthread_t		_g_video_rtp_tid;
-static atomic_bool		_g_video_rtp_tid_created = false;
-static pthread_t		_g_video_sink_tid;
-static atomic_bool		_g_video_sink_tid_created = false;
 static pthread_t		_g_acap_tid;
 static atomic_bool		_g_acap_tid_created = false;
 static pthread_t		_g_aplay_tid;
@@ -88,7 +89,7 @@ static atomic_bool		_g_stop = false;
 static atomic_bool		_g_has_watchers = false;
 static atomic_bool		_g_has_listeners = false;
 static atomic_bool		_g_has_speakers = false;
-static atomic_bool		_g_key_required = false;
+static atomic_uint		_g_video_bitrate = 0; // Kbps, 0 = no limit
 
 
 #define _LOCK_VIDEO		US_MUTEX_LOCK(_g_video_lock)
@@ -115,32 +116,44 @@ static atomic_bool		_g_key_required = false;
 janus_plugin *create(void);
 
 
-static void *_video_rtp_thread(void *arg) {
-	(void)arg;
-	US_THREAD_SETTLE("us_p_rtpv");
-	atomic_store(&_g_video_rtp_tid_created, true);
+static void _update_video_bitrate(void) {
+	// The encoder is common for all sessions, so the slowest one determines the bitrate.
+	// With several layers the sessions are switched between them instead.
+	// Must be called under the video lock.
+	uint bitrate = 0;
+	if (_g_n_video_layers > 1) {
+		atomic_store(&_g_video_bitrate, 0);
+		return;
+	}
+	US_LIST_ITERATE(_g_clients, client, {
+		if (atomic_load(&client->transmit) && client->video_remb > 0) {
+			bitrate = (bitrate == 0 ? client->video_remb : US_MIN(bitrate, client->video_remb));
+		}
+	});
+	atomic_store(&_g_video_bitrate, bitrate);
+}
 
-	while (!_STOP) {
-		const int ri = us_ring_consumer_acquire(_g_video_ring, 0.1);
-		if (ri >= 0) {
-			const us_frame_s *const frame = _g_video_ring->items[ri];
-			_LOCK_VIDEO;
-			const bool zero_playout_delay = (frame->gop == 0);
-			us_rtpv_wrap(_g_rtpv, frame, zero_playout_delay);
-			_UNLOCK_VIDEO;
-			us_ring_consumer_release(_g_video_ring, ri);
+
+static us_janus_client_s *_find_client(janus_plugin_session *session) {
+	US_LIST_ITERATE(_g_clients, client, {
+		if (client->session == session) {
+			return client;
 		}
-	}
+	});
 	return NULL;
 }
 
-static void *_video_sink_thread(void *arg) {
-	(void)arg;
-	US_THREAD_SETTLE("us_p_vsink");
-	atomic_store(&_g_video_sink_tid_created, true);
+static void _set_key_required(void) {
+	for (uint index = 0; index < _g_n_video_layers; ++index) {
+		atomic_store(&_g_video_layers[index]->key_required, true);
+	}
+}
+
+static void *_video_sink_thread(void *v_layer) {
+	us_video_layer_s *const layer = v_layer;
+	US_THREAD_SETTLE("us_p_vsink%u", layer->index);
+	atomic_store(&layer->sink_tid_created, true);
 
-	us_frame_s *drop = us_frame_init();
-	u64 frame_id = 0;
 	int once = 0;
 
 	while (!_STOP) {
@@ -151,66 +164,73 @@ static void *_video_sink_thread(void *arg) {
 		}
 
 		int fd = -1;
-		us_memsink_shared_s *mem = NULL;
+		us_memsinkcl_s *cl = NULL;
 
-		const uz data_size = us_memsink_calculate_size(_g_config->video_sink_name);
+		const uz data_size = us_memsink_calculate_size(layer->sink_name);
 		if (data_size == 0) {
 			US_ONCE({ US_JLOG_ERROR("video", "Invalid memsink object suffix"); });
 			goto close_memsink;
 		}
 
-		if ((fd = shm_open(_g_config->video_sink_name, O_RDWR, 0)) <= 0) {
+		if ((fd = shm_open(layer->sink_name, O_RDWR, 0)) <= 0) {
 			US_ONCE({ US_JLOG_PERROR("video", "Can't open memsink"); });
 			goto close_memsink;
 		}
 
-		if ((mem = us_memsink_shared_map(fd, data_size)) == NULL) {
+		cl = us_memsinkcl_init(fd, data_size);
+		fd = -1; // The client takes it
+		if (cl == NULL) {
 			US_ONCE({ US_JLOG_PERROR("video", "Can't map memsink"); });
 			goto close_memsink;
 		}
 
 		once = 0;
 
-		US_JLOG_INFO("video", "Memsink opened; reading frames ...");
+		US_JLOG_INFO("video", "Memsink %s opened; reading frames ...", layer->sink_name);
 		while (!_STOP && _HAS_WATCHERS) {
-			const int waited = us_memsink_fd_wait_frame(fd, mem, frame_id);
-			if (waited == 0) {
-				const int ri = us_ring_producer_acquire(_g_video_ring, 0);
-				us_frame_s *frame;
-				if (ri >= 0) {
-					frame = _g_video_ring->items[ri];
-				} else {
-					US_ONCE({ US_JLOG_PERROR("video", "Video ring is full"); });
-					frame = drop;
+			const int acquired = us_memsinkcl_acquire(cl, 1, 1); // lock_timeout, wait_timeout
+			if (acquired == 0) {
+				// The frame is packetized right from the shared memory while the memsink
+				// is locked. It's not longer than copying the frame out of it, and the packets
+				// are going to the shared RTP ring anyway, so no staging copy is required.
+				// The ring takes only its own short mutex, not the video lock, and the fan-out
+				// is done by the session threads, so the NACK relays don't hold the memsink.
+				us_memsink_shared_s *const mem = cl->mem;
+				us_frame_s frame;
+				const int got = us_memsink_fd_get_frame(mem, &frame,
+					atomic_load(&layer->key_required), atomic_load(&_g_video_bitrate));
+				if (got == 0) {
+					const bool zero_playout_delay = (frame.gop == 0);
+					us_rtpv_wrap(layer->rtpv, &frame, mem->nalus, US_MIN(mem->n_nalus, (uint)US_NALUS_MAX), zero_playout_delay);
+					us_video_layer_account(layer, frame.used);
+					if (frame.key) {
+						atomic_store(&layer->key_required, false);
+					}
 				}
-
-				const int got = us_memsink_fd_get_frame(fd, mem, frame, &frame_id, atomic_load(&_g_key_required));
-				if (ri >= 0) {
-					us_ring_producer_release(_g_video_ring, ri);
+				if (us_memsinkcl_release(cl) < 0) {
+					US_JLOG_PERROR("video", "Can't unlock memsink");
+					goto close_memsink;
 				}
 				if (got < 0) {
 					goto close_memsink;
 				}
-
-				if (ri >= 0 && frame->key) {
-					atomic_store(&_g_key_required, false);
+			} else if (acquired != US_ERROR_NO_DATA) {
+				if (errno == EPROTO) {
+					US_JLOG_ERROR("video", "Memsink protocol version mismatch: required=%u", US_MEMSINK_VERSION);
+				} else {
+					US_JLOG_PERROR("video", "Can't read memsink");
 				}
-			} else if (waited != US_ERROR_NO_DATA) {
 				goto close_memsink;
 			}
 		}
 
 	close_memsink:
-		if (mem != NULL) {
-			us_memsink_shared_unmap(mem, data_size);
-			mem = NULL;
-		}
+		US_DELETE(cl, us_memsinkcl_destroy);
 		US_CLOSE_FD(fd);
 		US_JLOG_INFO("video", "Memsink closed");
 		sleep(1); // error_delay
 	}
 
-	us_frame_destroy(drop);
 	return NULL;
 }
 
@@ -258,7 +278,10 @@ static void *_acap_thread(void *arg) {
 			goto close_acap;
 		}
 		US_ONCE({ US_JLOG_INFO("acap", "Detected host audio"); });
-		if ((acap = us_acap_init(_g_config->acap_dev_name, hz)) == NULL) {
+		if ((acap = us_acap_init(
+			_g_config->acap_dev_name, hz,
+			_g_config->acap_dtx, _g_config->acap_fec_loss, &_g_au_stats
+		)) == NULL) {
 			goto close_acap;
 		}
 
@@ -297,6 +320,9 @@ static void *_aplay_thread(void *arg) {
 
 	int once = 0;
 
+	// The mix bus is allocated once, the clients PCM is mixed right from their rings
+	us_au_pcm_s *const mixed = us_au_pcm_init();
+
 	while (!_STOP) {
 		snd_pcm_t *dev = NULL;
 		bool skip = true;
@@ -304,24 +330,32 @@ static void *_aplay_thread(void *arg) {
 		while (!_STOP) {
 			usleep((US_AU_FRAME_MS / 4) * 1000);
 
-			us_au_pcm_s mixed = {0};
+			mixed->frames = 0;
+			const u64 begin_us = us_au_get_cpu_us();
 			_LOCK_APLAY;
 			US_LIST_ITERATE(_g_clients, client, {
-				us_au_pcm_s last = {0};
+				us_ring_s *const ring = client->aplay_pcm_ring;
+				int last_ri = -1;
 				do {
-					const int ri = us_ring_consumer_acquire(client->aplay_pcm_ring, 0);
-					if (ri >= 0) {
-						const us_au_pcm_s *pcm = client->aplay_pcm_ring->items[ri];
-						memcpy(&last, pcm, sizeof(us_au_pcm_s));
-						us_ring_consumer_release(client->aplay_pcm_ring, ri);
-					} else {
+					const int ri = us_ring_consumer_acquire(ring, 0);
+					if (ri < 0) {
 						break;
 					}
+					if (last_ri >= 0) {
+						us_ring_consumer_release(ring, last_ri);
+					}
+					last_ri = ri;
 				} while (skip && !_STOP);
-				us_au_pcm_mix(&mixed, &last);
+				if (last_ri >= 0) {
+					us_au_pcm_mix(mixed, ring->items[last_ri]);
+					us_ring_consumer_release(ring, last_ri);
+				}
 				// US_JLOG_INFO("++++++", "mixed %p", client);
 			});
 			_UNLOCK_APLAY;
+			if (mixed->frames > 0) {
+				us_au_stage_account(&_g_au_stats.mix, begin_us);
+			}
 			// US_JLOG_INFO("++++++", "--------------");
 
 			if (skip) {
@@ -357,8 +391,8 @@ static void *_aplay_thread(void *arg) {
 				once = 0;
 			}
 
-			if (dev != NULL && mixed.frames > 0) {
-				snd_pcm_sframes_t frames = snd_pcm_writei(dev, mixed.data, mixed.frames);
+			if (dev != NULL && mixed->frames > 0) {
+				snd_pcm_sframes_t frames = snd_pcm_writei(dev, mixed->data, mixed->frames);
 				if (frames < 0) {
 					frames = snd_pcm_recover(dev, frames, 1);
 				} else {
@@ -390,10 +424,12 @@ static void *_aplay_thread(void *arg) {
 			US_JLOG_INFO("aplay", "Playback closed");
 		}
 	}
+	us_au_pcm_destroy(mixed);
 	return NULL;
 }
 
 static void _relay_rtp_clients(const us_rtp_s *rtp) {
+	// Only audio here, each session reads video packets from the layer rings by itself
 	US_LIST_ITERATE(_g_clients, client, {
 		us_janus_client_send(client, rtp);
 	});
@@ -422,17 +458,21 @@ static int _plugin_init(janus_callbacks *gw, const char *config_dir_path) {
 
 	snd_lib_error_set_handler(_alsa_quiet);
 
-	US_RING_INIT_WITH_ITEMS(_g_video_ring, 64, us_frame_init);
-	_g_rtpv = us_rtpv_init(_relay_rtp_clients);
+	for (uint index = 0; index < _g_config->n_video_sinks; ++index) {
+		_g_video_layers[index] = us_video_layer_init(_g_config->video_sinks[index], index);
+	}
+	_g_n_video_layers = _g_config->n_video_sinks;
 	if (_g_config->acap_dev_name != NULL && us_acap_probe(_g_config->acap_dev_name)) {
-		_g_rtpa = us_rtpa_init(_relay_rtp_clients);
+		_g_rtpa = us_rtpa_init(_relay_rtp_clients, _g_config->acap_dtx, (_g_config->acap_fec_loss > 0));
 		US_THREAD_CREATE(_g_acap_tid, _acap_thread, NULL);
 		if (_g_config->aplay_dev_name != NULL) {
 			US_THREAD_CREATE(_g_aplay_tid, _aplay_thread, NULL);
 		}
 	}
-	US_THREAD_CREATE(_g_video_rtp_tid, _video_rtp_thread, NULL);
-	US_THREAD_CREATE(_g_video_sink_tid, _video_sink_thread, NULL);
+	for (uint index = 0; index < _g_n_video_layers; ++index) {
+		us_video_layer_s *const layer = _g_video_layers[index];
+		US_THREAD_CREATE(layer->sink_tid, _video_sink_thread, layer);
+	}
 
 	atomic_store(&_g_ready, true);
 	return 0;
@@ -443,8 +483,9 @@ static void _plugin_destroy(void) {
 
 	atomic_store(&_g_stop, true);
 #	define JOIN(_tid) { if (atomic_load(&_tid##_created)) { US_THREAD_JOIN(_tid); } }
-	JOIN(_g_video_sink_tid);
-	JOIN(_g_video_rtp_tid);
+	for (uint index = 0; index < _g_n_video_layers; ++index) {
+		JOIN(_g_video_layers[index]->sink_tid);
+	}
 	JOIN(_g_acap_tid);
 	JOIN(_g_aplay_tid);
 #	undef JOIN
@@ -454,10 +495,12 @@ static void _plugin_destroy(void) {
 		us_janus_client_destroy(client);
 	});
 
-	US_RING_DELETE_WITH_ITEMS(_g_video_ring, us_frame_destroy);
+	for (uint index = 0; index < _g_n_video_layers; ++index) {
+		US_DELETE(_g_video_layers[index], us_video_layer_destroy);
+	}
+	_g_n_video_layers = 0;
 
 	US_DELETE(_g_rtpa, us_rtpa_destroy);
-	US_DELETE(_g_rtpv, us_rtpv_destroy);
 	US_DELETE(_g_config, us_config_destroy);
 }
 
@@ -465,7 +508,7 @@ static void _plugin_create_session(janus_plugin_session *session, int *err) {
 	_IF_DISABLED({ *err = -1; return; });
 	_LOCK_ALL;
 	US_JLOG_INFO("main", "Creating session %p ...", session);
-	us_janus_client_s *const client = us_janus_client_init(_g_gw, session);
+	us_janus_client_s *const client = us_janus_client_init(_g_gw, session, _g_config, _g_video_layers, _g_n_video_layers);
 	US_LIST_APPEND(_g_clients, client);
 	atomic_store(&_g_has_watchers, true);
 	_UNLOCK_ALL;
@@ -494,19 +537,61 @@ static void _plugin_destroy_session(janus_plugin_session* session, int *err) {
 		US_JLOG_WARN("main", "No session %p", session);
 		*err = -2;
 	}
+	_update_video_bitrate();
 	atomic_store(&_g_has_watchers, has_watchers);
 	atomic_store(&_g_has_listeners, has_listeners);
 	atomic_store(&_g_has_speakers, has_speakers);
 	_UNLOCK_ALL;
 }
 
+static json_t *_make_au_stage_json(us_au_stage_s *stage) {
+	u64 count;
+	ldf avg;
+	ldf max;
+	us_au_stage_get_stats(stage, &count, &avg, &max);
+	return json_pack("{s:I, s:f, s:f}",
+		"count", (json_int_t)count,
+		"cpu_avg_us", (double)(avg * 1000000),
+		"cpu_max_us", (double)(max * 1000000));
+}
+
 static json_t *_plugin_query_session(janus_plugin_session *session) {
 	_IF_DISABLED({ return NULL; });
 	json_t *info = NULL;
 	_LOCK_ALL;
 	US_LIST_ITERATE(_g_clients, client, {
 		if (client->session == session) {
-			info = json_string("session_found");
+			if (!_g_config->admin_stats) {
+				info = json_string("session_found");
+				break;
+			}
+			info = json_object();
+			json_object_set_new(info, "session_found", json_true());
+			const uint layer = us_janus_client_get_layer(client);
+			json_object_set_new(info, "layer", json_pack("{s:i, s:s}",
+				"index", (int)layer,
+				"sink", _g_video_layers[layer]->sink_name));
+			json_object_set_new(info, "nack", json_pack("{s:I, s:I}",
+				"retransmitted", (json_int_t)atomic_load(&client->video_retransmitted),
+				"missed", (json_int_t)atomic_load(&client->video_nack_missed)));
+			json_object_set_new(info, "lag", json_pack("{s:I, s:I}",
+				"dropped_frames", (json_int_t)atomic_load(&client->video_lag_frames),
+				"dropped_packets", (json_int_t)atomic_load(&client->video_lag_packets)));
+			json_object_set_new(info, "audio", json_pack("{s:o, s:o, s:o, s:o}",
+				"resample", _make_au_stage_json(&_g_au_stats.resample),
+				"encode", _make_au_stage_json(&_g_au_stats.encode),
+				"mix", _make_au_stage_json(&_g_au_stats.mix),
+				"decode", _make_au_stage_json(&client->aplay_decode)));
+			if (client->video_pacer != NULL) {
+				u64 delayed;
+				ldf delay_avg;
+				ldf delay_max;
+				us_pacer_get_stats(client->video_pacer, &delayed, &delay_avg, &delay_max);
+				json_object_set_new(info, "pacing", json_pack("{s:I, s:f, s:f}",
+					"delayed", (json_int_t)delayed,
+					"delay_avg_ms", (double)(delay_avg * 1000),
+					"delay_max_ms", (double)(delay_max * 1000)));
+			}
 			break;
 		}
 	});
@@ -523,6 +608,7 @@ static void _set_transmit(janus_plugin_session *session, const char *msg, bool t
 	US_LIST_ITERATE(_g_clients, client, {
 		if (client->session == session) {
 			atomic_store(&client->transmit, transmit);
+			client->video_remb = 0;
 			// US_JLOG_INFO("main", "%s session %p", msg, session);
 			found = true;
 		}
@@ -531,6 +617,7 @@ static void _set_transmit(janus_plugin_session *session, const char *msg, bool t
 	if (!found) {
 		US_JLOG_WARN("main", "No session %p", session);
 	}
+	_update_video_bitrate();
 	atomic_store(&_g_has_watchers, has_watchers);
 	_UNLOCK_ALL;
 }
@@ -626,7 +713,7 @@ static struct janus_plugin_result *_plugin_handle_message(
 
 		{
 			char *sdp;
-			char *const video_sdp = us_rtpv_make_sdp(_g_rtpv);
+			char *const video_sdp = us_rtpv_make_sdp(_g_video_layers[0]->rtpv);
 			char *const audio_sdp = (with_acap ? us_rtpa_make_sdp(_g_rtpa, with_aplay) : us_strdup(""));
 			US_ASPRINTF(sdp,
 				"v=0" RN
@@ -684,7 +771,7 @@ static struct janus_plugin_result *_plugin_handle_message(
 
 	} else if (!strcmp(request_str, "key_required")) {
 		// US_JLOG_INFO("main", "Got key_required message");
-		atomic_store(&_g_key_required, true);
+		_set_key_required();
 
 	} else {
 		PUSH_ERROR(405, "Not implemented");
@@ -723,10 +810,64 @@ static void _plugin_incoming_rtcp(janus_plugin_session *session, janus_plugin_rt
 	if (session == NULL || packet == NULL || !packet->video) {
 		return; // Accept only valid video
 	}
-	if (janus_rtcp_has_pli(packet->buffer, packet->length)) {
-		// US_JLOG_INFO("main", "Got video PLI");
-		atomic_store(&_g_key_required, true);
+
+	_LOCK_VIDEO;
+	us_janus_client_s *const client = _find_client(session);
+	if (client == NULL) {
+		goto done;
+	}
+
+	bool key_required = (
+		janus_rtcp_has_pli(packet->buffer, packet->length)
+		|| janus_rtcp_has_fir(packet->buffer, packet->length)
+	);
+	// if (key_required) { US_JLOG_INFO("main", "Got video PLI or FIR"); }
+
+	// Disabled by default: the core answers the NACKs from its own queue, and the plugin API
+	// can't disable it for our sessions, so both would send the same packet. See docs/h264.md.
+	GSList *const nacks = (_g_config->video_nack_max_age > 0 ? janus_rtcp_get_nacks(packet->buffer, packet->length) : NULL);
+	if (nacks != NULL) {
+		for (GSList *item = nacks; item != NULL; item = item->next) {
+			if (!us_janus_client_retransmit(client, GPOINTER_TO_UINT(item->data))) {
+				// Too old to be retransmitted, the decoder can be recovered only by a keyframe
+				key_required = true;
+			}
+		}
+		g_slist_free(nacks);
+	}
+
+	if (key_required) {
+		// Only the layer which is being sent to this session
+		atomic_store(&_g_video_layers[us_janus_client_get_layer(client)]->key_required, true);
+	}
+
+	const u32 remb = janus_rtcp_get_remb(packet->buffer, packet->length); // Bits per second
+	if (remb > 0) {
+		client->video_remb = US_MAX(remb / 1000, (u32)1);
+		_update_video_bitrate();
+		us_janus_client_select_layer(client, false);
+	}
+
+done:
+	_UNLOCK_VIDEO;
+}
+
+#if JANUS_PLUGIN_API_VERSION >= 100
+static void _plugin_slow_link(janus_plugin_session *session, int mindex, gboolean video, gboolean uplink) {
+	(void)mindex;
+#else
+static void _plugin_slow_link(janus_plugin_session *session, int uplink, int video) {
+#endif
+	_IF_DISABLED({ return; });
+	if (session == NULL || !video || uplink) {
+		return; // Only the video which we're sending to the browser
+	}
+	_LOCK_VIDEO;
+	us_janus_client_s *const client = _find_client(session);
+	if (client != NULL) {
+		us_janus_client_select_layer(client, true);
 	}
+	_UNLOCK_VIDEO;
 }
 
 
@@ -766,6 +907,7 @@ janus_plugin *create(void) {
 
 		.incoming_rtp = _plugin_incoming_rtp,
 		.incoming_rtcp = _plugin_incoming_rtcp,
+		.slow_link = _plugin_slow_link,
 	);
 #	pragma GCC diagnostic pop
 	return &plugin;
@@ -26,6 +26,7 @@
 #include "rtp.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "uslibs/types.h"
 #include "uslibs/tools.h"
@@ -47,14 +48,26 @@ void us_rtp_assign(us_rtp_s *rtp, uint payload, bool video) {
 	rtp->ssrc = us_triple_u32(us_get_now_monotonic_u64());
 }
 
+void us_rtp_copy(const us_rtp_s *src, us_rtp_s *dest) {
+	// Only the used part of the datagram
+	dest->payload = src->payload;
+	dest->video = src->video;
+	dest->ssrc = src->ssrc;
+	dest->seq = src->seq;
+	memcpy(dest->datagram, src->datagram, src->used);
+	dest->used = src->used;
+	dest->zero_playout_delay = src->zero_playout_delay;
+	dest->key_begin = src->key_begin;
+}
+
 void us_rtp_write_header(us_rtp_s *rtp, u32 pts, bool marked) {
 	u32 word0 = 0x80000000;
 	if (marked) {
 		word0 |= 1 << 23;
 	}
 	word0 |= (rtp->payload & 0x7F) << 16;
+	++rtp->seq; // So the field always matches the datagram
 	word0 |= rtp->seq;
-	++rtp->seq;
 
 #	define WRITE_BE_U32(x_offset, x_value) \
 		*((u32*)(rtp->datagram + x_offset)) = __builtin_bswap32(x_value)
@@ -63,3 +76,10 @@ void us_rtp_write_header(us_rtp_s *rtp, u32 pts, bool marked) {
 	WRITE_BE_U32(8, rtp->ssrc);
 #	undef WRITE_BE_U32
 }
+
+void us_rtp_rewrite_header(us_rtp_s *rtp, u32 ssrc, u16 seq) {
+	rtp->ssrc = ssrc;
+	rtp->seq = seq;
+	*((u16*)(rtp->datagram + 2)) = __builtin_bswap16(seq);
+	*((u32*)(rtp->datagram + 8)) = __builtin_bswap32(ssrc);
+}
@@ -46,6 +46,7 @@ typedef struct {
 	u8		datagram[US_RTP_DATAGRAM_SIZE];
 	uz		used;
 	bool	zero_playout_delay;
+	bool	key_begin; // The first packet of a keyframe
 } us_rtp_s;
 
 typedef void (*us_rtp_callback_f)(const us_rtp_s *rtp);
@@ -55,4 +56,6 @@ us_rtp_s *us_rtp_init(void);
 void us_rtp_destroy(us_rtp_s *rtp);
 
 void us_rtp_assign(us_rtp_s *rtp, uint payload, bool video);
+void us_rtp_copy(const us_rtp_s *src, us_rtp_s *dest);
 void us_rtp_write_header(us_rtp_s *rtp, u32 pts, bool marked);
+void us_rtp_rewrite_header(us_rtp_s *rtp, u32 ssrc, u16 seq);
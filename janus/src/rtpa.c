@@ -29,12 +29,14 @@
 #include "uslibs/tools.h"
 
 
-us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback) {
+us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback, bool dtx, bool fec) {
 	us_rtpa_s *rtpa;
 	US_CALLOC(rtpa, 1);
 	rtpa->rtp = us_rtp_init();
 	us_rtp_assign(rtpa->rtp, US_RTP_OPUS_PAYLOAD, false);
 	rtpa->callback = callback;
+	rtpa->dtx = dtx;
+	rtpa->fec = fec;
 	return rtpa;
 }
 
@@ -50,7 +52,7 @@ char *us_rtpa_make_sdp(us_rtpa_s *rtpa, bool mic) {
 		"m=audio 1 RTP/SAVPF %u" RN
 		"c=IN IP4 0.0.0.0" RN
 		"a=rtpmap:%u OPUS/%u/%u" RN
-		"a=fmtp:%u sprop-stereo=1" RN // useinbandfec=1
+		"a=fmtp:%u sprop-stereo=1%s%s" RN
 		"a=rtcp-fb:%u nack" RN
 		"a=rtcp-fb:%u nack pli" RN
 		"a=rtcp-fb:%u goog-remb" RN
@@ -58,7 +60,8 @@ char *us_rtpa_make_sdp(us_rtpa_s *rtpa, bool mic) {
 		"a=%s" RN,
 		pl, pl,
 		US_RTP_OPUS_HZ, US_RTP_OPUS_CH,
-		pl, pl, pl, pl,
+		pl, (rtpa->fec ? ";useinbandfec=1" : ""), (rtpa->dtx ? ";usedtx=1" : ""),
+		pl, pl, pl,
 		rtpa->rtp->ssrc,
 		(mic ? "sendrecv" : "sendonly")
 	);
@@ -30,10 +30,12 @@
 typedef struct {
 	us_rtp_s			*rtp;
 	us_rtp_callback_f	callback;
+	bool				dtx;
+	bool				fec;
 } us_rtpa_s;
 
 
-us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback);
+us_rtpa_s *us_rtpa_init(us_rtp_callback_f callback, bool dtx, bool fec);
 void us_rtpa_destroy(us_rtpa_s *rtpa);
 
 char *us_rtpa_make_sdp(us_rtpa_s *rtpa, bool mic);
@@ -0,0 +1,197 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "rtpring.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <assert.h>
+
+#include <pthread.h>
+
+#include "uslibs/types.h"
+#include "uslibs/tools.h"
+#include "uslibs/threading.h"
+
+#include "rtp.h"
+
+
+us_rtp_ring_s *us_rtp_ring_init(uint capacity) {
+	us_rtp_ring_s *ring;
+	US_CALLOC(ring, 1);
+	US_CALLOC(ring->slots, capacity);
+	ring->capacity = capacity;
+	for (uint index = 0; index < capacity; ++index) {
+		ring->slots[index].rtp = us_rtp_init();
+		atomic_init(&ring->slots[index].refs, 0);
+	}
+	US_MUTEX_INIT(ring->mutex);
+
+	pthread_condattr_t attrs;
+	assert(!pthread_condattr_init(&attrs));
+	assert(!pthread_condattr_setclock(&attrs, CLOCK_MONOTONIC));
+	assert(!pthread_cond_init(&ring->cond, &attrs));
+	assert(!pthread_condattr_destroy(&attrs));
+	return ring;
+}
+
+void us_rtp_ring_destroy(us_rtp_ring_s *ring) {
+	US_COND_DESTROY(ring->cond);
+	US_MUTEX_DESTROY(ring->mutex);
+	for (uint index = 0; index < ring->capacity; ++index) {
+		assert(atomic_load(&ring->slots[index].refs) == 0);
+		us_rtp_destroy(ring->slots[index].rtp);
+	}
+	free(ring->slots);
+	free(ring);
+}
+
+void us_rtp_ring_put(us_rtp_ring_s *ring, const us_rtp_s *rtp) {
+	US_MUTEX_LOCK(ring->mutex);
+	us_rtp_ring_slot_s *const slot = &ring->slots[ring->head % ring->capacity];
+	while (atomic_load(&slot->refs) > 0) {
+		// The oldest packet is still being sent by a lagging session.
+		// This is very short and very rare, so we don't need a condition here.
+		US_MUTEX_UNLOCK(ring->mutex);
+		sched_yield();
+		US_MUTEX_LOCK(ring->mutex);
+	}
+	us_rtp_copy(rtp, slot->rtp);
+	slot->id = ring->head;
+	slot->ts = us_get_now_monotonic();
+	slot->frame = ring->frames;
+	if (rtp->datagram[1] & 0x80) { // Marker, the last packet of the frame
+		++ring->frames;
+	}
+	++ring->head;
+	US_MUTEX_UNLOCK(ring->mutex);
+	US_COND_BROADCAST(ring->cond);
+}
+
+void us_rtp_ring_cursor_reset(us_rtp_ring_s *ring, us_rtp_cursor_s *cursor) {
+	// The reader always starts from a keyframe, so the decoder gets
+	// a clean picture instead of a tail of the previous GOP.
+	US_MUTEX_LOCK(ring->mutex);
+	cursor->next = ring->head;
+	US_MUTEX_UNLOCK(ring->mutex);
+	cursor->wait_key = true;
+	cursor->key_required = false;
+	cursor->started = false;
+	cursor->lost = 0;
+	cursor->frames_dropped = 0;
+}
+
+int us_rtp_ring_acquire(us_rtp_ring_s *ring, us_rtp_cursor_s *cursor, ldf timeout, ldf max_lag) {
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	us_ld_to_timespec(us_timespec_to_ld(&ts) + timeout, &ts);
+
+	US_MUTEX_LOCK(ring->mutex);
+	while (true) {
+		if (
+			ring->head - cursor->next > ring->capacity / 2
+			|| (
+				max_lag > 0 && cursor->next < ring->head
+				&& ring->slots[cursor->next % ring->capacity].ts + max_lag < us_get_now_monotonic()
+			)
+		) {
+			// The session is lagging too much or the ring is going to be overwritten.
+			// Sending the old packets makes the lag even longer, so we're skipping
+			// everything up to the next keyframe and asking for it instead of
+			// waiting for the end of the GOP.
+			if (cursor->started) {
+				cursor->lost += ring->head - cursor->next;
+			}
+			cursor->next = ring->head;
+			cursor->wait_key = true;
+			cursor->key_required = true;
+		}
+
+		while (cursor->next < ring->head) {
+			const uint index = cursor->next % ring->capacity;
+			us_rtp_ring_slot_s *const slot = &ring->slots[index];
+			assert(slot->id == cursor->next);
+			++cursor->next;
+			if (cursor->wait_key) {
+				if (!slot->rtp->key_begin) {
+					if (cursor->started) {
+						++cursor->lost;
+					}
+					continue;
+				}
+				cursor->wait_key = false;
+			}
+			if (cursor->started && slot->frame != cursor->last_frame) {
+				// Count the frames between the previous and the current packets,
+				// plus the previous frame if it was cut.
+				cursor->frames_dropped += slot->frame - cursor->last_frame - 1;
+				cursor->frames_dropped += !cursor->last_frame_complete;
+			}
+			cursor->started = true;
+			cursor->last_frame = slot->frame;
+			cursor->last_frame_complete = (slot->rtp->datagram[1] & 0x80);
+			atomic_fetch_add(&slot->refs, 1);
+			US_MUTEX_UNLOCK(ring->mutex);
+			return index;
+		}
+
+		const int err = pthread_cond_timedwait(&ring->cond, &ring->mutex, &ts);
+		if (err == ETIMEDOUT) {
+			US_MUTEX_UNLOCK(ring->mutex);
+			return -1;
+		}
+		assert(!err);
+	}
+}
+
+int us_rtp_ring_acquire_seq(us_rtp_ring_s *ring, u16 seq, ldf max_age) {
+	// The ring is filled by the single packetizer, so the sequence numbers
+	// of the neighboring slots are consecutive and we can compute the slot
+	// from the distance to the newest packet.
+	int index = -1;
+	US_MUTEX_LOCK(ring->mutex);
+	if (ring->head > 0) {
+		const us_rtp_s *const newest = ring->slots[(ring->head - 1) % ring->capacity].rtp;
+		const u16 distance = newest->seq - seq;
+		if (distance < ring->capacity && distance < ring->head) {
+			const u64 id = ring->head - 1 - distance;
+			us_rtp_ring_slot_s *const slot = &ring->slots[id % ring->capacity];
+			if (
+				slot->id == id
+				&& slot->rtp->seq == seq
+				&& slot->ts + max_age >= us_get_now_monotonic()
+			) {
+				atomic_fetch_add(&slot->refs, 1);
+				index = id % ring->capacity;
+			}
+		}
+	}
+	US_MUTEX_UNLOCK(ring->mutex);
+	return index;
+}
+
+void us_rtp_ring_release(us_rtp_ring_s *ring, uint index) {
+	assert(atomic_fetch_sub(&ring->slots[index].refs, 1) > 0);
+}
@@ -0,0 +1,78 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "uslibs/types.h"
+
+#include "rtp.h"
+
+
+// A single producer / multiple readers packet ring. Each packet is written
+// into the ring once and every session reads it through its own cursor,
+// so there is no per-session queue of packets.
+
+typedef struct {
+	us_rtp_s	*rtp;
+	u64			id;
+	ldf			ts; // Monotonic time of writing
+	u64			frame; // Number of the frame of this packet
+	atomic_uint	refs;
+} us_rtp_ring_slot_s;
+
+typedef struct {
+	us_rtp_ring_slot_s	*slots;
+	uint				capacity;
+	u64					head; // Id of the next packet to write
+	u64					frames; // Number of the completed frames
+
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+} us_rtp_ring_s;
+
+typedef struct {
+	u64		next;
+	bool	wait_key;
+	bool	key_required; // Set on lagging, the reader should request a keyframe and reset it
+
+	bool	started; // Something was read after the reset
+	u64		last_frame;
+	bool	last_frame_complete;
+
+	u64		lost; // Packets skipped after the start because of lagging
+	u64		frames_dropped; // Whole and incomplete frames skipped after the start
+} us_rtp_cursor_s;
+
+
+us_rtp_ring_s *us_rtp_ring_init(uint capacity);
+void us_rtp_ring_destroy(us_rtp_ring_s *ring);
+
+void us_rtp_ring_put(us_rtp_ring_s *ring, const us_rtp_s *rtp);
+
+void us_rtp_ring_cursor_reset(us_rtp_ring_s *ring, us_rtp_cursor_s *cursor);
+int us_rtp_ring_acquire(us_rtp_ring_s *ring, us_rtp_cursor_s *cursor, ldf timeout, ldf max_lag);
+int us_rtp_ring_acquire_seq(us_rtp_ring_s *ring, u16 seq, ldf max_age);
+void us_rtp_ring_release(us_rtp_ring_s *ring, uint index);
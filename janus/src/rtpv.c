@@ -34,19 +34,21 @@
 #include "uslibs/types.h"
 #include "uslibs/tools.h"
 #include "uslibs/frame.h"
+#include "uslibs/nalu.h"
 
+#include "rtp.h"
+#include "rtpring.h"
 
-void _rtpv_process_nalu(us_rtpv_s *rtpv, const u8 *data, uz size, u32 pts, bool marked);
 
-static sz _find_annexb(const u8 *data, uz size);
+void _rtpv_process_nalu(us_rtpv_s *rtpv, const u8 *data, uz size, u32 pts, bool marked);
 
 
-us_rtpv_s *us_rtpv_init(us_rtp_callback_f callback) {
+us_rtpv_s *us_rtpv_init(us_rtp_ring_s *ring) {
 	us_rtpv_s *rtpv;
 	US_CALLOC(rtpv, 1);
 	rtpv->rtp = us_rtp_init();
 	us_rtp_assign(rtpv->rtp, US_RTP_H264_PAYLOAD, true);
-	rtpv->callback = callback;
+	rtpv->ring = ring;
 	return rtpv;
 }
 
@@ -82,20 +84,30 @@ char *us_rtpv_make_sdp(us_rtpv_s *rtpv) {
 
 #define _PRE 3 // Annex B prefix length
 
-void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, bool zero_playout_delay) {
+void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, const us_nalu_s *nalus, uint n_nalus, bool zero_playout_delay) {
 	// There is a complicated logic here but everything works as it should:
 	//   - https://github.com/pikvm/ustreamer/issues/115#issuecomment-893071775
 
 	assert(frame->format == V4L2_PIX_FMT_H264);
 
 	rtpv->rtp->zero_playout_delay = zero_playout_delay;
+	rtpv->rtp->key_begin = frame->key; // Will be dropped after the first packet
 
 	const u32 pts = us_get_now_monotonic_u64() * 9 / 100; // PTS units are in 90 kHz
+
+	if (n_nalus > 0 && (uz)nalus[n_nalus - 1].offset + nalus[n_nalus - 1].size <= frame->used) {
+		// The index made by the memsink server, no need to scan the data
+		for (uint index = 0; index < n_nalus; ++index) {
+			_rtpv_process_nalu(rtpv, frame->data + nalus[index].offset, nalus[index].size, pts, (index == n_nalus - 1));
+		}
+		return;
+	}
+
 	sz last_offset = -_PRE;
 
 	while (true) { // Find and iterate by nalus
 		const uz next_start = last_offset + _PRE;
-		sz offset = _find_annexb(frame->data + next_start, frame->used - next_start);
+		sz offset = us_nalu_find_annexb(frame->data + next_start, frame->used - next_start);
 		if (offset < 0) {
 			break;
 		}
@@ -129,7 +141,8 @@ void _rtpv_process_nalu(us_rtpv_s *rtpv, const u8 *data, uz size, u32 pts, bool
 		us_rtp_write_header(rtpv->rtp, pts, marked);
 		memcpy(dg + US_RTP_HEADER_SIZE, data, size);
 		rtpv->rtp->used = size + US_RTP_HEADER_SIZE;
-		rtpv->callback(rtpv->rtp);
+		us_rtp_ring_put(rtpv->ring, rtpv->rtp);
+		rtpv->rtp->key_begin = false;
 		return;
 	}
 
@@ -161,7 +174,8 @@ void _rtpv_process_nalu(us_rtpv_s *rtpv, const u8 *data, uz size, u32 pts, bool
 
 		memcpy(dg + fu_overhead, src, frag_size);
 		rtpv->rtp->used = fu_overhead + frag_size;
-		rtpv->callback(rtpv->rtp);
+		us_rtp_ring_put(rtpv->ring, rtpv->rtp);
+		rtpv->rtp->key_begin = false;
 
 		src += frag_size;
 		remaining -= frag_size;
@@ -169,16 +183,4 @@ void _rtpv_process_nalu(us_rtpv_s *rtpv, const u8 *data, uz size, u32 pts, bool
 	}
 }
 
-static sz _find_annexb(const u8 *data, uz size) {
-	// Parses buffer for 00 00 01 start codes
-	if (size >= _PRE) {
-		for (uz index = 0; index <= size - _PRE; ++index) {
-			if (data[index] == 0 && data[index + 1] == 0 && data[index + 2] == 1) {
-				return index;
-			}
-		}
-	}
-	return -1;
-}
-
 #undef _PRE
@@ -24,18 +24,20 @@
 
 #include "uslibs/types.h"
 #include "uslibs/frame.h"
+#include "uslibs/nalu.h"
 
 #include "rtp.h"
+#include "rtpring.h"
 
 
 typedef struct {
-	us_rtp_s			*rtp;
-	us_rtp_callback_f	callback;
+	us_rtp_s		*rtp;
+	us_rtp_ring_s	*ring;
 } us_rtpv_s;
 
 
-us_rtpv_s *us_rtpv_init(us_rtp_callback_f callback);
+us_rtpv_s *us_rtpv_init(us_rtp_ring_s *ring);
 void us_rtpv_destroy(us_rtpv_s *rtpv);
 
 char *us_rtpv_make_sdp(us_rtpv_s *rtpv);
-void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, bool zero_playout_delay);
+void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, const us_nalu_s *nalus, uint n_nalus, bool zero_playout_delay);
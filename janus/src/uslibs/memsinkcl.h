@@ -0,0 +1 @@
+../../../src/libs/memsinkcl.h
\ No newline at end of file
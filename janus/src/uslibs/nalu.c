@@ -0,0 +1 @@
+../../../src/libs/nalu.c
\ No newline at end of file
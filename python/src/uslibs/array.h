@@ -0,0 +1 @@
+../../../src/libs/array.h
\ No newline at end of file
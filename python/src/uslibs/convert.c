@@ -0,0 +1 @@
+../../../src/libs/convert.c
\ No newline at end of file
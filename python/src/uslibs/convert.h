@@ -0,0 +1 @@
+../../../src/libs/convert.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../src/libs/memsinkcl.c
\ No newline at end of file
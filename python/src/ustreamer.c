@@ -19,8 +19,16 @@
 #include "uslibs/tools.h"
 #include "uslibs/frame.h"
 #include "uslibs/memsinksh.h"
+#include "uslibs/memsinkcl.h"
+#include "uslibs/convert.h"
 
 
+typedef struct {
+	PyObject_HEAD
+
+	us_frame_s	*frame;
+} _FrameBufferObject;
+
 typedef struct {
 	PyObject_HEAD
 
@@ -28,29 +36,61 @@ typedef struct {
 	double	lock_timeout;
 	double	wait_timeout;
 	double	drop_same_frames;
-	uz		data_size;
-
-	int					fd;
-	us_memsink_shared_s	*mem;
 
-	u64				frame_id;
-	ldf				frame_ts;
-	us_frame_s		*frame;
+	us_memsinkcl_s		*cl;
+	ldf					frame_ts;
+	_FrameBufferObject	*buffer; // The snapshot of the last frame
 } _MemsinkObject;
 
 
-static void _MemsinkObject_destroy_internals(_MemsinkObject *self) {
-	if (self->mem != NULL) {
-		us_memsink_shared_unmap(self->mem, self->data_size);
-		self->mem = NULL;
+static PyTypeObject _FrameBufferType;
+
+
+static int _FrameBufferObject_init(_FrameBufferObject *self, PyObject *Py_UNUSED(args), PyObject *Py_UNUSED(kwargs)) {
+	if (self->frame == NULL) {
+		self->frame = us_frame_init();
 	}
-	US_CLOSE_FD(self->fd);
+	return 0;
+}
+
+static void _FrameBufferObject_dealloc(_FrameBufferObject *self) {
 	US_DELETE(self->frame, us_frame_destroy);
+	PyObject_Del(self);
 }
 
-static int _MemsinkObject_init(_MemsinkObject *self, PyObject *args, PyObject *kwargs) {
-	self->fd = -1;
+static int _FrameBufferObject_getbuffer(_FrameBufferObject *self, Py_buffer *view, int flags) {
+	return PyBuffer_FillInfo(view, (PyObject*)self, self->frame->data, self->frame->used, 1, flags);
+}
+
+static PyBufferProcs _FrameBufferObject_as_buffer = {
+	.bf_getbuffer = (getbufferproc)_FrameBufferObject_getbuffer,
+};
+
+static PyTypeObject _FrameBufferType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "ustreamer.FrameBuffer",
+	.tp_basicsize	= sizeof(_FrameBufferObject),
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_new			= PyType_GenericNew,
+	.tp_init		= (initproc)_FrameBufferObject_init,
+	.tp_dealloc		= (destructor)_FrameBufferObject_dealloc,
+	.tp_as_buffer	= &_FrameBufferObject_as_buffer,
+};
+
 
+static void _MemsinkObject_destroy_internals(_MemsinkObject *self) {
+	if (self->cl != NULL) {
+		// The notification thread may take up to its polling interval to stop
+		us_memsinkcl_s *const cl = self->cl;
+		self->cl = NULL;
+		Py_BEGIN_ALLOW_THREADS
+		us_memsinkcl_destroy(cl);
+		Py_END_ALLOW_THREADS
+	}
+	Py_CLEAR(self->buffer);
+}
+
+static int _MemsinkObject_init(_MemsinkObject *self, PyObject *args, PyObject *kwargs) {
 	self->lock_timeout = 1;
 	self->wait_timeout = 1;
 
@@ -72,18 +112,22 @@ static int _MemsinkObject_init(_MemsinkObject *self, PyObject *args, PyObject *k
 	SET_DOUBLE(drop_same_frames, >= 0);
 #	undef SET_DOUBLE
 
-	if ((self->data_size = us_memsink_calculate_size(self->obj)) == 0) {
+	const uz data_size = us_memsink_calculate_size(self->obj);
+	if (data_size == 0) {
 		PyErr_SetString(PyExc_ValueError, "Invalid memsink object suffix");
 		return -1;
 	}
 
-	self->frame = us_frame_init();
+	if ((self->buffer = (_FrameBufferObject*)PyObject_CallNoArgs((PyObject*)&_FrameBufferType)) == NULL) {
+		goto error;
+	}
 
-	if ((self->fd = shm_open(self->obj, O_RDWR, 0)) == -1) {
+	const int fd = shm_open(self->obj, O_RDWR, 0);
+	if (fd == -1) {
 		PyErr_SetFromErrno(PyExc_OSError);
 		goto error;
 	}
-	if ((self->mem = us_memsink_shared_map(self->fd, self->data_size)) == NULL) {
+	if ((self->cl = us_memsinkcl_init(fd, data_size)) == NULL) { // The client takes the fd
 		PyErr_SetFromErrno(PyExc_OSError);
 		goto error;
 	}
@@ -119,99 +163,89 @@ static PyObject *_MemsinkObject_exit(_MemsinkObject *self, PyObject *Py_UNUSED(i
 	return PyObject_CallMethod((PyObject*)self, "close", "");
 }
 
-static int _wait_frame(_MemsinkObject *self) {
-	const ldf deadline_ts = us_get_now_monotonic() + self->wait_timeout;
-
-	int locked = -1;
-	ldf now_ts;
-	do {
-		Py_BEGIN_ALLOW_THREADS
-
-		locked = us_flock_timedwait_monotonic(self->fd, self->lock_timeout);
-		now_ts = us_get_now_monotonic();
-		if (locked < 0) {
-			if (errno == EWOULDBLOCK) {
-				goto retry;
-			}
-			goto os_error;
-		}
-
-		us_memsink_shared_s *mem = self->mem;
-		if (mem->magic != US_MEMSINK_MAGIC || mem->version != US_MEMSINK_VERSION) {
-			goto retry;
-		}
+static bool _is_same_frame(_MemsinkObject *self, ldf now_ts) {
+	const us_memsink_shared_s *const mem = self->cl->mem;
+	const us_frame_s *const frame = self->buffer->frame;
+	return (
+		self->drop_same_frames > 0
+		&& US_FRAME_COMPARE_GEOMETRY(mem, frame)
+		&& (self->frame_ts + self->drop_same_frames > now_ts)
+		&& !memcmp(frame->data, us_memsink_get_data((us_memsink_shared_s*)mem), mem->used)
+	);
+}
 
-		// Let the sink know that the client is alive
-		mem->last_client_ts = now_ts;
+static int _wait_frame(_MemsinkObject *self, ldf timeout) {
+	const ldf deadline_ts = us_get_now_monotonic() + timeout;
 
-		if (mem->id == self->frame_id) {
-			goto retry;
+	int retval;
+	Py_BEGIN_ALLOW_THREADS
+	while (true) {
+		const ldf now_ts = us_get_now_monotonic();
+		retval = us_memsinkcl_acquire(self->cl, self->lock_timeout, US_MAX(deadline_ts - now_ts, (ldf)0));
+		if (retval != 0 || !_is_same_frame(self, now_ts)) {
+			break;
 		}
-
-		if (self->drop_same_frames > 0) {
-			if (
-				US_FRAME_COMPARE_GEOMETRY(self->mem, self->frame)
-				&& (self->frame_ts + self->drop_same_frames > now_ts)
-				&& !memcmp(self->frame->data, us_memsink_get_data(mem), mem->used)
-			) {
-				self->frame_id = mem->id;
-				goto retry;
-			}
+		if ((retval = us_memsinkcl_release(self->cl)) < 0) {
+			break;
 		}
+	}
+	Py_END_ALLOW_THREADS
 
-		// New frame found
-		Py_BLOCK_THREADS
-		return 0;
-
-	os_error:
-		Py_BLOCK_THREADS
+	if (retval < 0 && retval != US_ERROR_NO_DATA) {
 		PyErr_SetFromErrno(PyExc_OSError);
 		return -1;
-
-	retry:
-		if (locked >= 0 && flock(self->fd, LOCK_UN) < 0) {
-			goto os_error;
-		}
-		if (usleep(1000) < 0) {
-			goto os_error;
-		}
-		Py_END_ALLOW_THREADS
-		if (PyErr_CheckSignals() < 0) {
-			return -1;
+	}
+	if (PyErr_CheckSignals() < 0) {
+		if (retval == 0) {
+			us_memsinkcl_release(self->cl);
 		}
-	} while (now_ts < deadline_ts);
-
-	return US_ERROR_NO_DATA;
+		return -1;
+	}
+	return retval;
 }
 
-static PyObject *_MemsinkObject_wait_frame(_MemsinkObject *self, PyObject *args, PyObject *kwargs) {
-	if (self->mem == NULL || self->fd <= 0) {
+static PyObject *_get_frame(_MemsinkObject *self, PyObject *args, PyObject *kwargs, ldf timeout) {
+	if (self->cl == NULL) {
 		PyErr_SetString(PyExc_RuntimeError, "Closed");
 		return NULL;
 	}
 
 	bool key_required = false;
-	static char *kws[] = {"key_required", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", kws, &key_required)) {
+	bool zero_copy = false;
+	static char *kws[] = {"key_required", "zero_copy", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|pp", kws, &key_required, &zero_copy)) {
 		return NULL;
 	}
 
-	switch (_wait_frame(self)) {
+	if (Py_REFCNT(self->buffer) > 1) {
+		// The previous snapshot is still exported via memoryview, so it can't be overwritten.
+		// Otherwise the same buffer is reused between the calls without any allocations.
+		_FrameBufferObject *buffer = (_FrameBufferObject*)PyObject_CallNoArgs((PyObject*)&_FrameBufferType);
+		if (buffer == NULL) {
+			return NULL;
+		}
+		if (self->drop_same_frames > 0) {
+			us_frame_copy(self->buffer->frame, buffer->frame);
+		}
+		Py_SETREF(self->buffer, buffer);
+	}
+
+	switch (_wait_frame(self, timeout)) {
 		case 0: break;
 		case US_ERROR_NO_DATA: Py_RETURN_NONE;
 		default: return NULL;
 	}
 
-	us_memsink_shared_s *mem = self->mem;
-	us_frame_set_data(self->frame, us_memsink_get_data(mem), mem->used);
-	US_FRAME_COPY_META(self->mem, self->frame);
-	self->frame_id = mem->id;
+	us_memsink_shared_s *const mem = self->cl->mem;
+	us_frame_s *const frame = self->buffer->frame;
+	us_frame_set_data(frame, us_memsink_get_data(mem), mem->used);
+	US_FRAME_COPY_META(mem, frame);
 	self->frame_ts = us_get_now_monotonic();
 	if (key_required) {
 		mem->key_requested = true;
 	}
 
-	if (flock(self->fd, LOCK_UN) < 0) {
+	if (us_memsinkcl_release(self->cl) < 0) {
 		return PyErr_SetFromErrno(PyExc_OSError);
 	}
 
@@ -232,7 +266,7 @@ static PyObject *_MemsinkObject_wait_frame(_MemsinkObject *self, PyObject *args,
 			Py_DECREF(m_tmp); \
 		}
 #	define SET_NUMBER(x_key, x_from, x_to) \
-		SET_VALUE(#x_key, Py##x_to##_From##x_from(self->frame->x_key))
+		SET_VALUE(#x_key, Py##x_to##_From##x_from(frame->x_key))
 
 	SET_NUMBER(width, Long, Long);
 	SET_NUMBER(height, Long, Long);
@@ -244,7 +278,12 @@ static PyObject *_MemsinkObject_wait_frame(_MemsinkObject *self, PyObject *args,
 	SET_NUMBER(grab_ts, Double, Float);
 	SET_NUMBER(encode_begin_ts, Double, Float);
 	SET_NUMBER(encode_end_ts, Double, Float);
-	SET_VALUE("data", PyBytes_FromStringAndSize((const char*)self->frame->data, self->frame->used));
+	if (zero_copy) {
+		// Read-only view of the snapshot without the second copy
+		SET_VALUE("data", PyMemoryView_FromObject((PyObject*)self->buffer));
+	} else {
+		SET_VALUE("data", PyBytes_FromStringAndSize((const char*)frame->data, frame->used));
+	}
 
 #	undef SET_NUMBER
 #	undef SET_VALUE
@@ -252,8 +291,32 @@ static PyObject *_MemsinkObject_wait_frame(_MemsinkObject *self, PyObject *args,
 	return dict_frame;
 }
 
+static PyObject *_MemsinkObject_wait_frame(_MemsinkObject *self, PyObject *args, PyObject *kwargs) {
+	return _get_frame(self, args, kwargs, self->wait_timeout);
+}
+
+static PyObject *_MemsinkObject_get_frame(_MemsinkObject *self, PyObject *args, PyObject *kwargs) {
+	// Non-blocking variant for the event loops, it resets the fileno() readiness
+	if (self->cl != NULL) {
+		us_memsinkcl_clear_notify_fd(self->cl);
+	}
+	return _get_frame(self, args, kwargs, 0);
+}
+
+static PyObject *_MemsinkObject_fileno(_MemsinkObject *self, PyObject *Py_UNUSED(ignored)) {
+	if (self->cl == NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "Closed");
+		return NULL;
+	}
+	const int fd = us_memsinkcl_get_notify_fd(self->cl);
+	if (fd < 0) {
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+	return PyLong_FromLong(fd);
+}
+
 static PyObject *_MemsinkObject_is_opened(_MemsinkObject *self, PyObject *Py_UNUSED(ignored)) {
-	return PyBool_FromLong(self->mem != NULL && self->fd > 0);
+	return PyBool_FromLong(self->cl != NULL);
 }
 
 #define FIELD_GETTER(x_field, x_from, x_to) \
@@ -273,6 +336,8 @@ static PyMethodDef _MemsinkObject_methods[] = {
 	ADD_METHOD("__enter__", enter, METH_NOARGS),
 	ADD_METHOD("__exit__", exit, METH_VARARGS),
 	ADD_METHOD("wait_frame", wait_frame, METH_VARARGS | METH_KEYWORDS),
+	ADD_METHOD("get_frame", get_frame, METH_VARARGS | METH_KEYWORDS),
+	ADD_METHOD("fileno", fileno, METH_NOARGS),
 	ADD_METHOD("is_opened", is_opened, METH_NOARGS),
 	{},
 #	undef ADD_METHOD
@@ -302,15 +367,172 @@ static PyTypeObject _MemsinkType = {
 	.tp_getset		= _MemsinkObject_getsets,
 };
 
+static int _parse_frame(PyObject *dict_frame, us_frame_s *frame, Py_buffer *data) {
+	// Takes the frame dict from wait_frame(), the data is not copied
+	if (!PyDict_Check(dict_frame)) {
+		PyErr_SetString(PyExc_TypeError, "The frame must be a dict returned by wait_frame()");
+		return -1;
+	}
+	memset(frame, 0, sizeof(us_frame_s));
+
+#	define GET_UINT(x_key) { \
+			PyObject *m_tmp = PyDict_GetItemString(dict_frame, #x_key); \
+			if (m_tmp == NULL) { \
+				PyErr_SetString(PyExc_KeyError, "The frame has no " #x_key); \
+				return -1; \
+			} \
+			const unsigned long m_value = PyLong_AsUnsignedLong(m_tmp); \
+			if (PyErr_Occurred()) { \
+				return -1; \
+			} \
+			frame->x_key = m_value; \
+		}
+	GET_UINT(width);
+	GET_UINT(height);
+	GET_UINT(format);
+	GET_UINT(stride);
+#	undef GET_UINT
+
+	PyObject *obj = PyDict_GetItemString(dict_frame, "data");
+	if (obj == NULL) {
+		PyErr_SetString(PyExc_KeyError, "The frame has no data");
+		return -1;
+	}
+	if (PyObject_GetBuffer(obj, data, PyBUF_SIMPLE) < 0) {
+		return -1;
+	}
+	frame->data = data->buf;
+	frame->used = data->len;
+	return 0;
+}
+
+static int _get_out_buffer(PyObject *obj, Py_buffer *out, uz size) {
+	if (PyObject_GetBuffer(obj, out, PyBUF_WRITABLE) < 0) {
+		return -1;
+	}
+	if ((uz)out->len < size) {
+		PyErr_Format(PyExc_ValueError, "The output buffer is too small: %zd < %zu", out->len, size);
+		PyBuffer_Release(out);
+		return -1;
+	}
+	return 0;
+}
+
+static PyObject *_convert(PyObject *args, PyObject *kwargs, uint channels) {
+	PyObject *dict_frame;
+	PyObject *obj_out;
+	static char *kws[] = {"frame", "out", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", kws, &dict_frame, &obj_out)) {
+		return NULL;
+	}
+
+	us_frame_s frame;
+	Py_buffer data;
+	if (_parse_frame(dict_frame, &frame, &data) < 0) {
+		return NULL;
+	}
+	Py_buffer out;
+	if (_get_out_buffer(obj_out, &out, (uz)frame.width * frame.height * channels) < 0) {
+		PyBuffer_Release(&data);
+		return NULL;
+	}
+
+	int retval;
+	Py_BEGIN_ALLOW_THREADS
+	if (channels == 3) {
+		retval = us_convert_to_rgb24(&frame, out.buf, frame.width * 3);
+	} else {
+		retval = us_convert_to_grey(&frame, out.buf, frame.width);
+	}
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&out);
+	PyBuffer_Release(&data);
+	if (retval < 0) {
+		PyErr_SetString(PyExc_ValueError, "Unsupported frame format or truncated frame data");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *_to_rgb(PyObject *Py_UNUSED(self), PyObject *args, PyObject *kwargs) {
+	return _convert(args, kwargs, 3);
+}
+
+static PyObject *_to_gray(PyObject *Py_UNUSED(self), PyObject *args, PyObject *kwargs) {
+	return _convert(args, kwargs, 1);
+}
+
+static PyObject *_resize(PyObject *Py_UNUSED(self), PyObject *args, PyObject *kwargs) {
+	PyObject *obj_src;
+	uint src_width;
+	uint src_height;
+	PyObject *obj_out;
+	uint width;
+	uint height;
+	uint channels = 3;
+	static char *kws[] = {"src", "src_width", "src_height", "out", "width", "height", "channels", NULL};
+	if (!PyArg_ParseTupleAndKeywords(
+		args, kwargs, "OIIOII|I", kws,
+		&obj_src, &src_width, &src_height, &obj_out, &width, &height, &channels)) {
+		return NULL;
+	}
+	if (channels < 1 || channels > 4) {
+		PyErr_SetString(PyExc_ValueError, "channels must be 1..4");
+		return NULL;
+	}
+
+	Py_buffer src;
+	if (PyObject_GetBuffer(obj_src, &src, PyBUF_SIMPLE) < 0) {
+		return NULL;
+	}
+	if ((uz)src.len < (uz)src_width * src_height * channels) {
+		PyErr_Format(PyExc_ValueError, "The source buffer is too small: %zd < %zu",
+			src.len, (uz)src_width * src_height * channels);
+		PyBuffer_Release(&src);
+		return NULL;
+	}
+	Py_buffer out;
+	if (_get_out_buffer(obj_out, &out, (uz)width * height * channels) < 0) {
+		PyBuffer_Release(&src);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	us_convert_resize(
+		src.buf, src_width, src_height, src_width * channels,
+		out.buf, width, height, width * channels,
+		channels);
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&out);
+	PyBuffer_Release(&src);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef _Module_methods[] = {
+#	define ADD_FUNCTION(x_name, x_func) \
+		{.ml_name = x_name, .ml_meth = (PyCFunction)x_func, .ml_flags = (METH_VARARGS | METH_KEYWORDS)}
+	ADD_FUNCTION("to_rgb", _to_rgb),
+	ADD_FUNCTION("to_gray", _to_gray),
+	ADD_FUNCTION("resize", _resize),
+	{},
+#	undef ADD_FUNCTION
+};
+
 static PyModuleDef _Module = {
 	PyModuleDef_HEAD_INIT,
 	.m_name = "ustreamer",
 	.m_size = -1,
+	.m_methods = _Module_methods,
 };
 
 PyMODINIT_FUNC PyInit_ustreamer(void) {
 	PyObject *module = NULL;
 
+	if (PyType_Ready(&_FrameBufferType) < 0) {
+		goto error;
+	}
 	if (PyType_Ready(&_MemsinkType) < 0) {
 		goto error;
 	}
@@ -0,0 +1,357 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <assert.h>
+
+#include <linux/videodev2.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/array.h"
+#include "../libs/frame.h"
+#include "../libs/convert.h"
+
+
+// Checks every kernel set supported by the CPU against the generic one
+// on the odd sizes and the padded strides, and then measures them
+// on the full frames. The YUV->RGB kernels may differ by 1.
+
+static const char *const _KERNELS[] = {"generic", "SSE4.1", "AVX2", "NEON"};
+
+static const uint _FORMATS[] = {
+	V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_YVYU, V4L2_PIX_FMT_UYVY,
+	V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV24,
+	V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_RGB565, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_BGR24,
+};
+
+static const us_convert_layout_e _LAYOUTS[] = {US_CONVERT_RGB24, US_CONVERT_BGR24, US_CONVERT_XRGB32};
+
+enum _OPT_VALUES {
+	_O_WIDTH = 'w',
+	_O_HEIGHT = 'h',
+	_O_ITERATIONS = 'i',
+	_O_CHECK_ONLY = 'c',
+	_O_SEED = 's',
+};
+
+static const struct option _LONG_OPTS[] = {
+	{"width",		required_argument,	NULL,	_O_WIDTH},
+	{"height",		required_argument,	NULL,	_O_HEIGHT},
+	{"iterations",	required_argument,	NULL,	_O_ITERATIONS},
+	{"check-only",	no_argument,		NULL,	_O_CHECK_ONLY},
+	{"seed",		required_argument,	NULL,	_O_SEED},
+	{NULL, 0, NULL, 0},
+};
+
+
+static bool _is_yuv(uint format);
+static uint _get_line(uint format, uint width);
+static void _fill_frame(us_frame_s *frame, uint format, uint width, uint height, uint padding);
+
+static uint _check_kernels(const char *name, uint seed);
+static uint _check_packed(const char *name, const us_frame_s *frame, us_convert_layout_e layout);
+static uint _check_planes(const char *name, const us_frame_s *frame);
+static uint _check_resize(const char *name, uint width, uint height, uint dest_width, uint dest_height, uint channels);
+static uint _compare(
+	const char *name, const char *what, const us_frame_s *frame,
+	const u8 *expected, const u8 *got, uint stride, uint row_size, uint height, uint tolerance);
+
+static void _bench_kernels(const char *name, uint width, uint height, uint iterations);
+
+
+int main(int argc, char *argv[]) {
+	uint width = 1920;
+	uint height = 1080;
+	uint iterations = 100;
+	bool check_only = false;
+	uint seed = 1;
+
+	int ch;
+	while ((ch = getopt_long(argc, argv, "w:h:i:cs:", _LONG_OPTS, NULL)) >= 0) {
+		switch (ch) {
+			case _O_WIDTH: width = strtoul(optarg, NULL, 10); break;
+			case _O_HEIGHT: height = strtoul(optarg, NULL, 10); break;
+			case _O_ITERATIONS: iterations = strtoul(optarg, NULL, 10); break;
+			case _O_CHECK_ONLY: check_only = true; break;
+			case _O_SEED: seed = strtoul(optarg, NULL, 10); break;
+			default:
+				printf("Usage: %s [--width 1920] [--height 1080] [--iterations 100] [--seed 1] [--check-only]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (width == 0 || height == 0 || iterations == 0) {
+		printf("Invalid frame size or iterations\n");
+		return 1;
+	}
+
+	printf("Selected kernels: %s\n", us_convert_get_kernels_name());
+
+	uint errors = 0;
+	for (uint index = 1; index < US_ARRAY_LEN(_KERNELS); ++index) {
+		if (us_convert_set_kernels(_KERNELS[index]) < 0) {
+			printf("%-8s skipped, not supported\n", _KERNELS[index]);
+			continue;
+		}
+		const uint kernel_errors = _check_kernels(_KERNELS[index], seed);
+		printf("%-8s %s\n", _KERNELS[index], (kernel_errors == 0 ? "OK" : "FAILED"));
+		errors += kernel_errors;
+	}
+
+	if (!check_only) {
+		for (uint index = 0; index < US_ARRAY_LEN(_KERNELS); ++index) {
+			if (us_convert_set_kernels(_KERNELS[index]) == 0) {
+				_bench_kernels(_KERNELS[index], width, height, iterations);
+			}
+		}
+	}
+	return (errors > 0 ? 1 : 0);
+}
+
+static bool _is_yuv(uint format) {
+	switch (format) {
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_RGB565:
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			return false;
+		default: break;
+	}
+	return true;
+}
+
+static uint _get_line(uint format, uint width) {
+	// The minimal stride, see _get_planes() in libs/convert.c
+	switch (format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+			return (width + 1) / 2 * 4;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			return (width + 1) / 2 * 2;
+		case V4L2_PIX_FMT_RGB565: return width * 2;
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			return width * 3;
+		default: break;
+	}
+	return width;
+}
+
+static void _fill_frame(us_frame_s *frame, uint format, uint width, uint height, uint padding) {
+	// Zero padding means the implicit stride
+	const uint stride = _get_line(format, width) + padding;
+	uz size = (uz)stride * height;
+	switch (format) {
+		case V4L2_PIX_FMT_NV12: size += (uz)stride * ((height + 1) / 2); break;
+		case V4L2_PIX_FMT_NV16: size *= 2; break;
+		case V4L2_PIX_FMT_NV24: size *= 3; break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			size += (uz)(stride / 2) * ((height + 1) / 2) * 2;
+			break;
+		default: break;
+	}
+
+	us_frame_realloc_data(frame, size);
+	for (uz index = 0; index < size; ++index) {
+		// Both the full range and the saturation edges
+		const uint value = rand();
+		frame->data[index] = ((value & 0x700) == 0 ? ((value & 1) ? 0xFF : 0) : value & 0xFF);
+	}
+	frame->used = size;
+	frame->width = width;
+	frame->height = height;
+	frame->format = format;
+	frame->stride = (padding > 0 ? stride : 0);
+}
+
+static uint _check_kernels(const char *name, uint seed) {
+	srand(seed);
+	us_frame_s *const frame = us_frame_init();
+	uint errors = 0;
+
+	for (uint index = 0; index < US_ARRAY_LEN(_FORMATS); ++index) {
+		const uint format = _FORMATS[index];
+		for (uint width = 1; width <= 130; width += (width < 40 ? 1 : 13)) {
+			for (uint pass = 0; pass < 3; ++pass) {
+				// No padding, the odd one and the random one
+				const uint padding = (pass == 0 ? 0 : (pass == 1 ? 1 : 1 + rand() % 67));
+				_fill_frame(frame, format, width, 1 + rand() % 5, padding);
+				for (uint layout = 0; layout < US_ARRAY_LEN(_LAYOUTS); ++layout) {
+					errors += _check_packed(name, frame, _LAYOUTS[layout]);
+				}
+				errors += _check_planes(name, frame);
+			}
+		}
+	}
+
+	for (uint channels = 1; channels <= 4; ++channels) {
+		for (uint pass = 0; pass < 20; ++pass) {
+			errors += _check_resize(name,
+				1 + rand() % 100, 1 + rand() % 50,
+				1 + rand() % 100, 1 + rand() % 50, channels);
+		}
+	}
+
+	us_frame_destroy(frame);
+	return errors;
+}
+
+static uint _check_packed(const char *name, const us_frame_s *frame, us_convert_layout_e layout) {
+	const uint bpp = (layout == US_CONVERT_XRGB32 ? 4 : 3);
+	const uint row_size = frame->width * bpp;
+	const uint stride = row_size + 5; // The output has its own padding
+	const uz size = (uz)stride * frame->height;
+	u8 *expected;
+	u8 *got;
+	US_CALLOC(expected, size);
+	US_CALLOC(got, size);
+
+	assert(!us_convert_set_kernels("generic"));
+	assert(!us_convert_to_packed(frame, layout, expected, stride, 0, 0));
+	assert(!us_convert_set_kernels(name));
+	assert(!us_convert_to_packed(frame, layout, got, stride, 0, 0));
+
+	const char *const what = (layout == US_CONVERT_RGB24 ? "RGB24" : (layout == US_CONVERT_BGR24 ? "BGR24" : "XRGB32"));
+	const uint errors = _compare(name, what, frame, expected, got, stride, row_size, frame->height, (_is_yuv(frame->format) ? 1 : 0));
+	free(expected);
+	free(got);
+	return errors;
+}
+
+static uint _check_planes(const char *name, const us_frame_s *frame) {
+	// The unpacking kernels are used for GREY and NV12, they must be exact
+	const uint width = frame->width;
+	const uint height = frame->height;
+	const uint y_stride = width + 3;
+	const uint uv_stride = (width + 1) / 2 * 2 + 3;
+	const uz size = (uz)y_stride * height + (uz)uv_stride * ((height + 1) / 2);
+	u8 *expected;
+	u8 *got;
+	US_CALLOC(expected, size * 2);
+	US_CALLOC(got, size * 2);
+
+	assert(!us_convert_set_kernels("generic"));
+	assert(!us_convert_to_grey(frame, expected, y_stride));
+	assert(!us_convert_to_nv12(frame, expected + size, y_stride, expected + size + (uz)y_stride * height, uv_stride));
+	assert(!us_convert_set_kernels(name));
+	assert(!us_convert_to_grey(frame, got, y_stride));
+	assert(!us_convert_to_nv12(frame, got + size, y_stride, got + size + (uz)y_stride * height, uv_stride));
+
+	uint errors = _compare(name, "GREY", frame, expected, got, y_stride, width, height, 0);
+	errors += _compare(name, "NV12", frame, expected + size, got + size, y_stride, width, height, 0);
+	errors += _compare(name, "NV12 UV", frame,
+		expected + size + (uz)y_stride * height, got + size + (uz)y_stride * height,
+		uv_stride, (width + 1) / 2 * 2, (height + 1) / 2, 0);
+	free(expected);
+	free(got);
+	return errors;
+}
+
+static uint _check_resize(const char *name, uint width, uint height, uint dest_width, uint dest_height, uint channels) {
+	const uint stride = width * channels + 7;
+	const uint dest_stride = dest_width * channels + 3;
+	u8 *src;
+	u8 *expected;
+	u8 *got;
+	US_CALLOC(src, (uz)stride * height);
+	US_CALLOC(expected, (uz)dest_stride * dest_height);
+	US_CALLOC(got, (uz)dest_stride * dest_height);
+	for (uz index = 0; index < (uz)stride * height; ++index) {
+		src[index] = rand();
+	}
+
+	assert(!us_convert_set_kernels("generic"));
+	us_convert_resize(src, width, height, stride, expected, dest_width, dest_height, dest_stride, channels);
+	assert(!us_convert_set_kernels(name));
+	us_convert_resize(src, width, height, stride, got, dest_width, dest_height, dest_stride, channels);
+
+	const us_frame_s frame = {.width = width, .height = height, .format = V4L2_PIX_FMT_GREY, .stride = stride};
+	char what[32];
+	US_SNPRINTF(what, 32, "resize %ux%u x%u", dest_width, dest_height, channels);
+	const uint errors = _compare(name, what, &frame, expected, got, dest_stride, dest_width * channels, dest_height, 0);
+	free(src);
+	free(expected);
+	free(got);
+	return errors;
+}
+
+static uint _compare(
+	const char *name, const char *what, const us_frame_s *frame,
+	const u8 *expected, const u8 *got, uint stride, uint row_size, uint height, uint tolerance) {
+
+	for (uint y = 0; y < height; ++y) {
+		for (uint x = 0; x < row_size; ++x) {
+			const int diff = (int)got[(uz)y * stride + x] - (int)expected[(uz)y * stride + x];
+			if (abs(diff) > (int)tolerance) {
+				char fourcc_str[8];
+				printf("%-8s %s mismatch: src=%s %ux%u stride=%u; byte %u of row %u: expected=%u, got=%u\n",
+					name, what, us_fourcc_to_string(frame->format, fourcc_str, 8),
+					frame->width, frame->height, frame->stride, x, y,
+					expected[(uz)y * stride + x], got[(uz)y * stride + x]);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void _bench_kernels(const char *name, uint width, uint height, uint iterations) {
+	srand(1);
+	us_frame_s *const frame = us_frame_init();
+	const uint dest_stride = width * 4;
+	u8 *dest;
+	u8 *resized;
+	US_CALLOC(dest, (uz)dest_stride * height);
+	US_CALLOC(resized, (uz)dest_stride * height);
+
+	printf("%-8s %ux%u to XRGB32, ms per frame:", name, width, height);
+	for (uint index = 0; index < US_ARRAY_LEN(_FORMATS); ++index) {
+		_fill_frame(frame, _FORMATS[index], width, height, 0);
+		const ldf begin_ts = us_get_now_monotonic();
+		for (uint iteration = 0; iteration < iterations; ++iteration) {
+			assert(!us_convert_to_packed(frame, US_CONVERT_XRGB32, dest, dest_stride, 0, 0));
+		}
+		char fourcc_str[8];
+		printf(" %s=%.2Lf", us_fourcc_to_string(_FORMATS[index], fourcc_str, 8),
+			(us_get_now_monotonic() - begin_ts) * 1000 / iterations);
+	}
+
+	// The downscale of the DRM output
+	const ldf begin_ts = us_get_now_monotonic();
+	for (uint iteration = 0; iteration < iterations; ++iteration) {
+		us_convert_resize(dest, width, height, dest_stride, resized, width * 2 / 3, height * 2 / 3, dest_stride, 4);
+	}
+	printf(" resize=%.2Lf\n", (us_get_now_monotonic() - begin_ts) * 1000 / iterations);
+
+	free(dest);
+	free(resized);
+	us_frame_destroy(frame);
+}
@@ -0,0 +1,273 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "bindump.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+
+#include "writer.h"
+
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#	error The binary dump format is little-endian
+#endif
+
+#define _HEADER_MAGIC	"uStrDump"
+#define _RECORD_MAGIC	"FRME"
+#define _FOOTER_MAGIC	"uStrIndx"
+
+
+static void _output_write(us_output_bindump_s *output, const void *data, uz size);
+static bool _reader_load_index(us_bindump_reader_s *reader);
+static void _reader_rebuild_index(us_bindump_reader_s *reader);
+static const us_bindump_record_s *_reader_get_record(const us_bindump_reader_s *reader, u64 offset);
+
+
+us_output_bindump_s *us_output_bindump_init(const char *path, uint queue, bool direct) {
+	if (strcmp(path, "-")) {
+		// The writer opens the file in its own thread, so check it here to fail early
+		const int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			US_LOG_PERROR("Can't open output file");
+			return NULL;
+		}
+		close(fd);
+	}
+
+	us_output_bindump_s *output;
+	US_CALLOC(output, 1);
+	US_LOG_INFO("Using binary output: %s", (strcmp(path, "-") ? path : "<stdout>"));
+	output->writer = us_writer_init(queue, direct, (strcmp(path, "-") ? 1 : 0));
+	us_writer_open(output->writer, path);
+
+	us_bindump_header_s header = {0};
+	memcpy(header.magic, _HEADER_MAGIC, 8);
+	header.version = US_BINDUMP_VERSION;
+	header.record_size = sizeof(us_bindump_record_s);
+	_output_write(output, &header, sizeof(header));
+	return output;
+}
+
+void us_output_bindump_write(void *v_output, const us_frame_s *frame) {
+	us_output_bindump_s *const output = v_output;
+
+	if (output->count == output->allocated) {
+		output->allocated = US_MAX(output->allocated * 2, (uz)1024);
+		US_REALLOC(output->index, output->allocated);
+	}
+	output->index[output->count] = (us_bindump_index_s){
+		.offset = output->offset,
+		.grab_ts = frame->grab_ts,
+		.key = frame->key,
+	};
+	++output->count;
+
+	us_bindump_record_s record = {
+		.size = frame->used,
+		.width = frame->width,
+		.height = frame->height,
+		.format = frame->format,
+		.stride = frame->stride,
+		.online = frame->online,
+		.key = frame->key,
+		.gop = frame->gop,
+		.grab_ts = frame->grab_ts,
+		.encode_begin_ts = frame->encode_begin_ts,
+		.encode_end_ts = frame->encode_end_ts,
+	};
+	memcpy(record.magic, _RECORD_MAGIC, 4);
+	_output_write(output, &record, sizeof(record));
+	_output_write(output, frame->data, frame->used);
+}
+
+void us_output_bindump_destroy(void *v_output) {
+	us_output_bindump_s *const output = v_output;
+
+	us_bindump_footer_s footer = {0};
+	memcpy(footer.magic, _FOOTER_MAGIC, 8);
+	footer.offset = output->offset;
+	footer.count = output->count;
+	_output_write(output, output->index, sizeof(us_bindump_index_s) * output->count);
+	_output_write(output, &footer, sizeof(footer));
+
+	us_writer_destroy(output->writer);
+	US_DELETE(output->index, free);
+	free(output);
+}
+
+us_bindump_reader_s *us_bindump_reader_init(const char *path) {
+	us_bindump_reader_s *reader;
+	US_CALLOC(reader, 1);
+	reader->path = us_strdup(path);
+	reader->data = MAP_FAILED;
+
+	if ((reader->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		US_LOG_PERROR("Can't open binary dump %s", path);
+		goto error;
+	}
+	struct stat st;
+	if (fstat(reader->fd, &st) < 0) {
+		US_LOG_PERROR("Can't stat binary dump %s", path);
+		goto error;
+	}
+	reader->size = st.st_size;
+	if (reader->size < sizeof(us_bindump_header_s)) {
+		US_LOG_ERROR("Invalid binary dump %s: too short", path);
+		goto error;
+	}
+	if ((reader->data = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0)) == MAP_FAILED) {
+		US_LOG_PERROR("Can't mmap binary dump %s", path);
+		goto error;
+	}
+
+	const us_bindump_header_s *const header = (const us_bindump_header_s*)reader->data;
+	if (
+		memcmp(header->magic, _HEADER_MAGIC, 8)
+		|| header->version != US_BINDUMP_VERSION
+		|| header->record_size != sizeof(us_bindump_record_s)
+	) {
+		US_LOG_ERROR("Invalid binary dump %s: unsupported header", path);
+		goto error;
+	}
+
+	if (!_reader_load_index(reader)) {
+		US_LOG_INFO("Binary dump %s has no index, scanning records ...", path);
+		_reader_rebuild_index(reader);
+		reader->index_rebuilt = true;
+	}
+	US_LOG_INFO("Using binary dump %s: frames=%zu", path, reader->count);
+	return reader;
+
+	error:
+		us_bindump_reader_destroy(reader);
+		return NULL;
+}
+
+void us_bindump_reader_destroy(us_bindump_reader_s *reader) {
+	if (reader->index_rebuilt) {
+		free(reader->index);
+	}
+	if (reader->data != MAP_FAILED) {
+		munmap((void*)reader->data, reader->size);
+	}
+	US_CLOSE_FD(reader->fd);
+	free(reader->path);
+	free(reader);
+}
+
+int us_bindump_reader_get(const us_bindump_reader_s *reader, uz number, us_frame_s *frame) {
+	if (number >= reader->count) {
+		return -1;
+	}
+	const us_bindump_record_s *const record = _reader_get_record(reader, reader->index[number].offset);
+	if (record == NULL) {
+		US_LOG_ERROR("Invalid binary dump %s: broken record %zu", reader->path, number);
+		return -1;
+	}
+	frame->data = (u8*)(record + 1);
+	frame->used = record->size;
+	frame->allocated = 0;
+	frame->dma_fd = -1;
+	frame->width = record->width;
+	frame->height = record->height;
+	frame->format = record->format;
+	frame->stride = record->stride;
+	frame->online = record->online;
+	frame->key = record->key;
+	frame->gop = record->gop;
+	frame->grab_ts = record->grab_ts;
+	frame->encode_begin_ts = record->encode_begin_ts;
+	frame->encode_end_ts = record->encode_end_ts;
+	return 0;
+}
+
+static void _output_write(us_output_bindump_s *output, const void *data, uz size) {
+	us_writer_write(output->writer, data, size);
+	output->offset += size;
+}
+
+static bool _reader_load_index(us_bindump_reader_s *reader) {
+	if (reader->size < sizeof(us_bindump_header_s) + sizeof(us_bindump_footer_s)) {
+		return false;
+	}
+	const us_bindump_footer_s *const footer = (const us_bindump_footer_s*)(
+		reader->data + reader->size - sizeof(us_bindump_footer_s));
+	if (memcmp(footer->magic, _FOOTER_MAGIC, 8)) {
+		return false;
+	}
+	const uz index_size = reader->size - sizeof(us_bindump_footer_s) - footer->offset;
+	if (footer->offset > reader->size || index_size != footer->count * sizeof(us_bindump_index_s)) {
+		return false;
+	}
+	// The mapping is page-aligned and the index is not, but all of our platforms
+	// handle the unaligned access to the packed struct.
+	reader->index = (us_bindump_index_s*)(reader->data + footer->offset);
+	reader->count = footer->count;
+	return true;
+}
+
+static void _reader_rebuild_index(us_bindump_reader_s *reader) {
+	uz allocated = 0;
+	u64 offset = sizeof(us_bindump_header_s);
+	const us_bindump_record_s *record;
+	while ((record = _reader_get_record(reader, offset)) != NULL) {
+		if (reader->count == allocated) {
+			allocated = US_MAX(allocated * 2, (uz)1024);
+			US_REALLOC(reader->index, allocated);
+		}
+		reader->index[reader->count] = (us_bindump_index_s){
+			.offset = offset,
+			.grab_ts = record->grab_ts,
+			.key = record->key,
+		};
+		++reader->count;
+		offset += sizeof(us_bindump_record_s) + record->size;
+	}
+	// The last record may be cut by the crash, it's just ignored
+}
+
+static const us_bindump_record_s *_reader_get_record(const us_bindump_reader_s *reader, u64 offset) {
+	if (offset + sizeof(us_bindump_record_s) > reader->size) {
+		return NULL;
+	}
+	const us_bindump_record_s *const record = (const us_bindump_record_s*)(reader->data + offset);
+	if (
+		memcmp(record->magic, _RECORD_MAGIC, 4)
+		|| offset + sizeof(us_bindump_record_s) + record->size > reader->size
+	) {
+		return NULL;
+	}
+	return record;
+}
@@ -0,0 +1,108 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+#include "writer.h"
+
+
+// A binary dump is a sequence of the length-prefixed frames with the full
+// metadata and a trailing index of the frames offsets. All the numbers
+// are little-endian, the timestamps are IEEE 754 doubles:
+//
+//   header: "uStrDump", u32 version, u32 record header size
+//   record: u32 "FRME", u32 data size, u32 width, u32 height, u32 format,
+//           u32 stride, u8 online, u8 key, u16 reserved, u32 gop,
+//           f64 grab_ts, f64 encode_begin_ts, f64 encode_end_ts, data
+//   index:  (u64 record offset, f64 grab_ts, u32 key, u32 reserved) * count
+//   footer: "uStrIndx", u64 index offset, u64 count
+//
+// The index is written on close. If the dump was interrupted, the reader
+// rebuilds it by scanning the records.
+
+#define US_BINDUMP_VERSION	1
+
+typedef struct __attribute__((packed)) {
+	char	magic[8];
+	u32		version;
+	u32		record_size;
+} us_bindump_header_s;
+
+typedef struct __attribute__((packed)) {
+	char	magic[4];
+	u32		size;
+	u32		width;
+	u32		height;
+	u32		format;
+	u32		stride;
+	u8		online;
+	u8		key;
+	u16		reserved;
+	u32		gop;
+	double	grab_ts;
+	double	encode_begin_ts;
+	double	encode_end_ts;
+} us_bindump_record_s;
+
+typedef struct __attribute__((packed)) {
+	u64		offset;
+	double	grab_ts;
+	u32		key;
+	u32		reserved;
+} us_bindump_index_s;
+
+typedef struct __attribute__((packed)) {
+	char	magic[8];
+	u64		offset;
+	u64		count;
+} us_bindump_footer_s;
+
+typedef struct {
+	us_writer_s			*writer;
+	u64					offset;
+	us_bindump_index_s	*index;
+	uz					count;
+	uz					allocated;
+} us_output_bindump_s;
+
+typedef struct {
+	char				*path;
+	int					fd;
+	const u8			*data;
+	uz					size;
+	us_bindump_index_s	*index;
+	uz					count;
+	bool				index_rebuilt;
+} us_bindump_reader_s;
+
+
+us_output_bindump_s *us_output_bindump_init(const char *path, uint queue, bool direct);
+void us_output_bindump_write(void *v_output, const us_frame_s *frame);
+void us_output_bindump_destroy(void *v_output);
+
+us_bindump_reader_s *us_bindump_reader_init(const char *path);
+void us_bindump_reader_destroy(us_bindump_reader_s *reader);
+// The frame data points to the mapped file, it must not be reallocated or freed
+int us_bindump_reader_get(const us_bindump_reader_s *reader, uz number, us_frame_s *frame);
@@ -0,0 +1,340 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "bridge.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+
+#include "bindump.h"
+
+
+#define _HEADER_MAGIC	"uStrDump"
+#define _RECORD_MAGIC	"FRME"
+#define _KEY_MAGIC		"KEYR"
+#define _MAX_FRAME_SIZE	(64 * 1024 * 1024)
+#define _IO_TIMEOUT		5
+
+
+static int _socket(const char *addr, bool server);
+static void _set_io_options(int fd);
+static int _send_all(int fd, struct iovec *iov, uint iov_count);
+static int _recv_all(int fd, void *data, uz size);
+
+
+int us_bridge_connect(const char *addr) {
+	const int fd = _socket(addr, false);
+	if (fd < 0) {
+		return -1;
+	}
+	_set_io_options(fd);
+
+	us_bindump_header_s header = {0};
+	memcpy(header.magic, _HEADER_MAGIC, 8);
+	header.version = US_BINDUMP_VERSION;
+	header.record_size = sizeof(us_bindump_record_s);
+	struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+	if (_send_all(fd, &iov, 1) < 0) {
+		US_LOG_PERROR("Bridge: Can't send the header to %s", addr);
+		close(fd);
+		return -1;
+	}
+	US_LOG_INFO("Bridge: Connected to %s", addr);
+	return fd;
+}
+
+int us_bridge_listen(const char *addr) {
+	const int fd = _socket(addr, true);
+	if (fd >= 0) {
+		US_LOG_INFO("Bridge: Listening on %s", addr);
+	}
+	return fd;
+}
+
+int us_bridge_accept(int listen_fd, ldf timeout) {
+	struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+	const int ready = poll(&pfd, 1, timeout * 1000);
+	if (ready <= 0) {
+		if (ready < 0 && errno != EINTR) {
+			US_LOG_PERROR("Bridge: Can't poll the listening socket");
+		}
+		return -1;
+	}
+
+	const int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0) {
+		US_LOG_PERROR("Bridge: Can't accept the connection");
+		return -1;
+	}
+	_set_io_options(fd);
+
+	us_bindump_header_s header;
+	if (_recv_all(fd, &header, sizeof(header)) < 0) {
+		US_LOG_ERROR("Bridge: Can't receive the header");
+		goto error;
+	}
+	if (
+		memcmp(header.magic, _HEADER_MAGIC, 8)
+		|| header.version != US_BINDUMP_VERSION
+		|| header.record_size != sizeof(us_bindump_record_s)
+	) {
+		US_LOG_ERROR("Bridge: Invalid header of the stream");
+		goto error;
+	}
+	US_LOG_INFO("Bridge: Accepted the new stream");
+	return fd;
+
+	error:
+		close(fd);
+		return -1;
+}
+
+int us_bridge_send_frame(int fd, const us_frame_s *frame) {
+	const ldf now = us_get_now_monotonic();
+	us_bindump_record_s record = {
+		.size = frame->used,
+		.width = frame->width,
+		.height = frame->height,
+		.format = frame->format,
+		.stride = frame->stride,
+		.online = frame->online,
+		.key = frame->key,
+		.gop = frame->gop,
+		.grab_ts = frame->grab_ts - now,
+		.encode_begin_ts = frame->encode_begin_ts - now,
+		.encode_end_ts = frame->encode_end_ts - now,
+	};
+	memcpy(record.magic, _RECORD_MAGIC, 4);
+
+	struct iovec iov[2] = {
+		{.iov_base = &record, .iov_len = sizeof(record)},
+		{.iov_base = frame->data, .iov_len = frame->used},
+	};
+	return _send_all(fd, iov, 2);
+}
+
+int us_bridge_recv_frame(int fd, us_frame_s *frame) {
+	us_bindump_record_s record;
+	if (_recv_all(fd, &record, sizeof(record)) < 0) {
+		return -1;
+	}
+	if (memcmp(record.magic, _RECORD_MAGIC, 4) || record.size > _MAX_FRAME_SIZE) {
+		US_LOG_ERROR("Bridge: Invalid frame record in the stream");
+		return -1;
+	}
+	us_frame_realloc_data(frame, record.size);
+	if (_recv_all(fd, frame->data, record.size) < 0) {
+		return -1;
+	}
+
+	const ldf now = us_get_now_monotonic();
+	frame->used = record.size;
+	frame->width = record.width;
+	frame->height = record.height;
+	frame->format = record.format;
+	frame->stride = record.stride;
+	frame->online = record.online;
+	frame->key = record.key;
+	frame->gop = record.gop;
+	frame->grab_ts = now + record.grab_ts;
+	frame->encode_begin_ts = now + record.encode_begin_ts;
+	frame->encode_end_ts = now + record.encode_end_ts;
+	return 0;
+}
+
+int us_bridge_send_key_request(int fd) {
+	struct iovec iov = {.iov_base = _KEY_MAGIC, .iov_len = 4};
+	return _send_all(fd, &iov, 1);
+}
+
+int us_bridge_recv_key_request(int fd) {
+	// Non-blocking, returns 1 if the keyframe was requested since the last call
+	int retval = 0;
+	char msg[4];
+	while (true) {
+		const sz got = recv(fd, msg, 4, MSG_DONTWAIT | MSG_PEEK);
+		if (got < 0) {
+			return ((errno == EAGAIN || errno == EWOULDBLOCK) ? retval : -1);
+		} else if (got == 0) {
+			return -1; // Closed
+		} else if (got < 4) {
+			return retval; // Wait for the whole message
+		}
+		assert(recv(fd, msg, 4, 0) == 4);
+		if (memcmp(msg, _KEY_MAGIC, 4)) {
+			US_LOG_ERROR("Bridge: Invalid message from the receiver");
+			return -1;
+		}
+		retval = 1;
+	}
+}
+
+static int _socket(const char *addr, bool server) {
+	int fd = -1;
+	struct addrinfo *res = NULL;
+
+	if (!strncmp(addr, "unix:", 5)) {
+		const char *const path = addr + 5;
+		struct sockaddr_un un = {0};
+		if (strlen(path) > sizeof(un.sun_path) - 1) {
+			US_LOG_ERROR("Bridge: UNIX socket path is too long: %s", path);
+			return -1;
+		}
+		strncpy(un.sun_path, path, sizeof(un.sun_path) - 1);
+		un.sun_family = AF_UNIX;
+		assert((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0);
+		if (server) {
+			if (unlink(path) < 0 && errno != ENOENT) {
+				US_LOG_PERROR("Bridge: Can't remove old UNIX socket %s", path);
+				goto error;
+			}
+			if (bind(fd, (struct sockaddr*)&un, sizeof(un)) < 0) {
+				US_LOG_PERROR("Bridge: Can't bind to %s", addr);
+				goto error;
+			}
+		} else if (connect(fd, (struct sockaddr*)&un, sizeof(un)) < 0) {
+			US_LOG_PERROR("Bridge: Can't connect to %s", addr);
+			goto error;
+		}
+
+	} else {
+		const char *const colon = strrchr(addr, ':');
+		if (colon == NULL || colon[1] == '\0') {
+			US_LOG_ERROR("Bridge: Invalid address, required unix:<path> or <host>:<port>: %s", addr);
+			return -1;
+		}
+		char *const host = us_strdup(addr);
+		host[colon - addr] = '\0';
+
+		const struct addrinfo hints = {
+			.ai_family = AF_UNSPEC,
+			.ai_socktype = SOCK_STREAM,
+			.ai_flags = (server ? AI_PASSIVE : 0),
+		};
+		const int error = getaddrinfo((host[0] != '\0' ? host : NULL), colon + 1, &hints, &res);
+		free(host);
+		if (error != 0) {
+			US_LOG_ERROR("Bridge: Can't resolve %s: %s", addr, gai_strerror(error));
+			return -1;
+		}
+
+		if ((fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+			US_LOG_PERROR("Bridge: Can't create the socket");
+			goto error;
+		}
+		if (server) {
+			const int on = 1;
+			assert(!setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)));
+			if (bind(fd, res->ai_addr, res->ai_addrlen) < 0) {
+				US_LOG_PERROR("Bridge: Can't bind to %s", addr);
+				goto error;
+			}
+		} else if (connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+			US_LOG_PERROR("Bridge: Can't connect to %s", addr);
+			goto error;
+		}
+		freeaddrinfo(res);
+		res = NULL;
+	}
+
+	if (server && listen(fd, 1) < 0) {
+		US_LOG_PERROR("Bridge: Can't listen on %s", addr);
+		goto error;
+	}
+	return fd;
+
+	error:
+		if (res != NULL) {
+			freeaddrinfo(res);
+		}
+		US_CLOSE_FD(fd);
+		return -1;
+}
+
+static void _set_io_options(int fd) {
+	// The frames are sent as soon as possible, and the dead peer is detected by the timeout
+	const int on = 1;
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Fails for UNIX sockets
+	const struct timeval tv = {.tv_sec = _IO_TIMEOUT};
+	assert(!setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)));
+	assert(!setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+}
+
+static int _send_all(int fd, struct iovec *iov, uint iov_count) {
+	// The record header and the data go to the socket with a single syscall
+	while (iov_count > 0) {
+		struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iov_count};
+		sz sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		while (iov_count > 0 && (uz)sent >= iov->iov_len) {
+			sent -= iov->iov_len;
+			++iov;
+			--iov_count;
+		}
+		if (iov_count > 0) {
+			iov->iov_base = (u8*)iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+	return 0;
+}
+
+static int _recv_all(int fd, void *data, uz size) {
+	u8 *ptr = data;
+	while (size > 0) {
+		const sz got = recv(fd, ptr, size, 0);
+		if (got < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		} else if (got == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		ptr += got;
+		size -= got;
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+
+// The bridge stream is the binary dump (see bindump.h) without the index:
+// the header and the frame records. The timestamps of the records are relative
+// to the sending time, so they don't depend on the monotonic clocks of the hosts.
+// The receiver sends back the 4-byte "KEYR" messages when its clients need a keyframe.
+//
+// The address is "unix:<path>" or "<host>:<port>" for TCP, the host can be empty to listen on all interfaces.
+
+int us_bridge_connect(const char *addr);
+int us_bridge_listen(const char *addr);
+int us_bridge_accept(int listen_fd, ldf timeout);
+
+int us_bridge_send_frame(int fd, const us_frame_s *frame);
+int us_bridge_recv_frame(int fd, us_frame_s *frame);
+
+int us_bridge_send_key_request(int fd);
+int us_bridge_recv_key_request(int fd);
@@ -22,56 +22,61 @@
 
 #include "file.h"
 
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
 
-us_output_file_s *us_output_file_init(const char *path, bool json) {
+
+us_output_file_s *us_output_file_init(const char *path, bool json, uint queue, bool direct) {
 	us_output_file_s *output;
 	US_CALLOC(output, 1);
 
-	if (!strcmp(path, "-")) {
-		US_LOG_INFO("Using output: <stdout>");
-		output->fp = stdout;
-	} else {
-		US_LOG_INFO("Using output: %s", path);
-		if ((output->fp = fopen(path, "wb")) == NULL) {
+	const bool is_stdout = !strcmp(path, "-");
+	US_LOG_INFO("Using output: %s", (is_stdout ? "<stdout>" : path));
+	if (!is_stdout) {
+		// The writer opens the file in its own thread, so check it here to fail early
+		const int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0) {
 			US_LOG_PERROR("Can't open output file");
-			goto error;
+			free(output);
+			return NULL;
 		}
+		close(fd);
 	}
 
+	// The pipe readers like ffmpeg expect each frame immediately
+	output->writer = us_writer_init(queue, direct, (is_stdout ? 0 : 1));
+	us_writer_open(output->writer, path);
 	output->json = json;
 	return output;
-
-	error:
-		us_output_file_destroy(output);
-		return NULL;
 }
 
 void us_output_file_write(void *v_output, const us_frame_s *frame) {
 	us_output_file_s *output = v_output;
 	if (output->json) {
 		us_base64_encode(frame->data, frame->used, &output->base64_data, &output->base64_allocated);
-		fprintf(output->fp,
+		char head[512];
+		const int head_size = snprintf(head, 512,
 			"{\"size\": %zu, \"width\": %u, \"height\": %u,"
 			" \"format\": %u, \"stride\": %u, \"online\": %u, \"key\": %u, \"gop\": %u,"
 			" \"grab_ts\": %.3Lf, \"encode_begin_ts\": %.3Lf, \"encode_end_ts\": %.3Lf,"
-			" \"data\": \"%s\"}\n",
+			" \"data\": \"",
 			frame->used, frame->width, frame->height,
 			frame->format, frame->stride, frame->online, frame->key, frame->gop,
-			frame->grab_ts, frame->encode_begin_ts, frame->encode_end_ts,
-			output->base64_data);
+			frame->grab_ts, frame->encode_begin_ts, frame->encode_end_ts);
+		assert(head_size > 0 && head_size < 512);
+		us_writer_write(output->writer, (const u8*)head, head_size);
+		us_writer_write(output->writer, (const u8*)output->base64_data, strlen(output->base64_data));
+		us_writer_write(output->writer, (const u8*)"\"}\n", 3);
 	} else {
-		fwrite(frame->data, 1, frame->used, output->fp);
+		us_writer_write(output->writer, frame->data, frame->used);
 	}
-	fflush(output->fp);
 }
 
 void us_output_file_destroy(void *v_output) {
 	us_output_file_s *output = v_output;
+	US_DELETE(output->writer, us_writer_destroy);
 	US_DELETE(output->base64_data, free);
-	if (output->fp && output->fp != stdout) {
-		if (fclose(output->fp) < 0) {
-			US_LOG_PERROR("Can't close output file");
-		}
-	}
 	free(output);
 }
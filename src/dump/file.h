@@ -33,17 +33,19 @@
 #include "../libs/frame.h"
 #include "../libs/base64.h"
 
+#include "writer.h"
+
 
 typedef struct {
 	const char *path;
 	bool		json;
 
-	FILE		*fp;
+	us_writer_s	*writer;
 	char		*base64_data;
 	size_t		base64_allocated;
 } us_output_file_s;
 
 
-us_output_file_s *us_output_file_init(const char *path, bool json);
+us_output_file_s *us_output_file_init(const char *path, bool json, uint queue, bool direct);
 void us_output_file_write(void *v_output, const us_frame_s *frame);
 void us_output_file_destroy(void *v_output);
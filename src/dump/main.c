@@ -23,14 +23,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <strings.h>
 #include <unistd.h>
 #include <limits.h>
 #include <float.h>
 #include <getopt.h>
+#include <poll.h>
 #include <errno.h>
 #include <assert.h>
 
 #include "../libs/const.h"
+#include "../libs/array.h"
 #include "../libs/errors.h"
 #include "../libs/tools.h"
 #include "../libs/logging.h"
@@ -41,6 +44,9 @@
 #include "../libs/options.h"
 
 #include "file.h"
+#include "record.h"
+#include "bindump.h"
+#include "bridge.h"
 
 
 enum _OPT_VALUES {
@@ -48,9 +54,11 @@ enum _OPT_VALUES {
 	_O_SINK_TIMEOUT = 't',
 	_O_OUTPUT = 'o',
 	_O_OUTPUT_JSON = 'j',
+	_O_OUTPUT_FORMAT = 'f',
 	_O_COUNT = 'c',
 	_O_INTERVAL = 'i',
 	_O_KEY_REQUIRED = 'k',
+	_O_REPLAY = 'r',
 
 	_O_HELP = 'h',
 	_O_VERSION = 'v',
@@ -61,6 +69,15 @@ enum _OPT_VALUES {
 	_O_DEBUG,
 	_O_FORCE_LOG_COLORS,
 	_O_NO_LOG_COLORS,
+
+	_O_SEGMENT,
+	_O_SEGMENT_KEEP,
+	_O_OUTPUT_QUEUE,
+	_O_OUTPUT_DIRECT,
+	_O_REPLAY_SPEED,
+	_O_REPLAY_LOOP,
+	_O_BRIDGE_CONNECT,
+	_O_BRIDGE_LISTEN,
 };
 
 static const struct option _LONG_OPTS[] = {
@@ -68,9 +85,19 @@ static const struct option _LONG_OPTS[] = {
 	{"sink-timeout",		required_argument,	NULL,	_O_SINK_TIMEOUT},
 	{"output",				required_argument,	NULL,	_O_OUTPUT},
 	{"output-json",			no_argument,		NULL,	_O_OUTPUT_JSON},
+	{"output-format",		required_argument,	NULL,	_O_OUTPUT_FORMAT},
+	{"segment",				required_argument,	NULL,	_O_SEGMENT},
+	{"segment-keep",		required_argument,	NULL,	_O_SEGMENT_KEEP},
+	{"output-queue",		required_argument,	NULL,	_O_OUTPUT_QUEUE},
+	{"output-direct",		no_argument,		NULL,	_O_OUTPUT_DIRECT},
 	{"count",				required_argument,	NULL,	_O_COUNT},
 	{"interval",			required_argument,	NULL,	_O_INTERVAL},
 	{"key-required",		no_argument,		NULL,	_O_KEY_REQUIRED},
+	{"replay",				required_argument,	NULL,	_O_REPLAY},
+	{"replay-speed",		required_argument,	NULL,	_O_REPLAY_SPEED},
+	{"replay-loop",			no_argument,		NULL,	_O_REPLAY_LOOP},
+	{"bridge-connect",		required_argument,	NULL,	_O_BRIDGE_CONNECT},
+	{"bridge-listen",		required_argument,	NULL,	_O_BRIDGE_LISTEN},
 
 	{"log-level",			required_argument,	NULL,	_O_LOG_LEVEL},
 	{"perf",				no_argument,		NULL,	_O_PERF},
@@ -86,6 +113,19 @@ static const struct option _LONG_OPTS[] = {
 };
 
 
+typedef enum {
+	_FORMAT_RAW,
+	_FORMAT_JSON,
+	_FORMAT_MP4,
+	_FORMAT_MKV,
+	_FORMAT_BIN,
+} _format_e;
+
+static const char *const _FORMATS_STR[] = {"RAW", "JSON", "MP4", "MKV", "BIN"};
+
+#define _MAX_SINKS 16
+
+
 volatile bool _g_stop = false;
 
 
@@ -95,15 +135,42 @@ typedef struct {
 	void (*destroy)(void *v_output);
 } _output_context_s;
 
+typedef struct {
+	const char			*name;
+	us_memsink_s		*sink;
+	us_frame_s			*frame;
+	us_fpsi_s			*fpsi;
+	_output_context_s	ctx;
+	bool				key_required;
+	long long			count;
+	long double			last_ts;
+} _sink_context_s;
+
 
 static void _signal_handler(int signum);
 
-static int _dump_sink(
+static int _open_output(
+	_sink_context_s *sc, const char *path, _format_e format,
+	uint segment, uint segment_keep,
+	uint queue, bool direct,
+	long double epoch_ts);
+
+static int _dump_sinks(
+	_sink_context_s *scs, uint scs_count,
+	unsigned sink_timeout, long double interval);
+
+static int _replay_sink(
+	const char *sink_name, const char *replay_path,
+	long long count, long double speed, bool loop);
+
+static int _bridge_send(
 	const char *sink_name, unsigned sink_timeout,
-	long long count, long double interval,
-	bool key_required,
-	_output_context_s *ctx);
+	const char *addr, long long count);
 
+static int _bridge_receive(
+	const char *sink_name, const char *addr, long long count);
+
+static int _parse_format(const char *str);
 static void _help(FILE *fp);
 
 
@@ -111,19 +178,40 @@ int main(int argc, char *argv[]) {
 	US_LOGGING_INIT;
 	US_THREAD_RENAME("main");
 
-	const char *sink_name = NULL;
+	const char *sink_names[_MAX_SINKS] = {0};
+	uint sinks_count = 0;
 	unsigned sink_timeout = 1;
-	const char *output_path = NULL;
-	bool output_json = false;
+	const char *output_paths[_MAX_SINKS] = {0};
+	uint outputs_count = 0;
+	_format_e output_format = _FORMAT_RAW;
+	uint segment = 0;
+	uint segment_keep = 0;
+	uint output_queue = 8;
+	bool output_direct = false;
 	long long count = 0;
 	long double interval = 0;
 	bool key_required = false;
+	const char *replay_path = NULL;
+	long double replay_speed = 1;
+	bool replay_loop = false;
+	const char *bridge_connect = NULL;
+	const char *bridge_listen = NULL;
 
 #	define OPT_SET(_dest, _value) { \
 			_dest = _value; \
 			break; \
 		}
 
+#	define OPT_APPEND(_name, _dest, _dest_count) { \
+			if (_dest_count >= _MAX_SINKS) { \
+				printf("Too many options %s: max=%d\n", _name, _MAX_SINKS); \
+				return 1; \
+			} \
+			_dest[_dest_count] = optarg; \
+			++_dest_count; \
+			break; \
+		}
+
 #	define OPT_NUMBER(_name, _dest, _min, _max, _base) { \
 			errno = 0; char *_end = NULL; long long _tmp = strtoll(optarg, &_end, _base); \
 			if (errno || *_end || _tmp < _min || _tmp > _max) { \
@@ -134,6 +222,16 @@ int main(int argc, char *argv[]) {
 			break; \
 		}
 
+#	define OPT_PARSE_ENUM(_name, _dest, _func) { \
+			const int _value = _func(optarg); \
+			if (_value < 0) { \
+				printf("Unknown " _name ": %s\n", optarg); \
+				return 1; \
+			} \
+			_dest = _value; \
+			break; \
+		}
+
 #	define OPT_LDOUBLE(_name, _dest, _min, _max) { \
 			errno = 0; char *_end = NULL; long double _tmp = strtold(optarg, &_end); \
 			if (errno || *_end || _tmp < _min || _tmp > _max) { \
@@ -149,13 +247,23 @@ int main(int argc, char *argv[]) {
 
 	for (int ch; (ch = getopt_long(argc, argv, short_opts, _LONG_OPTS, NULL)) >= 0;) {
 		switch (ch) {
-			case _O_SINK:			OPT_SET(sink_name, optarg);
+			case _O_SINK:			OPT_APPEND("--sink", sink_names, sinks_count);
 			case _O_SINK_TIMEOUT:	OPT_NUMBER("--sink-timeout", sink_timeout, 1, 60, 0);
-			case _O_OUTPUT:			OPT_SET(output_path, optarg);
-			case _O_OUTPUT_JSON:	OPT_SET(output_json, true);
+			case _O_OUTPUT:			OPT_APPEND("--output", output_paths, outputs_count);
+			case _O_OUTPUT_JSON:	OPT_SET(output_format, _FORMAT_JSON);
+			case _O_OUTPUT_FORMAT:	OPT_PARSE_ENUM("output format", output_format, _parse_format);
+			case _O_SEGMENT:		OPT_NUMBER("--segment", segment, 0, 86400, 0);
+			case _O_SEGMENT_KEEP:	OPT_NUMBER("--segment-keep", segment_keep, 0, 100000, 0);
+			case _O_OUTPUT_QUEUE:	OPT_NUMBER("--output-queue", output_queue, 2, 256, 0);
+			case _O_OUTPUT_DIRECT:	OPT_SET(output_direct, true);
 			case _O_COUNT:			OPT_NUMBER("--count", count, 0, LLONG_MAX, 0);
 			case _O_INTERVAL:		OPT_LDOUBLE("--interval", interval, 0, 60);
 			case _O_KEY_REQUIRED:	OPT_SET(key_required, true);
+			case _O_REPLAY:			OPT_SET(replay_path, optarg);
+			case _O_REPLAY_SPEED:	OPT_LDOUBLE("--replay-speed", replay_speed, 0, 1000);
+			case _O_REPLAY_LOOP:	OPT_SET(replay_loop, true);
+			case _O_BRIDGE_CONNECT:	OPT_SET(bridge_connect, optarg);
+			case _O_BRIDGE_LISTEN:	OPT_SET(bridge_listen, optarg);
 
 			case _O_LOG_LEVEL:			OPT_NUMBER("--log-level", us_g_log_level, US_LOG_LEVEL_INFO, US_LOG_LEVEL_DEBUG, 0);
 			case _O_PERF:				OPT_SET(us_g_log_level, US_LOG_LEVEL_PERF);
@@ -173,28 +281,77 @@ int main(int argc, char *argv[]) {
 	}
 
 #	undef OPT_LDOUBLE
+#	undef OPT_PARSE_ENUM
 #	undef OPT_NUMBER
+#	undef OPT_APPEND
 #	undef OPT_SET
 
-	if (sink_name == NULL || sink_name[0] == '\0') {
+	if (sinks_count == 0 || sink_names[0][0] == '\0') {
 		puts("Missing option --sink. See --help for details.");
 		return 1;
 	}
+	if (outputs_count > 0 && outputs_count != sinks_count) {
+		puts("Each --sink requires its own --output. See --help for details.");
+		return 1;
+	}
+	if (segment > 0 && output_format != _FORMAT_MP4 && output_format != _FORMAT_MKV) {
+		puts("Option --segment requires --output-format=mp4 or mkv. See --help for details.");
+		return 1;
+	}
 
-	_output_context_s ctx = {0};
+	if (replay_path != NULL && replay_path[0] != '\0') {
+		if (sinks_count > 1) {
+			puts("Option --replay requires a single --sink. See --help for details.");
+			return 1;
+		}
+		us_install_signals_handler(_signal_handler, false);
+		return abs(_replay_sink(sink_names[0], replay_path, count, replay_speed, replay_loop));
+	}
 
-	if (output_path && output_path[0] != '\0') {
-		if ((ctx.v_output = (void*)us_output_file_init(output_path, output_json)) == NULL) {
+	if (bridge_connect != NULL || bridge_listen != NULL) {
+		if (sinks_count > 1 || outputs_count > 0 || (bridge_connect != NULL && bridge_listen != NULL)) {
+			puts("The bridge requires a single --sink and either --bridge-connect or --bridge-listen. See --help for details.");
 			return 1;
 		}
-		ctx.write = us_output_file_write;
-		ctx.destroy = us_output_file_destroy;
+		us_install_signals_handler(_signal_handler, false);
+		if (bridge_connect != NULL) {
+			return abs(_bridge_send(sink_names[0], sink_timeout, bridge_connect, count));
+		}
+		return abs(_bridge_receive(sink_names[0], bridge_listen, count));
+	}
+
+	// All the recordings share the same zero timestamp to be aligned with each other
+	const long double epoch_ts = us_get_now_monotonic();
+
+	_sink_context_s scs[_MAX_SINKS] = {0};
+	int retval = 1;
+
+	for (uint index = 0; index < sinks_count; ++index) {
+		_sink_context_s *const sc = &scs[index];
+		sc->name = sink_names[index];
+		sc->key_required = key_required;
+		sc->count = (count > 0 ? count : -1);
+		if (outputs_count > 0 && output_paths[index][0] != '\0') {
+			if (_open_output(
+				sc, output_paths[index], output_format,
+				segment, segment_keep,
+				output_queue, output_direct,
+				epoch_ts
+			) < 0) {
+				goto error;
+			}
+		}
 	}
 
 	us_install_signals_handler(_signal_handler, false);
-	const int retval = abs(_dump_sink(sink_name, sink_timeout, count, interval, key_required, &ctx));
-	if (ctx.v_output && ctx.destroy) {
-		ctx.destroy(ctx.v_output);
+	retval = abs(_dump_sinks(scs, sinks_count, sink_timeout, interval));
+
+error:
+	for (uint index = 0; index < sinks_count; ++index) {
+		_output_context_s *const ctx = &scs[index].ctx;
+		if (ctx->v_output && ctx->destroy) {
+			ctx->destroy(ctx->v_output);
+		}
 	}
 	return retval;
 }
@@ -207,68 +364,309 @@ static void _signal_handler(int signum) {
 	_g_stop = true;
 }
 
-static int _dump_sink(
-	const char *sink_name, unsigned sink_timeout,
-	long long count, long double interval,
-	bool key_required,
-	_output_context_s *ctx) {
+static int _open_output(
+	_sink_context_s *sc, const char *path, _format_e format,
+	uint segment, uint segment_keep,
+	uint queue, bool direct,
+	long double epoch_ts) {
+
+	_output_context_s *const ctx = &sc->ctx;
+
+	if (format == _FORMAT_MP4 || format == _FORMAT_MKV) {
+		if ((ctx->v_output = (void*)us_output_record_init(
+			path,
+			(format == _FORMAT_MP4 ? US_RECORD_MP4 : US_RECORD_MKV),
+			segment, segment_keep,
+			queue, direct,
+			epoch_ts
+		)) == NULL) {
+			return -1;
+		}
+		ctx->write = us_output_record_write;
+		ctx->destroy = us_output_record_destroy;
+		sc->key_required = true; // The recording starts from a keyframe
+	} else if (format == _FORMAT_BIN) {
+		if ((ctx->v_output = (void*)us_output_bindump_init(path, queue, direct)) == NULL) {
+			return -1;
+		}
+		ctx->write = us_output_bindump_write;
+		ctx->destroy = us_output_bindump_destroy;
+	} else {
+		if ((ctx->v_output = (void*)us_output_file_init(path, (format == _FORMAT_JSON), queue, direct)) == NULL) {
+			return -1;
+		}
+		ctx->write = us_output_file_write;
+		ctx->destroy = us_output_file_destroy;
+	}
+	return 0;
+}
 
-	int retval = -1;
+static int _dump_sinks(
+	_sink_context_s *scs, uint scs_count,
+	unsigned sink_timeout, long double interval) {
 
-	if (count == 0) {
-		count = -1;
-	}
+	// All the sinks are read in the same loop. If none of them had a new frame,
+	// it sleeps on the notification fds of the sinks which are not done yet.
+
+	int retval = -1;
 
 	const useconds_t interval_us = interval * 1000000;
 
-	us_frame_s *frame = us_frame_init();
-	us_fpsi_s *fpsi = us_fpsi_init("SINK", false);
-	us_memsink_s *sink = NULL;
+	struct pollfd *pfds;
+	US_CALLOC(pfds, scs_count);
 
-	if ((sink = us_memsink_init_opened("input", sink_name, false, 0, false, 0, sink_timeout)) == NULL) {
-		goto error;
+	for (uint index = 0; index < scs_count; ++index) {
+		_sink_context_s *const sc = &scs[index];
+		sc->frame = us_frame_init();
+		sc->fpsi = us_fpsi_init(sc->name, false);
+		if ((sc->sink = us_memsink_init_opened("input", sc->name, false, 0, false, 0, sink_timeout)) == NULL) {
+			goto error;
+		}
+		if ((pfds[index].fd = us_memsinkcl_get_notify_fd(sc->sink->client)) < 0) {
+			US_LOG_PERROR("%s-sink: Can't create the notification fd", sc->name);
+			goto error;
+		}
+		pfds[index].events = POLLIN;
 	}
 
-	long double last_ts = 0;
+	uint active = scs_count;
 
-	while (!_g_stop) {
-		bool key_requested;
-		const int got = us_memsink_client_get(sink, frame, &key_requested, key_required);
-		if (got == 0) {
-			key_required = false;
+	while (!_g_stop && active > 0) {
+		bool got_any = false;
+
+		for (uint index = 0; index < scs_count && !_g_stop; ++index) {
+			_sink_context_s *const sc = &scs[index];
+			if (sc->count == 0) {
+				pfds[index].fd = -1; // Done with this sink, poll() ignores it
+				continue;
+			}
+
+			// Clear it before reading, so a frame exposed after the check signals it again
+			us_memsinkcl_clear_notify_fd(sc->sink->client);
 
+			bool key_requested;
+			const int got = us_memsink_client_get(sc->sink, sc->frame, &key_requested, sc->key_required);
+			if (got == US_ERROR_NO_DATA) {
+				continue;
+			} else if (got < 0) {
+				goto error;
+			}
+
+			got_any = true;
+			sc->key_required = false;
+
+			const us_frame_s *const frame = sc->frame;
 			const long double now = us_get_now_monotonic();
 
 			char fourcc_str[8];
-			US_LOG_VERBOSE("Frame: %s - %ux%u -- online=%d, key=%d, kr=%d, gop=%u, latency=%.3Lf, backlog=%.3Lf, size=%zu",
+			US_LOG_VERBOSE("Frame: %s: %s - %ux%u -- online=%d, key=%d, kr=%d, gop=%u, latency=%.3Lf, backlog=%.3Lf, size=%zu",
+				sc->name,
 				us_fourcc_to_string(frame->format, fourcc_str, 8),
 				frame->width, frame->height,
 				frame->online, frame->key, key_requested, frame->gop,
-				now - frame->grab_ts, (last_ts ? now - last_ts : 0),
+				now - frame->grab_ts, (sc->last_ts ? now - sc->last_ts : 0),
 				frame->used);
-			last_ts = now;
+			sc->last_ts = now;
 
 			US_LOG_DEBUG("       stride=%u, grab_ts=%.3Lf, encode_begin_ts=%.3Lf, encode_end_ts=%.3Lf",
 				frame->stride, frame->grab_ts, frame->encode_begin_ts, frame->encode_end_ts);
 
-			us_fpsi_update(fpsi, true, NULL);
+			us_fpsi_update(sc->fpsi, true, NULL);
 
-			if (ctx->v_output != NULL) {
-				ctx->write(ctx->v_output, frame);
+			if (sc->ctx.v_output != NULL) {
+				sc->ctx.write(sc->ctx.v_output, frame);
 			}
 
-			if (count >= 0) {
-				--count;
-				if (count <= 0) {
+			if (sc->count > 0) {
+				--sc->count;
+				if (sc->count == 0) {
+					--active;
+				}
+			}
+		}
+
+		if (!got_any && active > 0 && !_g_stop) {
+			// The timeout is for _g_stop
+			if (poll(pfds, scs_count, 100) < 0 && errno != EINTR) {
+				US_LOG_PERROR("Can't wait for the sinks");
+				goto error;
+			}
+		} else if (interval_us > 0) {
+			usleep(interval_us);
+		}
+	}
+
+	retval = 0;
+
+error:
+	for (uint index = 0; index < scs_count; ++index) {
+		_sink_context_s *const sc = &scs[index];
+		US_DELETE(sc->sink, us_memsink_destroy);
+		US_DELETE(sc->fpsi, us_fpsi_destroy);
+		US_DELETE(sc->frame, us_frame_destroy);
+	}
+	free(pfds);
+	US_LOG_INFO("Bye-bye");
+	return retval;
+}
+
+static int _replay_sink(
+	const char *sink_name, const char *replay_path,
+	long long count, long double speed, bool loop) {
+
+	int retval = -1;
+
+	if (count == 0) {
+		count = -1;
+	}
+
+	us_fpsi_s *fpsi = us_fpsi_init("REPLAY", false);
+	us_bindump_reader_s *reader = NULL;
+	us_memsink_s *sink = NULL;
+
+	if ((reader = us_bindump_reader_init(replay_path)) == NULL) {
+		goto error;
+	}
+	if (reader->count == 0) {
+		US_LOG_ERROR("Nothing to replay, the binary dump is empty");
+		goto error;
+	}
+	if ((sink = us_memsink_init_opened("output", sink_name, true, 0660, true, 10, 1)) == NULL) {
+		goto error;
+	}
+
+	while (!_g_stop && count != 0) {
+		const long double begin_ts = us_get_now_monotonic();
+		long double first_ts = 0;
+
+		for (uz number = 0; number < reader->count && !_g_stop && count != 0; ++number) {
+			us_frame_s frame;
+			if (us_bindump_reader_get(reader, number, &frame) < 0) {
+				goto error;
+			}
+			if (number == 0) {
+				first_ts = frame.grab_ts;
+			}
+
+			if (speed > 0) {
+				// The slow replay may wait for a long time, so the sleep is split for _g_stop
+				const long double next_ts = begin_ts + (frame.grab_ts - first_ts) / speed;
+				long double now;
+				while (!_g_stop && next_ts > (now = us_get_now_monotonic())) {
+					usleep(US_MIN(next_ts - now, (long double)0.1) * 1000000);
+				}
+				if (_g_stop) {
 					break;
 				}
 			}
 
-			if (interval_us > 0) {
-				usleep(interval_us);
+			// The clients measure the latency from the grab time, so it should be fresh
+			const long double shift = us_get_now_monotonic() - frame.grab_ts;
+			frame.grab_ts += shift;
+			frame.encode_begin_ts += shift;
+			frame.encode_end_ts += shift;
+
+			if (us_memsink_server_put(sink, &frame, NULL) < 0) {
+				goto error;
+			}
+			us_fpsi_update(fpsi, true, NULL);
+
+			if (count > 0) {
+				--count;
+			}
+		}
+
+		if (!loop) {
+			break;
+		}
+	}
+
+	retval = 0;
+
+error:
+	US_DELETE(sink, us_memsink_destroy);
+	US_DELETE(reader, us_bindump_reader_destroy);
+	us_fpsi_destroy(fpsi);
+	US_LOG_INFO("Bye-bye");
+	return retval;
+}
+
+static int _bridge_send(
+	const char *sink_name, unsigned sink_timeout,
+	const char *addr, long long count) {
+
+	int retval = -1;
+
+	if (count == 0) {
+		count = -1;
+	}
+
+	us_frame_s *frame = us_frame_init();
+	us_fpsi_s *fpsi = us_fpsi_init("BRIDGE", false);
+	us_memsink_s *sink = NULL;
+	int fd = -1;
+
+	if ((sink = us_memsink_init_opened("input", sink_name, false, 0, false, 0, sink_timeout)) == NULL) {
+		goto error;
+	}
+
+	// The sink notifications and the keyframe requests from the receiver
+	struct pollfd pfds[2] = {{.fd = -1, .events = POLLIN}, {.fd = -1, .events = POLLIN}};
+	if ((pfds[0].fd = us_memsinkcl_get_notify_fd(sink->client)) < 0) {
+		US_LOG_PERROR("Can't create the sink notification fd");
+		goto error;
+	}
+
+	long double connect_ts = 0;
+	bool key_required = false;
+
+	while (!_g_stop && count != 0) {
+		if (fd < 0) {
+			// The sink isn't read without the connection, so the encoder can sleep
+			const long double now = us_get_now_monotonic();
+			if (connect_ts + 1 > now) {
+				usleep(100000);
+				continue;
+			}
+			connect_ts = now;
+			if ((fd = us_bridge_connect(addr)) < 0) {
+				continue;
+			}
+			key_required = true; // The new receiver has to start from a keyframe
+		}
+
+		const int key_requested = us_bridge_recv_key_request(fd);
+		if (key_requested < 0) {
+			US_LOG_ERROR("Bridge: The receiver has closed the connection");
+			US_CLOSE_FD(fd);
+			continue;
+		} else if (key_requested > 0) {
+			US_LOG_VERBOSE("Bridge: The receiver requested a keyframe");
+			key_required = true;
+		}
+
+		// Clear it before reading, so a frame exposed after the check signals it again
+		us_memsinkcl_clear_notify_fd(sink->client);
+
+		const int got = us_memsink_client_get(sink, frame, NULL, key_required);
+		if (got == 0) {
+			key_required = false;
+			if (us_bridge_send_frame(fd, frame) < 0) {
+				US_LOG_PERROR("Bridge: Can't send the frame");
+				US_CLOSE_FD(fd);
+				continue;
+			}
+			us_fpsi_update(fpsi, true, NULL);
+			if (count > 0) {
+				--count;
 			}
 		} else if (got == US_ERROR_NO_DATA) {
-			usleep(1000);
+			// The timeout is for _g_stop
+			pfds[1].fd = fd;
+			if (poll(pfds, 2, 100) < 0 && errno != EINTR) {
+				US_LOG_PERROR("Can't wait for the sink");
+				goto error;
+			}
 		} else {
 			goto error;
 		}
@@ -277,6 +675,79 @@ static int _dump_sink(
 	retval = 0;
 
 error:
+	US_CLOSE_FD(fd);
+	US_DELETE(sink, us_memsink_destroy);
+	us_fpsi_destroy(fpsi);
+	us_frame_destroy(frame);
+	US_LOG_INFO("Bye-bye");
+	return retval;
+}
+
+static int _bridge_receive(const char *sink_name, const char *addr, long long count) {
+	int retval = -1;
+
+	if (count == 0) {
+		count = -1;
+	}
+
+	us_frame_s *frame = us_frame_init();
+	us_fpsi_s *fpsi = us_fpsi_init("BRIDGE", false);
+	us_memsink_s *sink = NULL;
+	int listen_fd = -1;
+	int fd = -1;
+
+	if ((sink = us_memsink_init_opened("output", sink_name, true, 0660, true, 10, 1)) == NULL) {
+		goto error;
+	}
+	if ((listen_fd = us_bridge_listen(addr)) < 0) {
+		goto error;
+	}
+
+	long double key_ts = 0;
+
+	while (!_g_stop && count != 0) {
+		if (fd < 0) {
+			fd = us_bridge_accept(listen_fd, 1);
+			continue;
+		}
+
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		if (poll(&pfd, 1, 1000) <= 0) {
+			continue; // Check _g_stop
+		}
+		if (us_bridge_recv_frame(fd, frame) < 0) {
+			US_LOG_PERROR("Bridge: The stream is interrupted");
+			US_CLOSE_FD(fd);
+			continue;
+		}
+
+		bool key_requested;
+		if (us_memsink_server_put(sink, frame, &key_requested) < 0) {
+			goto error;
+		}
+		us_fpsi_update(fpsi, true, NULL);
+
+		const long double now = us_get_now_monotonic();
+		if (key_requested && key_ts + 1 < now) {
+			// The sender will request it from its own sink
+			key_ts = now;
+			if (us_bridge_send_key_request(fd) < 0) {
+				US_LOG_PERROR("Bridge: Can't send the keyframe request");
+				US_CLOSE_FD(fd);
+				continue;
+			}
+		}
+
+		if (count > 0) {
+			--count;
+		}
+	}
+
+	retval = 0;
+
+error:
+	US_CLOSE_FD(fd);
+	US_CLOSE_FD(listen_fd);
 	US_DELETE(sink, us_memsink_destroy);
 	us_fpsi_destroy(fpsi);
 	us_frame_destroy(frame);
@@ -284,6 +755,15 @@ error:
 	return retval;
 }
 
+static int _parse_format(const char *str) {
+	for (uint index = 0; index < US_ARRAY_LEN(_FORMATS_STR); ++index) {
+		if (!strcasecmp(str, _FORMATS_STR[index])) {
+			return index;
+		}
+	}
+	return -1;
+}
+
 static void _help(FILE *fp) {
 #	define SAY(_msg, ...) fprintf(fp, _msg "\n", ##__VA_ARGS__)
 	SAY("\nuStreamer-dump - Dump uStreamer's memory sink to file");
@@ -294,15 +774,46 @@ static void _help(FILE *fp) {
 	SAY("════════");
 	SAY("    ustreamer-dump --sink test --output - \\");
 	SAY("        | ffmpeg -use_wallclock_as_timestamps 1 -i pipe: -c:v libx264 test.mp4\n");
+	SAY("    ustreamer-dump --sink test::h264 --output-format mkv --segment 600 --segment-keep 144 \\");
+	SAY("        --output /var/lib/rec/%%Y%%m%%d-%%H%%M%%S.mkv\n");
+	SAY("    ustreamer-dump --output-format mkv \\");
+	SAY("        --sink cam::jpeg --output cam.mkv --sink cam::h264 --output cam-h264.mkv\n");
 	SAY("Sink options:");
 	SAY("═════════════");
-	SAY("    -s|--sink <name>  ──────── Memory sink ID. No default.\n");
+	SAY("    -s|--sink <name>  ──────── Memory sink ID. Can be specified up to %d times to dump several sinks", _MAX_SINKS);
+	SAY("                               in one process, the recordings share the same timeline. No default.\n");
 	SAY("    -t|--sink-timeout <sec>  ─ Timeout for the upcoming frame. Default: 1.\n");
-	SAY("    -o|--output <filename> ─── Filename to dump output to. Use '-' for stdout. Default: just consume the sink.\n");
+	SAY("    -o|--output <filename> ─── Filename to dump output to. Use '-' for stdout. With several sinks");
+	SAY("                               each --sink requires its own --output in the same order.");
+	SAY("                               Default: just consume the sink.\n");
 	SAY("    -j|--output-json  ──────── Format output as JSON. Required option --output. Default: disabled.\n");
-	SAY("    -c|--count  <N>  ───────── Limit the number of frames. Default: 0 (infinite).\n");
+	SAY("    -f|--output-format <fmt>  ─ Output format: raw, json, mp4 (fragmented, H.264 only),");
+	SAY("                                mkv (H.264 and MJPEG) or bin (binary dump with all the metadata");
+	SAY("                                for --replay). Default: raw.\n");
+	SAY("    --segment <sec>  ────────── Split the MP4/MKV recording into segments of this duration.");
+	SAY("                                The output filename is a strftime() pattern. Default: 0 (single file).\n");
+	SAY("    --segment-keep <N>  ─────── Remove the oldest segments to keep only N last ones. Default: 0 (keep all).\n");
+	SAY("    --output-queue <N>  ─────── Number of the 2 MiB output buffers in the write queue.");
+	SAY("                                The writes are asynchronous with io_uring if available. Default: 8.\n");
+	SAY("    --output-direct  ────────── Write the output file with O_DIRECT bypassing the page cache. Default: disabled.\n");
+	SAY("    -c|--count  <N>  ───────── Limit the number of frames of each sink. Default: 0 (infinite).\n");
 	SAY("    -i|--interval <sec>  ───── Delay between reading frames (float). Default: 0.\n");
 	SAY("    -k|--key-required  ─────── Request keyframe from the sink. Default: disabled.\n");
+	SAY("Replay options:");
+	SAY("═══════════════");
+	SAY("    -r|--replay <filename>  ─ Push the frames from the binary dump (--output-format=bin) to the sink");
+	SAY("                              instead of reading it. The sink is created like by uStreamer.");
+	SAY("                              Option --count limits the number of frames. Default: disabled.\n");
+	SAY("    --replay-speed <x>  ───── Replay speed relative to the original timing (float),");
+	SAY("                              0 to push the frames as fast as possible. Default: 1.\n");
+	SAY("    --replay-loop  ────────── Replay the dump in a loop. Default: disabled.\n");
+	SAY("Bridge options:");
+	SAY("═══════════════");
+	SAY("    --bridge-connect <addr>  ─ Send the frames of the sink to the remote bridge with all the metadata.");
+	SAY("                               The address is unix:<path> or <host>:<port>. Default: disabled.\n");
+	SAY("    --bridge-listen <addr>  ── Receive the frames from the remote bridge and expose them to the sink");
+	SAY("                               created like by uStreamer. The keyframe requests of its clients are");
+	SAY("                               forwarded to the sending side. Default: disabled.\n");
 	SAY("Logging options:");
 	SAY("════════════════");
 	SAY("    --log-level <N>  ──── Verbosity level of messages from 0 (info) to 3 (debug).");
@@ -0,0 +1,215 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "mkv.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <linux/videodev2.h>
+
+#include "../libs/const.h"
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/frame.h"
+
+#include "mux.h"
+
+
+// Live Matroska with a single H.264 or MJPEG track. The Segment and Clusters
+// have unknown sizes, so the file is written strictly sequentially and it can
+// be played or cut at any cluster even if the recording was interrupted.
+// A new cluster is started on each H.264 keyframe and every second of MJPEG.
+
+#define _ID_EBML				0x1A45DFA3
+#define _ID_EBML_VERSION		0x4286
+#define _ID_EBML_READ_VERSION	0x42F7
+#define _ID_EBML_MAX_ID_LENGTH	0x42F2
+#define _ID_EBML_MAX_SIZE_LENGTH 0x42F3
+#define _ID_DOC_TYPE			0x4282
+#define _ID_DOC_TYPE_VERSION	0x4287
+#define _ID_DOC_TYPE_READ_VERSION 0x4285
+#define _ID_SEGMENT				0x18538067
+#define _ID_INFO				0x1549A966
+#define _ID_TIMESTAMP_SCALE		0x2AD7B1
+#define _ID_DATE_UTC			0x4461
+#define _ID_MUXING_APP			0x4D80
+#define _ID_WRITING_APP			0x5741
+#define _ID_TRACKS				0x1654AE6B
+#define _ID_TRACK_ENTRY			0xAE
+#define _ID_TRACK_NUMBER		0xD7
+#define _ID_TRACK_UID			0x73C5
+#define _ID_TRACK_TYPE			0x83
+#define _ID_FLAG_LACING			0x9C
+#define _ID_CODEC_ID			0x86
+#define _ID_CODEC_PRIVATE		0x63A2
+#define _ID_VIDEO				0xE0
+#define _ID_PIXEL_WIDTH			0xB0
+#define _ID_PIXEL_HEIGHT		0xBA
+#define _ID_CLUSTER				0x1F43B675
+#define _ID_TIMESTAMP			0xE7
+#define _ID_SIMPLE_BLOCK		0xA3
+
+#define _UNKNOWN_SIZE			0x01FFFFFFFFFFFFFFULL
+#define _CLUSTER_MAX_MS			1000
+
+
+static void _put_id(us_mux_buf_s *buf, u32 id);
+static void _put_size(us_mux_buf_s *buf, u64 size);
+static void _put_uint(us_mux_buf_s *buf, u32 id, u64 value);
+static void _put_string(us_mux_buf_s *buf, u32 id, const char *str);
+static uz _master_begin(us_mux_buf_s *buf, u32 id);
+static void _master_end(us_mux_buf_s *buf, uz offset);
+
+
+us_mkv_s *us_mkv_init(void) {
+	us_mkv_s *mkv;
+	US_CALLOC(mkv, 1);
+	return mkv;
+}
+
+void us_mkv_destroy(us_mkv_s *mkv) {
+	free(mkv);
+}
+
+void us_mkv_begin(us_mkv_s *mkv, const us_mux_avc_s *avc, const us_frame_s *frame, ldf date, us_mux_buf_s *buf) {
+	mkv->cluster_opened = false;
+	mkv->cluster_ts = 0;
+
+	const uz ebml = _master_begin(buf, _ID_EBML);
+	_put_uint(buf, _ID_EBML_VERSION, 1);
+	_put_uint(buf, _ID_EBML_READ_VERSION, 1);
+	_put_uint(buf, _ID_EBML_MAX_ID_LENGTH, 4);
+	_put_uint(buf, _ID_EBML_MAX_SIZE_LENGTH, 8);
+	_put_string(buf, _ID_DOC_TYPE, "matroska");
+	_put_uint(buf, _ID_DOC_TYPE_VERSION, 4);
+	_put_uint(buf, _ID_DOC_TYPE_READ_VERSION, 2);
+	_master_end(buf, ebml);
+
+	_put_id(buf, _ID_SEGMENT);
+	us_mux_buf_put_be(buf, _UNKNOWN_SIZE, 8);
+
+	const uz info = _master_begin(buf, _ID_INFO);
+	_put_uint(buf, _ID_TIMESTAMP_SCALE, 1000000); // Milliseconds
+	if (date > 0) {
+		// The date of the zero timestamp, nanoseconds since 2001-01-01
+		_put_id(buf, _ID_DATE_UTC);
+		_put_size(buf, 8);
+		us_mux_buf_put_be(buf, (u64)((date - 978307200) * 1000000000), 8);
+	}
+	_put_string(buf, _ID_MUXING_APP, "uStreamer-dump " US_VERSION);
+	_put_string(buf, _ID_WRITING_APP, "uStreamer-dump " US_VERSION);
+	_master_end(buf, info);
+
+	const uz tracks = _master_begin(buf, _ID_TRACKS);
+	const uz entry = _master_begin(buf, _ID_TRACK_ENTRY);
+	_put_uint(buf, _ID_TRACK_NUMBER, 1);
+	_put_uint(buf, _ID_TRACK_UID, 1);
+	_put_uint(buf, _ID_TRACK_TYPE, 1); // Video
+	_put_uint(buf, _ID_FLAG_LACING, 0);
+	if (avc != NULL) {
+		_put_string(buf, _ID_CODEC_ID, "V_MPEG4/ISO/AVC");
+		const uz priv = _master_begin(buf, _ID_CODEC_PRIVATE);
+		us_mux_avc_write_config(avc, buf);
+		_master_end(buf, priv);
+	} else {
+		_put_string(buf, _ID_CODEC_ID, "V_MJPEG");
+	}
+	const uz video = _master_begin(buf, _ID_VIDEO);
+	_put_uint(buf, _ID_PIXEL_WIDTH, frame->width);
+	_put_uint(buf, _ID_PIXEL_HEIGHT, frame->height);
+	_master_end(buf, video);
+	_master_end(buf, entry);
+	_master_end(buf, tracks);
+}
+
+void us_mkv_write(us_mkv_s *mkv, const us_frame_s *frame, ldf pts, us_mux_buf_s *buf) {
+	const u64 ts = pts * 1000;
+	const bool h264 = (frame->format == V4L2_PIX_FMT_H264);
+	if (
+		!mkv->cluster_opened
+		|| ts < mkv->cluster_ts
+		|| (h264 && frame->key)
+		|| ts - mkv->cluster_ts >= (h264 ? 30000 : _CLUSTER_MAX_MS) // The block timestamp is s16
+	) {
+		_put_id(buf, _ID_CLUSTER);
+		us_mux_buf_put_be(buf, _UNKNOWN_SIZE, 8);
+		_put_uint(buf, _ID_TIMESTAMP, ts);
+		mkv->cluster_opened = true;
+		mkv->cluster_ts = ts;
+	}
+
+	const uz block = _master_begin(buf, _ID_SIMPLE_BLOCK);
+	us_mux_buf_put_be(buf, 0x81, 1); // Track number 1
+	us_mux_buf_put_be(buf, ts - mkv->cluster_ts, 2);
+	us_mux_buf_put_be(buf, (frame->key || !h264 ? 0x80 : 0), 1);
+	if (h264) {
+		us_mux_avc_write_sample(frame->data, frame->used, buf);
+	} else {
+		us_mux_buf_append(buf, frame->data, frame->used);
+	}
+	_master_end(buf, block);
+}
+
+static void _put_id(us_mux_buf_s *buf, u32 id) {
+	// The ID already contains the length marker
+	const uint size = (id > 0xFFFFFF ? 4 : (id > 0xFFFF ? 3 : (id > 0xFF ? 2 : 1)));
+	us_mux_buf_put_be(buf, id, size);
+}
+
+static void _put_size(us_mux_buf_s *buf, u64 size) {
+	uint len = 1;
+	while (len < 8 && size >= (1ULL << (7 * len)) - 1) {
+		++len;
+	}
+	us_mux_buf_put_be(buf, size | (1ULL << (7 * len)), len);
+}
+
+static void _put_uint(us_mux_buf_s *buf, u32 id, u64 value) {
+	uint len = 1;
+	while (len < 8 && (value >> (8 * len)) > 0) {
+		++len;
+	}
+	_put_id(buf, id);
+	_put_size(buf, len);
+	us_mux_buf_put_be(buf, value, len);
+}
+
+static void _put_string(us_mux_buf_s *buf, u32 id, const char *str) {
+	const uz len = strlen(str);
+	_put_id(buf, id);
+	_put_size(buf, len);
+	us_mux_buf_append(buf, str, len);
+}
+
+static uz _master_begin(us_mux_buf_s *buf, u32 id) {
+	// The size is always written as 8 bytes to be patched by _master_end()
+	_put_id(buf, id);
+	const uz offset = buf->used;
+	us_mux_buf_put_be(buf, 0, 8);
+	return offset;
+}
+
+static void _master_end(us_mux_buf_s *buf, uz offset) {
+	us_mux_buf_patch_be(buf, offset, (buf->used - offset - 8) | (1ULL << 56), 8);
+}
@@ -0,0 +1,41 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+#include "mux.h"
+
+
+typedef struct {
+	bool	cluster_opened;
+	u64		cluster_ts; // Milliseconds
+} us_mkv_s;
+
+
+us_mkv_s *us_mkv_init(void);
+void us_mkv_destroy(us_mkv_s *mkv);
+
+void us_mkv_begin(us_mkv_s *mkv, const us_mux_avc_s *avc, const us_frame_s *frame, ldf date, us_mux_buf_s *buf);
+void us_mkv_write(us_mkv_s *mkv, const us_frame_s *frame, ldf pts, us_mux_buf_s *buf);
@@ -0,0 +1,264 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "mp4.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/frame.h"
+
+#include "mux.h"
+
+
+// Fragmented MP4 (ISO/IEC 14496-12) with a single H.264 track.
+// Each segment file starts with the init section (ftyp + moov) and contains
+// one moof + mdat fragment per frame, so an interrupted recording remains
+// playable up to the last written frame.
+
+#define _TIMESCALE 90000
+
+
+static uz _box_begin(us_mux_buf_s *buf, const char *type);
+static uz _full_box_begin(us_mux_buf_s *buf, const char *type, u8 version, u32 flags);
+static void _box_end(us_mux_buf_s *buf, uz offset);
+static void _put_matrix(us_mux_buf_s *buf);
+static void _write_fragment(us_mp4_s *mp4, u64 duration, us_mux_buf_s *buf);
+
+
+us_mp4_s *us_mp4_init(void) {
+	us_mp4_s *mp4;
+	US_CALLOC(mp4, 1);
+	return mp4;
+}
+
+void us_mp4_destroy(us_mp4_s *mp4) {
+	us_mux_buf_destroy(&mp4->pending);
+	free(mp4);
+}
+
+void us_mp4_begin(us_mp4_s *mp4, const us_mux_avc_s *avc, const us_frame_s *frame, ldf date, us_mux_buf_s *buf) {
+	mp4->width = frame->width;
+	mp4->height = frame->height;
+	mp4->seq = 0;
+	mp4->pending.used = 0;
+	mp4->last_duration = _TIMESCALE / 30;
+
+	uz box = _box_begin(buf, "ftyp");
+	us_mux_buf_append(buf, "isom", 4);
+	us_mux_buf_put_be(buf, 0x200, 4);
+	us_mux_buf_append(buf, "isomiso5iso6avc1mp41", 20);
+	_box_end(buf, box);
+
+	const uz moov = _box_begin(buf, "moov");
+
+	box = _full_box_begin(buf, "mvhd", 0, 0);
+	const u32 mp4_date = (date > 0 ? (u64)date + 2082844800 : 0); // Since 1904-01-01
+	us_mux_buf_put_be(buf, mp4_date, 4); // Creation time
+	us_mux_buf_put_be(buf, mp4_date, 4); // Modification time
+	us_mux_buf_put_be(buf, 1000, 4); // Timescale
+	us_mux_buf_put_be(buf, 0, 4); // Duration is unknown
+	us_mux_buf_put_be(buf, 0x00010000, 4); // Rate 1.0
+	us_mux_buf_put_be(buf, 0x0100, 2); // Volume 1.0
+	us_mux_buf_put_zeros(buf, 10);
+	_put_matrix(buf);
+	us_mux_buf_put_zeros(buf, 24);
+	us_mux_buf_put_be(buf, 2, 4); // Next track ID
+	_box_end(buf, box);
+
+	const uz trak = _box_begin(buf, "trak");
+
+	box = _full_box_begin(buf, "tkhd", 0, 3); // Enabled, in movie
+	us_mux_buf_put_zeros(buf, 8);
+	us_mux_buf_put_be(buf, 1, 4); // Track ID
+	us_mux_buf_put_zeros(buf, 4);
+	us_mux_buf_put_be(buf, 0, 4); // Duration
+	us_mux_buf_put_zeros(buf, 16); // Reserved, layer, group, volume, reserved
+	_put_matrix(buf);
+	us_mux_buf_put_be(buf, mp4->width << 16, 4);
+	us_mux_buf_put_be(buf, mp4->height << 16, 4);
+	_box_end(buf, box);
+
+	const uz mdia = _box_begin(buf, "mdia");
+
+	box = _full_box_begin(buf, "mdhd", 0, 0);
+	us_mux_buf_put_zeros(buf, 8);
+	us_mux_buf_put_be(buf, _TIMESCALE, 4);
+	us_mux_buf_put_be(buf, 0, 4);
+	us_mux_buf_put_be(buf, 0x55C4, 2); // "und"
+	us_mux_buf_put_zeros(buf, 2);
+	_box_end(buf, box);
+
+	box = _full_box_begin(buf, "hdlr", 0, 0);
+	us_mux_buf_put_zeros(buf, 4);
+	us_mux_buf_append(buf, "vide", 4);
+	us_mux_buf_put_zeros(buf, 12);
+	us_mux_buf_append(buf, "VideoHandler", 13);
+	_box_end(buf, box);
+
+	const uz minf = _box_begin(buf, "minf");
+
+	box = _full_box_begin(buf, "vmhd", 0, 1);
+	us_mux_buf_put_zeros(buf, 8);
+	_box_end(buf, box);
+
+	const uz dinf = _box_begin(buf, "dinf");
+	box = _full_box_begin(buf, "dref", 0, 0);
+	us_mux_buf_put_be(buf, 1, 4);
+	_box_end(buf, _full_box_begin(buf, "url ", 0, 1)); // Self-contained
+	_box_end(buf, box);
+	_box_end(buf, dinf);
+
+	const uz stbl = _box_begin(buf, "stbl");
+
+	const uz stsd = _full_box_begin(buf, "stsd", 0, 0);
+	us_mux_buf_put_be(buf, 1, 4);
+	const uz avc1 = _box_begin(buf, "avc1");
+	us_mux_buf_put_zeros(buf, 6);
+	us_mux_buf_put_be(buf, 1, 2); // Data reference index
+	us_mux_buf_put_zeros(buf, 16);
+	us_mux_buf_put_be(buf, mp4->width, 2);
+	us_mux_buf_put_be(buf, mp4->height, 2);
+	us_mux_buf_put_be(buf, 0x00480000, 4); // 72 dpi
+	us_mux_buf_put_be(buf, 0x00480000, 4);
+	us_mux_buf_put_zeros(buf, 4);
+	us_mux_buf_put_be(buf, 1, 2); // Frame count
+	us_mux_buf_put_zeros(buf, 32); // Compressor name
+	us_mux_buf_put_be(buf, 0x0018, 2); // Depth
+	us_mux_buf_put_be(buf, 0xFFFF, 2);
+	box = _box_begin(buf, "avcC");
+	us_mux_avc_write_config(avc, buf);
+	_box_end(buf, box);
+	_box_end(buf, avc1);
+	_box_end(buf, stsd);
+
+	// Empty tables, all samples are in the fragments
+	box = _full_box_begin(buf, "stts", 0, 0);
+	us_mux_buf_put_be(buf, 0, 4);
+	_box_end(buf, box);
+	box = _full_box_begin(buf, "stsc", 0, 0);
+	us_mux_buf_put_be(buf, 0, 4);
+	_box_end(buf, box);
+	box = _full_box_begin(buf, "stsz", 0, 0);
+	us_mux_buf_put_zeros(buf, 8);
+	_box_end(buf, box);
+	box = _full_box_begin(buf, "stco", 0, 0);
+	us_mux_buf_put_be(buf, 0, 4);
+	_box_end(buf, box);
+
+	_box_end(buf, stbl);
+	_box_end(buf, minf);
+	_box_end(buf, mdia);
+	_box_end(buf, trak);
+
+	const uz mvex = _box_begin(buf, "mvex");
+	box = _full_box_begin(buf, "trex", 0, 0);
+	us_mux_buf_put_be(buf, 1, 4); // Track ID
+	us_mux_buf_put_be(buf, 1, 4); // Sample description index
+	us_mux_buf_put_zeros(buf, 12); // Default duration, size and flags
+	_box_end(buf, box);
+	_box_end(buf, mvex);
+
+	_box_end(buf, moov);
+}
+
+void us_mp4_write(us_mp4_s *mp4, const us_frame_s *frame, ldf pts, us_mux_buf_s *buf) {
+	u64 dts = pts * _TIMESCALE;
+	if (mp4->pending.used > 0) {
+		dts = US_MAX(dts, mp4->pending_dts + 1); // Keep the order on the grab_ts jitter
+		mp4->last_duration = dts - mp4->pending_dts;
+		_write_fragment(mp4, mp4->last_duration, buf);
+		mp4->pending.used = 0;
+	}
+	us_mux_avc_write_sample(frame->data, frame->used, &mp4->pending);
+	mp4->pending_key = frame->key;
+	mp4->pending_dts = dts;
+}
+
+void us_mp4_end(us_mp4_s *mp4, us_mux_buf_s *buf) {
+	if (mp4->pending.used > 0) {
+		_write_fragment(mp4, mp4->last_duration, buf);
+		mp4->pending.used = 0;
+	}
+}
+
+static uz _box_begin(us_mux_buf_s *buf, const char *type) {
+	const uz offset = buf->used;
+	us_mux_buf_put_be(buf, 0, 4);
+	us_mux_buf_append(buf, type, 4);
+	return offset;
+}
+
+static uz _full_box_begin(us_mux_buf_s *buf, const char *type, u8 version, u32 flags) {
+	const uz offset = _box_begin(buf, type);
+	us_mux_buf_put_be(buf, ((u32)version << 24) | flags, 4);
+	return offset;
+}
+
+static void _box_end(us_mux_buf_s *buf, uz offset) {
+	us_mux_buf_patch_be(buf, offset, buf->used - offset, 4);
+}
+
+static void _put_matrix(us_mux_buf_s *buf) {
+	const u32 matrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+	for (uint index = 0; index < 9; ++index) {
+		us_mux_buf_put_be(buf, matrix[index], 4);
+	}
+}
+
+static void _write_fragment(us_mp4_s *mp4, u64 duration, us_mux_buf_s *buf) {
+	++mp4->seq;
+	const uz moof = _box_begin(buf, "moof");
+
+	uz box = _full_box_begin(buf, "mfhd", 0, 0);
+	us_mux_buf_put_be(buf, mp4->seq, 4);
+	_box_end(buf, box);
+
+	const uz traf = _box_begin(buf, "traf");
+	box = _full_box_begin(buf, "tfhd", 0, 0x020000); // Default base is moof
+	us_mux_buf_put_be(buf, 1, 4);
+	_box_end(buf, box);
+
+	box = _full_box_begin(buf, "tfdt", 1, 0);
+	us_mux_buf_put_be(buf, mp4->pending_dts, 8);
+	_box_end(buf, box);
+
+	box = _full_box_begin(buf, "trun", 0, 0x000701); // Data offset, sample duration, size and flags
+	us_mux_buf_put_be(buf, 1, 4); // Sample count
+	const uz data_offset = buf->used;
+	us_mux_buf_put_be(buf, 0, 4);
+	us_mux_buf_put_be(buf, duration, 4);
+	us_mux_buf_put_be(buf, mp4->pending.used, 4);
+	us_mux_buf_put_be(buf, (mp4->pending_key ? 0x02000000 : 0x01010000), 4);
+	_box_end(buf, box);
+
+	_box_end(buf, traf);
+	_box_end(buf, moof);
+	us_mux_buf_patch_be(buf, data_offset, buf->used - moof + 8, 4); // From moof to the mdat payload
+
+	us_mux_buf_put_be(buf, 8 + mp4->pending.used, 4);
+	us_mux_buf_append(buf, "mdat", 4);
+	us_mux_buf_append(buf, mp4->pending.data, mp4->pending.used);
+}
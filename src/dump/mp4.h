@@ -0,0 +1,50 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+#include "mux.h"
+
+
+typedef struct {
+	uint			width;
+	uint			height;
+	u32				seq;
+
+	// The fragment of the frame is written when the next frame comes,
+	// so the sample duration is exact instead of guessed.
+	us_mux_buf_s	pending;
+	bool			pending_key;
+	u64				pending_dts;
+	u64				last_duration;
+} us_mp4_s;
+
+
+us_mp4_s *us_mp4_init(void);
+void us_mp4_destroy(us_mp4_s *mp4);
+
+void us_mp4_begin(us_mp4_s *mp4, const us_mux_avc_s *avc, const us_frame_s *frame, ldf date, us_mux_buf_s *buf);
+void us_mp4_write(us_mp4_s *mp4, const us_frame_s *frame, ldf pts, us_mux_buf_s *buf);
+void us_mp4_end(us_mp4_s *mp4, us_mux_buf_s *buf);
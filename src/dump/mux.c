@@ -0,0 +1,140 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "mux.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/nalu.h"
+
+
+void us_mux_buf_destroy(us_mux_buf_s *buf) {
+	US_DELETE(buf->data, free);
+	buf->used = 0;
+	buf->allocated = 0;
+}
+
+void us_mux_buf_append(us_mux_buf_s *buf, const void *data, uz size) {
+	if (buf->used + size > buf->allocated) {
+		buf->allocated = us_align_size(buf->used + size, 64 * 1024);
+		US_REALLOC(buf->data, buf->allocated);
+	}
+	if (data != NULL) {
+		memcpy(buf->data + buf->used, data, size);
+	} else {
+		memset(buf->data + buf->used, 0, size);
+	}
+	buf->used += size;
+}
+
+void us_mux_buf_put_be(us_mux_buf_s *buf, u64 value, uint size) {
+	us_mux_buf_append(buf, NULL, size);
+	us_mux_buf_patch_be(buf, buf->used - size, value, size);
+}
+
+void us_mux_buf_patch_be(us_mux_buf_s *buf, uz offset, u64 value, uint size) {
+	assert(size <= 8);
+	assert(offset + size <= buf->used);
+	for (uint index = 0; index < size; ++index) {
+		buf->data[offset + index] = value >> ((size - index - 1) * 8);
+	}
+}
+
+void us_mux_buf_put_zeros(us_mux_buf_s *buf, uz size) {
+	us_mux_buf_append(buf, NULL, size);
+}
+
+void us_mux_avc_destroy(us_mux_avc_s *avc) {
+	US_DELETE(avc->sps, free);
+	US_DELETE(avc->pps, free);
+	avc->sps_size = 0;
+	avc->pps_size = 0;
+}
+
+int us_mux_avc_update(us_mux_avc_s *avc, const u8 *data, uz size) {
+	// Returns -1 if the frame has no SPS/PPS, 0 if they are the same
+	// as the previous ones and 1 if they were changed.
+	// The sliced frames may have any number of NAL units, so they are not indexed.
+	us_nalu_s nalu;
+	us_nalu_s sps = {0};
+	us_nalu_s pps = {0};
+	uz pos = 0;
+	while ((sps.size == 0 || pps.size == 0) && us_nalu_next(data, size, &pos, &nalu)) {
+		if (nalu.type == 7 && sps.size == 0 && nalu.size >= 4) {
+			sps = nalu;
+		} else if (nalu.type == 8 && pps.size == 0) {
+			pps = nalu;
+		}
+	}
+	if (sps.size == 0 || pps.size == 0) {
+		return -1;
+	}
+
+	if (
+		avc->sps_size == sps.size && !memcmp(avc->sps, data + sps.offset, sps.size)
+		&& avc->pps_size == pps.size && !memcmp(avc->pps, data + pps.offset, pps.size)
+	) {
+		return 0;
+	}
+
+	us_mux_avc_destroy(avc);
+	US_CALLOC(avc->sps, sps.size);
+	memcpy(avc->sps, data + sps.offset, sps.size);
+	avc->sps_size = sps.size;
+	US_CALLOC(avc->pps, pps.size);
+	memcpy(avc->pps, data + pps.offset, pps.size);
+	avc->pps_size = pps.size;
+	return 1;
+}
+
+void us_mux_avc_write_config(const us_mux_avc_s *avc, us_mux_buf_s *buf) {
+	// AVCDecoderConfigurationRecord from ISO/IEC 14496-15,
+	// the same for MP4 avcC box and Matroska CodecPrivate.
+	assert(avc->sps != NULL);
+	us_mux_buf_put_be(buf, 1, 1); // configurationVersion
+	us_mux_buf_append(buf, avc->sps + 1, 3); // Profile, compatibility and level
+	us_mux_buf_put_be(buf, 0xFF, 1); // lengthSizeMinusOne = 3
+	us_mux_buf_put_be(buf, 0xE1, 1); // One SPS
+	us_mux_buf_put_be(buf, avc->sps_size, 2);
+	us_mux_buf_append(buf, avc->sps, avc->sps_size);
+	us_mux_buf_put_be(buf, 1, 1); // One PPS
+	us_mux_buf_put_be(buf, avc->pps_size, 2);
+	us_mux_buf_append(buf, avc->pps, avc->pps_size);
+}
+
+void us_mux_avc_write_sample(const u8 *data, uz size, us_mux_buf_s *buf) {
+	// Annex B to the length-prefixed NAL units. SPS, PPS and AUD are dropped,
+	// the parameters are stored in the decoder configuration.
+	us_nalu_s nalu;
+	uz pos = 0;
+	while (us_nalu_next(data, size, &pos, &nalu)) {
+		if (nalu.type == 7 || nalu.type == 8 || nalu.type == 9) {
+			continue;
+		}
+		us_mux_buf_put_be(buf, nalu.size, 4);
+		us_mux_buf_append(buf, data + nalu.offset, nalu.size);
+	}
+}
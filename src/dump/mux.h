@@ -0,0 +1,51 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../libs/types.h"
+
+
+typedef struct {
+	u8	*data;
+	uz	used;
+	uz	allocated;
+} us_mux_buf_s;
+
+typedef struct {
+	u8	*sps;
+	uz	sps_size;
+	u8	*pps;
+	uz	pps_size;
+} us_mux_avc_s;
+
+
+void us_mux_buf_destroy(us_mux_buf_s *buf);
+void us_mux_buf_append(us_mux_buf_s *buf, const void *data, uz size);
+void us_mux_buf_put_be(us_mux_buf_s *buf, u64 value, uint size);
+void us_mux_buf_patch_be(us_mux_buf_s *buf, uz offset, u64 value, uint size);
+void us_mux_buf_put_zeros(us_mux_buf_s *buf, uz size);
+
+void us_mux_avc_destroy(us_mux_avc_s *avc);
+int us_mux_avc_update(us_mux_avc_s *avc, const u8 *data, uz size);
+void us_mux_avc_write_config(const us_mux_avc_s *avc, us_mux_buf_s *buf);
+void us_mux_avc_write_sample(const u8 *data, uz size, us_mux_buf_s *buf);
@@ -0,0 +1,266 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "record.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <linux/videodev2.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+
+#include "mux.h"
+#include "mp4.h"
+#include "mkv.h"
+#include "writer.h"
+
+
+static void _begin_segment(us_output_record_s *rec, const us_frame_s *frame);
+static void _end_segment(us_output_record_s *rec);
+static void _make_segment_path(us_output_record_s *rec, char *path);
+static bool _is_segment_path_used(const us_output_record_s *rec, const char *path);
+static void _keep_segment(us_output_record_s *rec, const char *path);
+static void _write_buf(us_output_record_s *rec);
+
+
+us_output_record_s *us_output_record_init(
+	const char *path, us_record_format_e format,
+	uint segment, uint keep,
+	uint queue, bool direct,
+	ldf epoch_ts) {
+
+	if (segment > 0) {
+		if (!strcmp(path, "-")) {
+			US_LOG_ERROR("Can't split the <stdout> output into segments");
+			return NULL;
+		}
+		if (strchr(path, '%') == NULL) {
+			US_LOG_ERROR("The segment filename must contain strftime() conversions, like %%Y%%m%%d-%%H%%M%%S");
+			return NULL;
+		}
+	}
+
+	us_output_record_s *rec;
+	US_CALLOC(rec, 1);
+	rec->path = us_strdup(path);
+	rec->format = format;
+	rec->segment = segment;
+	rec->keep = keep;
+	rec->epoch_ts = epoch_ts;
+	rec->epoch_date = us_get_now_real() - (us_get_now_monotonic() - epoch_ts);
+	rec->writer = us_writer_init(queue, direct, 1);
+	if (format == US_RECORD_MP4) {
+		rec->mp4 = us_mp4_init();
+	} else {
+		rec->mkv = us_mkv_init();
+	}
+	US_CALLOC(rec->kept, US_MAX(keep, 1u));
+
+	US_LOG_INFO("Using %s output: %s; segment=%u, keep=%u",
+		(format == US_RECORD_MP4 ? "MP4" : "MKV"),
+		(strcmp(path, "-") ? path : "<stdout>"), segment, keep);
+	return rec;
+}
+
+void us_output_record_write(void *v_output, const us_frame_s *frame) {
+	us_output_record_s *const rec = v_output;
+
+	const bool h264 = (frame->format == V4L2_PIX_FMT_H264);
+	if (!h264 && !(rec->format == US_RECORD_MKV && us_is_jpeg(frame->format))) {
+		US_ONCE_FOR(rec->once, frame->format, {
+			char fourcc_str[8];
+			US_LOG_ERROR("Can't record %s frames to %s",
+				us_fourcc_to_string(frame->format, fourcc_str, 8),
+				(rec->format == US_RECORD_MP4 ? "MP4" : "MKV"));
+		});
+		return;
+	}
+	rec->once = 0;
+
+	// The timeline is continuous across the segments and it's shared
+	// with the other outputs started with the same epoch.
+	const ldf pts = US_MAX(frame->grab_ts - rec->epoch_ts, (ldf)0);
+
+	bool begin = (
+		!rec->started
+		|| rec->width != frame->width
+		|| rec->height != frame->height
+		|| rec->frame_format != frame->format
+	);
+	if (h264) {
+		if (frame->key && us_mux_avc_update(&rec->avc, frame->data, frame->used) > 0) {
+			begin = true; // New SPS/PPS
+		}
+		if (!frame->key || rec->avc.sps == NULL) {
+			if (begin) {
+				return; // Wait for a keyframe
+			}
+			goto write;
+		}
+	}
+	if (rec->segment > 0 && frame->grab_ts - rec->segment_ts >= rec->segment) {
+		begin = true;
+	}
+	if (begin) {
+		_begin_segment(rec, frame);
+	}
+
+write:
+	if (rec->mp4 != NULL) {
+		us_mp4_write(rec->mp4, frame, pts, &rec->buf);
+	} else {
+		us_mkv_write(rec->mkv, frame, pts, &rec->buf);
+	}
+	_write_buf(rec);
+}
+
+void us_output_record_destroy(void *v_output) {
+	us_output_record_s *const rec = v_output;
+	_end_segment(rec);
+	us_writer_destroy(rec->writer);
+	US_DELETE(rec->mp4, us_mp4_destroy);
+	US_DELETE(rec->mkv, us_mkv_destroy);
+	us_mux_avc_destroy(&rec->avc);
+	us_mux_buf_destroy(&rec->buf);
+	for (uint index = 0; index < rec->kept_count; ++index) {
+		free(rec->kept[index]);
+	}
+	free(rec->kept);
+	US_DELETE(rec->last_path, free);
+	free(rec->path);
+	free(rec);
+}
+
+static void _begin_segment(us_output_record_s *rec, const us_frame_s *frame) {
+	_end_segment(rec);
+
+	char path[PATH_MAX];
+	if (rec->segment > 0) {
+		_make_segment_path(rec, path);
+	} else {
+		US_SNPRINTF(path, PATH_MAX, "%s", rec->path);
+	}
+
+	US_LOG_INFO("Recording %ux%u to %s ...", frame->width, frame->height, (strcmp(path, "-") ? path : "<stdout>"));
+	us_writer_open(rec->writer, path);
+	if (rec->segment > 0) {
+		_keep_segment(rec, path);
+	}
+
+	const bool h264 = (frame->format == V4L2_PIX_FMT_H264);
+	if (rec->mp4 != NULL) {
+		us_mp4_begin(rec->mp4, &rec->avc, frame, rec->epoch_date, &rec->buf);
+	} else {
+		us_mkv_begin(rec->mkv, (h264 ? &rec->avc : NULL), frame, rec->epoch_date, &rec->buf);
+	}
+	_write_buf(rec);
+
+	rec->started = true;
+	rec->segment_ts = frame->grab_ts;
+	rec->width = frame->width;
+	rec->height = frame->height;
+	rec->frame_format = frame->format;
+}
+
+static void _end_segment(us_output_record_s *rec) {
+	if (rec->started) {
+		if (rec->mp4 != NULL) {
+			us_mp4_end(rec->mp4, &rec->buf);
+			_write_buf(rec);
+		}
+		us_writer_flush(rec->writer);
+		rec->started = false;
+	}
+}
+
+static void _make_segment_path(us_output_record_s *rec, char *path) {
+	const time_t now = time(NULL);
+	struct tm tm;
+	assert(localtime_r(&now, &tm) != NULL);
+	char base[PATH_MAX];
+	if (strftime(base, PATH_MAX, rec->path, &tm) == 0) {
+		US_SNPRINTF(base, PATH_MAX, "%s", rec->path);
+	}
+
+	// The format has a resolution of a second at most, and the segment can be
+	// restarted in the same second on a resolution change. The writer truncates
+	// the file, so the existing one gets a numeric suffix before the extension.
+	US_SNPRINTF(path, PATH_MAX, "%s", base);
+	const char *const slash = strrchr(base, '/');
+	const char *dot = strrchr(base, '.');
+	if (dot == NULL || (slash != NULL && dot < slash) || dot == (slash != NULL ? slash + 1 : base)) {
+		dot = base + strlen(base);
+	}
+	for (uint seq = 1; _is_segment_path_used(rec, path); ++seq) {
+		US_SNPRINTF(path, PATH_MAX, "%.*s-%u%s", (int)(dot - base), base, seq, dot);
+	}
+
+	US_DELETE(rec->last_path, free);
+	rec->last_path = us_strdup(path);
+}
+
+static bool _is_segment_path_used(const us_output_record_s *rec, const char *path) {
+	if (rec->last_path != NULL && !strcmp(rec->last_path, path)) {
+		return true; // The writer may not have created it yet
+	}
+	for (uint index = 0; index < rec->kept_count; ++index) {
+		if (!strcmp(rec->kept[index], path)) {
+			return true;
+		}
+	}
+	return (access(path, F_OK) == 0);
+}
+
+static void _keep_segment(us_output_record_s *rec, const char *path) {
+	if (rec->keep == 0) {
+		return;
+	}
+	if (rec->kept_count == rec->keep) {
+		// Remove the oldest segment, the writer doesn't need it anymore
+		// or has an open descriptor which is fine for unlink().
+		US_LOG_INFO("Removing the old segment %s ...", rec->kept[0]);
+		if (unlink(rec->kept[0]) < 0 && errno != ENOENT) {
+			US_LOG_PERROR("Can't remove the old segment %s", rec->kept[0]);
+		}
+		free(rec->kept[0]);
+		memmove(rec->kept, rec->kept + 1, sizeof(char*) * (rec->keep - 1));
+		--rec->kept_count;
+	}
+	rec->kept[rec->kept_count] = us_strdup(path);
+	++rec->kept_count;
+}
+
+static void _write_buf(us_output_record_s *rec) {
+	if (rec->buf.used > 0) {
+		us_writer_write(rec->writer, rec->buf.data, rec->buf.used);
+		rec->buf.used = 0;
+	}
+}
@@ -0,0 +1,73 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+#include "mux.h"
+#include "mp4.h"
+#include "mkv.h"
+#include "writer.h"
+
+
+typedef enum {
+	US_RECORD_MP4,
+	US_RECORD_MKV,
+} us_record_format_e;
+
+typedef struct {
+	char				*path;
+	us_record_format_e	format;
+	uint				segment; // Seconds, 0 = single file
+	uint				keep; // Number of the kept segments, 0 = all
+
+	us_writer_s			*writer;
+	us_mux_buf_s		buf;
+	us_mux_avc_s		avc;
+	us_mp4_s			*mp4;
+	us_mkv_s			*mkv;
+
+	ldf					epoch_ts; // The zero timestamp for all the segments and the other outputs
+	ldf					epoch_date; // The same in the wall-clock time
+
+	bool				started;
+	ldf					segment_ts; // The grab_ts of the first frame in the segment
+	uint				width;
+	uint				height;
+	uint				frame_format;
+
+	char				*last_path; // The name of the current segment
+	char				**kept;
+	uint				kept_count;
+	int					once;
+} us_output_record_s;
+
+
+us_output_record_s *us_output_record_init(
+	const char *path, us_record_format_e format,
+	uint segment, uint keep,
+	uint queue, bool direct,
+	ldf epoch_ts);
+void us_output_record_write(void *v_output, const us_frame_s *frame);
+void us_output_record_destroy(void *v_output);
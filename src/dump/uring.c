@@ -0,0 +1,184 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "uring.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include) && __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#	include <linux/io_uring.h>
+#	define _WITH_URING
+#endif
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+
+
+#ifdef _WITH_URING
+static void _uring_unmap(us_uring_s *uring);
+#endif
+
+
+us_uring_s *us_uring_init(uint entries) {
+#	ifdef _WITH_URING
+	struct io_uring_params params = {0};
+	const int fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) {
+		US_LOG_PERROR("Can't create io_uring");
+		return NULL;
+	}
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+		// IORING_OP_WRITE requires Linux 5.6, the same as the RW_CUR_POS feature
+		US_LOG_ERROR("The kernel io_uring is too old");
+		close(fd);
+		return NULL;
+	}
+
+	us_uring_s *uring;
+	US_CALLOC(uring, 1);
+	uring->fd = fd;
+	uring->entries = params.sq_entries;
+
+	uring->sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+	uring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->sq_size = US_MAX(uring->sq_size, uring->cq_size);
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	uring->sq_ptr = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	uring->cq_ptr = uring->sq_ptr; // Single mmap
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (uring->sq_ptr == MAP_FAILED || uring->sqes == MAP_FAILED) {
+		US_LOG_PERROR("Can't map io_uring");
+		goto error;
+	}
+
+	u8 *const sq = uring->sq_ptr;
+	uring->sq_head = (u32*)(sq + params.sq_off.head);
+	uring->sq_tail = (u32*)(sq + params.sq_off.tail);
+	uring->sq_mask = (u32*)(sq + params.sq_off.ring_mask);
+	uring->sq_array = (u32*)(sq + params.sq_off.array);
+	uring->cq_head = (u32*)(sq + params.cq_off.head);
+	uring->cq_tail = (u32*)(sq + params.cq_off.tail);
+	uring->cq_mask = (u32*)(sq + params.cq_off.ring_mask);
+	uring->cqes = sq + params.cq_off.cqes;
+	return uring;
+
+	error:
+		us_uring_destroy(uring);
+		return NULL;
+#	else
+	(void)entries;
+	US_LOG_ERROR("uStreamer-dump was built without io_uring support");
+	return NULL;
+#	endif
+}
+
+void us_uring_destroy(us_uring_s *uring) {
+#	ifdef _WITH_URING
+	_uring_unmap(uring);
+	US_CLOSE_FD(uring->fd);
+#	endif
+	free(uring);
+}
+
+int us_uring_write(us_uring_s *uring, int fd, const void *data, uz size, s64 offset, u64 user_data) {
+#	ifdef _WITH_URING
+	const u32 tail = *uring->sq_tail;
+	if (tail - atomic_load_explicit((_Atomic u32*)uring->sq_head, memory_order_acquire) >= uring->entries) {
+		return -1;
+	}
+	const u32 index = tail & *uring->sq_mask;
+	struct io_uring_sqe *const sqe = &((struct io_uring_sqe*)uring->sqes)[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (u64)(uintptr_t)data;
+	sqe->len = size;
+	sqe->off = (u64)offset; // -1 for the current position of the pipe or stdout
+	sqe->user_data = user_data;
+	uring->sq_array[index] = index;
+	atomic_store_explicit((_Atomic u32*)uring->sq_tail, tail + 1, memory_order_release);
+	++uring->pending;
+	return 0;
+#	else
+	(void)uring; (void)fd; (void)data; (void)size; (void)offset; (void)user_data;
+	return -1;
+#	endif
+}
+
+int us_uring_submit(us_uring_s *uring, uint wait) {
+	// Submits the queued writes and waits for the given number of completions
+#	ifdef _WITH_URING
+	while (true) {
+		const int retval = syscall(__NR_io_uring_enter, uring->fd, uring->pending, wait, (wait > 0 ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+		if (retval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		uring->pending -= US_MIN((uint)retval, uring->pending);
+		return 0;
+	}
+#	else
+	(void)uring; (void)wait;
+	return -1;
+#	endif
+}
+
+bool us_uring_get(us_uring_s *uring, u64 *user_data, int *result) {
+	// Takes a completed write without a syscall
+#	ifdef _WITH_URING
+	const u32 head = *uring->cq_head;
+	if (head == atomic_load_explicit((_Atomic u32*)uring->cq_tail, memory_order_acquire)) {
+		return false;
+	}
+	const struct io_uring_cqe *const cqe = &((struct io_uring_cqe*)uring->cqes)[head & *uring->cq_mask];
+	*user_data = cqe->user_data;
+	*result = cqe->res;
+	atomic_store_explicit((_Atomic u32*)uring->cq_head, head + 1, memory_order_release);
+	return true;
+#	else
+	(void)uring; (void)user_data; (void)result;
+	return false;
+#	endif
+}
+
+#ifdef _WITH_URING
+static void _uring_unmap(us_uring_s *uring) {
+	if (uring->sqes != NULL && uring->sqes != MAP_FAILED) {
+		munmap(uring->sqes, uring->sqes_size);
+	}
+	if (uring->sq_ptr != NULL && uring->sq_ptr != MAP_FAILED) {
+		munmap(uring->sq_ptr, uring->sq_size);
+	}
+}
+#endif
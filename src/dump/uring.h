@@ -0,0 +1,60 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "../libs/types.h"
+
+
+// A minimal io_uring wrapper for the file writes without liburing.
+// Only the raw kernel interface from <linux/io_uring.h> is used.
+
+typedef struct {
+	int		fd;
+	uint	entries;
+
+	void	*sq_ptr;
+	uz		sq_size;
+	void	*cq_ptr;
+	uz		cq_size;
+	void	*sqes;
+	uz		sqes_size;
+
+	u32		*sq_head;
+	u32		*sq_tail;
+	u32		*sq_mask;
+	u32		*sq_array;
+	u32		*cq_head;
+	u32		*cq_tail;
+	u32		*cq_mask;
+	void	*cqes;
+
+	uint	pending; // Queued, but not submitted to the kernel yet
+} us_uring_s;
+
+
+us_uring_s *us_uring_init(uint entries);
+void us_uring_destroy(us_uring_s *uring);
+
+int us_uring_write(us_uring_s *uring, int fd, const void *data, uz size, s64 offset, u64 user_data);
+int us_uring_submit(us_uring_s *uring, uint wait);
+bool us_uring_get(us_uring_s *uring, u64 *user_data, int *result);
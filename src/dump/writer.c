@@ -0,0 +1,441 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "writer.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/threading.h"
+#include "../libs/logging.h"
+#include "../libs/ring.h"
+
+#include "uring.h"
+
+
+// The output data is collected into the large page-aligned chunks and
+// written by a dedicated thread, so the sink reader doesn't wait for
+// the disk. The thread keeps up to the whole ring of chunks in flight
+// with io_uring or writes them one by one if io_uring is not available.
+// The pipes and stdout have no offsets, so only one write is in flight for them.
+//
+// With O_DIRECT the writes must be aligned, so the unaligned tail
+// of a flushed chunk is written padded and then rewritten from
+// the beginning of the next chunk. The file is truncated to the real
+// size on close, as well as the fallocate() preallocation.
+
+#define _CHUNK_SIZE			(2 * 1024 * 1024)
+#define _ALIGN				4096
+#define _PREALLOC_STEP		(32 * 1024 * 1024)
+#define _REPORT_INTERVAL	10
+
+
+static us_writer_chunk_s *_chunk_init(uz size);
+static void _chunk_destroy(us_writer_chunk_s *chunk);
+
+static void *_writer_thread(void *v_writer);
+static void _writer_submit(us_writer_s *writer, uint ri);
+static void _writer_complete(us_writer_s *writer, uint ri, sz result);
+static void _writer_reap(us_writer_s *writer, uint wait);
+static void _writer_drain(us_writer_s *writer);
+static void _writer_reopen(us_writer_s *writer, const char *path);
+static void _writer_close(us_writer_s *writer);
+static void _writer_prealloc(us_writer_s *writer, u64 end);
+static void _writer_report(us_writer_s *writer, bool info);
+
+static us_writer_chunk_s *_producer_get(us_writer_s *writer);
+static void _producer_submit(us_writer_s *writer);
+
+
+us_writer_s *us_writer_init(uint depth, bool direct, ldf flush_interval) {
+	us_writer_s *writer;
+	US_CALLOC(writer, 1);
+	writer->chunk_size = _CHUNK_SIZE;
+	writer->depth = depth;
+	writer->direct = direct;
+	writer->flush_interval = flush_interval;
+	writer->ring = us_ring_init(depth);
+	for (uint index = 0; index < depth; ++index) {
+		writer->ring->items[index] = _chunk_init(writer->chunk_size);
+	}
+	writer->chunk_index = -1;
+	US_CALLOC(writer->tail, _ALIGN);
+	atomic_init(&writer->stop, false);
+	writer->fd = -1;
+
+	if ((writer->uring = us_uring_init(depth)) == NULL) {
+		US_LOG_INFO("Using synchronous writes for output");
+	} else {
+		US_LOG_INFO("Using io_uring for output; queue=%u", depth);
+	}
+
+	US_THREAD_CREATE(writer->tid, _writer_thread, writer);
+	return writer;
+}
+
+void us_writer_destroy(us_writer_s *writer) {
+	_producer_submit(writer);
+	atomic_store(&writer->stop, true);
+	US_THREAD_JOIN(writer->tid);
+	_writer_close(writer);
+	_writer_report(writer, true);
+	US_DELETE(writer->uring, us_uring_destroy);
+	US_RING_DELETE_WITH_ITEMS(writer->ring, _chunk_destroy);
+	free(writer->tail);
+	free(writer);
+}
+
+void us_writer_open(us_writer_s *writer, const char *path) {
+	_producer_submit(writer);
+	writer->tail_size = 0;
+	writer->carry = (writer->direct && strcmp(path, "-"));
+	us_writer_chunk_s *const chunk = _producer_get(writer);
+	chunk->used = 0; // Drop the tail of the previous file if the chunk was kept
+	chunk->carry = 0;
+	chunk->path = us_strdup(path);
+}
+
+void us_writer_write(us_writer_s *writer, const u8 *data, uz size) {
+	while (size > 0) {
+		us_writer_chunk_s *chunk = _producer_get(writer);
+		if (chunk->used == writer->chunk_size) {
+			_producer_submit(writer);
+			chunk = _producer_get(writer);
+		}
+		const uz part = US_MIN(size, writer->chunk_size - chunk->used);
+		memcpy(chunk->data + chunk->used, data, part);
+		chunk->used += part;
+		data += part;
+		size -= part;
+	}
+	if (us_get_now_monotonic() - writer->chunk_ts >= writer->flush_interval) {
+		// Limit the amount of the data lost on a crash
+		_producer_submit(writer);
+	}
+}
+
+void us_writer_flush(us_writer_s *writer) {
+	_producer_submit(writer);
+}
+
+static us_writer_chunk_s *_chunk_init(uz size) {
+	us_writer_chunk_s *chunk;
+	US_CALLOC(chunk, 1);
+	assert(!posix_memalign((void**)&chunk->data, _ALIGN, size));
+	return chunk;
+}
+
+static void _chunk_destroy(us_writer_chunk_s *chunk) {
+	US_DELETE(chunk->path, free);
+	free(chunk->data);
+	free(chunk);
+}
+
+static void *_writer_thread(void *v_writer) {
+	US_THREAD_SETTLE("writer");
+	us_writer_s *const writer = v_writer;
+	writer->report_ts = us_get_now_monotonic();
+
+	while (true) {
+		_writer_reap(writer, 0);
+
+		// Poll the ring more often while something is in flight to release the chunks
+		const int ri = us_ring_consumer_acquire(writer->ring, (writer->inflight > 0 ? 0.001 : 0.1));
+		if (ri >= 0) {
+			us_writer_chunk_s *const chunk = writer->ring->items[ri];
+			if (chunk->path != NULL) {
+				_writer_drain(writer);
+				_writer_reopen(writer, chunk->path);
+				US_DELETE(chunk->path, free);
+			} else if (chunk->carry > 0) {
+				_writer_drain(writer); // The previous chunk is overwritten partially
+			} else if (!writer->fd_seekable) {
+				// Unlinked writes to a pipe may be executed in any order,
+				// and a short write must be finished before the next chunk.
+				_writer_drain(writer);
+			}
+			_writer_submit(writer, ri);
+		} else if (writer->inflight == 0 && atomic_load(&writer->stop)) {
+			break;
+		}
+
+		if (us_get_now_monotonic() - writer->report_ts >= _REPORT_INTERVAL) {
+			_writer_report(writer, false);
+			writer->report_ts = us_get_now_monotonic();
+		}
+	}
+	return NULL;
+}
+
+static void _writer_submit(us_writer_s *writer, uint ri) {
+	us_writer_chunk_s *const chunk = writer->ring->items[ri];
+
+	if (writer->fd < 0) {
+		chunk->io_size = 0; // Drop the data
+		_writer_complete(writer, ri, 0);
+		return;
+	}
+
+	chunk->io_data = chunk->data;
+	chunk->io_size = chunk->used;
+	chunk->io_offset = -1;
+	if (writer->fd_seekable) {
+		chunk->io_offset = writer->fd_pos - chunk->carry;
+		writer->fd_pos += chunk->used - chunk->carry;
+		if (writer->fd_direct) {
+			chunk->io_size = us_align_size(chunk->used, _ALIGN);
+			memset(chunk->data + chunk->used, 0, chunk->io_size - chunk->used);
+		}
+		_writer_prealloc(writer, chunk->io_offset + chunk->io_size);
+	} else {
+		chunk->io_data += chunk->carry;
+		chunk->io_size -= chunk->carry;
+	}
+	chunk->io_ts = us_get_now_monotonic();
+
+	if (
+		writer->uring != NULL
+		&& !us_uring_write(writer->uring, writer->fd, chunk->io_data, chunk->io_size, chunk->io_offset, ri)
+	) {
+		// The queued write is in flight even if the submit fails: it's already
+		// in the SQ ring, so it's submitted again by _writer_reap() and never
+		// written synchronously, otherwise the chunk would be written twice.
+		++writer->inflight;
+		if (writer->inflight > atomic_load(&writer->inflight_max)) {
+			atomic_store(&writer->inflight_max, writer->inflight);
+		}
+		if (us_uring_submit(writer->uring, 0) < 0) {
+			US_LOG_PERROR("Can't submit to io_uring, will retry");
+		}
+		return;
+	}
+
+	sz result;
+	do {
+		if (chunk->io_offset >= 0) {
+			result = pwrite(writer->fd, chunk->io_data, chunk->io_size, chunk->io_offset);
+		} else {
+			result = write(writer->fd, chunk->io_data, chunk->io_size);
+		}
+	} while (result < 0 && errno == EINTR);
+	_writer_complete(writer, ri, (result < 0 ? -errno : result));
+}
+
+static void _writer_complete(us_writer_s *writer, uint ri, sz result) {
+	us_writer_chunk_s *const chunk = writer->ring->items[ri];
+
+	while (result >= 0 && (uz)result < chunk->io_size) {
+		// Finish the short write synchronously, it's very rare.
+		// A pipe has no other writes in flight at this point.
+		chunk->io_data += result;
+		chunk->io_size -= result;
+		if (chunk->io_offset >= 0) {
+			chunk->io_offset += result;
+			result = pwrite(writer->fd, chunk->io_data, chunk->io_size, chunk->io_offset);
+		} else {
+			result = write(writer->fd, chunk->io_data, chunk->io_size);
+		}
+		if (result < 0) {
+			result = (errno == EINTR ? 0 : -errno);
+		}
+	}
+
+	if (result < 0) {
+		errno = -result;
+		US_LOG_PERROR("Can't write to output %s", writer->fd_path);
+		atomic_fetch_add(&writer->errors, 1);
+	} else if (chunk->io_ts > 0) {
+		const u64 latency_us = (us_get_now_monotonic() - chunk->io_ts) * 1000000;
+		atomic_fetch_add(&writer->written, chunk->used - chunk->carry);
+		atomic_fetch_add(&writer->writes, 1);
+		atomic_fetch_add(&writer->latency_sum_us, latency_us);
+		if (latency_us > atomic_load(&writer->latency_max_us)) {
+			atomic_store(&writer->latency_max_us, latency_us);
+		}
+	}
+
+	chunk->used = 0;
+	chunk->carry = 0;
+	chunk->io_ts = 0;
+	us_ring_consumer_release(writer->ring, ri);
+}
+
+static void _writer_reap(us_writer_s *writer, uint wait) {
+	if (writer->uring == NULL || writer->inflight == 0) {
+		return;
+	}
+	if (
+		(wait > 0 || writer->uring->pending > 0)
+		&& us_uring_submit(writer->uring, US_MIN(wait, writer->inflight)) < 0
+	) {
+		US_LOG_PERROR("Can't submit to or wait for io_uring");
+	}
+	u64 ri;
+	int result;
+	while (us_uring_get(writer->uring, &ri, &result)) {
+		--writer->inflight;
+		_writer_complete(writer, ri, result);
+	}
+}
+
+static void _writer_drain(us_writer_s *writer) {
+	while (writer->inflight > 0) {
+		_writer_reap(writer, writer->inflight);
+	}
+}
+
+static void _writer_reopen(us_writer_s *writer, const char *path) {
+	_writer_close(writer);
+	writer->fd_path = us_strdup(path);
+	writer->fd_pos = 0;
+	writer->fd_prealloc = 0;
+	writer->fd_direct = false;
+
+	if (!strcmp(path, "-")) {
+		writer->fd = STDOUT_FILENO;
+	} else {
+		const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+		if (writer->direct) {
+			if ((writer->fd = open(path, flags | O_DIRECT, 0644)) >= 0) {
+				writer->fd_direct = true;
+			} else if (errno == EINVAL) {
+				US_LOG_ERROR("O_DIRECT is not supported for output %s, using the page cache", path);
+			}
+		}
+		if (writer->fd < 0 && (writer->fd = open(path, flags, 0644)) < 0) {
+			US_LOG_PERROR("Can't open output file %s", path);
+			return;
+		}
+	}
+
+	struct stat st;
+	writer->fd_seekable = (!fstat(writer->fd, &st) && S_ISREG(st.st_mode));
+	if (writer->fd_seekable) {
+		// The next segment is most likely the same size as the previous one
+		_writer_prealloc(writer, writer->last_size);
+	}
+}
+
+static void _writer_close(us_writer_s *writer) {
+	if (writer->fd >= 0 && writer->fd != STDOUT_FILENO) {
+		if (writer->fd_seekable) {
+			// Remove the O_DIRECT padding and the unused preallocated space
+			if (ftruncate(writer->fd, writer->fd_pos) < 0) {
+				US_LOG_PERROR("Can't truncate output file %s", writer->fd_path);
+			}
+			writer->last_size = writer->fd_pos;
+		}
+		// The closed segment should be really on the disk
+		if (fdatasync(writer->fd) < 0) {
+			US_LOG_PERROR("Can't sync output file %s", writer->fd_path);
+		}
+		if (close(writer->fd) < 0) {
+			US_LOG_PERROR("Can't close output file %s", writer->fd_path);
+		}
+	}
+	writer->fd = -1;
+	US_DELETE(writer->fd_path, free);
+}
+
+static void _writer_prealloc(us_writer_s *writer, u64 end) {
+	// Preallocation keeps the file in one piece on the SD cards and saves
+	// the metadata updates on each write. KEEP_SIZE makes the data written
+	// so far readable by the players, the rest is truncated on close.
+	if (end <= writer->fd_prealloc) {
+		return;
+	}
+	const u64 size = us_align_size(end + _PREALLOC_STEP, _PREALLOC_STEP);
+	if (fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, writer->fd_prealloc, size - writer->fd_prealloc) < 0) {
+		if (errno != EOPNOTSUPP) {
+			US_LOG_PERROR("Can't preallocate output file %s", writer->fd_path);
+		}
+		writer->fd_prealloc = UINT64_MAX; // Don't try again for this file
+		return;
+	}
+	writer->fd_prealloc = size;
+}
+
+static void _writer_report(us_writer_s *writer, bool info) {
+	const ull writes = atomic_load(&writer->writes);
+	const ldf latency_avg = (writes > 0 ? (ldf)atomic_load(&writer->latency_sum_us) / writes / 1000 : 0);
+	const ldf latency_max = (ldf)atomic_exchange(&writer->latency_max_us, 0) / 1000;
+	const uint inflight_max = atomic_exchange(&writer->inflight_max, 0);
+#	define REPORT(x_log) x_log( \
+		"Output: queue=%u/%u, latency_avg=%.1Lf, latency_max=%.1Lf, writes=%llu, written=%.1Lf MiB, stalls=%llu, errors=%llu", \
+		inflight_max, writer->depth, latency_avg, latency_max, writes, \
+		(ldf)atomic_load(&writer->written) / 1024 / 1024, \
+		atomic_load(&writer->stalls), atomic_load(&writer->errors))
+	if (info) {
+		REPORT(US_LOG_INFO);
+	} else {
+		REPORT(US_LOG_PERF);
+	}
+#	undef REPORT
+}
+
+static us_writer_chunk_s *_producer_get(us_writer_s *writer) {
+	if (writer->chunk_index < 0) {
+		if ((writer->chunk_index = us_ring_producer_acquire(writer->ring, 0)) < 0) {
+			// Wait for the disk instead of breaking the container
+			atomic_fetch_add(&writer->stalls, 1);
+			while ((writer->chunk_index = us_ring_producer_acquire(writer->ring, 1)) < 0) {
+				US_LOG_ERROR("Output is too slow, all the write buffers are busy");
+			}
+		}
+		writer->chunk_ts = us_get_now_monotonic();
+
+		us_writer_chunk_s *const chunk = writer->ring->items[writer->chunk_index];
+		if (writer->tail_size > 0) {
+			memcpy(chunk->data, writer->tail, writer->tail_size);
+			chunk->used = writer->tail_size;
+			chunk->carry = writer->tail_size;
+			writer->tail_size = 0;
+		}
+	}
+	return writer->ring->items[writer->chunk_index];
+}
+
+static void _producer_submit(us_writer_s *writer) {
+	if (writer->chunk_index < 0) {
+		return;
+	}
+	us_writer_chunk_s *const chunk = writer->ring->items[writer->chunk_index];
+	if (chunk->used == chunk->carry && chunk->path == NULL) {
+		return; // Nothing new, keep the chunk
+	}
+	if (writer->carry && chunk->used < writer->chunk_size) {
+		writer->tail_size = chunk->used % _ALIGN;
+		memcpy(writer->tail, chunk->data + chunk->used - writer->tail_size, writer->tail_size);
+	}
+	us_ring_producer_release(writer->ring, writer->chunk_index);
+	writer->chunk_index = -1;
+}
@@ -0,0 +1,90 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "../libs/types.h"
+#include "../libs/ring.h"
+
+#include "uring.h"
+
+
+typedef struct {
+	u8			*data; // Aligned to the page size
+	uz			used;
+	uz			carry; // The O_DIRECT tail of the previous chunk, it will be rewritten
+	char		*path; // Reopen the output with this path before writing the data
+
+	const u8	*io_data;
+	uz			io_size;
+	s64			io_offset;
+	ldf			io_ts;
+} us_writer_chunk_s;
+
+typedef struct {
+	uz				chunk_size;
+	uint			depth;
+	bool			direct;
+	ldf				flush_interval;
+	us_ring_s		*ring;
+
+	// Producer side
+	int				chunk_index;
+	ldf				chunk_ts;
+	bool			carry;
+	u8				*tail;
+	uz				tail_size;
+
+	// Writer thread side
+	pthread_t		tid;
+	atomic_bool		stop;
+	us_uring_s		*uring;
+	uint			inflight;
+	int				fd;
+	char			*fd_path;
+	bool			fd_seekable;
+	bool			fd_direct;
+	u64				fd_pos;
+	u64				fd_prealloc;
+	u64				last_size;
+	ldf				report_ts;
+
+	atomic_ullong	written;
+	atomic_ullong	writes;
+	atomic_ullong	errors;
+	atomic_ullong	stalls; // The producer was waiting for a free buffer
+	atomic_ullong	latency_sum_us;
+	atomic_ullong	latency_max_us;
+	atomic_uint		inflight_max;
+} us_writer_s;
+
+
+us_writer_s *us_writer_init(uint depth, bool direct, ldf flush_interval);
+void us_writer_destroy(us_writer_s *writer);
+
+void us_writer_open(us_writer_s *writer, const char *path);
+void us_writer_write(us_writer_s *writer, const u8 *data, uz size);
+void us_writer_flush(us_writer_s *writer);
@@ -0,0 +1,1099 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "convert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <linux/videodev2.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#	include <immintrin.h>
+#	define _WITH_X86
+#elif defined(__aarch64__)
+#	include <arm_neon.h>
+#	define _WITH_NEON
+#endif
+
+#include "types.h"
+#include "tools.h"
+#include "array.h"
+#include "frame.h"
+
+
+typedef struct {
+	const u8	*data[3];
+	uint		stride[3];
+} _planes_s;
+
+// The rows of Y, U and V. The chroma is half-width for yuv422_row() and full-width for yuv444_row().
+typedef void (*_yuv_row_f)(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+// RGB24 or BGR24 row to any layout
+typedef void (*_rgb_row_f)(const u8 *src, bool src_bgr, u8 *dest, uint width, us_convert_layout_e layout);
+// Packed YUYV-like row to the planar rows, the order is the offsets of Y0, U, Y1 and V
+typedef void (*_unpack_yuyv_row_f)(const u8 *src, const u8 *order, u8 *y, u8 *u, u8 *v, uint width);
+// Interleaved UV of NV12/16/24 to the planar rows
+typedef void (*_unpack_uv_row_f)(const u8 *src, u8 *u, u8 *v, uint count);
+// Vertical step of the bilinear resize, the weight of the bottom row is 0..255
+typedef void (*_blend_rows_f)(const u8 *top, const u8 *bottom, uint weight, u8 *dest, uint count);
+
+typedef struct {
+	const char			*name;
+	_yuv_row_f			yuv422_row;
+	_yuv_row_f			yuv444_row;
+	_rgb_row_f			rgb_row;
+	_unpack_yuyv_row_f	unpack_yuyv_row;
+	_unpack_uv_row_f	unpack_uv_row;
+	_blend_rows_f		blend_rows;
+} _kernels_s;
+
+typedef struct {
+	const u8	*y;
+	const u8	*u;
+	const u8	*v;
+	uint		chroma_shift; // 1 for the half-width chroma
+} _yuv_row_s;
+
+typedef struct {
+	u8			*y;
+	u8			*u;
+	u8			*v;
+	u8			*rgb;
+} _scratch_s;
+
+
+static const _kernels_s *_get_kernels(void);
+static void _init_kernels(void);
+static bool _is_kernels_supported(const _kernels_s *kernels);
+
+static int _get_planes(const us_frame_s *src, _planes_s *planes);
+static bool _is_yuv(uint format);
+static void _get_yuv_row(const us_frame_s *src, const _planes_s *planes, uint y, _scratch_s *scratch, _yuv_row_s *row);
+static void _get_rgb_row(const us_frame_s *src, const _planes_s *planes, uint y, uint width, u8 *dest);
+static void _scratch_init(_scratch_s *scratch, uint width);
+static void _scratch_destroy(_scratch_s *scratch);
+
+static void _generic_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+static void _generic_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+static void _generic_rgb_row(const u8 *src, bool src_bgr, u8 *dest, uint width, us_convert_layout_e layout);
+static void _generic_unpack_yuyv_row(const u8 *src, const u8 *order, u8 *y, u8 *u, u8 *v, uint width);
+static void _generic_unpack_uv_row(const u8 *src, u8 *u, u8 *v, uint count);
+static void _generic_blend_rows(const u8 *top, const u8 *bottom, uint weight, u8 *dest, uint count);
+
+#ifdef _WITH_X86
+static void _sse41_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+static void _sse41_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+static void _sse41_rgb_row(const u8 *src, bool src_bgr, u8 *dest, uint width, us_convert_layout_e layout);
+static void _sse41_unpack_yuyv_row(const u8 *src, const u8 *order, u8 *y, u8 *u, u8 *v, uint width);
+static void _sse41_unpack_uv_row(const u8 *src, u8 *u, u8 *v, uint count);
+static void _sse41_blend_rows(const u8 *top, const u8 *bottom, uint weight, u8 *dest, uint count);
+static void _avx2_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+static void _avx2_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+#endif
+
+#ifdef _WITH_NEON
+static void _neon_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+static void _neon_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout);
+static void _neon_rgb_row(const u8 *src, bool src_bgr, u8 *dest, uint width, us_convert_layout_e layout);
+static void _neon_unpack_yuyv_row(const u8 *src, const u8 *order, u8 *y, u8 *u, u8 *v, uint width);
+static void _neon_unpack_uv_row(const u8 *src, u8 *u, u8 *v, uint count);
+static void _neon_blend_rows(const u8 *top, const u8 *bottom, uint weight, u8 *dest, uint count);
+#endif
+
+
+static const _kernels_s _GENERIC_KERNELS = {
+	"generic", _generic_yuv422_row, _generic_yuv444_row, _generic_rgb_row,
+	_generic_unpack_yuyv_row, _generic_unpack_uv_row, _generic_blend_rows,
+};
+#ifdef _WITH_X86
+static const _kernels_s _SSE41_KERNELS = {
+	"SSE4.1", _sse41_yuv422_row, _sse41_yuv444_row, _sse41_rgb_row,
+	_sse41_unpack_yuyv_row, _sse41_unpack_uv_row, _sse41_blend_rows,
+};
+// The unpacking and the blending are limited by the memory, AVX2 doesn't help here
+static const _kernels_s _AVX2_KERNELS = {
+	"AVX2", _avx2_yuv422_row, _avx2_yuv444_row, _sse41_rgb_row,
+	_sse41_unpack_yuyv_row, _sse41_unpack_uv_row, _sse41_blend_rows,
+};
+#endif
+#ifdef _WITH_NEON
+static const _kernels_s _NEON_KERNELS = {
+	"NEON", _neon_yuv422_row, _neon_yuv444_row, _neon_rgb_row,
+	_neon_unpack_yuyv_row, _neon_unpack_uv_row, _neon_blend_rows,
+};
+#endif
+
+static const _kernels_s *const _ALL_KERNELS[] = {
+	&_GENERIC_KERNELS,
+#	ifdef _WITH_X86
+	&_SSE41_KERNELS,
+	&_AVX2_KERNELS,
+#	endif
+#	ifdef _WITH_NEON
+	&_NEON_KERNELS,
+#	endif
+};
+
+static const _kernels_s *_g_kernels = &_GENERIC_KERNELS;
+static pthread_once_t _g_kernels_once = PTHREAD_ONCE_INIT;
+
+
+// The SIMD kernels multiply the 16-bit lanes with the rounding to the upper half.
+// The chroma and the luma are shifted left by 7 bits and the U for the blue by 8,
+// so the coefficients of _put_yuv() are scaled by 64 (by 32 for the blue) to give
+// the same result with 6 fractional bits. It may differ from the C code by 1.
+#define _YUV_MUL_Y	(298 * 64)
+#define _YUV_MUL_VR	(409 * 64)
+#define _YUV_MUL_UG	(100 * 64)
+#define _YUV_MUL_VG	(208 * 64)
+#define _YUV_MUL_UB	(516 * 32)
+
+
+static inline uint _get_layout_bpp(us_convert_layout_e layout) {
+	return (layout == US_CONVERT_XRGB32 ? 4 : 3);
+}
+
+static inline u8 _clamp(int value) {
+	return (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline void _put_rgb(u8 *dest, uint x, us_convert_layout_e layout, u8 r, u8 g, u8 b) {
+	switch (layout) {
+		case US_CONVERT_RGB24: dest += x * 3; dest[0] = r; dest[1] = g; dest[2] = b; break;
+		case US_CONVERT_BGR24: dest += x * 3; dest[0] = b; dest[1] = g; dest[2] = r; break;
+		case US_CONVERT_XRGB32: dest += x * 4; dest[0] = b; dest[1] = g; dest[2] = r; dest[3] = 0xFF; break;
+	}
+}
+
+static inline void _put_yuv(u8 *dest, uint x, us_convert_layout_e layout, int y, int u, int v) {
+	// BT.601 limited range with 8-bit coefficients
+	const int c = 298 * (y - 16) + 128;
+	u -= 128;
+	v -= 128;
+	_put_rgb(dest, x, layout,
+		_clamp((c + 409 * v) >> 8),
+		_clamp((c - 100 * u - 208 * v) >> 8),
+		_clamp((c + 516 * u) >> 8));
+}
+
+static inline void _resize_row(const u8 *src, const uint *xs, const u8 *xw, u8 *dest, uint width, uint channels) {
+	for (uint x = 0; x < width; ++x) {
+		const u8 *const left = src + xs[x * 2];
+		const u8 *const right = src + xs[x * 2 + 1];
+		const uint wx = xw[x];
+		for (uint ch = 0; ch < channels; ++ch) {
+			dest[ch] = (left[ch] * (256 - wx) + right[ch] * wx + 128) >> 8;
+		}
+		dest += channels;
+	}
+}
+
+
+int us_convert_to_rgb24(const us_frame_s *src, u8 *dest, uint dest_stride) {
+	return us_convert_to_packed(src, US_CONVERT_RGB24, dest, dest_stride, 0, 0);
+}
+
+int us_convert_to_packed(
+	const us_frame_s *src, us_convert_layout_e layout, u8 *dest, uint dest_stride,
+	uint max_width, uint max_height) {
+
+	_planes_s planes;
+	if (_get_planes(src, &planes) < 0) {
+		return -1;
+	}
+	const uint width = (max_width > 0 ? US_MIN(src->width, max_width) : src->width);
+	const uint height = (max_height > 0 ? US_MIN(src->height, max_height) : src->height);
+	const _kernels_s *const kernels = _get_kernels();
+
+	if (src->format == V4L2_PIX_FMT_RGB24 || src->format == V4L2_PIX_FMT_BGR24) {
+		const bool src_bgr = (src->format == V4L2_PIX_FMT_BGR24);
+		for (uint y = 0; y < height; ++y) {
+			kernels->rgb_row(planes.data[0] + (uz)y * planes.stride[0], src_bgr, dest + (uz)y * dest_stride, width, layout);
+		}
+		return 0;
+	}
+
+	_scratch_s scratch;
+	_scratch_init(&scratch, src->width);
+	for (uint y = 0; y < height; ++y) {
+		u8 *const out = dest + (uz)y * dest_stride;
+		if (_is_yuv(src->format)) {
+			_yuv_row_s row;
+			_get_yuv_row(src, &planes, y, &scratch, &row);
+			const _yuv_row_f row_f = (row.chroma_shift > 0 ? kernels->yuv422_row : kernels->yuv444_row);
+			row_f(row.y, row.u, row.v, out, width, layout);
+		} else {
+			_get_rgb_row(src, &planes, y, width, scratch.rgb);
+			kernels->rgb_row(scratch.rgb, false, out, width, layout);
+		}
+	}
+	_scratch_destroy(&scratch);
+	return 0;
+}
+
+int us_convert_to_grey(const us_frame_s *src, u8 *dest, uint dest_stride) {
+	_planes_s planes;
+	if (_get_planes(src, &planes) < 0) {
+		return -1;
+	}
+
+	_scratch_s scratch;
+	_scratch_init(&scratch, src->width);
+	for (uint y = 0; y < src->height; ++y) {
+		u8 *const out = dest + (uz)y * dest_stride;
+		if (_is_yuv(src->format)) {
+			// Just the luma
+			_yuv_row_s row;
+			_get_yuv_row(src, &planes, y, &scratch, &row);
+			memcpy(out, row.y, src->width);
+		} else {
+			_get_rgb_row(src, &planes, y, src->width, scratch.rgb);
+			for (uint x = 0; x < src->width; ++x) {
+				const u8 *const px = scratch.rgb + x * 3;
+				out[x] = (77 * px[0] + 150 * px[1] + 29 * px[2]) >> 8;
+			}
+		}
+	}
+	_scratch_destroy(&scratch);
+	return 0;
+}
+
+int us_convert_to_nv12(const us_frame_s *src, u8 *dest_y, uint y_stride, u8 *dest_uv, uint uv_stride) {
+	_planes_s planes;
+	if (_get_planes(src, &planes) < 0) {
+		return -1;
+	}
+
+	const uint width = src->width;
+	const uint height = src->height;
+	const uint chroma_width = (width + 1) / 2;
+	_scratch_s scratch[2];
+	_scratch_init(&scratch[0], width);
+	_scratch_init(&scratch[1], width);
+
+	for (uint y = 0; y < height; y += 2) {
+		const uint rows = (y + 1 < height ? 2 : 1);
+		u8 *const uv = dest_uv + (uz)(y / 2) * uv_stride;
+
+		if (_is_yuv(src->format)) {
+			_yuv_row_s row[2];
+			for (uint index = 0; index < rows; ++index) {
+				_get_yuv_row(src, &planes, y + index, &scratch[index], &row[index]);
+				memcpy(dest_y + (uz)(y + index) * y_stride, row[index].y, width);
+			}
+			if (rows == 1) {
+				row[1] = row[0];
+			}
+
+			const bool subsampled = (src->format == V4L2_PIX_FMT_NV12 || src->format == V4L2_PIX_FMT_YUV420 || src->format == V4L2_PIX_FMT_YVU420);
+			for (uint x = 0; x < chroma_width; ++x) {
+				if (row[0].chroma_shift > 0) {
+					if (subsampled) {
+						uv[x * 2] = row[0].u[x];
+						uv[x * 2 + 1] = row[0].v[x];
+					} else { // 4:2:2
+						uv[x * 2] = (row[0].u[x] + row[1].u[x] + 1) / 2;
+						uv[x * 2 + 1] = (row[0].v[x] + row[1].v[x] + 1) / 2;
+					}
+				} else { // 4:4:4
+					const uint right = US_MIN(x * 2 + 1, width - 1);
+					uv[x * 2] = (row[0].u[x * 2] + row[0].u[right] + row[1].u[x * 2] + row[1].u[right] + 2) / 4;
+					uv[x * 2 + 1] = (row[0].v[x * 2] + row[0].v[right] + row[1].v[x * 2] + row[1].v[right] + 2) / 4;
+				}
+			}
+
+		} else {
+			const u8 *rgb[2];
+			for (uint index = 0; index < rows; ++index) {
+				rgb[index] = scratch[index].rgb;
+				_get_rgb_row(src, &planes, y + index, width, scratch[index].rgb);
+				u8 *const out = dest_y + (uz)(y + index) * y_stride;
+				for (uint x = 0; x < width; ++x) {
+					const u8 *const px = rgb[index] + x * 3;
+					out[x] = ((66 * px[0] + 129 * px[1] + 25 * px[2] + 128) >> 8) + 16;
+				}
+			}
+			if (rows == 1) {
+				rgb[1] = rgb[0];
+			}
+
+			for (uint x = 0; x < chroma_width; ++x) {
+				const uint left = x * 6;
+				const uint right = US_MIN(x * 2 + 1, width - 1) * 3;
+				int sum[3];
+				for (uint ch = 0; ch < 3; ++ch) {
+					sum[ch] = (rgb[0][left + ch] + rgb[0][right + ch] + rgb[1][left + ch] + rgb[1][right + ch] + 2) / 4;
+				}
+				uv[x * 2] = ((-38 * sum[0] - 74 * sum[1] + 112 * sum[2] + 128) >> 8) + 128;
+				uv[x * 2 + 1] = ((112 * sum[0] - 94 * sum[1] - 18 * sum[2] + 128) >> 8) + 128;
+			}
+		}
+	}
+
+	_scratch_destroy(&scratch[0]);
+	_scratch_destroy(&scratch[1]);
+	return 0;
+}
+
+bool us_convert_is_supported(uint format) {
+	switch (format) {
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_RGB565:
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			return true;
+		default: break;
+	}
+	return false;
+}
+
+const char *us_convert_get_kernels_name(void) {
+	return _get_kernels()->name;
+}
+
+int us_convert_set_kernels(const char *name) {
+	_get_kernels();
+	for (uint index = 0; index < US_ARRAY_LEN(_ALL_KERNELS); ++index) {
+		if (!strcmp(_ALL_KERNELS[index]->name, name) && _is_kernels_supported(_ALL_KERNELS[index])) {
+			_g_kernels = _ALL_KERNELS[index];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void us_convert_resize(
+	const u8 *src, uint src_width, uint src_height, uint src_stride,
+	u8 *dest, uint dest_width, uint dest_height, uint dest_stride,
+	uint channels) {
+
+	assert(channels >= 1 && channels <= 4);
+	if (src_width == 0 || src_height == 0 || dest_width == 0 || dest_height == 0) {
+		return;
+	}
+
+	const _kernels_s *const kernels = _get_kernels();
+
+	// 16.16 fixed point with the pixel centers aligned, the weights are 8-bit.
+	// The rows are blended by the kernel first and then the columns.
+	uint *xs; // Source offsets of the left and the right pixels
+	u8 *xw; // Weight of the right pixel
+	u8 *blended;
+	US_CALLOC(xs, dest_width * 2);
+	US_CALLOC(xw, dest_width);
+	US_CALLOC(blended, (uz)src_width * channels);
+	const u64 x_step = ((u64)src_width << 16) / dest_width;
+	for (uint x = 0; x < dest_width; ++x) {
+		const s64 pos = US_MAX((s64)(x * x_step + x_step / 2) - 0x8000, (s64)0);
+		const uint left = US_MIN((uint)(pos >> 16), src_width - 1);
+		const uint right = US_MIN(left + 1, src_width - 1);
+		xs[x * 2] = left * channels;
+		xs[x * 2 + 1] = right * channels;
+		xw[x] = (right > left ? (pos >> 8) & 0xFF : 0);
+	}
+
+	const u64 y_step = ((u64)src_height << 16) / dest_height;
+	uint blended_top = UINT_MAX;
+	uint blended_wy = 0;
+	for (uint y = 0; y < dest_height; ++y) {
+		const s64 pos = US_MAX((s64)(y * y_step + y_step / 2) - 0x8000, (s64)0);
+		const uint top = US_MIN((uint)(pos >> 16), src_height - 1);
+		const uint wy = (top + 1 < src_height ? (pos >> 8) & 0xFF : 0);
+		const u8 *row = src + (uz)top * src_stride;
+		if (wy > 0) {
+			// The upscaled rows often repeat
+			if (top != blended_top || wy != blended_wy) {
+				kernels->blend_rows(row, row + src_stride, wy, blended, src_width * channels);
+				blended_top = top;
+				blended_wy = wy;
+			}
+			row = blended;
+		}
+
+		u8 *const out = dest + (uz)y * dest_stride;
+		if (src_width == dest_width) {
+			memcpy(out, row, (uz)src_width * channels);
+			continue;
+		}
+		switch (channels) {
+			// The constant channels unroll the inner loop
+			case 1: _resize_row(row, xs, xw, out, dest_width, 1); break;
+			case 2: _resize_row(row, xs, xw, out, dest_width, 2); break;
+			case 3: _resize_row(row, xs, xw, out, dest_width, 3); break;
+			default: _resize_row(row, xs, xw, out, dest_width, 4); break;
+		}
+	}
+
+	free(xs);
+	free(xw);
+	free(blended);
+}
+
+static const _kernels_s *_get_kernels(void) {
+	assert(!pthread_once(&_g_kernels_once, _init_kernels));
+	return _g_kernels;
+}
+
+static void _init_kernels(void) {
+	// The best ones are the last
+	for (uint index = 0; index < US_ARRAY_LEN(_ALL_KERNELS); ++index) {
+		if (_is_kernels_supported(_ALL_KERNELS[index])) {
+			_g_kernels = _ALL_KERNELS[index];
+		}
+	}
+}
+
+static bool _is_kernels_supported(const _kernels_s *kernels) {
+#	ifdef _WITH_X86
+	__builtin_cpu_init();
+	if (kernels == &_AVX2_KERNELS) {
+		return __builtin_cpu_supports("avx2");
+	} else if (kernels == &_SSE41_KERNELS) {
+		return __builtin_cpu_supports("sse4.1");
+	}
+#	endif
+	(void)kernels;
+	return true; // Generic and NEON which is mandatory for AArch64
+}
+
+static int _get_planes(const us_frame_s *src, _planes_s *planes) {
+	const uint width = src->width;
+	const uint height = src->height;
+
+	uint bpp; // Bytes per pixel of the first plane
+	switch (src->format) {
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_GREY:
+			bpp = 1;
+			break;
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_RGB565:
+			bpp = 2;
+			break;
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			bpp = 3;
+			break;
+		default:
+			return -1;
+	}
+
+	uint line = width * bpp;
+	if (_is_yuv(src->format) && src->format != V4L2_PIX_FMT_NV24) {
+		line = (width + 1) / 2 * 2 * bpp; // The odd width has the whole last chroma sample
+	}
+	const uint stride = (src->stride > 0 ? src->stride : line);
+	if (width == 0 || height == 0 || stride < line) {
+		return -1;
+	}
+
+	const uz luma_size = (uz)stride * height;
+	uz size = luma_size;
+	memset(planes, 0, sizeof(_planes_s));
+	planes->data[0] = src->data;
+	planes->stride[0] = stride;
+
+	switch (src->format) {
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24: {
+			const uint chroma_stride = (src->format == V4L2_PIX_FMT_NV24 ? stride * 2 : stride);
+			const uint chroma_height = (src->format == V4L2_PIX_FMT_NV12 ? (height + 1) / 2 : height);
+			planes->data[1] = src->data + luma_size;
+			planes->stride[1] = chroma_stride;
+			size += (uz)chroma_stride * chroma_height;
+			break;
+		}
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420: {
+			const uint chroma_stride = stride / 2;
+			const uz chroma_size = (uz)chroma_stride * ((height + 1) / 2);
+			const bool yvu = (src->format == V4L2_PIX_FMT_YVU420);
+			planes->data[1] = src->data + luma_size + (yvu ? chroma_size : 0); // U
+			planes->data[2] = src->data + luma_size + (yvu ? 0 : chroma_size); // V
+			planes->stride[1] = chroma_stride;
+			planes->stride[2] = chroma_stride;
+			size += chroma_size * 2;
+			break;
+		}
+		default: break;
+	}
+
+	if (src->used < size) {
+		return -1;
+	}
+	return 0;
+}
+
+static bool _is_yuv(uint format) {
+	switch (format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			return true;
+		default: break;
+	}
+	return false;
+}
+
+static void _get_yuv_row(const us_frame_s *src, const _planes_s *planes, uint y, _scratch_s *scratch, _yuv_row_s *row) {
+	// Splits the source line to the planar Y, U and V rows.
+	// The planar formats are used directly, the packed ones are unpacked to the scratch.
+	const uint width = src->width;
+	const u8 *const line = planes->data[0] + (uz)y * planes->stride[0];
+	row->y = line;
+	row->u = scratch->u;
+	row->v = scratch->v;
+	row->chroma_shift = 1;
+
+	switch (src->format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY: {
+			// See also: https://www.kernel.org/doc/html/v4.8/media/uapi/v4l/pixfmt-uyvy.html
+			static const u8 yuyv[4] = {0, 1, 2, 3};
+			static const u8 yvyu[4] = {0, 3, 2, 1};
+			static const u8 uyvy[4] = {1, 0, 3, 2};
+			const u8 *const order = (
+				src->format == V4L2_PIX_FMT_YVYU ? yvyu
+				: src->format == V4L2_PIX_FMT_UYVY ? uyvy
+				: yuyv);
+			_get_kernels()->unpack_yuyv_row(line, order, scratch->y, scratch->u, scratch->v, width);
+			row->y = scratch->y;
+			break;
+		}
+
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24: {
+			const uint chroma_y = (src->format == V4L2_PIX_FMT_NV12 ? y / 2 : y);
+			const u8 *const uv = planes->data[1] + (uz)chroma_y * planes->stride[1];
+			const uint chroma_width = (src->format == V4L2_PIX_FMT_NV24 ? width : (width + 1) / 2);
+			_get_kernels()->unpack_uv_row(uv, scratch->u, scratch->v, chroma_width);
+			row->chroma_shift = (src->format == V4L2_PIX_FMT_NV24 ? 0 : 1);
+			break;
+		}
+
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			row->u = planes->data[1] + (uz)(y / 2) * planes->stride[1];
+			row->v = planes->data[2] + (uz)(y / 2) * planes->stride[2];
+			break;
+
+		default: assert(0 && "Unsupported pixel format");
+	}
+}
+
+static void _get_rgb_row(const us_frame_s *src, const _planes_s *planes, uint y, uint width, u8 *dest) {
+	const u8 *const line = planes->data[0] + (uz)y * planes->stride[0];
+
+	switch (src->format) {
+		case V4L2_PIX_FMT_GREY:
+			for (uint x = 0; x < width; ++x) {
+				dest[x * 3] = dest[x * 3 + 1] = dest[x * 3 + 2] = line[x];
+			}
+			break;
+
+		case V4L2_PIX_FMT_RGB565:
+			for (uint x = 0; x < width; ++x) {
+				const uint pixel = (line[x * 2 + 1] << 8) | line[x * 2];
+				dest[x * 3] = (pixel >> 8) & 0xF8; // Red
+				dest[x * 3 + 1] = (pixel >> 3) & 0xFC; // Green
+				dest[x * 3 + 2] = (pixel << 3) & 0xF8; // Blue
+			}
+			break;
+
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			_get_kernels()->rgb_row(line, (src->format == V4L2_PIX_FMT_BGR24), dest, width, US_CONVERT_RGB24);
+			break;
+
+		default: assert(0 && "Unsupported pixel format");
+	}
+}
+
+static void _scratch_init(_scratch_s *scratch, uint width) {
+	US_CALLOC(scratch->y, width);
+	US_CALLOC(scratch->u, width);
+	US_CALLOC(scratch->v, width);
+	US_CALLOC(scratch->rgb, width * 3);
+}
+
+static void _scratch_destroy(_scratch_s *scratch) {
+	free(scratch->y);
+	free(scratch->u);
+	free(scratch->v);
+	free(scratch->rgb);
+}
+
+static void _generic_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	for (uint x = 0; x < width; ++x) {
+		_put_yuv(dest, x, layout, y[x], u[x / 2], v[x / 2]);
+	}
+}
+
+static void _generic_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	for (uint x = 0; x < width; ++x) {
+		_put_yuv(dest, x, layout, y[x], u[x], v[x]);
+	}
+}
+
+static void _generic_rgb_row(const u8 *src, bool src_bgr, u8 *dest, uint width, us_convert_layout_e layout) {
+	if (!src_bgr && layout == US_CONVERT_RGB24) {
+		memcpy(dest, src, width * 3);
+		return;
+	}
+	const uint r = (src_bgr ? 2 : 0);
+	const uint b = (src_bgr ? 0 : 2);
+	for (uint x = 0; x < width; ++x) {
+		const u8 *const px = src + x * 3;
+		_put_rgb(dest, x, layout, px[r], px[1], px[b]);
+	}
+}
+
+static void _generic_unpack_yuyv_row(const u8 *src, const u8 *order, u8 *y, u8 *u, u8 *v, uint width) {
+	for (uint x = 0; x < width / 2; ++x) {
+		const u8 *const px = src + x * 4;
+		y[x * 2] = px[order[0]];
+		y[x * 2 + 1] = px[order[2]];
+		u[x] = px[order[1]];
+		v[x] = px[order[3]];
+	}
+	if (width & 1) {
+		const u8 *const px = src + (width - 1) * 2;
+		y[width - 1] = px[order[0]];
+		u[width / 2] = px[order[1]];
+		v[width / 2] = px[order[3]];
+	}
+}
+
+static void _generic_unpack_uv_row(const u8 *src, u8 *u, u8 *v, uint count) {
+	for (uint x = 0; x < count; ++x) {
+		u[x] = src[x * 2];
+		v[x] = src[x * 2 + 1];
+	}
+}
+
+static void _generic_blend_rows(const u8 *top, const u8 *bottom, uint weight, u8 *dest, uint count) {
+	for (uint x = 0; x < count; ++x) {
+		dest[x] = (top[x] * (256 - weight) + bottom[x] * weight + 128) >> 8;
+	}
+}
+
+
+#ifdef _WITH_X86
+#	define _SSE41 __attribute__((target("sse4.1")))
+#	define _AVX2 __attribute__((target("avx2")))
+
+_SSE41 static inline void _sse41_yuv8(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b) {
+	// 8 pixels in 16-bit lanes with 6 fractional bits, see _put_yuv() and _YUV_MUL_*
+	y = _mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), 7);
+	u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	v = _mm_slli_epi16(_mm_sub_epi16(v, _mm_set1_epi16(128)), 7);
+	const __m128i c = _mm_add_epi16(_mm_mulhrs_epi16(y, _mm_set1_epi16(_YUV_MUL_Y)), _mm_set1_epi16(32));
+	*r = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mulhrs_epi16(v, _mm_set1_epi16(_YUV_MUL_VR))), 6);
+	*g = _mm_srai_epi16(_mm_subs_epi16(c, _mm_add_epi16(
+		_mm_mulhrs_epi16(_mm_slli_epi16(u, 7), _mm_set1_epi16(_YUV_MUL_UG)),
+		_mm_mulhrs_epi16(v, _mm_set1_epi16(_YUV_MUL_VG)))), 6);
+	*b = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mulhrs_epi16(_mm_slli_epi16(u, 8), _mm_set1_epi16(_YUV_MUL_UB))), 6);
+}
+
+_SSE41 static inline void _sse41_yuv16(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b) {
+	// 16 pixels with the full-width chroma
+	const __m128i zero = _mm_setzero_si128();
+	__m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+	_sse41_yuv8(_mm_cvtepu8_epi16(y), _mm_cvtepu8_epi16(u), _mm_cvtepu8_epi16(v), &r_lo, &g_lo, &b_lo);
+	_sse41_yuv8(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(u, zero), _mm_unpackhi_epi8(v, zero), &r_hi, &g_hi, &b_hi);
+	*r = _mm_packus_epi16(r_lo, r_hi);
+	*g = _mm_packus_epi16(g_lo, g_hi);
+	*b = _mm_packus_epi16(b_lo, b_hi);
+}
+
+_SSE41 static inline void _sse41_store_rgb24x4(u8 *dest, __m128i q0, __m128i q1, __m128i q2, __m128i q3) {
+	// Each quad has 4 pixels in the lower 12 bytes
+	_mm_storeu_si128((__m128i*)dest, _mm_or_si128(q0, _mm_slli_si128(q1, 12)));
+	_mm_storeu_si128((__m128i*)(dest + 16), _mm_or_si128(_mm_srli_si128(q1, 4), _mm_slli_si128(q2, 8)));
+	_mm_storeu_si128((__m128i*)(dest + 32), _mm_or_si128(_mm_srli_si128(q2, 8), _mm_slli_si128(q3, 4)));
+}
+
+_SSE41 static inline void _sse41_store16(u8 *dest, __m128i r, __m128i g, __m128i b, us_convert_layout_e layout) {
+	if (layout == US_CONVERT_XRGB32) {
+		const __m128i bg_lo = _mm_unpacklo_epi8(b, g);
+		const __m128i bg_hi = _mm_unpackhi_epi8(b, g);
+		const __m128i rx_lo = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+		const __m128i rx_hi = _mm_unpackhi_epi8(r, _mm_set1_epi8(-1));
+		_mm_storeu_si128((__m128i*)dest, _mm_unpacklo_epi16(bg_lo, rx_lo));
+		_mm_storeu_si128((__m128i*)(dest + 16), _mm_unpackhi_epi16(bg_lo, rx_lo));
+		_mm_storeu_si128((__m128i*)(dest + 32), _mm_unpacklo_epi16(bg_hi, rx_hi));
+		_mm_storeu_si128((__m128i*)(dest + 48), _mm_unpackhi_epi16(bg_hi, rx_hi));
+	} else {
+		if (layout == US_CONVERT_BGR24) {
+			const __m128i tmp = r;
+			r = b;
+			b = tmp;
+		}
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		const __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+		const __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+		const __m128i bz_lo = _mm_unpacklo_epi8(b, zero);
+		const __m128i bz_hi = _mm_unpackhi_epi8(b, zero);
+		_sse41_store_rgb24x4(dest,
+			_mm_shuffle_epi8(_mm_unpacklo_epi16(rg_lo, bz_lo), mask),
+			_mm_shuffle_epi8(_mm_unpackhi_epi16(rg_lo, bz_lo), mask),
+			_mm_shuffle_epi8(_mm_unpacklo_epi16(rg_hi, bz_hi), mask),
+			_mm_shuffle_epi8(_mm_unpackhi_epi16(rg_hi, bz_hi), mask));
+	}
+}
+
+_SSE41 static void _sse41_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	const uint bpp = _get_layout_bpp(layout);
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const __m128i u8x8 = _mm_loadl_epi64((const __m128i*)(u + x / 2));
+		const __m128i v8x8 = _mm_loadl_epi64((const __m128i*)(v + x / 2));
+		__m128i r, g, b;
+		_sse41_yuv16(
+			_mm_loadu_si128((const __m128i*)(y + x)),
+			_mm_unpacklo_epi8(u8x8, u8x8),
+			_mm_unpacklo_epi8(v8x8, v8x8),
+			&r, &g, &b);
+		_sse41_store16(dest + x * bpp, r, g, b, layout);
+	}
+	_generic_yuv422_row(y + x, u + x / 2, v + x / 2, dest + x * bpp, width - x, layout);
+}
+
+_SSE41 static void _sse41_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	const uint bpp = _get_layout_bpp(layout);
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i r, g, b;
+		_sse41_yuv16(
+			_mm_loadu_si128((const __m128i*)(y + x)),
+			_mm_loadu_si128((const __m128i*)(u + x)),
+			_mm_loadu_si128((const __m128i*)(v + x)),
+			&r, &g, &b);
+		_sse41_store16(dest + x * bpp, r, g, b, layout);
+	}
+	_generic_yuv444_row(y + x, u + x, v + x, dest + x * bpp, width - x, layout);
+}
+
+_SSE41 static void _sse41_rgb_row(const u8 *src, bool src_bgr, u8 *dest, uint width, us_convert_layout_e layout) {
+	const bool swap = (src_bgr != (layout != US_CONVERT_RGB24));
+	if (!swap && layout != US_CONVERT_XRGB32) {
+		memcpy(dest, src, width * 3);
+		return;
+	}
+	const uint bpp = _get_layout_bpp(layout);
+	__m128i mask;
+	if (layout == US_CONVERT_XRGB32) {
+		mask = (swap
+			? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+			: _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+	} else {
+		mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1);
+	}
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		// 16 pixels are 48 bytes = 4 quads of 12 bytes
+		const u8 *const px = src + x * 3;
+		const __m128i in0 = _mm_loadu_si128((const __m128i*)px);
+		const __m128i in1 = _mm_loadu_si128((const __m128i*)(px + 16));
+		const __m128i in2 = _mm_loadu_si128((const __m128i*)(px + 32));
+		const __m128i q0 = _mm_shuffle_epi8(in0, mask);
+		const __m128i q1 = _mm_shuffle_epi8(_mm_alignr_epi8(in1, in0, 12), mask);
+		const __m128i q2 = _mm_shuffle_epi8(_mm_alignr_epi8(in2, in1, 8), mask);
+		const __m128i q3 = _mm_shuffle_epi8(_mm_srli_si128(in2, 4), mask);
+		u8 *const out = dest + x * bpp;
+		if (layout == US_CONVERT_XRGB32) {
+			_mm_storeu_si128((__m128i*)out, _mm_or_si128(q0, alpha));
+			_mm_storeu_si128((__m128i*)(out + 16), _mm_or_si128(q1, alpha));
+			_mm_storeu_si128((__m128i*)(out + 32), _mm_or_si128(q2, alpha));
+			_mm_storeu_si128((__m128i*)(out + 48), _mm_or_si128(q3, alpha));
+		} else {
+			_sse41_store_rgb24x4(out, q0, q1, q2, q3);
+		}
+	}
+	_generic_rgb_row(src + x * 3, src_bgr, dest + x * bpp, width - x, layout);
+}
+
+_SSE41 static void _sse41_unpack_yuyv_row(const u8 *src, const u8 *order, u8 *y, u8 *u, u8 *v, uint width) {
+	// Every 16 bytes are shuffled to 8 Y, 4 U and 4 V
+	u8 mask_bytes[16];
+	for (uint pair = 0; pair < 4; ++pair) {
+		mask_bytes[pair * 2] = pair * 4 + order[0];
+		mask_bytes[pair * 2 + 1] = pair * 4 + order[2];
+		mask_bytes[8 + pair] = pair * 4 + order[1];
+		mask_bytes[12 + pair] = pair * 4 + order[3];
+	}
+	const __m128i mask = _mm_loadu_si128((const __m128i*)mask_bytes);
+
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 2)), mask);
+		const __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 2 + 16)), mask);
+		const __m128i uv = _mm_unpackhi_epi32(lo, hi); // U0-3, U4-7, V0-3, V4-7
+		_mm_storeu_si128((__m128i*)(y + x), _mm_unpacklo_epi64(lo, hi));
+		_mm_storel_epi64((__m128i*)(u + x / 2), uv);
+		_mm_storel_epi64((__m128i*)(v + x / 2), _mm_srli_si128(uv, 8));
+	}
+	_generic_unpack_yuyv_row(src + x * 2, order, y + x, u + x / 2, v + x / 2, width - x);
+}
+
+_SSE41 static void _sse41_unpack_uv_row(const u8 *src, u8 *u, u8 *v, uint count) {
+	const __m128i mask = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+	uint x = 0;
+	for (; x + 8 <= count; x += 8) {
+		const __m128i uv = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 2)), mask);
+		_mm_storel_epi64((__m128i*)(u + x), uv);
+		_mm_storel_epi64((__m128i*)(v + x), _mm_srli_si128(uv, 8));
+	}
+	_generic_unpack_uv_row(src + x * 2, u + x, v + x, count - x);
+}
+
+_SSE41 static void _sse41_blend_rows(const u8 *top, const u8 *bottom, uint weight, u8 *dest, uint count) {
+	// The sum is 65280 at most, so the unsigned 16-bit lanes are enough
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w_top = _mm_set1_epi16(256 - weight);
+	const __m128i w_bottom = _mm_set1_epi16(weight);
+	const __m128i half = _mm_set1_epi16(128);
+	uint x = 0;
+	for (; x + 16 <= count; x += 16) {
+		const __m128i t = _mm_loadu_si128((const __m128i*)(top + x));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(bottom + x));
+		const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_cvtepu8_epi16(t), w_top),
+			_mm_mullo_epi16(_mm_cvtepu8_epi16(b), w_bottom)), half), 8);
+		const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpackhi_epi8(t, zero), w_top),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w_bottom)), half), 8);
+		_mm_storeu_si128((__m128i*)(dest + x), _mm_packus_epi16(lo, hi));
+	}
+	_generic_blend_rows(top + x, bottom + x, weight, dest + x, count - x);
+}
+
+_AVX2 static inline void _avx2_yuv16(__m256i y, __m256i u, __m256i v, __m256i *r, __m256i *g, __m256i *b) {
+	// 16 pixels in 16-bit lanes, see _sse41_yuv8()
+	y = _mm256_slli_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)), 7);
+	u = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+	v = _mm256_slli_epi16(_mm256_sub_epi16(v, _mm256_set1_epi16(128)), 7);
+	const __m256i c = _mm256_add_epi16(_mm256_mulhrs_epi16(y, _mm256_set1_epi16(_YUV_MUL_Y)), _mm256_set1_epi16(32));
+	*r = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mulhrs_epi16(v, _mm256_set1_epi16(_YUV_MUL_VR))), 6);
+	*g = _mm256_srai_epi16(_mm256_subs_epi16(c, _mm256_add_epi16(
+		_mm256_mulhrs_epi16(_mm256_slli_epi16(u, 7), _mm256_set1_epi16(_YUV_MUL_UG)),
+		_mm256_mulhrs_epi16(v, _mm256_set1_epi16(_YUV_MUL_VG)))), 6);
+	*b = _mm256_srai_epi16(_mm256_adds_epi16(c, _mm256_mulhrs_epi16(_mm256_slli_epi16(u, 8), _mm256_set1_epi16(_YUV_MUL_UB))), 6);
+}
+
+_AVX2 static inline void _avx2_yuv32(__m256i y, __m128i u_lo, __m128i u_hi, __m128i v_lo, __m128i v_hi, u8 *dest, us_convert_layout_e layout) {
+	// 32 pixels with the full-width chroma as the two halves
+	__m256i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+	_avx2_yuv16(
+		_mm256_cvtepu8_epi16(_mm256_castsi256_si128(y)),
+		_mm256_cvtepu8_epi16(u_lo), _mm256_cvtepu8_epi16(v_lo),
+		&r_lo, &g_lo, &b_lo);
+	_avx2_yuv16(
+		_mm256_cvtepu8_epi16(_mm256_extracti128_si256(y, 1)),
+		_mm256_cvtepu8_epi16(u_hi), _mm256_cvtepu8_epi16(v_hi),
+		&r_hi, &g_hi, &b_hi);
+	// The packing is per 128-bit lane, so restore the order of the quadwords
+	const __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r_lo, r_hi), 0xD8);
+	const __m256i g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g_lo, g_hi), 0xD8);
+	const __m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b_lo, b_hi), 0xD8);
+	const uint bpp = _get_layout_bpp(layout);
+	_sse41_store16(dest, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b), layout);
+	_sse41_store16(dest + 16 * bpp, _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1), layout);
+}
+
+_AVX2 static void _avx2_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	const uint bpp = _get_layout_bpp(layout);
+	uint x = 0;
+	for (; x + 32 <= width; x += 32) {
+		const __m128i u8x16 = _mm_loadu_si128((const __m128i*)(u + x / 2));
+		const __m128i v8x16 = _mm_loadu_si128((const __m128i*)(v + x / 2));
+		_avx2_yuv32(
+			_mm256_loadu_si256((const __m256i*)(y + x)),
+			_mm_unpacklo_epi8(u8x16, u8x16), _mm_unpackhi_epi8(u8x16, u8x16),
+			_mm_unpacklo_epi8(v8x16, v8x16), _mm_unpackhi_epi8(v8x16, v8x16),
+			dest + x * bpp, layout);
+	}
+	_sse41_yuv422_row(y + x, u + x / 2, v + x / 2, dest + x * bpp, width - x, layout);
+}
+
+_AVX2 static void _avx2_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	const uint bpp = _get_layout_bpp(layout);
+	uint x = 0;
+	for (; x + 32 <= width; x += 32) {
+		_avx2_yuv32(
+			_mm256_loadu_si256((const __m256i*)(y + x)),
+			_mm_loadu_si128((const __m128i*)(u + x)), _mm_loadu_si128((const __m128i*)(u + x + 16)),
+			_mm_loadu_si128((const __m128i*)(v + x)), _mm_loadu_si128((const __m128i*)(v + x + 16)),
+			dest + x * bpp, layout);
+	}
+	_sse41_yuv444_row(y + x, u + x, v + x, dest + x * bpp, width - x, layout);
+}
+
+#	undef _AVX2
+#	undef _SSE41
+#endif // _WITH_X86
+
+
+#ifdef _WITH_NEON
+static inline void _neon_yuv8(int16x8_t y, int16x8_t u, int16x8_t v, uint8x8_t *r, uint8x8_t *g, uint8x8_t *b) {
+	// 8 pixels in 16-bit lanes, vqrdmulh is the same as _mm_mulhrs_epi16() in _sse41_yuv8()
+	y = vshlq_n_s16(vsubq_s16(y, vdupq_n_s16(16)), 7);
+	u = vsubq_s16(u, vdupq_n_s16(128));
+	v = vshlq_n_s16(vsubq_s16(v, vdupq_n_s16(128)), 7);
+	const int16x8_t c = vaddq_s16(vqrdmulhq_n_s16(y, _YUV_MUL_Y), vdupq_n_s16(32));
+	*r = vqshrun_n_s16(vqaddq_s16(c, vqrdmulhq_n_s16(v, _YUV_MUL_VR)), 6);
+	*g = vqshrun_n_s16(vqsubq_s16(c, vaddq_s16(
+		vqrdmulhq_n_s16(vshlq_n_s16(u, 7), _YUV_MUL_UG),
+		vqrdmulhq_n_s16(v, _YUV_MUL_VG))), 6);
+	*b = vqshrun_n_s16(vqaddq_s16(c, vqrdmulhq_n_s16(vshlq_n_s16(u, 8), _YUV_MUL_UB)), 6);
+}
+
+static inline int16x8_t _neon_widen(uint8x8_t value) {
+	return vreinterpretq_s16_u16(vmovl_u8(value));
+}
+
+static inline void _neon_yuv16(uint8x16_t y, uint8x8_t u_lo, uint8x8_t u_hi, uint8x8_t v_lo, uint8x8_t v_hi, u8 *dest, us_convert_layout_e layout) {
+	uint8x8_t r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+	_neon_yuv8(_neon_widen(vget_low_u8(y)), _neon_widen(u_lo), _neon_widen(v_lo), &r_lo, &g_lo, &b_lo);
+	_neon_yuv8(_neon_widen(vget_high_u8(y)), _neon_widen(u_hi), _neon_widen(v_hi), &r_hi, &g_hi, &b_hi);
+	const uint8x16_t r = vcombine_u8(r_lo, r_hi);
+	const uint8x16_t g = vcombine_u8(g_lo, g_hi);
+	const uint8x16_t b = vcombine_u8(b_lo, b_hi);
+	switch (layout) {
+		case US_CONVERT_RGB24: vst3q_u8(dest, (uint8x16x3_t){{r, g, b}}); break;
+		case US_CONVERT_BGR24: vst3q_u8(dest, (uint8x16x3_t){{b, g, r}}); break;
+		case US_CONVERT_XRGB32: vst4q_u8(dest, (uint8x16x4_t){{b, g, r, vdupq_n_u8(0xFF)}}); break;
+	}
+}
+
+static void _neon_yuv422_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	const uint bpp = _get_layout_bpp(layout);
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const uint8x8_t u8x8 = vld1_u8(u + x / 2);
+		const uint8x8_t v8x8 = vld1_u8(v + x / 2);
+		const uint8x8x2_t uu = vzip_u8(u8x8, u8x8);
+		const uint8x8x2_t vv = vzip_u8(v8x8, v8x8);
+		_neon_yuv16(vld1q_u8(y + x), uu.val[0], uu.val[1], vv.val[0], vv.val[1], dest + x * bpp, layout);
+	}
+	_generic_yuv422_row(y + x, u + x / 2, v + x / 2, dest + x * bpp, width - x, layout);
+}
+
+static void _neon_yuv444_row(const u8 *y, const u8 *u, const u8 *v, u8 *dest, uint width, us_convert_layout_e layout) {
+	const uint bpp = _get_layout_bpp(layout);
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const uint8x16_t u8x16 = vld1q_u8(u + x);
+		const uint8x16_t v8x16 = vld1q_u8(v + x);
+		_neon_yuv16(vld1q_u8(y + x),
+			vget_low_u8(u8x16), vget_high_u8(u8x16),
+			vget_low_u8(v8x16), vget_high_u8(v8x16),
+			dest + x * bpp, layout);
+	}
+	_generic_yuv444_row(y + x, u + x, v + x, dest + x * bpp, width - x, layout);
+}
+
+static void _neon_rgb_row(const u8 *src, bool src_bgr, u8 *dest, uint width, us_convert_layout_e layout) {
+	if (!src_bgr && layout == US_CONVERT_RGB24) {
+		memcpy(dest, src, width * 3);
+		return;
+	}
+	const uint bpp = _get_layout_bpp(layout);
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const uint8x16x3_t px = vld3q_u8(src + x * 3);
+		const uint8x16_t r = px.val[src_bgr ? 2 : 0];
+		const uint8x16_t b = px.val[src_bgr ? 0 : 2];
+		switch (layout) {
+			case US_CONVERT_RGB24: vst3q_u8(dest + x * bpp, (uint8x16x3_t){{r, px.val[1], b}}); break;
+			case US_CONVERT_BGR24: vst3q_u8(dest + x * bpp, (uint8x16x3_t){{b, px.val[1], r}}); break;
+			case US_CONVERT_XRGB32: vst4q_u8(dest + x * bpp, (uint8x16x4_t){{b, px.val[1], r, vdupq_n_u8(0xFF)}}); break;
+		}
+	}
+	_generic_rgb_row(src + x * 3, src_bgr, dest + x * bpp, width - x, layout);
+}
+
+static void _neon_unpack_yuyv_row(const u8 *src, const u8 *order, u8 *y, u8 *u, u8 *v, uint width) {
+	uint x = 0;
+	for (; x + 16 <= width; x += 16) {
+		const uint8x8x4_t px = vld4_u8(src + x * 2);
+		vst2_u8(y + x, (uint8x8x2_t){{px.val[order[0]], px.val[order[2]]}});
+		vst1_u8(u + x / 2, px.val[order[1]]);
+		vst1_u8(v + x / 2, px.val[order[3]]);
+	}
+	_generic_unpack_yuyv_row(src + x * 2, order, y + x, u + x / 2, v + x / 2, width - x);
+}
+
+static void _neon_unpack_uv_row(const u8 *src, u8 *u, u8 *v, uint count) {
+	uint x = 0;
+	for (; x + 16 <= count; x += 16) {
+		const uint8x16x2_t uv = vld2q_u8(src + x * 2);
+		vst1q_u8(u + x, uv.val[0]);
+		vst1q_u8(v + x, uv.val[1]);
+	}
+	_generic_unpack_uv_row(src + x * 2, u + x, v + x, count - x);
+}
+
+static void _neon_blend_rows(const u8 *top, const u8 *bottom, uint weight, u8 *dest, uint count) {
+	// top * 256 + (bottom - top) * weight wraps in the middle, but the result fits 16 bits
+	const uint8x8_t w = vdup_n_u8(weight);
+	uint x = 0;
+	for (; x + 16 <= count; x += 16) {
+		const uint8x16_t t = vld1q_u8(top + x);
+		const uint8x16_t b = vld1q_u8(bottom + x);
+		uint16x8_t lo = vshll_n_u8(vget_low_u8(t), 8);
+		uint16x8_t hi = vshll_n_u8(vget_high_u8(t), 8);
+		lo = vmlsl_u8(vmlal_u8(lo, vget_low_u8(b), w), vget_low_u8(t), w);
+		hi = vmlsl_u8(vmlal_u8(hi, vget_high_u8(b), w), vget_high_u8(t), w);
+		vst1q_u8(dest + x, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+	}
+	_generic_blend_rows(top + x, bottom + x, weight, dest + x, count - x);
+}
+#endif // _WITH_NEON
@@ -0,0 +1,67 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "types.h"
+#include "frame.h"
+
+
+// The byte order of the packed output in memory
+typedef enum {
+	US_CONVERT_RGB24,	// R, G, B
+	US_CONVERT_BGR24,	// B, G, R: DRM_FORMAT_RGB888
+	US_CONVERT_XRGB32,	// B, G, R, 0xFF: DRM_FORMAT_XRGB8888
+} us_convert_layout_e;
+
+
+// Stride-aware conversions of the raw frames to the packed RGB or GREY images.
+// The source stride is the bytes per line of the first plane, 0 means no padding.
+// Returns -1 if the format is not supported or the frame data is too short.
+int us_convert_to_rgb24(const us_frame_s *src, u8 *dest, uint dest_stride);
+int us_convert_to_grey(const us_frame_s *src, u8 *dest, uint dest_stride);
+
+// The same with the explicit output layout. The image is cropped
+// to max_width x max_height if they are not 0.
+int us_convert_to_packed(
+	const us_frame_s *src, us_convert_layout_e layout, u8 *dest, uint dest_stride,
+	uint max_width, uint max_height);
+
+// The raw formats accepted by the functions above
+bool us_convert_is_supported(uint format);
+
+// BT.601 limited range NV12 for the hardware encoders
+int us_convert_to_nv12(const us_frame_s *src, u8 *dest_y, uint y_stride, u8 *dest_uv, uint uv_stride);
+
+// The YUV->RGB kernels are selected once by the CPU features: AVX2, SSE4.1, NEON or generic
+const char *us_convert_get_kernels_name(void);
+
+// For the tests and the benchmark: forces the kernels with this name.
+// Returns -1 if they are not built or not supported by the CPU.
+// It must not be called while any conversion is running.
+int us_convert_set_kernels(const char *name);
+
+// Bilinear resize of the packed 8-bit image with 1..4 channels
+void us_convert_resize(
+	const u8 *src, uint src_width, uint src_height, uint src_stride,
+	u8 *dest, uint dest_width, uint dest_height, uint dest_stride,
+	uint channels);
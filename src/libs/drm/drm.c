@@ -38,7 +38,6 @@
 #include <xf86drmMode.h>
 #include <drm_fourcc.h>
 #include <libdrm/drm.h>
-#include <libyuv.h>
 
 #include "../types.h"
 #include "../errors.h"
@@ -47,6 +46,7 @@
 #include "../frame.h"
 #include "../frametext.h"
 #include "../capture.h"
+#include "../convert.h"
 #include "../unjpeg.h"
 
 
@@ -54,12 +54,26 @@ static void _drm_vsync_callback(int fd, uint n_frame, uint sec, uint usec, void
 static int _drm_check_status(us_drm_s *drm);
 static void _drm_ensure_dpms_power(us_drm_s *drm, bool on);
 static int _drm_init_buffers(us_drm_s *drm, const us_capture_s *cap);
+static int _drm_init_dma(us_drm_s *drm, const us_capture_s *cap);
+static bool _drm_check_scanout(us_drm_s *drm, const us_capture_s *cap);
+static bool _drm_has_plane_format(us_drm_s *drm, u32 format);
+static int _drm_init_swapchain(us_drm_s *drm, const us_capture_s *cap);
+static int _drm_create_dumb(us_drm_s *drm, us_drm_buffer_s *buf, uint width, uint height);
+static void _drm_destroy_buffer(us_drm_s *drm, us_drm_buffer_s *buf, uint n_buf);
+static int _drm_find_plane(us_drm_s *drm);
+static void _drm_read_plane_formats(us_drm_s *drm, const drmModePlane *plane);
+static int _drm_init_atomic(us_drm_s *drm);
+static bool _drm_test_plane_scaling(us_drm_s *drm, uint width, uint height);
+static int _drm_atomic_commit(us_drm_s *drm, us_drm_buffer_s *buf, u32 flags);
+static int _drm_flip(us_drm_s *drm, us_drm_buffer_s *buf, bool async);
+static int _drm_present(us_drm_s *drm, uint n_buf);
+static int _drm_expose_converted(us_drm_s *drm, const us_frame_s *frame);
+static int _drm_handle_events(us_drm_s *drm, bool wait);
+static void _drm_account_flip(us_drm_s *drm, const us_drm_buffer_s *buf);
 static int _drm_find_sink(us_drm_s *drm, uint width, uint height, float hz);
-static void _drm_calculate_center(us_drm_center_s *center, uint src_w, uint src_h, uint dst_w, uint dst_h);
-static void _drm_convert_yuyv_simple(const u8 *src_data, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h);
-static void _drm_convert_rgb24(const u8 *src_data, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h);
-static void _drm_convert_bgr24(const u8 *src_data, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h);
-static void _drm_convert_mjpeg(const u8 *src_data, size_t src_size, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h);
+static void _drm_calculate_fit(us_drm_fit_s *fit, uint src_w, uint src_h, uint dst_w, uint dst_h);
+static int _drm_draw_frame(us_drm_s *drm, const us_frame_s *frame, us_drm_buffer_s *buf);
+static void _drm_clear_borders(us_drm_buffer_s *buf, const us_drm_fit_s *fit, uint dst_w, uint dst_h);
 
 // Platform-specific implementation functions
 static int _drm_expose_rpi_v4p_impl(us_drm_s *drm, const us_capture_hwbuf_s *hw);
@@ -68,14 +82,20 @@ static int _drm_expose_amlogic_display_impl(us_drm_s *drm, const us_capture_hwbu
 static drmModeModeInfo *_find_best_mode(drmModeConnector *conn, uint width, uint height, float hz);
 static u32 _find_dpms(int fd, drmModeConnector *conn);
 static u32 _find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, u32 *taken_crtcs);
+static u32 _find_property(int fd, u32 obj_id, u32 obj_type, const char *name, u64 *value);
+static u32 _v4l2_to_drm_format(uint format);
 static const char *_connector_type_to_string(u32 type);
 static float _get_refresh_rate(const drmModeModeInfo *mode);
 static us_drm_platform_e _detect_drm_platform(int fd);
 
 
+// The buffer on the screen, the one waiting for the vblank and the one being drawn
+#define _SWAPCHAIN_SIZE	3
+
 #define _LOG_ERROR(x_msg, ...)	US_LOG_ERROR("DRM: " x_msg, ##__VA_ARGS__)
 #define _LOG_PERROR(x_msg, ...)	US_LOG_PERROR("DRM: " x_msg, ##__VA_ARGS__)
 #define _LOG_INFO(x_msg, ...)		US_LOG_INFO("DRM: " x_msg, ##__VA_ARGS__)
+#define _LOG_PERF(x_msg, ...)		US_LOG_PERF("DRM: " x_msg, ##__VA_ARGS__)
 #define _LOG_VERBOSE(x_msg, ...)	US_LOG_VERBOSE("DRM: " x_msg, ##__VA_ARGS__)
 #define _LOG_DEBUG(x_msg, ...)	US_LOG_DEBUG("DRM: " x_msg, ##__VA_ARGS__)
 
@@ -92,6 +112,10 @@ us_drm_s *us_drm_init(void) {
 	run->ft = us_frametext_init();
 	run->detected_bpp = 24;  // 默认24位
 	run->platform = US_DRM_PLATFORM_UNKNOWN;  // Will be detected during open
+	run->decoded = us_frame_init();
+	run->front_n_buf = -1;
+	run->pending_n_buf = -1;
+	run->queued_n_buf = -1;
 
 	us_drm_s *drm;
 	US_CALLOC(drm, 1);
@@ -106,6 +130,8 @@ us_drm_s *us_drm_init(void) {
 }
 
 void us_drm_destroy(us_drm_s *drm) {
+	us_frame_destroy(drm->run->decoded);
+	US_DELETE(drm->run->plane_formats, free);
 	us_frametext_destroy(drm->run->ft);
 	US_DELETE(drm->run, free);
 	US_DELETE(drm->path, free);
@@ -166,8 +192,7 @@ int us_drm_open(us_drm_s *drm, const us_capture_s *cap) {
 	int stub = 0; // Open the real device with DMA
 	if (cap == NULL) {
 		stub = US_DRM_STUB_USER;
-	} else if (cap->run->format != V4L2_PIX_FMT_RGB24 && cap->run->format != V4L2_PIX_FMT_BGR24 && 
-	           cap->run->format != V4L2_PIX_FMT_YUYV && cap->run->format != V4L2_PIX_FMT_MJPEG) {
+	} else if (!us_is_jpeg(cap->run->format) && !us_convert_is_supported(cap->run->format)) {
 		stub = US_DRM_STUB_BAD_FORMAT;
 		char fourcc_str[8];
 		us_fourcc_to_string(cap->run->format, fourcc_str, 8);
@@ -192,6 +217,13 @@ int us_drm_open(us_drm_s *drm, const us_capture_s *cap) {
 	}
 #	undef CHECK_CAP
 
+	{
+		// Virtual drivers like vkms don't support the async flips
+		u64 async_flip = 0;
+		run->has_async_flip = (drmGetCap(run->fd, DRM_CAP_ASYNC_PAGE_FLIP, &async_flip) == 0 && async_flip);
+		_LOG_DEBUG("Async page flip: %s", (run->has_async_flip ? "supported" : "unsupported"));
+	}
+
 	const uint width = (stub > 0 ? 0 : cap->run->width);
 	const uint height = (stub > 0 ? 0 : cap->run->height);
 	const uint hz = (stub > 0 ? 0 : cap->run->hz);
@@ -200,10 +232,21 @@ int us_drm_open(us_drm_s *drm, const us_capture_s *cap) {
 		case US_ERROR_NO_DEVICE: goto unplugged;
 		default: goto error;
 	}
-	if ((stub == 0) && (width != run->mode.hdisplay || height < run->mode.vdisplay)) {
-		// We'll try to show something instead of nothing if height != vdisplay
-		stub = US_DRM_STUB_BAD_RESOLUTION;
-		_LOG_ERROR("There is no appropriate modes for the capture, forcing to STUB ...");
+	{
+		u64 modifiers = 0;
+		run->has_modifiers = (drmGetCap(run->fd, DRM_CAP_ADDFB2_MODIFIERS, &modifiers) == 0 && modifiers);
+	}
+	_drm_find_plane(drm); // Not fatal, the formats are just unknown
+	_drm_init_atomic(drm); // Falls back to the legacy API
+
+	if (stub == 0) {
+		// The DMA import is only possible if the display shows the capture buffer as is,
+		// otherwise the frames are decoded and scaled to the dumb buffers.
+		run->converting = !_drm_check_scanout(drm, cap);
+		if (width != run->mode.hdisplay || height != run->mode.vdisplay) {
+			_LOG_INFO("There is no exact mode for the capture, scaling %ux%u to %ux%u ...",
+				width, height, run->mode.hdisplay, run->mode.vdisplay);
+		}
 	}
 
 	if (_drm_init_buffers(drm, (stub > 0 ? NULL : cap)) < 0) {
@@ -213,8 +256,13 @@ int us_drm_open(us_drm_s *drm, const us_capture_s *cap) {
 	run->saved_crtc = drmModeGetCrtc(run->fd, run->crtc_id);
 	_LOG_DEBUG("Setting up CRTC ...");
 
-	// Standard CRTC setup for all platforms
-	if (drmModeSetCrtc(run->fd, run->crtc_id, run->bufs[0].id, 0, 0, &run->conn_id, 1, &run->mode) < 0) {
+	int modeset;
+	if (run->atomic) {
+		modeset = _drm_atomic_commit(drm, &run->bufs[0], DRM_MODE_ATOMIC_ALLOW_MODESET);
+	} else {
+		modeset = drmModeSetCrtc(run->fd, run->crtc_id, run->bufs[0].id, 0, 0, &run->conn_id, 1, &run->mode);
+	}
+	if (modeset < 0) {
 		if (errno == EACCES || errno == EPERM) {
 			_LOG_INFO("CRTC is busy (probably used by desktop environment), continuing without display control");
 		} else {
@@ -223,7 +271,10 @@ int us_drm_open(us_drm_s *drm, const us_capture_s *cap) {
 		}
 	}
 
-	_LOG_INFO("Opened for %s ...", (stub > 0 ? "STUB" : "DMA"));
+	_LOG_INFO("Opened for %s ...", (stub > 0 ? "STUB" : (run->converting ? "SWAPCHAIN" : "DMA")));
+	run->front_n_buf = 0;
+	run->pending_n_buf = -1;
+	run->queued_n_buf = -1;
 	run->exposing_dma_fd = -1;
 	run->blank_at_ts = 0;
 	run->opened = stub;
@@ -270,24 +321,17 @@ void us_drm_close(us_drm_s *drm) {
 	if (run->bufs != NULL) {
 		_LOG_DEBUG("Releasing buffers ...");
 		for (uint n_buf = 0; n_buf < run->n_bufs; ++n_buf) {
-			us_drm_buffer_s *const buf = &run->bufs[n_buf];
-			if (buf->fb_added && drmModeRmFB(run->fd, buf->id) < 0) {
-				_LOG_PERROR("Can't remove buffer=%u", n_buf);
-			}
-			if (buf->dumb_created) {
-				struct drm_mode_destroy_dumb destroy = {.handle = buf->handle};
-				if (drmIoctl(run->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy) < 0) {
-					_LOG_PERROR("Can't destroy dumb buffer=%u", n_buf);
-				}
-			}
-			if (buf->data != NULL && munmap(buf->data, buf->allocated)) {
-				_LOG_PERROR("Can't unmap buffer=%u", n_buf);
-			}
+			_drm_destroy_buffer(drm, &run->bufs[n_buf], n_buf);
 		}
 		US_DELETE(run->bufs, free);
 		run->n_bufs = 0;
 	}
 
+	if (run->mode_blob_id > 0) {
+		drmModeDestroyPropertyBlob(run->fd, run->mode_blob_id);
+		run->mode_blob_id = 0;
+	}
+
 	const bool say = (run->fd >= 0);
 	US_CLOSE_FD(run->status_fd);
 
@@ -305,6 +349,18 @@ void us_drm_close(us_drm_s *drm) {
 	run->opened = -1;
 	run->has_vsync = true;
 	run->stub_n_buf = 0;
+	run->converting = false;
+	run->has_async_flip = false;
+	run->atomic = false;
+	run->flipped = NULL;
+	US_MEMSET_ZERO(run->perf);
+	run->plane_id = 0;
+	US_DELETE(run->plane_formats, free);
+	run->n_plane_formats = 0;
+	run->has_modifiers = false;
+	run->front_n_buf = -1;
+	run->pending_n_buf = -1;
+	run->queued_n_buf = -1;
 
 	if (say) {
 		_LOG_INFO("Closed");
@@ -371,47 +427,26 @@ int us_drm_wait_for_vsync(us_drm_s *drm) {
 	}
 
 	// Skip VSync wait for Amlogic platforms - they don't support it reliably
-	if (run->platform == US_DRM_PLATFORM_AMLOGIC) {
+	if (run->platform == US_DRM_PLATFORM_AMLOGIC && !run->atomic) {
 		_LOG_DEBUG("Skipping VSync wait on Amlogic platform");
 		run->has_vsync = true; // Mark as having VSync to avoid future calls
 		return 0;
 	}
 
-	struct timeval timeout = {.tv_sec = drm->timeout};
-	fd_set fds;
-	FD_ZERO(&fds);
-	FD_SET(run->fd, &fds);
-
-	_LOG_DEBUG("Calling select() for VSync ...");
-	const int result = select(run->fd + 1, &fds, NULL, NULL, &timeout);
-	if (result < 0) {
-		_LOG_PERROR("Can't select(%d) device for VSync", run->fd);
-		return -1;
-	} else if (result == 0) {
-		_LOG_ERROR("Device timeout while waiting VSync");
-		return -1;
-	}
-
-	drmEventContext ctx = {
-		.version = DRM_EVENT_CONTEXT_VERSION,
-		.page_flip_handler = _drm_vsync_callback,
-	};
-	_LOG_DEBUG("Handling DRM event (maybe VSync) ...");
-	if (drmHandleEvent(run->fd, &ctx) < 0) {
-		_LOG_PERROR("Can't handle DRM event");
-		return -1;
-	}
-	return 0;
+	// The swapchain always has a free buffer for the next frame,
+	// so it's only worth waiting if the drawn one is queued for the vblank.
+	const bool wait = (run->opened != 0 || !run->converting || run->queued_n_buf >= 0);
+	return _drm_handle_events(drm, wait);
 }
 
 static void _drm_vsync_callback(int fd, uint n_frame, uint sec, uint usec, void *v_buf) {
 	(void)fd;
 	(void)n_frame;
-	(void)sec;
-	(void)usec;
 	us_drm_buffer_s *const buf = v_buf;
+	buf->vblank_us = (u64)sec * 1000000 + usec; // CLOCK_MONOTONIC
 	*buf->ctx.has_vsync = true;
 	*buf->ctx.exposing_dma_fd = -1;
+	*buf->ctx.flipped = buf;
 	_LOG_DEBUG("Got VSync signal");
 }
 
@@ -458,24 +493,35 @@ int us_drm_expose_stub(us_drm_s *drm, us_drm_stub_e stub, const us_capture_s *ca
 	}
 #	undef DRAW_MSG
 
+	// Don't draw over the buffer on the screen or the one waiting for the vblank
+	for (uint tries = 0; tries < run->n_bufs; ++tries) {
+		if ((int)run->stub_n_buf != run->front_n_buf && (int)run->stub_n_buf != run->pending_n_buf) {
+			break;
+		}
+		run->stub_n_buf = (run->stub_n_buf + 1) % run->n_bufs;
+	}
 	us_drm_buffer_s *const buf = &run->bufs[run->stub_n_buf];
 
-	run->has_vsync = false;
-
-	_LOG_DEBUG("Copying STUB frame ...")
-	memcpy(buf->data, run->ft->frame->data, US_MIN(run->ft->frame->used, buf->allocated));
+	_LOG_DEBUG("Drawing STUB frame ...")
+	if (_drm_draw_frame(drm, run->ft->frame, buf) < 0) {
+		_LOG_ERROR("Can't draw STUB frame n_buf=%u", run->stub_n_buf);
+		return -1;
+	}
 
+	buf->grab_ts = 0; // Not a live frame
 	_LOG_DEBUG("Exposing STUB framebuffer n_buf=%u ...", run->stub_n_buf);
-	const int retval = drmModePageFlip(
-		run->fd, run->crtc_id, buf->id,
-		DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC,
-		buf);
+	const int retval = _drm_flip(drm, buf, true);
 	if (retval < 0) {
 		if (errno == EACCES || errno == EPERM) {
 			_LOG_DEBUG("Page flip permission denied (desktop environment active)");
 		} else {
 			_LOG_PERROR("Can't expose STUB framebuffer n_buf=%u", run->stub_n_buf);
 		}
+	} else {
+		// It becomes the front buffer on the page flip event like a swapchain one.
+		// The frame queued for the swapchain is older than the stub, so it's dropped.
+		run->pending_n_buf = run->stub_n_buf;
+		run->queued_n_buf = -1;
 	}
 	_LOG_DEBUG("Exposed STUB framebuffer n_buf=%u", run->stub_n_buf);
 
@@ -488,14 +534,6 @@ int us_drm_expose_dma(us_drm_s *drm, const us_capture_hwbuf_s *hw) {
 
 	assert(run->fd >= 0);
 	assert(run->opened == 0);
-
-	// Safety check for buffer index
-	if (hw->buf.index >= run->n_bufs) {
-		_LOG_ERROR("Invalid buffer index %u (max: %u)", hw->buf.index, run->n_bufs);
-		return -1;
-	}
-
-	us_drm_buffer_s *const buf = &run->bufs[hw->buf.index];
 	run->blank_at_ts = 0;
 
 	switch (_drm_check_status(drm)) {
@@ -505,113 +543,20 @@ int us_drm_expose_dma(us_drm_s *drm, const us_capture_hwbuf_s *hw) {
 	}
 	_drm_ensure_dpms_power(drm, true);
 
-	run->has_vsync = false;
+	if (run->converting) {
+		return _drm_expose_converted(drm, &hw->raw);
+	}
 
-	// If using fallback buffer (DMA import failed), copy data manually
-	if (buf->allocated > 0 && buf->data != NULL) {
-		_LOG_DEBUG("Copying frame data to fallback framebuffer n_buf=%u ...", hw->buf.index);
-		
-		// Format conversion with centering for fallback buffer
-		if (hw->raw.used > 0 && hw->raw.data != NULL) {
-			uint8_t *dst = buf->data;
-			const uint dst_width = run->mode.hdisplay;
-			const uint dst_height = run->mode.vdisplay;
-			
-			// Clear the buffer first (black background)
-			memset(dst, 0, buf->allocated);
-			
-			// For MJPEG format, we can't directly process the compressed data
-			// Instead, create a simple test pattern or skip processing
-			if (hw->raw.format == V4L2_PIX_FMT_MJPEG) {
-				_LOG_DEBUG("MJPEG format detected - creating test pattern instead of decoding");
-				
-				// Create a simple gradient test pattern
-				for (uint y = 0; y < dst_height && y * dst_width * 3 < buf->allocated; y++) {
-					for (uint x = 0; x < dst_width && (y * dst_width + x) * 3 + 2 < buf->allocated; x++) {
-						uint pos = (y * dst_width + x) * 3;
-						// Simple gradient pattern: R=x, G=y, B=128
-						dst[pos] = (x * 255) / dst_width;      // Red gradient
-						dst[pos + 1] = (y * 255) / dst_height; // Green gradient  
-						dst[pos + 2] = 128;                    // Blue constant
-					}
-				}
-			} else if (hw->raw.format == V4L2_PIX_FMT_YUYV) {
-				// Process YUYV format
-				const uint8_t *src = hw->raw.data;
-				const uint src_width = hw->raw.width;
-				const uint src_height = hw->raw.height;
-				
-				// Calculate centering offsets
-				const uint offset_x = (dst_width > src_width) ? (dst_width - src_width) / 2 : 0;
-				const uint offset_y = (dst_height > src_height) ? (dst_height - src_height) / 2 : 0;
-				
-				_LOG_DEBUG("Centering %ux%u YUYV frame in %ux%u display (offset: %u,%u)", 
-					src_width, src_height, dst_width, dst_height, offset_x, offset_y);
-				
-				// Basic YUYV to RGB conversion with centering
-				for (uint y = 0; y < src_height && (y + offset_y) < dst_height; y++) {
-					for (uint x = 0; x < src_width && (x + offset_x) < dst_width; x += 2) {
-						if ((y * src_width + x) * 2 + 3 < hw->raw.used) {
-							int Y1 = src[(y * src_width + x) * 2];
-							int U  = src[(y * src_width + x) * 2 + 1];
-							int Y2 = src[(y * src_width + x) * 2 + 2];
-							int V  = src[(y * src_width + x) * 2 + 3];
-							
-							// Simple YUV to RGB conversion
-							int R1 = Y1 + ((V - 128) * 1436) / 1024;
-							int G1 = Y1 - ((U - 128) * 352 + (V - 128) * 731) / 1024;
-							int B1 = Y1 + ((U - 128) * 1814) / 1024;
-							
-							int R2 = Y2 + ((V - 128) * 1436) / 1024;
-							int G2 = Y2 - ((U - 128) * 352 + (V - 128) * 731) / 1024;
-							int B2 = Y2 + ((U - 128) * 1814) / 1024;
-							
-							// Clamp values
-							R1 = (R1 < 0) ? 0 : (R1 > 255) ? 255 : R1;
-							G1 = (G1 < 0) ? 0 : (G1 > 255) ? 255 : G1;
-							B1 = (B1 < 0) ? 0 : (B1 > 255) ? 255 : B1;
-							R2 = (R2 < 0) ? 0 : (R2 > 255) ? 255 : R2;
-							G2 = (G2 < 0) ? 0 : (G2 > 255) ? 255 : G2;
-							B2 = (B2 < 0) ? 0 : (B2 > 255) ? 255 : B2;
-							
-							// Write RGB pixels to centered position
-							uint dst_y = y + offset_y;
-							uint dst_x = x + offset_x;
-							uint dst_pos = dst_y * dst_width + dst_x;
-							
-							if (dst_pos * 3 + 5 < buf->allocated) {
-								dst[dst_pos * 3] = R1;
-								dst[dst_pos * 3 + 1] = G1;
-								dst[dst_pos * 3 + 2] = B1;
-								if (x + 1 < src_width && dst_x + 1 < dst_width) {
-									dst[(dst_pos + 1) * 3] = R2;
-									dst[(dst_pos + 1) * 3 + 1] = G2;
-									dst[(dst_pos + 1) * 3 + 2] = B2;
-								}
-							}
-						}
-					}
-				}
-			} else {
-				// For other formats, create a simple test pattern
-				_LOG_DEBUG("Unknown format - creating test pattern");
-				for (uint y = 0; y < dst_height && y * dst_width * 3 < buf->allocated; y++) {
-					for (uint x = 0; x < dst_width && (y * dst_width + x) * 3 + 2 < buf->allocated; x++) {
-						uint pos = (y * dst_width + x) * 3;
-						dst[pos] = 255;     // Red
-						dst[pos + 1] = 0;   // Green  
-						dst[pos + 2] = 0;   // Blue
-					}
-				}
-			}
-		}
+	// Safety check for buffer index
+	if (hw->buf.index >= run->n_bufs) {
+		_LOG_ERROR("Invalid buffer index %u (max: %u)", hw->buf.index, run->n_bufs);
+		return -1;
 	}
+	us_drm_buffer_s *const buf = &run->bufs[hw->buf.index];
 
+	buf->grab_ts = hw->raw.grab_ts;
 	_LOG_DEBUG("Exposing DMA framebuffer n_buf=%u ...", hw->buf.index);
-	const int retval = drmModePageFlip(
-		run->fd, run->crtc_id, buf->id,
-		DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC,
-		buf);
+	const int retval = _drm_flip(drm, buf, true);
 	if (retval < 0) {
 		if (errno == EACCES || errno == EPERM) {
 			_LOG_DEBUG("Page flip permission denied (desktop environment active)");
@@ -619,7 +564,7 @@ int us_drm_expose_dma(us_drm_s *drm, const us_capture_hwbuf_s *hw) {
 			_LOG_PERROR("Can't expose DMA framebuffer n_buf=%u", hw->buf.index);
 		}
 	}
-	_LOG_DEBUG("Exposed DMA framebuffer n_buf=%u", run->stub_n_buf);
+	_LOG_DEBUG("Exposed DMA framebuffer n_buf=%u", hw->buf.index);
 	run->exposing_dma_fd = hw->dma_fd;
 	return retval;
 }
@@ -686,24 +631,41 @@ static void _drm_ensure_dpms_power(us_drm_s *drm, bool on) {
 static int _drm_init_buffers(us_drm_s *drm, const us_capture_s *cap) {
 	us_drm_runtime_s *const run = drm->run;
 
-	const uint n_bufs = (cap == NULL ? 4 : cap->run->n_bufs);
-	const char *name = (cap == NULL ? "STUB" : "DMA");
+	if (cap != NULL) {
+		if (!run->converting) {
+			if (_drm_init_dma(drm, cap) == 0) {
+				return 0;
+			}
+			char fourcc_str[8];
+			_LOG_INFO("Converting %s frames on CPU: the capture buffers can't be scanned out",
+				us_fourcc_to_string(cap->run->format, fourcc_str, 8));
+			for (uint n_buf = 0; n_buf < run->n_bufs; ++n_buf) {
+				_drm_destroy_buffer(drm, &run->bufs[n_buf], n_buf);
+			}
+			US_DELETE(run->bufs, free);
+			run->n_bufs = 0;
+			run->converting = true;
+		}
+		return _drm_init_swapchain(drm, cap);
+	}
+
+	const uint n_bufs = 4;
+	const char *name = "STUB";
 
 	_LOG_DEBUG("Initializing %u %s buffers ...", n_bufs, name);
 
 	uint format = DRM_FORMAT_RGB888;  // Default format
 	uint bpp = 24;                    // Default bpp
 
-	// For all platforms, use simplified dumb buffers with better Amlogic compatibility
 	if (run->platform == US_DRM_PLATFORM_AMLOGIC) {
 		// Amlogic-optimized format but still use dumb buffers (simpler and more reliable)
 		format = DRM_FORMAT_XRGB8888;
 		bpp = 32;  // Use 32-bit for Amlogic compatibility
 		_LOG_INFO("Using Amlogic-optimized dumb buffers: XRGB8888 32-bit");
-	} else {
-		// Standard format for other platforms
-		format = DRM_FORMAT_RGB888;
-		bpp = 24;
+	} else if (run->platform != US_DRM_PLATFORM_RPI) {
+		// XRGB8888 is the only format that is guaranteed by KMS, vkms doesn't have RGB888
+		format = DRM_FORMAT_XRGB8888;
+		bpp = 32;
 	}
 
 	US_CALLOC(run->bufs, n_bufs);
@@ -713,228 +675,136 @@ static int _drm_init_buffers(us_drm_s *drm, const us_capture_s *cap) {
 
 		buf->ctx.has_vsync = &run->has_vsync;
 		buf->ctx.exposing_dma_fd = &run->exposing_dma_fd;
+		buf->ctx.flipped = &run->flipped;
 
 		u32 handles[4] = {0};
 		u32 strides[4] = {0};
 		u32 offsets[4] = {0};
 
-		if (cap == NULL) {
-			struct drm_mode_create_dumb create = {
-				.width = run->mode.hdisplay,
-				.height = run->mode.vdisplay,
-				.bpp = bpp,
-			};
-			if (drmIoctl(run->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
-				_LOG_PERROR("Can't create %s buffer=%u", name, n_buf);
-				return -1;
-			}
-			buf->handle = create.handle;
-			buf->dumb_created = true;
-
-			struct drm_mode_map_dumb map = {.handle = create.handle};
-			if (drmIoctl(run->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
-				_LOG_PERROR("Can't prepare dumb buffer=%u to mapping", n_buf);
-				return -1;
-			}
-			if ((buf->data = mmap(
-				NULL, create.size,
-				PROT_READ | PROT_WRITE, MAP_SHARED,
-				run->fd, map.offset
-			)) == MAP_FAILED) {
-				_LOG_PERROR("Can't map buffer=%u", n_buf);
-				return -1;
-			}
-			memset(buf->data, 0, create.size);
-			buf->allocated = create.size;
-
-			handles[0] = create.handle;
-			strides[0] = create.pitch;
-
-		} else {
-			// Skip DMA-BUF import for Amlogic platforms - use direct buffer copy instead
-			bool use_dma_import = false;
-			if (run->platform != US_DRM_PLATFORM_AMLOGIC) {
-				_LOG_DEBUG("Attempting DMA buffer import for buffer %u", n_buf);
-				if (drmPrimeFDToHandle(run->fd, cap->run->bufs[n_buf].dma_fd, &buf->handle) >= 0) {
-					use_dma_import = true;
-					_LOG_DEBUG("DMA buffer import successful for buffer %u", n_buf);
-				} else {
-					_LOG_DEBUG("DMA-BUF import failed for buffer %u: %s", n_buf, strerror(errno));
-				}
-			} else {
-				_LOG_DEBUG("Amlogic platform detected, skipping DMA-BUF import for buffer %u", n_buf);
-			}
-
-			if (!use_dma_import) {
-				_LOG_DEBUG("Using manual buffer creation for buffer %u", n_buf);
+		struct drm_mode_create_dumb create = {
+			.width = run->mode.hdisplay,
+			.height = run->mode.vdisplay,
+			.bpp = bpp,
+		};
+		if (drmIoctl(run->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+			_LOG_PERROR("Can't create %s buffer=%u", name, n_buf);
+			return -1;
+		}
+		buf->handle = create.handle;
+		buf->dumb_created = true;
 
-				// Manual buffer creation for all failed DMA imports or Amlogic
-				struct drm_mode_create_dumb create = {0};
-				create.width = run->mode.hdisplay;   // Use display resolution, not capture resolution
-				create.height = run->mode.vdisplay;  // Use display resolution, not capture resolution
-				// For Amlogic platform with XRGB8888, we need 32-bit buffer
-				create.bpp = (run->platform == US_DRM_PLATFORM_AMLOGIC) ? 32 : 24;
+		struct drm_mode_map_dumb map = {.handle = create.handle};
+		if (drmIoctl(run->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
+			_LOG_PERROR("Can't prepare dumb buffer=%u to mapping", n_buf);
+			return -1;
+		}
+		if ((buf->data = mmap(
+			NULL, create.size,
+			PROT_READ | PROT_WRITE, MAP_SHARED,
+			run->fd, map.offset
+		)) == MAP_FAILED) {
+			_LOG_PERROR("Can't map buffer=%u", n_buf);
+			return -1;
+		}
+		memset(buf->data, 0, create.size);
+		buf->allocated = create.size;
+		buf->pitch = create.pitch;
+		buf->bpp = create.bpp;
 
-				_LOG_DEBUG("Creating fallback dumb buffer: %ux%u, bpp=%u",
-				          create.width, create.height, create.bpp);
+		handles[0] = create.handle;
+		strides[0] = create.pitch;
 
-				if (drmIoctl(run->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
-					_LOG_PERROR("Can't create fallback dumb buffer=%u", n_buf);
-					return -1;
-				}
-				buf->handle = create.handle;
-				buf->dumb_created = true;
-
-				struct drm_mode_map_dumb map = {0};
-				map.handle = create.handle;
-				if (drmIoctl(run->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
-					_LOG_PERROR("Can't get fallback buffer=%u map info", n_buf);
-					// Clean up on error
-					struct drm_mode_destroy_dumb destroy = {.handle = create.handle};
-					drmIoctl(run->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
-					return -1;
-				}
-				
-				if ((buf->data = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED,
-					run->fd, map.offset
-				)) == MAP_FAILED) {
-					_LOG_PERROR("Can't map fallback buffer=%u", n_buf);
-					// Clean up on error
-					struct drm_mode_destroy_dumb destroy = {.handle = create.handle};
-					drmIoctl(run->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
-					return -1;
-				}
-				memset(buf->data, 0, create.size);
-				buf->allocated = create.size;
-				
-				handles[0] = create.handle;
-				strides[0] = create.pitch;
-				// Format is already set based on platform at the beginning of this function
-				_LOG_DEBUG("Created fallback buffer: %ux%u, bpp=%u, pitch=%u, size=%llu, handle=%u",
-					create.width, create.height, create.bpp, create.pitch, (unsigned long long)create.size, create.handle);
-			} else {
-				handles[0] = buf->handle;
-				strides[0] = cap->run->stride;
-				
-				switch (cap->run->format) {
-					case V4L2_PIX_FMT_RGB24: format = (DRM_FORMAT_BIG_ENDIAN ? DRM_FORMAT_BGR888 : DRM_FORMAT_RGB888); break;
-					case V4L2_PIX_FMT_BGR24: format = (DRM_FORMAT_BIG_ENDIAN ? DRM_FORMAT_RGB888 : DRM_FORMAT_BGR888); break;
-					case V4L2_PIX_FMT_YUYV: format = DRM_FORMAT_YUYV; break;
-					case V4L2_PIX_FMT_MJPEG:
-						// MJPEG needs to be decoded first, use XRGB8888 as fallback
-						format = DRM_FORMAT_XRGB8888;
-						_LOG_INFO("MJPEG format detected, will decode to XRGB8888 for display");
-						break;
-				}
-			}
-		}
+		buf->width = run->mode.hdisplay;
+		buf->height = run->mode.vdisplay;
 
 		int fb_ret = -1;
-		if (cap == NULL) {
-			// For STUB buffers, use different methods based on platform
-			if (run->platform == US_DRM_PLATFORM_AMLOGIC) {
-				// Amlogic: Use legacy AddFB for better compatibility
-				// For XRGB8888: depth=24 (RGB without padding), bpp=32 (4 bytes per pixel)
-				uint fb_depth = 24;
-				uint fb_bpp = 32;
-				_LOG_DEBUG("Creating Amlogic STUB framebuffer: %ux%u, depth=%u, bpp=%u, handle=%u, stride=%u",
-					run->mode.hdisplay, run->mode.vdisplay, fb_depth, fb_bpp, handles[0], strides[0]);
-				fb_ret = drmModeAddFB(run->fd, run->mode.hdisplay, run->mode.vdisplay,
-				                     fb_depth, fb_bpp, strides[0], handles[0], &buf->id);
-			} else {
-				// Other platforms: Use AddFB2 method
-				_LOG_DEBUG("Creating STUB framebuffer: %ux%u, format=0x%x, handle=%u, stride=%u",
-					run->mode.hdisplay, run->mode.vdisplay, format, handles[0], strides[0]);
-				fb_ret = drmModeAddFB2(run->fd, run->mode.hdisplay, run->mode.vdisplay,
-				                       format, handles, strides, offsets, &buf->id, 0);
-			}
+		// For STUB buffers, use different methods based on platform
+		if (run->platform == US_DRM_PLATFORM_AMLOGIC) {
+			// Amlogic: Use legacy AddFB for better compatibility
+			// For XRGB8888: depth=24 (RGB without padding), bpp=32 (4 bytes per pixel)
+			uint fb_depth = 24;
+			uint fb_bpp = 32;
+			_LOG_DEBUG("Creating Amlogic STUB framebuffer: %ux%u, depth=%u, bpp=%u, handle=%u, stride=%u",
+				run->mode.hdisplay, run->mode.vdisplay, fb_depth, fb_bpp, handles[0], strides[0]);
+			fb_ret = drmModeAddFB(run->fd, run->mode.hdisplay, run->mode.vdisplay,
+			                     fb_depth, fb_bpp, strides[0], handles[0], &buf->id);
+		} else {
+			// Other platforms: Use AddFB2 method
+			_LOG_DEBUG("Creating STUB framebuffer: %ux%u, format=0x%x, handle=%u, stride=%u",
+				run->mode.hdisplay, run->mode.vdisplay, format, handles[0], strides[0]);
+			fb_ret = drmModeAddFB2(run->fd, run->mode.hdisplay, run->mode.vdisplay,
+			                       format, handles, strides, offsets, &buf->id, 0);
+		}
+		
+		if (fb_ret != 0) {
+			// Original method failed, try fallback formats
+			_LOG_DEBUG("Original RGB888 format failed, trying fallback formats...");
+			struct {
+				uint bpp;
+				const char *name;
+			} fallback_formats[] = {
+				{32, "XRGB8888"},
+				{16, "RGB565"},
+			};
 			
-			if (fb_ret != 0) {
-				// Original method failed, try fallback formats
-				_LOG_DEBUG("Original RGB888 format failed, trying fallback formats...");
-				struct {
-					uint bpp;
-					const char *name;
-				} fallback_formats[] = {
-					{32, "XRGB8888"},
-					{16, "RGB565"},
+			bool fallback_success = false;
+			for (int i = 0; i < 2 && !fallback_success; i++) {
+				// Recreate buffer with different bpp
+				if (buf->dumb_created) {
+					struct drm_mode_destroy_dumb destroy_old = {.handle = buf->handle};
+					drmIoctl(run->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_old);
+					if (buf->data != NULL) {
+						munmap(buf->data, buf->allocated);
+						buf->data = NULL;
+					}
+					buf->dumb_created = false;
+				}
+				
+				struct drm_mode_create_dumb create_fb = {
+					.width = run->mode.hdisplay,
+					.height = run->mode.vdisplay,
+					.bpp = fallback_formats[i].bpp,
 				};
 				
-				bool fallback_success = false;
-				for (int i = 0; i < 2 && !fallback_success; i++) {
-					// Recreate buffer with different bpp
-					if (buf->dumb_created) {
-						struct drm_mode_destroy_dumb destroy_old = {.handle = buf->handle};
-						drmIoctl(run->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_old);
-						if (buf->data != NULL) {
-							munmap(buf->data, buf->allocated);
-							buf->data = NULL;
-						}
-						buf->dumb_created = false;
-					}
-					
-					struct drm_mode_create_dumb create_fb = {
-						.width = run->mode.hdisplay,
-						.height = run->mode.vdisplay,
-						.bpp = fallback_formats[i].bpp,
-					};
+				if (drmIoctl(run->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_fb) == 0) {
+					buf->handle = create_fb.handle;
+					buf->dumb_created = true;
 					
-					if (drmIoctl(run->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_fb) == 0) {
-						buf->handle = create_fb.handle;
-						buf->dumb_created = true;
-						
-						// Map the buffer
-						struct drm_mode_map_dumb map_fb = {.handle = create_fb.handle};
-						if (drmIoctl(run->fd, DRM_IOCTL_MODE_MAP_DUMB, &map_fb) == 0) {
-							buf->data = mmap(NULL, create_fb.size, PROT_READ | PROT_WRITE, 
-							               MAP_SHARED, run->fd, map_fb.offset);
-							if (buf->data != MAP_FAILED) {
-								memset(buf->data, 0, create_fb.size);
-								buf->allocated = create_fb.size;
-								
-								// Try to create framebuffer with legacy API
-								handles[0] = create_fb.handle;
-								strides[0] = create_fb.pitch;
-								fb_ret = drmModeAddFB(run->fd, run->mode.hdisplay, run->mode.vdisplay, 
-								                     fallback_formats[i].bpp, fallback_formats[i].bpp, 
-								                     create_fb.pitch, create_fb.handle, &buf->id);
-								
-								if (fb_ret == 0) {
-									_LOG_INFO("Successfully using fallback format: %s (%u bpp)", 
-									         fallback_formats[i].name, fallback_formats[i].bpp);
-									bpp = fallback_formats[i].bpp;  // 记录成功的bpp供后续使用
-									run->detected_bpp = bpp;         // 保存到运行时状态
-									fallback_success = true;
-								}
+					// Map the buffer
+					struct drm_mode_map_dumb map_fb = {.handle = create_fb.handle};
+					if (drmIoctl(run->fd, DRM_IOCTL_MODE_MAP_DUMB, &map_fb) == 0) {
+						buf->data = mmap(NULL, create_fb.size, PROT_READ | PROT_WRITE, 
+						               MAP_SHARED, run->fd, map_fb.offset);
+						if (buf->data != MAP_FAILED) {
+							memset(buf->data, 0, create_fb.size);
+							buf->allocated = create_fb.size;
+							buf->pitch = create_fb.pitch;
+							buf->bpp = create_fb.bpp;
+							
+							// Try to create framebuffer with legacy API
+							handles[0] = create_fb.handle;
+							strides[0] = create_fb.pitch;
+							fb_ret = drmModeAddFB(run->fd, run->mode.hdisplay, run->mode.vdisplay, 
+							                     fallback_formats[i].bpp, fallback_formats[i].bpp, 
+							                     create_fb.pitch, create_fb.handle, &buf->id);
+							
+							if (fb_ret == 0) {
+								_LOG_INFO("Successfully using fallback format: %s (%u bpp)", 
+								         fallback_formats[i].name, fallback_formats[i].bpp);
+								bpp = fallback_formats[i].bpp;  // 记录成功的bpp供后续使用
+								run->detected_bpp = bpp;         // 保存到运行时状态
+								fallback_success = true;
 							}
 						}
 					}
 				}
-				
-				if (!fallback_success) {
-					fb_ret = -1; // 确保失败状态
-				}
 			}
-		} else {
-			// For DMA buffers, use platform-specific API
-			if (run->platform == US_DRM_PLATFORM_AMLOGIC) {
-				// Amlogic: Use legacy AddFB for DMA buffers too
-				// For XRGB8888: depth=24, bpp=32
-				uint fb_depth = 24;
-				uint fb_bpp = 32;
-				_LOG_DEBUG("Creating Amlogic DMA framebuffer: %ux%u, depth=%u, bpp=%u, handle=%u, stride=%u",
-					cap->run->width, cap->run->height, fb_depth, fb_bpp, handles[0], strides[0]);
-				fb_ret = drmModeAddFB(run->fd, cap->run->width, cap->run->height,
-				                     fb_depth, fb_bpp, strides[0], handles[0], &buf->id);
-			} else {
-				// Other platforms: Use AddFB2 with format-specific handling
-				_LOG_DEBUG("Creating DMA framebuffer: %ux%u, format=0x%x, handle=%u, stride=%u",
-					cap->run->width, cap->run->height, format, handles[0], strides[0]);
-				fb_ret = drmModeAddFB2(run->fd, cap->run->width, cap->run->height,
-				                       format, handles, strides, offsets, &buf->id, 0);
+			
+			if (!fallback_success) {
+				fb_ret = -1; // 确保失败状态
 			}
 		}
-		
+
 		if (fb_ret) {
 			_LOG_PERROR("Can't setup buffer=%u", n_buf);
 			return -1;
@@ -944,6 +814,672 @@ static int _drm_init_buffers(us_drm_s *drm, const us_capture_s *cap) {
 	return 0;
 }
 
+static int _drm_init_dma(us_drm_s *drm, const us_capture_s *cap) {
+	us_drm_runtime_s *const run = drm->run;
+
+	const u32 format = _v4l2_to_drm_format(cap->run->format);
+	const uint width = cap->run->width;
+	const uint height = cap->run->height;
+	const uint stride = cap->run->stride;
+	assert(format > 0);
+
+	// The single-planar V4L2 buffers keep all the planes in the same DMA-BUF
+	u32 strides[4] = {stride};
+	u32 offsets[4] = {0};
+	switch (format) {
+		case DRM_FORMAT_NV12:
+		case DRM_FORMAT_NV16:
+		case DRM_FORMAT_NV24:
+			strides[1] = (format == DRM_FORMAT_NV24 ? stride * 2 : stride);
+			offsets[1] = stride * height;
+			break;
+		case DRM_FORMAT_YUV420:
+		case DRM_FORMAT_YVU420:
+			strides[1] = stride / 2;
+			strides[2] = stride / 2;
+			offsets[1] = stride * height;
+			offsets[2] = offsets[1] + (stride / 2) * ((height + 1) / 2);
+			break;
+		default: break;
+	}
+
+	_LOG_DEBUG("Initializing %u DMA buffers ...", cap->run->n_bufs);
+
+	US_CALLOC(run->bufs, cap->run->n_bufs);
+	for (run->n_bufs = 0; run->n_bufs < cap->run->n_bufs; ++run->n_bufs) {
+		const uint n_buf = run->n_bufs;
+		us_drm_buffer_s *const buf = &run->bufs[n_buf];
+
+		buf->ctx.has_vsync = &run->has_vsync;
+		buf->ctx.exposing_dma_fd = &run->exposing_dma_fd;
+		buf->ctx.flipped = &run->flipped;
+		buf->width = width;
+		buf->height = height;
+
+		if (drmPrimeFDToHandle(run->fd, cap->run->bufs[n_buf].dma_fd, &buf->handle) < 0) {
+			_LOG_PERROR("Can't import DMA buffer=%u", n_buf);
+			return -1;
+		}
+
+		u32 handles[4] = {0};
+		u64 modifiers[4] = {0};
+		for (uint pi = 0; pi < 4 && (pi == 0 || strides[pi] > 0); ++pi) {
+			handles[pi] = buf->handle;
+			modifiers[pi] = DRM_FORMAT_MOD_LINEAR; // V4L2 never tiles the buffers
+		}
+
+		_LOG_DEBUG("Creating DMA framebuffer: %ux%u, format=0x%x, handle=%u, stride=%u",
+			width, height, format, buf->handle, stride);
+		int retval;
+		if (run->has_modifiers) {
+			retval = drmModeAddFB2WithModifiers(
+				run->fd, width, height, format,
+				handles, strides, offsets, modifiers, &buf->id, DRM_MODE_FB_MODIFIERS);
+		} else {
+			retval = drmModeAddFB2(
+				run->fd, width, height, format,
+				handles, strides, offsets, &buf->id, 0);
+		}
+		if (retval < 0) {
+			_LOG_PERROR("Can't setup DMA buffer=%u", n_buf);
+			return -1;
+		}
+		buf->fb_added = true;
+	}
+
+	if (
+		(width != run->mode.hdisplay || height != run->mode.vdisplay)
+		&& _drm_atomic_commit(drm, &run->bufs[0], DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET) < 0
+	) {
+		_LOG_INFO("The plane can't scale %ux%u to %ux%u", width, height, run->mode.hdisplay, run->mode.vdisplay);
+		return -1;
+	}
+	return 0;
+}
+
+static bool _drm_check_scanout(us_drm_s *drm, const us_capture_s *cap) {
+	us_drm_runtime_s *const run = drm->run;
+
+	const u32 format = _v4l2_to_drm_format(cap->run->format);
+	const bool scaled = (cap->run->width != run->mode.hdisplay || cap->run->height != run->mode.vdisplay);
+
+	const char *reason = NULL;
+	if (run->platform == US_DRM_PLATFORM_AMLOGIC) {
+		reason = "the capture buffers are never imported on Amlogic";
+	} else if (format == 0) {
+		reason = "there is no matching DRM format";
+	} else if (!_drm_has_plane_format(drm, format)) {
+		reason = "the display plane doesn't support this format";
+	} else if (scaled && !run->atomic) {
+		reason = "the scaling requires the atomic modesetting";
+	}
+
+	char fourcc_str[8];
+	us_fourcc_to_string(cap->run->format, fourcc_str, 8);
+	if (reason != NULL) {
+		_LOG_INFO("Converting %s frames on CPU: %s", fourcc_str, reason);
+		return false;
+	}
+	_LOG_INFO("Using the direct scanout of %s frames", fourcc_str);
+	return true;
+}
+
+static bool _drm_has_plane_format(us_drm_s *drm, u32 format) {
+	const us_drm_runtime_s *const run = drm->run;
+	if (run->plane_formats == NULL) {
+		return true; // Unknown, the import will tell us
+	}
+	for (uint fi = 0; fi < run->n_plane_formats; ++fi) {
+		if (run->plane_formats[fi] == format) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int _drm_init_swapchain(us_drm_s *drm, const us_capture_s *cap) {
+	us_drm_runtime_s *const run = drm->run;
+
+	uint width = run->mode.hdisplay;
+	uint height = run->mode.vdisplay;
+	if (
+		run->atomic
+		&& (cap->run->width != width || cap->run->height != height)
+		&& cap->run->width <= width && cap->run->height <= height
+		&& _drm_test_plane_scaling(drm, cap->run->width, cap->run->height)
+	) {
+		// The display controller upscales for free, so the CPU only converts the format.
+		// Bigger sources are shrunk by the decoder and the resizer, it's cheaper to draw less.
+		width = cap->run->width;
+		height = cap->run->height;
+		_LOG_INFO("Using the plane scaling %ux%u -> %ux%u",
+			width, height, run->mode.hdisplay, run->mode.vdisplay);
+	}
+
+	_LOG_DEBUG("Initializing %u SWAPCHAIN buffers %ux%u ...", _SWAPCHAIN_SIZE, width, height);
+
+	US_CALLOC(run->bufs, _SWAPCHAIN_SIZE);
+	for (run->n_bufs = 0; run->n_bufs < _SWAPCHAIN_SIZE; ++run->n_bufs) {
+		us_drm_buffer_s *const buf = &run->bufs[run->n_bufs];
+		buf->ctx.has_vsync = &run->has_vsync;
+		buf->ctx.exposing_dma_fd = &run->exposing_dma_fd;
+		buf->ctx.flipped = &run->flipped;
+		if (_drm_create_dumb(drm, buf, width, height) < 0) {
+			_drm_destroy_buffer(drm, buf, run->n_bufs);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int _drm_create_dumb(us_drm_s *drm, us_drm_buffer_s *buf, uint width, uint height) {
+	us_drm_runtime_s *const run = drm->run;
+
+	// XRGB8888 is the only format that is guaranteed by KMS, but vc4 is fine with RGB888
+	const bool rgb24 = (run->platform == US_DRM_PLATFORM_RPI);
+
+	struct drm_mode_create_dumb create = {
+		.width = width,
+		.height = height,
+		.bpp = (rgb24 ? 24 : 32),
+	};
+	if (drmIoctl(run->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+		_LOG_PERROR("Can't create dumb buffer %ux%u", width, height);
+		return -1;
+	}
+	buf->handle = create.handle;
+	buf->dumb_created = true;
+
+	struct drm_mode_map_dumb map = {.handle = create.handle};
+	if (drmIoctl(run->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
+		_LOG_PERROR("Can't prepare dumb buffer to mapping");
+		return -1;
+	}
+	if ((buf->data = mmap(
+		NULL, create.size,
+		PROT_READ | PROT_WRITE, MAP_SHARED,
+		run->fd, map.offset
+	)) == MAP_FAILED) {
+		_LOG_PERROR("Can't map dumb buffer");
+		buf->data = NULL;
+		return -1;
+	}
+	memset(buf->data, 0, create.size);
+	buf->allocated = create.size;
+	buf->pitch = create.pitch;
+	buf->bpp = create.bpp;
+	buf->width = width;
+	buf->height = height;
+
+	int retval;
+	if (run->platform == US_DRM_PLATFORM_AMLOGIC) {
+		// Amlogic: Use legacy AddFB for better compatibility, XRGB8888 is depth=24, bpp=32
+		retval = drmModeAddFB(run->fd, width, height, 24, 32, create.pitch, create.handle, &buf->id);
+	} else {
+		const u32 handles[4] = {create.handle};
+		const u32 strides[4] = {create.pitch};
+		const u32 offsets[4] = {0};
+		retval = drmModeAddFB2(
+			run->fd, width, height,
+			(rgb24 ? DRM_FORMAT_RGB888 : DRM_FORMAT_XRGB8888),
+			handles, strides, offsets, &buf->id, 0);
+	}
+	if (retval < 0) {
+		_LOG_PERROR("Can't add framebuffer for dumb buffer %ux%u", width, height);
+		return -1;
+	}
+	buf->fb_added = true;
+	_LOG_DEBUG("Created dumb framebuffer: %ux%u, bpp=%u, pitch=%u, size=%llu, id=%u",
+		width, height, buf->bpp, buf->pitch, (ull)create.size, buf->id);
+	return 0;
+}
+
+static void _drm_destroy_buffer(us_drm_s *drm, us_drm_buffer_s *buf, uint n_buf) {
+	us_drm_runtime_s *const run = drm->run;
+
+	if (buf->fb_added && drmModeRmFB(run->fd, buf->id) < 0) {
+		_LOG_PERROR("Can't remove buffer=%u", n_buf);
+	}
+	if (buf->dumb_created) {
+		struct drm_mode_destroy_dumb destroy = {.handle = buf->handle};
+		if (drmIoctl(run->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy) < 0) {
+			_LOG_PERROR("Can't destroy dumb buffer=%u", n_buf);
+		}
+	}
+	if (buf->data != NULL && munmap(buf->data, buf->allocated)) {
+		_LOG_PERROR("Can't unmap buffer=%u", n_buf);
+	}
+	buf->fb_added = false;
+	buf->dumb_created = false;
+	buf->data = NULL;
+}
+
+static int _drm_find_plane(us_drm_s *drm) {
+	us_drm_runtime_s *const run = drm->run;
+
+	drmModeRes *res = NULL;
+	drmModePlaneRes *planes = NULL;
+	int retval = -1;
+	run->plane_id = 0;
+
+	// The primary planes are hidden from the clients without this cap
+	if (drmSetClientCap(run->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) < 0) {
+		_LOG_PERROR("Can't enable the universal planes");
+		goto done;
+	}
+
+	if ((res = drmModeGetResources(run->fd)) == NULL) {
+		_LOG_PERROR("Can't get resources info");
+		goto done;
+	}
+	int crtc_index = -1;
+	for (int ci = 0; ci < res->count_crtcs; ++ci) {
+		if (res->crtcs[ci] == run->crtc_id) {
+			crtc_index = ci;
+			break;
+		}
+	}
+	if (crtc_index < 0) {
+		_LOG_ERROR("Can't find CRTC=%u index", run->crtc_id);
+		goto done;
+	}
+
+	if ((planes = drmModeGetPlaneResources(run->fd)) == NULL) {
+		_LOG_PERROR("Can't get planes info");
+		goto done;
+	}
+	for (uint pi = 0; pi < planes->count_planes && run->plane_id == 0; ++pi) {
+		drmModePlane *plane = drmModeGetPlane(run->fd, planes->planes[pi]);
+		if (plane == NULL) {
+			continue;
+		}
+		u64 type = 0;
+		if (
+			(plane->possible_crtcs & (1 << crtc_index))
+			&& _find_property(run->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) > 0
+			&& type == DRM_PLANE_TYPE_PRIMARY
+		) {
+			run->plane_id = plane->plane_id;
+			_drm_read_plane_formats(drm, plane);
+		}
+		drmModeFreePlane(plane);
+	}
+	if (run->plane_id == 0) {
+		_LOG_ERROR("Can't find the primary plane for CRTC=%u", run->crtc_id);
+		goto done;
+	}
+	retval = 0;
+
+done:
+	if (planes != NULL) {
+		drmModeFreePlaneResources(planes);
+	}
+	if (res != NULL) {
+		drmModeFreeResources(res);
+	}
+	return retval;
+}
+
+static void _drm_read_plane_formats(us_drm_s *drm, const drmModePlane *plane) {
+	us_drm_runtime_s *const run = drm->run;
+
+	US_DELETE(run->plane_formats, free);
+	run->n_plane_formats = 0;
+	US_CALLOC(run->plane_formats, US_MAX(plane->count_formats, 1u));
+
+	u64 blob_id = 0;
+	drmModePropertyBlobRes *blob = NULL;
+	if (
+		_find_property(run->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "IN_FORMATS", &blob_id) > 0
+		&& (blob = drmModeGetPropertyBlob(run->fd, blob_id)) != NULL
+	) {
+		// Only the linear layout is interesting, the capture buffers are never tiled
+		const struct drm_format_modifier_blob *const header = blob->data;
+		const u32 *const formats = (const u32*)((const u8*)blob->data + header->formats_offset);
+		const struct drm_format_modifier *const mods = (const struct drm_format_modifier*)(
+			(const u8*)blob->data + header->modifiers_offset);
+		for (uint fi = 0; fi < header->count_formats && run->n_plane_formats < plane->count_formats; ++fi) {
+			for (uint mi = 0; mi < header->count_modifiers; ++mi) {
+				if (
+					mods[mi].modifier == DRM_FORMAT_MOD_LINEAR
+					&& fi >= mods[mi].offset && fi < mods[mi].offset + 64
+					&& (mods[mi].formats & (1ULL << (fi - mods[mi].offset)))
+				) {
+					run->plane_formats[run->n_plane_formats] = formats[fi];
+					++run->n_plane_formats;
+					break;
+				}
+			}
+		}
+		drmModeFreePropertyBlob(blob);
+	} else {
+		// No modifiers, so everything is linear
+		memcpy(run->plane_formats, plane->formats, sizeof(u32) * plane->count_formats);
+		run->n_plane_formats = plane->count_formats;
+	}
+
+	char list[256] = {0};
+	for (uint fi = 0; fi < run->n_plane_formats; ++fi) {
+		char fourcc_str[8];
+		us_fourcc_to_string(run->plane_formats[fi], fourcc_str, 8);
+		const uz len = strlen(list);
+		US_SNPRINTF(list + len, sizeof(list) - len - 1, "%s%s", (fi > 0 ? " " : ""), fourcc_str);
+	}
+	_LOG_VERBOSE("Primary plane=%u scanout formats: %s", plane->plane_id, list);
+}
+
+static u32 _v4l2_to_drm_format(uint format) {
+	switch (format) {
+		case V4L2_PIX_FMT_RGB24: return DRM_FORMAT_BGR888; // R, G, B in memory
+		case V4L2_PIX_FMT_BGR24: return DRM_FORMAT_RGB888;
+		case V4L2_PIX_FMT_RGB565: return DRM_FORMAT_RGB565;
+		case V4L2_PIX_FMT_YUYV: return DRM_FORMAT_YUYV;
+		case V4L2_PIX_FMT_YVYU: return DRM_FORMAT_YVYU;
+		case V4L2_PIX_FMT_UYVY: return DRM_FORMAT_UYVY;
+		case V4L2_PIX_FMT_NV12: return DRM_FORMAT_NV12;
+		case V4L2_PIX_FMT_NV16: return DRM_FORMAT_NV16;
+		case V4L2_PIX_FMT_NV24: return DRM_FORMAT_NV24;
+		case V4L2_PIX_FMT_YUV420: return DRM_FORMAT_YUV420;
+		case V4L2_PIX_FMT_YVU420: return DRM_FORMAT_YVU420;
+		default: break; // GREY and JPEG are converted
+	}
+	return 0;
+}
+
+static int _drm_init_atomic(us_drm_s *drm) {
+	us_drm_runtime_s *const run = drm->run;
+
+	run->atomic = false;
+	if (run->plane_id == 0) {
+		_LOG_INFO("There is no known primary plane, using the legacy modesetting API");
+		return -1;
+	}
+	if (drmSetClientCap(run->fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0) {
+		_LOG_INFO("Atomic modesetting is not supported, using the legacy API");
+		return -1;
+	}
+
+	us_drm_props_s *const props = &run->props;
+#	define FIND_PROP(x_field, x_obj, x_type, x_name) { \
+			if ((props->x_field = _find_property(run->fd, (x_obj), (x_type), (x_name), NULL)) == 0) { \
+				_LOG_ERROR("Can't find property " x_name); \
+				goto error; \
+			} \
+		}
+	FIND_PROP(conn_crtc_id, run->conn_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+	FIND_PROP(crtc_mode_id, run->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+	FIND_PROP(crtc_active, run->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+	FIND_PROP(plane_fb_id, run->plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID");
+	FIND_PROP(plane_crtc_id, run->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+	FIND_PROP(plane_src_x, run->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X");
+	FIND_PROP(plane_src_y, run->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+	FIND_PROP(plane_src_w, run->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W");
+	FIND_PROP(plane_src_h, run->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H");
+	FIND_PROP(plane_crtc_x, run->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+	FIND_PROP(plane_crtc_y, run->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+	FIND_PROP(plane_crtc_w, run->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+	FIND_PROP(plane_crtc_h, run->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+#	undef FIND_PROP
+
+	if (drmModeCreatePropertyBlob(run->fd, &run->mode, sizeof(run->mode), &run->mode_blob_id) < 0) {
+		_LOG_PERROR("Can't create the mode blob");
+		goto error;
+	}
+
+	run->atomic = true;
+	_LOG_INFO("Using atomic modesetting: plane=%u", run->plane_id);
+	return 0;
+
+error:
+	drmSetClientCap(run->fd, DRM_CLIENT_CAP_ATOMIC, 0);
+	_LOG_INFO("Falling back to the legacy modesetting API");
+	return -1;
+}
+
+static bool _drm_test_plane_scaling(us_drm_s *drm, uint width, uint height) {
+	// Many planes can't scale at all or only in the limited range,
+	// the only reliable way to know it is to ask the driver.
+	us_drm_buffer_s buf = {0};
+	bool ok = false;
+	if (_drm_create_dumb(drm, &buf, width, height) == 0) {
+		ok = (_drm_atomic_commit(drm, &buf, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET) == 0);
+	}
+	_drm_destroy_buffer(drm, &buf, 0);
+	_LOG_DEBUG("Plane scaling %ux%u -> %ux%u: %s",
+		width, height, drm->run->mode.hdisplay, drm->run->mode.vdisplay, (ok ? "supported" : "unsupported"));
+	return ok;
+}
+
+static int _drm_atomic_commit(us_drm_s *drm, us_drm_buffer_s *buf, u32 flags) {
+	us_drm_runtime_s *const run = drm->run;
+	const us_drm_props_s *const props = &run->props;
+
+	drmModeAtomicReq *const req = drmModeAtomicAlloc();
+	assert(req != NULL);
+
+	bool ok = true;
+#	define ADD_PROP(x_obj, x_prop, x_value) { \
+			ok = ok && (drmModeAtomicAddProperty(req, (x_obj), props->x_prop, (x_value)) >= 0); \
+		}
+	if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET) {
+		ADD_PROP(run->conn_id, conn_crtc_id, run->crtc_id);
+		ADD_PROP(run->crtc_id, crtc_mode_id, run->mode_blob_id);
+		ADD_PROP(run->crtc_id, crtc_active, 1);
+	}
+
+	// The plane scales the buffer to the display keeping the aspect ratio,
+	// it's 1:1 for the buffers of the display size.
+	us_drm_fit_s fit;
+	_drm_calculate_fit(&fit, buf->width, buf->height, run->mode.hdisplay, run->mode.vdisplay);
+	ADD_PROP(run->plane_id, plane_fb_id, buf->id);
+	ADD_PROP(run->plane_id, plane_crtc_id, run->crtc_id);
+	ADD_PROP(run->plane_id, plane_src_x, 0);
+	ADD_PROP(run->plane_id, plane_src_y, 0);
+	ADD_PROP(run->plane_id, plane_src_w, (u64)buf->width << 16); // 16.16 fixed point
+	ADD_PROP(run->plane_id, plane_src_h, (u64)buf->height << 16);
+	ADD_PROP(run->plane_id, plane_crtc_x, fit.offset_x);
+	ADD_PROP(run->plane_id, plane_crtc_y, fit.offset_y);
+	ADD_PROP(run->plane_id, plane_crtc_w, fit.width);
+	ADD_PROP(run->plane_id, plane_crtc_h, fit.height);
+#	undef ADD_PROP
+
+	int retval = -1;
+	if (ok) {
+		retval = drmModeAtomicCommit(run->fd, req, flags, buf);
+	} else {
+		errno = ENOMEM;
+	}
+	drmModeAtomicFree(req);
+	return retval;
+}
+
+static int _drm_flip(us_drm_s *drm, us_drm_buffer_s *buf, bool async) {
+	us_drm_runtime_s *const run = drm->run;
+
+	int retval;
+	if (run->atomic) {
+		// Only the FB is changed, the commit completes on the vblank with the page flip event
+		retval = _drm_atomic_commit(drm, buf, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
+	} else {
+		retval = drmModePageFlip(
+			run->fd, run->crtc_id, buf->id,
+			DRM_MODE_PAGE_FLIP_EVENT | (async && run->has_async_flip ? DRM_MODE_PAGE_FLIP_ASYNC : 0),
+			buf);
+	}
+	if (retval >= 0) {
+		buf->flip_us = us_get_now_monotonic_u64();
+		run->has_vsync = false;
+	}
+	return retval;
+}
+
+static int _drm_present(us_drm_s *drm, uint n_buf) {
+	us_drm_runtime_s *const run = drm->run;
+	us_drm_buffer_s *const buf = &run->bufs[n_buf];
+
+	if (run->platform == US_DRM_PLATFORM_AMLOGIC && !run->atomic) {
+		// The legacy Amlogic driver doesn't send the page flip events reliably, SetCrtc is synchronous
+		if (drmModeSetCrtc(run->fd, run->crtc_id, buf->id, 0, 0, &run->conn_id, 1, &run->mode) < 0) {
+			_LOG_PERROR("Can't expose SWAPCHAIN framebuffer n_buf=%u", n_buf);
+			return -1;
+		}
+		run->front_n_buf = n_buf;
+		return 0;
+	}
+
+	_LOG_DEBUG("Exposing SWAPCHAIN framebuffer n_buf=%u ...", n_buf);
+	if (_drm_flip(drm, buf, false) < 0) {
+		if (errno == EACCES || errno == EPERM) {
+			_LOG_DEBUG("Page flip permission denied (desktop environment active)");
+		} else {
+			_LOG_PERROR("Can't expose SWAPCHAIN framebuffer n_buf=%u", n_buf);
+		}
+		return -1;
+	}
+	run->pending_n_buf = n_buf;
+	return 0;
+}
+
+static int _drm_expose_converted(us_drm_s *drm, const us_frame_s *frame) {
+	us_drm_runtime_s *const run = drm->run;
+
+	// Retire the completed flip to free its buffer, it doesn't block
+	if (_drm_handle_events(drm, false) < 0) {
+		return -1;
+	}
+
+	// Mailbox: the fresh frame replaces the queued one, so the capture is never
+	// throttled by the display and the screen is at most one vblank behind.
+	int n_buf = run->queued_n_buf;
+	run->queued_n_buf = -1;
+	if (n_buf >= 0) {
+		atomic_fetch_add(&run->stats.replaced, 1);
+	} else {
+		for (n_buf = 0; n_buf < (int)run->n_bufs; ++n_buf) {
+			if (n_buf != run->front_n_buf && n_buf != run->pending_n_buf) {
+				break;
+			}
+		}
+	}
+	assert(n_buf < (int)run->n_bufs);
+	us_drm_buffer_s *const buf = &run->bufs[n_buf];
+
+	_LOG_DEBUG("Drawing frame to the SWAPCHAIN buffer n_buf=%d ...", n_buf);
+	const u64 begin_us = us_get_now_monotonic_u64();
+	if (_drm_draw_frame(drm, frame, buf) < 0) {
+		_LOG_ERROR("Can't draw frame n_buf=%d, skipped", n_buf);
+		return 0; // The previous frame stays on the screen
+	}
+	const u64 convert_us = us_get_now_monotonic_u64() - begin_us;
+	buf->grab_ts = frame->grab_ts;
+	atomic_fetch_add(&run->stats.converted, 1);
+	atomic_store(&run->stats.convert_us, convert_us);
+	atomic_fetch_add(&run->stats.convert_sum_us, convert_us);
+	++run->perf.converted;
+	run->perf.convert_sum_us += convert_us;
+
+	if (run->pending_n_buf >= 0) {
+		// It will be flipped right after the pending commit
+		run->queued_n_buf = n_buf;
+		return 0;
+	}
+	return _drm_present(drm, n_buf);
+}
+
+static int _drm_handle_events(us_drm_s *drm, bool wait) {
+	us_drm_runtime_s *const run = drm->run;
+
+	if (!run->has_vsync) {
+		struct timeval timeout = {.tv_sec = (wait ? drm->timeout : 0)};
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(run->fd, &fds);
+
+		_LOG_DEBUG("Calling select() for VSync ...");
+		const int result = select(run->fd + 1, &fds, NULL, NULL, &timeout);
+		if (result < 0) {
+			_LOG_PERROR("Can't select(%d) device for VSync", run->fd);
+			return -1;
+		} else if (result == 0) {
+			if (wait) {
+				_LOG_ERROR("Device timeout while waiting VSync");
+				return -1;
+			}
+			return 0;
+		}
+
+		drmEventContext ctx = {
+			.version = DRM_EVENT_CONTEXT_VERSION,
+			.page_flip_handler = _drm_vsync_callback,
+		};
+		_LOG_DEBUG("Handling DRM event (maybe VSync) ...");
+		if (drmHandleEvent(run->fd, &ctx) < 0) {
+			_LOG_PERROR("Can't handle DRM event");
+			return -1;
+		}
+		if (run->flipped != NULL) {
+			_drm_account_flip(drm, run->flipped);
+			run->flipped = NULL;
+		}
+	}
+
+	if (run->has_vsync && run->pending_n_buf >= 0) {
+		// The page flip event is the fence: the scanout is done with the previous front buffer
+		run->front_n_buf = run->pending_n_buf;
+		run->pending_n_buf = -1;
+		if (run->queued_n_buf >= 0) {
+			const uint n_buf = run->queued_n_buf;
+			run->queued_n_buf = -1;
+			return _drm_present(drm, n_buf);
+		}
+	}
+	return 0;
+}
+
+static void _drm_account_flip(us_drm_s *drm, const us_drm_buffer_s *buf) {
+	us_drm_runtime_s *const run = drm->run;
+
+	if (buf->grab_ts <= 0) {
+		return; // STUB
+	}
+
+	const u64 grab_us = buf->grab_ts * 1000000;
+	const u64 latency_us = (buf->vblank_us > grab_us ? buf->vblank_us - grab_us : 0);
+
+	// The flip is expected to complete on the first vblank after the commit
+	const float hz = _get_refresh_rate(&run->mode);
+	uint missed = 0;
+	if (hz > 0 && buf->vblank_us > buf->flip_us) {
+		missed = (buf->vblank_us - buf->flip_us) * hz / 1000000;
+	}
+
+	us_drm_stats_s *const stats = &run->stats;
+	atomic_fetch_add(&stats->flips, 1);
+	atomic_fetch_add(&stats->missed_vblanks, missed);
+	atomic_store(&stats->latency_us, latency_us);
+	atomic_fetch_add(&stats->latency_sum_us, latency_us);
+
+	++run->perf.flips;
+	run->perf.missed_vblanks += missed;
+	run->perf.latency_sum_us += latency_us;
+	run->perf.latency_max_us = US_MAX(run->perf.latency_max_us, latency_us);
+
+	const ldf now_ts = us_get_now_monotonic();
+	if (run->perf.begin_ts <= 0) {
+		run->perf.begin_ts = now_ts;
+	} else if (now_ts - run->perf.begin_ts >= 1) {
+		_LOG_PERF("Flips=%u, latency=%.1f/%.1f ms (avg/max), convert=%.1f ms (%u frames), missed_vblanks=%u",
+			run->perf.flips,
+			(double)run->perf.latency_sum_us / run->perf.flips / 1000,
+			(double)run->perf.latency_max_us / 1000,
+			(run->perf.converted > 0 ? (double)run->perf.convert_sum_us / run->perf.converted / 1000 : 0),
+			run->perf.converted,
+			run->perf.missed_vblanks);
+		US_MEMSET_ZERO(run->perf);
+		run->perf.begin_ts = now_ts;
+	}
+}
+
 static int _drm_find_sink(us_drm_s *drm, uint width, uint height, float hz) {
 	us_drm_runtime_s *const run = drm->run;
 
@@ -1023,10 +1559,6 @@ static int _drm_find_sink(us_drm_s *drm, uint width, uint height, float hz) {
 		run->conn_id = conn->connector_id;
 		memcpy(&run->mode, best, sizeof(drmModeModeInfo));
 
-		// Pre-calculate display stride for performance (XRGB8888 = 4 bytes per pixel)
-		run->display_stride = run->mode.hdisplay * 4;
-		_LOG_DEBUG("Pre-calculated display stride: %u (hdisplay=%u)", run->display_stride, run->mode.hdisplay);
-
 		drmModeFreeConnector(conn);
 		break;
 	}
@@ -1128,6 +1660,28 @@ static u32 _find_crtc(int fd, drmModeRes *res, drmModeConnector *conn, u32 *take
 	return 0;
 }
 
+static u32 _find_property(int fd, u32 obj_id, u32 obj_type, const char *name, u64 *value) {
+	drmModeObjectProperties *props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (props == NULL) {
+		return 0;
+	}
+	u32 id = 0;
+	for (uint pi = 0; pi < props->count_props && id == 0; ++pi) {
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[pi]);
+		if (prop != NULL) {
+			if (!strcmp(prop->name, name)) {
+				id = prop->prop_id;
+				if (value != NULL) {
+					*value = props->prop_values[pi];
+				}
+			}
+			drmModeFreeProperty(prop);
+		}
+	}
+	drmModeFreeObjectProperties(props);
+	return id;
+}
+
 static const char *_connector_type_to_string(u32 type) {
 	switch (type) {
 #		define CASE_NAME(x_suffix, x_name) \
@@ -1172,29 +1726,42 @@ static float _get_refresh_rate(const drmModeModeInfo *mode) {
 	return (float)mhz / 1000;
 }
 
-static void _drm_calculate_center(us_drm_center_s *center, uint src_w, uint src_h, uint dst_w, uint dst_h) {
-	center->src_width = src_w;
-	center->src_height = src_h;
-	center->dst_width = dst_w;
-	center->dst_height = dst_h;
-	
-	if (src_w <= dst_w && src_h <= dst_h) {
-		center->offset_x = (dst_w - src_w) / 2;
-		center->offset_y = (dst_h - src_h) / 2;
-		center->needs_center = true;
-		_LOG_DEBUG("Centering: %ux%u -> %ux%u, offset=(%u,%u)", 
-			src_w, src_h, dst_w, dst_h, center->offset_x, center->offset_y);
+static void _drm_calculate_fit(us_drm_fit_s *fit, uint src_w, uint src_h, uint dst_w, uint dst_h) {
+	// Letterboxing or pillarboxing with the preserved aspect ratio, both for upscaling and downscaling
+	if ((u64)src_w * dst_h > (u64)src_h * dst_w) {
+		fit->width = dst_w;
+		fit->height = US_MAX((uint)((u64)src_h * dst_w / src_w), 1u);
 	} else {
-		center->offset_x = 0;
-		center->offset_y = 0;
-		center->needs_center = false;
-		_LOG_DEBUG("No centering needed: source %ux%u >= display %ux%u", src_w, src_h, dst_w, dst_h);
+		fit->width = US_MAX((uint)((u64)src_w * dst_h / src_h), 1u);
+		fit->height = dst_h;
+	}
+	fit->offset_x = (dst_w - fit->width) / 2;
+	fit->offset_y = (dst_h - fit->height) / 2;
+}
+
+static void _drm_clear_borders(us_drm_buffer_s *buf, const us_drm_fit_s *fit, uint dst_w, uint dst_h) {
+	// Only the borders, the picture is overwritten anyway
+	const uint bytes = buf->bpp / 8;
+	for (uint y = 0; y < dst_h; ++y) {
+		u8 *const line = buf->data + (uz)y * buf->pitch;
+		if (y < fit->offset_y || y >= fit->offset_y + fit->height) {
+			memset(line, 0, (uz)dst_w * bytes);
+		} else {
+			memset(line, 0, (uz)fit->offset_x * bytes);
+			const uint right = fit->offset_x + fit->width;
+			memset(line + (uz)right * bytes, 0, (uz)(dst_w - right) * bytes);
+		}
 	}
 }
 
 int us_drm_expose_centered(us_drm_s *drm, const us_capture_hwbuf_s *hw) {
 	us_drm_runtime_s *const run = drm->run;
 
+	if (run->platform != US_DRM_PLATFORM_RPI && run->platform != US_DRM_PLATFORM_AMLOGIC) {
+		// Generic KMS drivers (including vkms) use the common path with the same scaling
+		return us_drm_expose_dma(drm, hw);
+	}
+
 	// Common pre-checks for all platforms
 	assert(run->fd >= 0);
 	assert(run->opened == 0);
@@ -1211,11 +1778,8 @@ int us_drm_expose_centered(us_drm_s *drm, const us_capture_hwbuf_s *hw) {
 	switch (run->platform) {
 		case US_DRM_PLATFORM_RPI:
 			return _drm_expose_rpi_v4p_impl(drm, hw);
-		case US_DRM_PLATFORM_AMLOGIC:
+		default: // US_DRM_PLATFORM_AMLOGIC
 			return _drm_expose_amlogic_display_impl(drm, hw);
-		default:
-			_LOG_ERROR("Unsupported DRM platform for centered display");
-			return -1;
 	}
 }
 
@@ -1247,95 +1811,56 @@ static us_drm_platform_e _detect_drm_platform(int fd) {
 	return platform;
 }
 
-static void _drm_convert_yuyv_simple(const u8 *src_data, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h) {
-	(void)dst_bpp; (void)dst_w; (void)dst_h;
-	u8 *dst_offset = dst_data + (center->offset_y * dst_stride) + (center->offset_x * 4);
-	YUY2ToARGB(src_data, src_w * 2, dst_offset, dst_stride, src_w, src_h);
-}
-
-
-static void _drm_convert_rgb24(const u8 *src_data, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h) {
-	const uint bytes_per_pixel = dst_bpp / 8;
-	const uint src_stride = src_w * 3; // RGB24 = 3 bytes per pixel
-
-	for (uint y = 0; y < src_h && y < center->src_height && (y + center->offset_y) < dst_h; y++) {
-		const u8 *src_row = src_data + (y * src_stride);
-		u8 *dst_row = dst_data + ((y + center->offset_y) * dst_stride) + (center->offset_x * bytes_per_pixel);
-
-		for (uint x = 0; x < src_w && x < center->src_width && (x + center->offset_x) < dst_w; x++) {
-			const uint src_pos = x * 3;
-			if (src_pos + 2 >= src_stride) break;
-
-			u8 R = src_row[src_pos + 0];
-			u8 G = src_row[src_pos + 1];
-			u8 B = src_row[src_pos + 2];
+static int _drm_draw_frame(us_drm_s *drm, const us_frame_s *frame, us_drm_buffer_s *buf) {
+	us_drm_runtime_s *const run = drm->run;
 
-			u8 *dst_pixel = dst_row + (x * bytes_per_pixel);
-			if (bytes_per_pixel == 4) {
-				dst_pixel[0] = B; dst_pixel[1] = G; dst_pixel[2] = R; dst_pixel[3] = 0xFF;
-			} else {
-				dst_pixel[0] = R; dst_pixel[1] = G; dst_pixel[2] = B;
-			}
-		}
+	us_convert_layout_e layout;
+	switch (buf->bpp) {
+		case 24: layout = US_CONVERT_BGR24; break; // DRM_FORMAT_RGB888 is B, G, R in memory
+		case 32: layout = US_CONVERT_XRGB32; break;
+		default: return -1;
+	}
+	const uint bytes = buf->bpp / 8;
+	const uint dst_w = buf->width;
+	const uint dst_h = buf->height;
+	if (frame->width == 0 || frame->height == 0 || frame->used == 0) {
+		return -1;
 	}
-}
-
-static void _drm_convert_bgr24(const u8 *src_data, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h) {
-	const uint bytes_per_pixel = dst_bpp / 8;
-	const uint src_stride = src_w * 3;
-
-	for (uint y = 0; y < src_h && y < center->src_height && (y + center->offset_y) < dst_h; y++) {
-		const u8 *src_row = src_data + (y * src_stride);
-		u8 *dst_row = dst_data + ((y + center->offset_y) * dst_stride) + (center->offset_x * bytes_per_pixel);
-
-		for (uint x = 0; x < src_w && x < center->src_width && (x + center->offset_x) < dst_w; x++) {
-			const uint src_pos = x * 3;
-			if (src_pos + 2 >= src_stride) break;
 
-			u8 B = src_row[src_pos + 0];
-			u8 G = src_row[src_pos + 1];
-			u8 R = src_row[src_pos + 2];
+	us_drm_fit_s fit;
+	_drm_calculate_fit(&fit, frame->width, frame->height, dst_w, dst_h);
+	_drm_clear_borders(buf, &fit, dst_w, dst_h);
+	u8 *const dst = buf->data + (uz)fit.offset_y * buf->pitch + (uz)fit.offset_x * bytes;
 
-			u8 *dst_pixel = dst_row + (x * bytes_per_pixel);
-			if (bytes_per_pixel == 4) {
-				dst_pixel[0] = B; dst_pixel[1] = G; dst_pixel[2] = R; dst_pixel[3] = 0xFF;
-			} else {
-				dst_pixel[0] = R; dst_pixel[1] = G; dst_pixel[2] = B;
-			}
+	us_frame_s *const decoded = run->decoded;
+	if (us_is_jpeg(frame->format)) {
+		// The decoder does the most of the downscaling, the rest is up to the resizer
+		if (us_unjpeg_to_packed(frame, decoded, layout, fit.width, fit.height) < 0) {
+			return -1;
+		}
+	} else if (frame->width == fit.width && frame->height == fit.height) {
+		return us_convert_to_packed(frame, layout, dst, buf->pitch, 0, 0);
+	} else {
+		US_FRAME_COPY_META(frame, decoded);
+		decoded->stride = frame->width * bytes;
+		decoded->used = (uz)decoded->stride * frame->height;
+		us_frame_realloc_data(decoded, decoded->used);
+		if (us_convert_to_packed(frame, layout, decoded->data, decoded->stride, 0, 0) < 0) {
+			return -1;
 		}
 	}
-}
-
-static void _drm_convert_mjpeg(const u8 *src_data, size_t src_size, uint src_w, uint src_h, u8 *dst_data, const us_drm_center_s *center, uint dst_stride, uint dst_bpp, uint dst_w, uint dst_h) {
-	_LOG_DEBUG("Decoding MJPEG frame %ux%u (%zu bytes)", src_w, src_h, src_size);
-
-	// Create temporary frames for JPEG decoding
-	us_frame_s src_frame = {0};
-	us_frame_s decoded_frame = {0};
-
-	// Setup source frame with MJPEG data
-	src_frame.width = src_w;
-	src_frame.height = src_h;
-	src_frame.format = V4L2_PIX_FMT_MJPEG;
-	src_frame.used = src_size;
-	src_frame.allocated = src_size;
-	src_frame.data = (u8*)src_data; // Cast away const for compatibility
-	src_frame.grab_ts = us_get_now_monotonic();
 
-	// Try to decode MJPEG to RGB24
-	if (us_unjpeg(&src_frame, &decoded_frame, true) == 0 && decoded_frame.data != NULL) {
-		_LOG_DEBUG("MJPEG decoded successfully to %ux%u RGB24", decoded_frame.width, decoded_frame.height);
-
-		// Now convert the decoded RGB24 to display format
-		_drm_convert_rgb24(decoded_frame.data, decoded_frame.width, decoded_frame.height,
-			dst_data, center, dst_stride, dst_bpp, dst_w, dst_h);
-
-		// Clean up decoded frame
-		US_DELETE(decoded_frame.data, free);
+	if (decoded->width == fit.width && decoded->height == fit.height) {
+		for (uint y = 0; y < fit.height; ++y) {
+			memcpy(dst + (uz)y * buf->pitch, decoded->data + (uz)y * decoded->stride, (uz)fit.width * bytes);
+		}
 	} else {
-		_LOG_ERROR("MJPEG decoding failed, cannot display frame");
-		// Leave buffer black (already cleared) - don't show fake data
+		us_convert_resize(
+			decoded->data, decoded->width, decoded->height, decoded->stride,
+			dst, fit.width, fit.height, buf->pitch,
+			bytes);
 	}
+	return 0;
 }
 
 
@@ -1347,11 +1872,9 @@ static void _drm_convert_mjpeg(const u8 *src_data, size_t src_size, uint src_w,
 static int _drm_expose_rpi_v4p_impl(us_drm_s *drm, const us_capture_hwbuf_s *hw) {
 	us_drm_runtime_s *const run = drm->run;
 
-	// Calculate centering parameters
-	us_drm_center_s center;
-	_drm_calculate_center(&center,
-		hw->raw.width, hw->raw.height,
-		run->mode.hdisplay, run->mode.vdisplay);
+	if (run->converting) {
+		return _drm_expose_converted(drm, &hw->raw);
+	}
 
 	// Safety checks
 	if (hw->buf.index >= run->n_bufs) {
@@ -1360,19 +1883,12 @@ static int _drm_expose_rpi_v4p_impl(us_drm_s *drm, const us_capture_hwbuf_s *hw)
 	}
 
 	us_drm_buffer_s *const buf = &run->bufs[hw->buf.index];
-	if (!buf->data) {
-		_LOG_ERROR("Buffer data is NULL for buffer %u", hw->buf.index);
-		return -1;
-	}
-
-	run->has_vsync = false;
 
+	buf->grab_ts = hw->raw.grab_ts;
 	_LOG_DEBUG("RPI V4P: Exposing DMA buffer %u", hw->buf.index);
 
 	// Original V4P uses page flip with DMA buffers
-	const int retval = drmModePageFlip(
-		run->fd, run->crtc_id, buf->id,
-		DRM_MODE_PAGE_FLIP_EVENT, buf);
+	const int retval = _drm_flip(drm, buf, false);
 
 	if (retval < 0) {
 		if (errno == EACCES || errno == EPERM) {
@@ -1391,111 +1907,17 @@ static int _drm_expose_rpi_v4p_impl(us_drm_s *drm, const us_capture_hwbuf_s *hw)
 static int _drm_expose_amlogic_display_impl(us_drm_s *drm, const us_capture_hwbuf_s *hw) {
 	us_drm_runtime_s *const run = drm->run;
 
-	// Calculate centering parameters
-	us_drm_center_s center;
-	_drm_calculate_center(&center,
-		hw->raw.width, hw->raw.height,
-		run->mode.hdisplay, run->mode.vdisplay);
-
-	if (!center.needs_center) {
-		_LOG_ERROR("Source resolution %ux%u is larger than display %ux%u",
-			hw->raw.width, hw->raw.height, run->mode.hdisplay, run->mode.vdisplay);
-		return us_drm_expose_stub(drm, US_DRM_STUB_BAD_RESOLUTION, NULL);
-	}
-
-	// Safety checks
-	if (hw->buf.index >= run->n_bufs) {
-		_LOG_ERROR("Invalid buffer index %u (max: %u)", hw->buf.index, run->n_bufs);
-		return -1;
-	}
-
-	us_drm_buffer_s *const buf = &run->bufs[hw->buf.index];
-	if (!buf->data || buf->allocated == 0) {
-		_LOG_ERROR("Invalid buffer %u for Amlogic display", hw->buf.index);
-		return -1;
-	}
-
-	run->has_vsync = false;
-
 	// Check for valid frame data
 	if (!hw->raw.data || hw->raw.used == 0) {
 		_LOG_DEBUG("No valid frame data available, skipping display");
 		return -1;
 	}
 
-	// Clear buffer only if resolution changed (for borders)
-	// For full-screen display, skip memset - libyuv will overwrite entire buffer
-	static uint last_src_w = 0, last_src_h = 0;
-	const bool resolution_changed = (last_src_w != hw->raw.width || last_src_h != hw->raw.height);
-	const bool is_fullscreen = (hw->raw.width == run->mode.hdisplay && hw->raw.height == run->mode.vdisplay);
-
-	if (resolution_changed && !is_fullscreen) {
-		memset(buf->data, 0, buf->allocated);
-		last_src_w = hw->raw.width;
-		last_src_h = hw->raw.height;
-	}
-
-	// Convert frame to display format
-	const uint actual_bpp = 32; // XRGB8888 for Amlogic
-	const uint dst_stride = run->display_stride; // Pre-calculated in init
-
-	// Log frame conversion only once per second to reduce overhead
-	static uint frame_counter = 0;
-	static uint last_logged_format = 0;
-	const bool should_log = ((frame_counter++ % 60) == 0) || (last_logged_format != hw->raw.format);
-
-	if (should_log) {
-		const char *format_name = "UNKNOWN";
-		switch (hw->raw.format) {
-			case V4L2_PIX_FMT_YUYV: format_name = "YUYV"; break;
-			case V4L2_PIX_FMT_RGB24: format_name = "RGB24"; break;
-			case V4L2_PIX_FMT_BGR24: format_name = "BGR24"; break;
-			case V4L2_PIX_FMT_MJPEG: format_name = "MJPEG"; break;
-			case V4L2_PIX_FMT_JPEG: format_name = "JPEG"; break;
-		}
-		_LOG_DEBUG("Amlogic: Converting %s %ux%u → display %ux%u",
-			format_name, hw->raw.width, hw->raw.height, run->mode.hdisplay, run->mode.vdisplay);
-		last_logged_format = hw->raw.format;
-	}
-
-	switch (hw->raw.format) {
-		case V4L2_PIX_FMT_YUYV:
-			_drm_convert_yuyv_simple(hw->raw.data, hw->raw.width, hw->raw.height,
-				buf->data, &center, dst_stride, actual_bpp, run->mode.hdisplay, run->mode.vdisplay);
-			break;
-
-		case V4L2_PIX_FMT_RGB24:
-			_drm_convert_rgb24(hw->raw.data, hw->raw.width, hw->raw.height,
-				buf->data, &center, dst_stride, actual_bpp, run->mode.hdisplay, run->mode.vdisplay);
-			break;
-
-		case V4L2_PIX_FMT_BGR24:
-			_drm_convert_bgr24(hw->raw.data, hw->raw.width, hw->raw.height,
-				buf->data, &center, dst_stride, actual_bpp, run->mode.hdisplay, run->mode.vdisplay);
-			break;
-
-		case V4L2_PIX_FMT_MJPEG:
-		case V4L2_PIX_FMT_JPEG:
-			_drm_convert_mjpeg(hw->raw.data, hw->raw.used, hw->raw.width, hw->raw.height,
-				buf->data, &center, dst_stride, actual_bpp, run->mode.hdisplay, run->mode.vdisplay);
-			break;
-
-		default:
-			_LOG_ERROR("Unsupported format 0x%08x for Amlogic display", hw->raw.format);
-			return -1;
-	}
-
-	// Display using SetCRTC (more compatible than page flip for Amlogic)
-	const int retval = drmModeSetCrtc(run->fd, run->crtc_id, buf->id,
-		0, 0, &run->conn_id, 1, &run->mode);
-
-	if (retval < 0) {
-		_LOG_PERROR("Can't set CRTC for Amlogic framebuffer n_buf=%u", hw->buf.index);
-	} else {
-		_LOG_DEBUG("Amlogic framebuffer displayed successfully");
-	}
-
-	return retval;
+	// Amlogic never imports the capture buffers, the frames are always drawn to the swapchain
+	assert(run->converting);
+	_LOG_DEBUG("Amlogic: Converting 0x%08x %ux%u → display %ux%u",
+		hw->raw.format, hw->raw.width, hw->raw.height, run->mode.hdisplay, run->mode.vdisplay);
+	return _drm_expose_converted(drm, &hw->raw);
 }
 
 
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <stdatomic.h>
 
 #include <xf86drmMode.h>
 
@@ -47,25 +48,59 @@ typedef enum {
 } us_drm_platform_e;
 
 typedef struct {
-	uint src_width, src_height;
-	uint dst_width, dst_height;
+	uint width, height; // The scaled picture with the source aspect ratio
 	uint offset_x, offset_y;
-	bool needs_center;
-} us_drm_center_s;
+} us_drm_fit_s;
 
-typedef struct {
+typedef struct us_drm_buffer_sx {
 	u32		id;
 	u32		handle;
 	u8		*data;
 	uz		allocated;
+	uint	width;
+	uint	height;
+	uint	pitch; // Only for the dumb buffers
+	uint	bpp;
 	bool	dumb_created;
 	bool	fb_added;
+	ldf		grab_ts;	// Of the shown frame, 0 for STUB
+	u64		flip_us;	// Commit time
+	u64		vblank_us;	// Completion time from the page flip event
 	struct {
-		bool	*has_vsync;
-		int		*exposing_dma_fd;
+		bool						*has_vsync;
+		int							*exposing_dma_fd;
+		struct us_drm_buffer_sx		**flipped;
 	} ctx;
 } us_drm_buffer_s;
 
+// The counters since the start, readable from any thread
+typedef struct {
+	atomic_ullong	flips;			// Live frames shown on the screen
+	atomic_ullong	missed_vblanks;	// Flips completed later than on the next vblank
+	atomic_ullong	replaced;		// Swapchain frames replaced by the newer ones before the flip
+	atomic_ullong	latency_us;		// Grab to flip of the last frame
+	atomic_ullong	latency_sum_us;
+	atomic_ullong	converted;
+	atomic_ullong	convert_us;		// Drawing time of the last converted frame
+	atomic_ullong	convert_sum_us;
+} us_drm_stats_s;
+
+typedef struct {
+	u32	conn_crtc_id;
+	u32	crtc_mode_id;
+	u32	crtc_active;
+	u32	plane_fb_id;
+	u32	plane_crtc_id;
+	u32	plane_src_x;
+	u32	plane_src_y;
+	u32	plane_src_w;
+	u32	plane_src_h;
+	u32	plane_crtc_x;
+	u32	plane_crtc_y;
+	u32	plane_crtc_w;
+	u32	plane_crtc_h;
+} us_drm_props_s;
+
 typedef struct {
 	int				status_fd;
 	int				fd;
@@ -88,7 +123,34 @@ typedef struct {
 	us_frametext_s	*ft;
 	uint			detected_bpp;	// Auto-detected bits per pixel
 	us_drm_platform_e platform;	// Platform type for different DRM handling
-	uint			display_stride;	// Pre-calculated stride for display (hdisplay * 4)
+	bool			converting;	// The frames are drawn to the swapchain instead of the DMA import
+	bool			has_async_flip;
+	us_frame_s		*decoded;	// Persistent MJPEG decoding and scaling buffer
+
+	bool			atomic;
+	u32				plane_id;
+	u32				mode_blob_id;
+	us_drm_props_s	props;
+	u32				*plane_formats;	// Linear scanout formats of the primary plane, NULL if unknown
+	uint			n_plane_formats;
+	bool			has_modifiers;
+
+	// The swapchain of the converted frames, -1 is none
+	int				front_n_buf;	// On the screen
+	int				pending_n_buf;	// Committed, waiting for the vblank
+	int				queued_n_buf;	// Drawn while the commit was pending
+
+	us_drm_buffer_s	*flipped;	// Set by the page flip event
+	us_drm_stats_s	stats;
+	struct {
+		ldf		begin_ts;
+		uint	flips;
+		uint	missed_vblanks;
+		u64		latency_sum_us;
+		u64		latency_max_us;
+		uint	converted;
+		u64		convert_sum_us;
+	} perf; // The window of the periodic PERF log
 } us_drm_runtime_s;
 
 typedef struct {
@@ -32,12 +32,19 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+#include <linux/videodev2.h>
+
 #include "types.h"
 #include "errors.h"
 #include "tools.h"
 #include "logging.h"
 #include "frame.h"
 #include "memsinksh.h"
+#include "memsinkcl.h"
+#include "nalu.h"
+
+static int _server_grow(us_memsink_s *sink, uz size);
+
 
 #ifdef WITH_MEDIACODEC
 static int shm_unlink(const char *name) {
@@ -107,6 +114,7 @@ us_memsink_s *us_memsink_init_opened(
 	sink->timeout = timeout;
 	sink->fd = -1;
 	atomic_init(&sink->has_clients, false);
+	atomic_init(&sink->oversize_dropped, 0);
 
 	US_LOG_INFO("Using %s-sink: %s", name, obj);
 
@@ -124,14 +132,35 @@ us_memsink_s *us_memsink_init_opened(
 		goto error;
 	}
 
-	if (sink->server && ftruncate(sink->fd, sizeof(us_memsink_shared_s) + sink->data_size) < 0) {
-		US_LOG_PERROR("%s-sink: Can't truncate shared memory", name);
-		goto error;
+	if (sink->server) {
+		// The sink may be grown by the previous server, and the clients may still use it.
+		// Never shrink it, the access to the truncated pages leads to SIGBUS.
+		struct stat st;
+		if (fstat(sink->fd, &st) < 0) {
+			US_LOG_PERROR("%s-sink: Can't stat shared memory", name);
+			goto error;
+		}
+		if ((uz)st.st_size > sizeof(us_memsink_shared_s) + sink->data_size) {
+			sink->data_size = st.st_size - sizeof(us_memsink_shared_s);
+		}
+		if (ftruncate(sink->fd, sizeof(us_memsink_shared_s) + sink->data_size) < 0) {
+			US_LOG_PERROR("%s-sink: Can't truncate shared memory", name);
+			goto error;
+		}
 	}
 
-	if ((sink->mem = us_memsink_shared_map(sink->fd, sink->data_size)) == NULL) {
-		US_LOG_PERROR("%s-sink: Can't mmap shared memory", name);
-		goto error;
+	if (sink->server) {
+		if ((sink->mem = us_memsink_shared_map(sink->fd, sink->data_size)) == NULL) {
+			US_LOG_PERROR("%s-sink: Can't mmap shared memory", name);
+			goto error;
+		}
+	} else {
+		const int fd = sink->fd;
+		sink->fd = -1; // The client takes it
+		if ((sink->client = us_memsinkcl_init(fd, sink->data_size)) == NULL) {
+			US_LOG_PERROR("%s-sink: Can't mmap shared memory", name);
+			goto error;
+		}
 	}
 	return sink;
 
@@ -141,6 +170,7 @@ error:
 }
 
 void us_memsink_destroy(us_memsink_s *sink) {
+	US_DELETE(sink->client, us_memsinkcl_destroy);
 	if (sink->mem != NULL) {
 		if (us_memsink_shared_unmap(sink->mem, sink->data_size) < 0) {
 			US_LOG_PERROR("%s-sink: Can't unmap shared memory", sink->name);
@@ -220,14 +250,26 @@ int us_memsink_server_put(us_memsink_s *sink, const us_frame_s *frame, bool *key
 	const ldf now = us_get_now_monotonic();
 
 	if (frame->used > sink->data_size) {
-		US_LOG_ERROR("%s-sink: Can't put frame: is too big (%zu > %zu)",
-			sink->name, frame->used, sink->data_size);
-		return 0;
+		if (frame->used > US_MEMSINK_MAX_DATA_SIZE) {
+			const ull dropped = atomic_fetch_add(&sink->oversize_dropped, 1) + 1;
+			US_LOG_ERROR("%s-sink: Can't put frame: is too big (%zu > %zu); dropped=%llu",
+				sink->name, frame->used, US_MEMSINK_MAX_DATA_SIZE, dropped);
+			return 0;
+		}
+		if (_server_grow(sink, frame->used) < 0) {
+			return -1;
+		}
 	}
 
 	if (us_flock_timedwait_monotonic(sink->fd, 1) == 0) {
 		US_LOG_VERBOSE("%s-sink: >>>>> Exposing new frame ...", sink->name);
 
+		if (sink->mem->magic != US_MEMSINK_MAGIC || sink->mem->version != US_MEMSINK_VERSION) {
+			// Fresh or outdated memory, the client fields can contain garbage here
+			sink->mem->key_requested = false;
+			sink->mem->bitrate_requested = 0;
+		}
+
 		sink->mem->id = us_get_now_id();
 		if (sink->mem->key_requested && frame->key) {
 			sink->mem->key_requested = false;
@@ -236,19 +278,32 @@ int us_memsink_server_put(us_memsink_s *sink, const us_frame_s *frame, bool *key
 			*key_requested = sink->mem->key_requested;
 		}
 
-		memcpy(us_memsink_get_data(sink->mem), frame->data, frame->used);
+		u8 *const data = us_memsink_get_data(sink->mem);
+		memcpy(data, frame->data, frame->used);
 		sink->mem->used = frame->used;
+		sink->mem->data_size = sink->data_size;
+		if (frame->format == V4L2_PIX_FMT_H264) {
+			// The data is still in the cache, so index it once here
+			// instead of rescanning it in every client.
+			sink->mem->n_nalus = us_nalu_index(data, frame->used, sink->mem->nalus, US_NALUS_MAX);
+		} else {
+			sink->mem->n_nalus = 0;
+		}
 		US_FRAME_COPY_META(frame, sink->mem);
 
 		sink->mem->magic = US_MEMSINK_MAGIC;
 		sink->mem->version = US_MEMSINK_VERSION;
 
-		atomic_store(&sink->has_clients, (sink->mem->last_client_ts + sink->client_ttl > us_get_now_monotonic()));
+		const bool has_clients = (sink->mem->last_client_ts + sink->client_ttl > us_get_now_monotonic());
+		atomic_store(&sink->has_clients, has_clients);
+		// The request is meaningful only while the client which wrote it is alive
+		sink->bitrate_requested = (has_clients ? sink->mem->bitrate_requested : 0);
 
 		if (flock(sink->fd, LOCK_UN) < 0) {
 			US_LOG_PERROR("%s-sink: Can't unlock memory", sink->name);
 			return -1;
 		}
+		us_memsink_shared_notify(sink->mem);
 		US_LOG_VERBOSE("%s-sink: Exposed new frame; full exposition time = %.3Lf",
 			sink->name, us_get_now_monotonic() - now);
 
@@ -265,49 +320,54 @@ int us_memsink_server_put(us_memsink_s *sink, const us_frame_s *frame, bool *key
 int us_memsink_client_get(us_memsink_s *sink, us_frame_s *frame, bool *key_requested, bool key_required) {
 	assert(!sink->server); // Client only
 
-	if (us_flock_timedwait_monotonic(sink->fd, sink->timeout) < 0) {
-		if (errno == EWOULDBLOCK) {
-			return US_ERROR_NO_DATA;
+	const int acquired = us_memsinkcl_acquire(sink->client, sink->timeout, 0);
+	if (acquired == US_ERROR_NO_DATA) {
+		return US_ERROR_NO_DATA; // Not updated
+	} else if (acquired < 0) {
+		if (errno == EPROTO) {
+			US_LOG_ERROR("%s-sink: Protocol version mismatch: required=%u", sink->name, US_MEMSINK_VERSION);
+		} else {
+			US_LOG_PERROR("%s-sink: Can't read memory", sink->name);
 		}
-		US_LOG_PERROR("%s-sink: Can't lock memory", sink->name);
 		return -1;
 	}
 
-	int retval = 0;
-
-	if (sink->mem->magic != US_MEMSINK_MAGIC) {
-		retval = US_ERROR_NO_DATA; // Not updated
-		goto done;
-	}
-	if (sink->mem->version != US_MEMSINK_VERSION) {
-		US_LOG_ERROR("%s-sink: Protocol version mismatch: sink=%u, required=%u",
-			sink->name, sink->mem->version, US_MEMSINK_VERSION);
-		retval = -1;
-		goto done;
-	}
-
-	// Let the sink know that the client is alive
-	sink->mem->last_client_ts = us_get_now_monotonic();
-
-	if (sink->mem->id == sink->last_readed_id) {
-		retval = US_ERROR_NO_DATA; // Not updated
-		goto done;
-	}
-
-	sink->last_readed_id = sink->mem->id;
-	us_frame_set_data(frame, us_memsink_get_data(sink->mem), sink->mem->used);
-	US_FRAME_COPY_META(sink->mem, frame);
+	us_memsink_shared_s *const mem = sink->client->mem;
+	us_frame_set_data(frame, us_memsink_get_data(mem), mem->used);
+	US_FRAME_COPY_META(mem, frame);
 	if (key_requested != NULL) { // We don't need it for non-H264 sinks
-		*key_requested = sink->mem->key_requested;
+		*key_requested = mem->key_requested;
 	}
 	if (key_required) {
-		sink->mem->key_requested = true;
+		mem->key_requested = true;
 	}
 
-done:
-	if (flock(sink->fd, LOCK_UN) < 0) {
+	if (us_memsinkcl_release(sink->client) < 0) {
 		US_LOG_PERROR("%s-sink: Can't unlock memory", sink->name);
-		retval = -1;
+		return -1;
 	}
-	return retval;
+	return 0;
+}
+
+static int _server_grow(us_memsink_s *sink, uz size) {
+	// The file is only extended, so the clients can continue to use their old mappings
+	// until they see the new data_size under the lock. Some extra space is added
+	// to avoid a remap for each slightly bigger frame.
+	const uz step = 1024 * 1024;
+	const uz new_size = US_MIN(((size + size / 4 + step - 1) / step) * step, US_MEMSINK_MAX_DATA_SIZE);
+	assert(new_size >= size);
+
+	if (ftruncate(sink->fd, sizeof(us_memsink_shared_s) + new_size) < 0) {
+		US_LOG_PERROR("%s-sink: Can't grow shared memory", sink->name);
+		return -1;
+	}
+	us_memsink_shared_s *const mem = us_memsink_shared_remap(sink->mem, sink->data_size, new_size);
+	if (mem == NULL) {
+		US_LOG_PERROR("%s-sink: Can't remap grown shared memory", sink->name);
+		return -1;
+	}
+	US_LOG_INFO("%s-sink: Grown data area: %zu -> %zu", sink->name, sink->data_size, new_size);
+	sink->mem = mem;
+	sink->data_size = new_size;
+	return 0;
 }
@@ -29,24 +29,26 @@
 #include "types.h"
 #include "frame.h"
 #include "memsinksh.h"
+#include "memsinkcl.h"
 
 
 typedef struct {
 	const char	*name;
 	const char	*obj;
-	uz			data_size;
+	uz			data_size; // The current size, it can grow
 	bool		server;
 	bool		rm;
 	uint		client_ttl; // Only for server
 	uint		timeout;
 
-	int					fd;
-	us_memsink_shared_s	*mem;
+	int					fd; // Only for server
+	us_memsink_shared_s	*mem; // Only for server
+	us_memsinkcl_s		*client; // Only for client
 
-	u64			last_readed_id; // Only for client
-
-	atomic_bool	has_clients; // Only for server results
-	ldf			unsafe_last_client_ts; // Only for server
+	atomic_bool		has_clients; // Only for server results
+	atomic_ullong	oversize_dropped; // Only for server results, the frames bigger than US_MEMSINK_MAX_DATA_SIZE
+	uint			bitrate_requested; // Only for server results
+	ldf				unsafe_last_client_ts; // Only for server
 } us_memsink_s;
 
 
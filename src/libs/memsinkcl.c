@@ -0,0 +1,186 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "memsinkcl.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/file.h>
+#include <sys/eventfd.h>
+
+#include <pthread.h>
+
+#include "types.h"
+#include "errors.h"
+#include "tools.h"
+#include "memsinksh.h"
+
+
+static int _remap(us_memsinkcl_s *cl);
+static void *_notify_thread(void *v_cl);
+
+
+us_memsinkcl_s *us_memsinkcl_init(int fd, uz data_size) {
+	us_memsinkcl_s *cl;
+	US_CALLOC(cl, 1);
+	cl->fd = fd;
+	cl->data_size = data_size;
+	cl->notify_fd = -1;
+	atomic_init(&cl->notify_stop, false);
+
+	if ((cl->mem = us_memsink_shared_map(fd, data_size)) == NULL) {
+		const int error = errno;
+		us_memsinkcl_destroy(cl);
+		errno = error;
+		return NULL;
+	}
+	return cl;
+}
+
+void us_memsinkcl_destroy(us_memsinkcl_s *cl) {
+	if (cl->notify_started) {
+		// Only the server bumps notify_seq, the thread will see the flag after the wait timeout
+		atomic_store(&cl->notify_stop, true);
+		pthread_join(cl->notify_tid, NULL);
+	}
+	US_CLOSE_FD(cl->notify_fd);
+	if (cl->notify_mem != NULL) {
+		us_memsink_shared_unmap(cl->notify_mem, 0);
+	}
+	if (cl->mem != NULL) {
+		us_memsink_shared_unmap(cl->mem, cl->data_size);
+	}
+	US_CLOSE_FD(cl->fd);
+	free(cl);
+}
+
+int us_memsinkcl_acquire(us_memsinkcl_s *cl, ldf lock_timeout, ldf timeout) {
+	const ldf deadline_ts = us_get_now_monotonic() + timeout;
+	while (true) {
+		// Read it before checking the frame, so the notification can't be missed
+		const u32 seq = atomic_load((_Atomic u32*)&cl->mem->notify_seq);
+
+		bool busy = false;
+		if (us_flock_timedwait_monotonic(cl->fd, lock_timeout) < 0) {
+			if (errno != EWOULDBLOCK) {
+				return -1;
+			}
+			busy = true; // The other client is reading the frame, it may be new for us too
+		} else {
+			us_memsink_shared_s *const mem = cl->mem;
+			if (mem->magic == US_MEMSINK_MAGIC) {
+				if (mem->version != US_MEMSINK_VERSION) {
+					// Here is the only place to support the other layouts of the sink
+					us_memsinkcl_release(cl);
+					errno = EPROTO;
+					return -1;
+				}
+				if (mem->data_size > cl->data_size && _remap(cl) < 0) {
+					const int error = errno;
+					us_memsinkcl_release(cl);
+					errno = error;
+					return -1;
+				}
+				// Let the sink know that the client is alive
+				cl->mem->last_client_ts = us_get_now_monotonic();
+				if (cl->mem->id != cl->last_id) {
+					cl->last_id = cl->mem->id;
+					return 0;
+				}
+			}
+			if (us_memsinkcl_release(cl) < 0) {
+				return -1;
+			}
+		}
+
+		const ldf now_ts = us_get_now_monotonic();
+		if (now_ts >= deadline_ts) {
+			return US_ERROR_NO_DATA;
+		}
+		if (busy) {
+			usleep(1000); // lock_polling
+		} else if (us_memsink_shared_wait(cl->mem, seq, deadline_ts - now_ts) < 0 && errno != ETIMEDOUT && errno != EINTR) {
+			// Sleep until the sink exposes a new frame instead of polling
+			return -1;
+		}
+	}
+}
+
+int us_memsinkcl_release(us_memsinkcl_s *cl) {
+	return flock(cl->fd, LOCK_UN);
+}
+
+int us_memsinkcl_get_notify_fd(us_memsinkcl_s *cl) {
+	if (!cl->notify_started) {
+		if (cl->notify_fd < 0 && (cl->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+			return -1;
+		}
+		if (cl->notify_mem == NULL && (cl->notify_mem = us_memsink_shared_map(cl->fd, 0)) == NULL) {
+			return -1;
+		}
+		atomic_store(&cl->notify_stop, false);
+		if ((errno = pthread_create(&cl->notify_tid, NULL, _notify_thread, cl)) != 0) {
+			return -1;
+		}
+		cl->notify_started = true;
+	}
+	return cl->notify_fd;
+}
+
+void us_memsinkcl_clear_notify_fd(us_memsinkcl_s *cl) {
+	if (cl->notify_fd >= 0) {
+		eventfd_t value;
+		(void)eventfd_read(cl->notify_fd, &value);
+	}
+}
+
+static int _remap(us_memsinkcl_s *cl) {
+	// The server has grown the sink for a bigger frame
+	const uz data_size = cl->mem->data_size;
+	us_memsink_shared_s *const mem = us_memsink_shared_remap(cl->mem, cl->data_size, data_size);
+	if (mem == NULL) {
+		return -1;
+	}
+	cl->mem = mem;
+	cl->data_size = data_size;
+	return 0;
+}
+
+static void *_notify_thread(void *v_cl) {
+	// Converts the futex notifications from the sink to the eventfd
+	us_memsinkcl_s *const cl = v_cl;
+	us_memsink_shared_s *const mem = cl->notify_mem;
+	u32 seq = atomic_load((_Atomic u32*)&mem->notify_seq) - 1; // Signal the first time
+	while (!atomic_load(&cl->notify_stop)) {
+		const u32 now_seq = atomic_load((_Atomic u32*)&mem->notify_seq);
+		if (now_seq != seq) {
+			seq = now_seq;
+			eventfd_write(cl->notify_fd, 1);
+		}
+		us_memsink_shared_wait(mem, seq, 0.1); // stop_polling
+	}
+	return NULL;
+}
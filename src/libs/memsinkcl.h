@@ -0,0 +1,64 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "types.h"
+#include "memsinksh.h"
+
+
+// The common memsink client for ustreamer-dump, Python, Janus and libustreamer-client.
+// It doesn't log anything, all the errors are reported via errno.
+
+typedef struct {
+	int					fd;
+	us_memsink_shared_s	*mem;
+	uz					data_size;
+	u64					last_id;
+
+	int					notify_fd; // Eventfd, it's signaled by notify_tid on each new frame
+	us_memsink_shared_s	*notify_mem; // The header only, it's never remapped under notify_tid
+	pthread_t			notify_tid;
+	bool				notify_started;
+	atomic_bool			notify_stop;
+} us_memsinkcl_s;
+
+
+// Takes the ownership of the opened shared memory fd
+us_memsinkcl_s *us_memsinkcl_init(int fd, uz data_size);
+void us_memsinkcl_destroy(us_memsinkcl_s *cl);
+
+// Returns 0 with the locked sink if a new frame is available, then the frame can be read
+// right from the cl->mem without copying until us_memsinkcl_release() is called.
+// Returns US_ERROR_NO_DATA on timeout, zero timeout means a single check.
+// Returns -1 and errno on error, EPROTO means the incompatible sink.
+int us_memsinkcl_acquire(us_memsinkcl_s *cl, ldf lock_timeout, ldf timeout);
+int us_memsinkcl_release(us_memsinkcl_s *cl);
+
+// Creates the eventfd which becomes readable when the sink may have a new frame.
+// It's for select(), poll(), epoll and so on.
+int us_memsinkcl_get_notify_fd(us_memsinkcl_s *cl);
+void us_memsinkcl_clear_notify_fd(us_memsinkcl_s *cl);
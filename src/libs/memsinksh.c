@@ -22,15 +22,24 @@
 
 #include "memsinksh.h"
 
+#include <stdatomic.h>
 #include <string.h>
 #include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
 #include <assert.h>
 
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "types.h"
 
 
+static void _advise_hugepages(us_memsink_shared_s *mem, uz data_size);
+
+
 us_memsink_shared_s *us_memsink_shared_map(int fd, uz data_size) {
 	us_memsink_shared_s *mem = mmap(
 		NULL,
@@ -41,6 +50,7 @@ us_memsink_shared_s *us_memsink_shared_map(int fd, uz data_size) {
 		return NULL;
 	}
 	assert(mem != NULL);
+	_advise_hugepages(mem, data_size);
 	return mem;
 }
 
@@ -49,6 +59,21 @@ int us_memsink_shared_unmap(us_memsink_shared_s *mem, uz data_size) {
 	return munmap(mem, sizeof(us_memsink_shared_s) + data_size);
 }
 
+us_memsink_shared_s *us_memsink_shared_remap(us_memsink_shared_s *mem, uz data_size, uz new_data_size) {
+	// The old mapping stays valid on error
+	assert(mem != NULL);
+	us_memsink_shared_s *const new_mem = mremap(
+		mem,
+		sizeof(us_memsink_shared_s) + data_size,
+		sizeof(us_memsink_shared_s) + new_data_size,
+		MREMAP_MAYMOVE);
+	if (new_mem == MAP_FAILED) {
+		return NULL;
+	}
+	_advise_hugepages(new_mem, new_data_size);
+	return new_mem;
+}
+
 uz us_memsink_calculate_size(const char *obj) {
 	const char *ptr = strrchr(obj, ':');
 	if (ptr == NULL) {
@@ -70,3 +95,44 @@ uz us_memsink_calculate_size(const char *obj) {
 u8 *us_memsink_get_data(us_memsink_shared_s *mem) {
 	return (u8*)(mem) + sizeof(us_memsink_shared_s);
 }
+
+void us_memsink_shared_notify(us_memsink_shared_s *mem) {
+	// Wakes up all the clients of all the processes sleeping in us_memsink_shared_wait()
+	atomic_fetch_add((_Atomic u32*)&mem->notify_seq, 1);
+	syscall(SYS_futex, &mem->notify_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+int us_memsink_shared_wait(us_memsink_shared_s *mem, u32 seq, ldf timeout) {
+	// Sleeps until notify_seq is changed from the given value or the timeout is expired.
+	// The seq must be read before checking the frame, so the notification can't be missed.
+	if (timeout <= 0) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	const struct timespec ts = {
+		.tv_sec = timeout,
+		.tv_nsec = (timeout - (long long)timeout) * 1000000000,
+	};
+	if (syscall(SYS_futex, &mem->notify_seq, FUTEX_WAIT, seq, &ts, NULL, 0) < 0) {
+		if (errno == EAGAIN) {
+			return 0; // Already changed
+		}
+		return -1; // ETIMEDOUT or EINTR
+	}
+	return 0;
+}
+
+static void _advise_hugepages(us_memsink_shared_s *mem, uz data_size) {
+	// The sink must be opened by name, so it can't be a hugetlbfs memfd.
+	// The huge pages for the shmem are used only if the administrator allowed them
+	// in /sys/kernel/mm/transparent_hugepage/shmem_enabled ("advise" or "always"),
+	// otherwise it's a no-op. The error is not critical, just 4K pages are used.
+#	ifdef MADV_HUGEPAGE
+	if (data_size >= 2 * 1024 * 1024) {
+		madvise(mem, sizeof(us_memsink_shared_s) + data_size, MADV_HUGEPAGE);
+	}
+#	else
+	(void)mem;
+	(void)data_size;
+#	endif
+}
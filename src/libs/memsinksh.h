@@ -24,10 +24,14 @@
 
 #include "types.h"
 #include "frame.h"
+#include "nalu.h"
 
 
 #define US_MEMSINK_MAGIC	((u64)0xCAFEBABECAFEBABE)
-#define US_MEMSINK_VERSION	((u32)7)
+#define US_MEMSINK_VERSION	((u32)11)
+
+// The data area grows on demand up to this size, see us_memsink_server_put()
+#define US_MEMSINK_MAX_DATA_SIZE	((uz)64 * 1024 * 1024)
 
 
 typedef struct {
@@ -35,9 +39,15 @@ typedef struct {
 	u32		version;
 	u64		id;
 	uz		used;
+	uz		data_size; // The data area can only grow, the clients remap it when it changes
+	u32		notify_seq; // Futex, incremented after each new frame
 
 	ldf		last_client_ts;
 	bool	key_requested;
+	uint	bitrate_requested; // Kbps, 0 = no limit
+
+	uint		n_nalus; // H264 only, 0 = unknown, scan the data
+	us_nalu_s	nalus[US_NALUS_MAX];
 
 	US_FRAME_META_DECLARE;
 } us_memsink_shared_s;
@@ -45,6 +55,10 @@ typedef struct {
 
 us_memsink_shared_s *us_memsink_shared_map(int fd, uz data_size);
 int us_memsink_shared_unmap(us_memsink_shared_s *mem, uz data_size);
+us_memsink_shared_s *us_memsink_shared_remap(us_memsink_shared_s *mem, uz data_size, uz new_data_size);
 
 uz us_memsink_calculate_size(const char *obj);
 u8 *us_memsink_get_data(us_memsink_shared_s *mem);
+
+void us_memsink_shared_notify(us_memsink_shared_s *mem);
+int us_memsink_shared_wait(us_memsink_shared_s *mem, u32 seq, ldf timeout);
@@ -0,0 +1,98 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "nalu.h"
+
+#include <string.h>
+
+#include "types.h"
+
+
+#define _PRE 3 // Annex B prefix length
+
+
+sz us_nalu_find_annexb(const u8 *data, uz size) {
+	// Finds 00 00 01 start code. The libc memchr() is vectorized on all of our
+	// platforms, so we're looking for the rare 01 byte and checking the zeros
+	// behind it instead of testing every byte of the slice data.
+	if (size < _PRE) {
+		return -1;
+	}
+	const u8 *ptr = data + _PRE - 1;
+	const u8 *const end = data + size;
+	while (ptr < end && (ptr = memchr(ptr, 1, end - ptr)) != NULL) {
+		if (ptr[-1] == 0 && ptr[-2] == 0) {
+			return ptr - data - (_PRE - 1);
+		}
+		++ptr;
+	}
+	return -1;
+}
+
+bool us_nalu_next(const u8 *data, uz size, uz *pos, us_nalu_s *nalu) {
+	// Iterates the NAL units without a limit, *pos must be 0 for the first one
+	while (*pos < size) {
+		sz begin = us_nalu_find_annexb(data + *pos, size - *pos);
+		if (begin < 0) {
+			break;
+		}
+		begin += *pos + _PRE;
+
+		sz end = us_nalu_find_annexb(data + begin, size - begin);
+		uz nalu_size;
+		if (end < 0) {
+			end = size;
+			nalu_size = size - begin;
+		} else {
+			end += begin;
+			nalu_size = end - begin;
+			if (nalu_size > 0 && data[begin + nalu_size - 1] == 0) { // Check for extra 00
+				--nalu_size;
+			}
+		}
+		*pos = end;
+
+		if (nalu_size > 0) {
+			nalu->offset = begin;
+			nalu->size = nalu_size;
+			nalu->type = data[begin] & 0x1F;
+			return true;
+		}
+	}
+	*pos = size;
+	return false;
+}
+
+uint us_nalu_index(const u8 *data, uz size, us_nalu_s *nalus, uint max) {
+	// Returns 0 if there are no NAL units or more than max
+	uint count = 0;
+	uz pos = 0;
+	us_nalu_s nalu;
+	while (us_nalu_next(data, size, &pos, &nalu)) {
+		if (count >= max) {
+			return 0;
+		}
+		nalus[count] = nalu;
+		++count;
+	}
+	return count;
+}
@@ -0,0 +1,40 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "types.h"
+
+
+#define US_NALUS_MAX 32
+
+
+typedef struct {
+	u32	offset; // The first byte after the start code
+	u32	size; // Without the start code and the trailing zero
+	u8	type;
+} us_nalu_s;
+
+
+sz us_nalu_find_annexb(const u8 *data, uz size);
+bool us_nalu_next(const u8 *data, uz size, uz *pos, us_nalu_s *nalu);
+uint us_nalu_index(const u8 *data, uz size, us_nalu_s *nalus, uint max);
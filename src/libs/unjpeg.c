@@ -30,6 +30,7 @@
 #include <linux/videodev2.h>
 
 #include "types.h"
+#include "tools.h"
 #include "logging.h"
 #include "frame.h"
 
@@ -42,6 +43,9 @@ typedef struct {
 
 
 static void _jpeg_error_handler(j_common_ptr jpeg);
+#ifndef JCS_EXTENSIONS
+static void _jpeg_rgb_to_layout(u8 *row, uint width, us_convert_layout_e layout);
+#endif
 
 
 int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode) {
@@ -165,6 +169,95 @@ done:
 	return retval;
 }
 
+int us_unjpeg_to_packed(const us_frame_s *src, us_frame_s *dest, us_convert_layout_e layout, uint min_width, uint min_height) {
+	assert(us_is_jpeg(src->format));
+
+	volatile int retval = 0;
+
+	struct jpeg_decompress_struct jpeg;
+	jpeg_create_decompress(&jpeg);
+
+	_jpeg_error_manager_s jpeg_error;
+	jpeg.err = jpeg_std_error((struct jpeg_error_mgr*)&jpeg_error);
+	jpeg_error.mgr.error_exit = _jpeg_error_handler;
+	jpeg_error.frame = src;
+	if (setjmp(jpeg_error.jmp) < 0) {
+		retval = -1;
+		goto done;
+	}
+
+	jpeg_mem_src(&jpeg, src->data, src->used);
+	jpeg_read_header(&jpeg, TRUE);
+
+	if (min_width > 0 && min_height > 0) {
+		// The reduced IDCT skips most of the work, unlike the resizing of the full image.
+		// Only 1/8, 1/4 and 1/2 are SIMD-accelerated by libjpeg-turbo, the others are slower than 1/1.
+		jpeg.scale_denom = 8;
+		for (jpeg.scale_num = 1; jpeg.scale_num < 8; jpeg.scale_num *= 2) {
+			jpeg_calc_output_dimensions(&jpeg);
+			if (jpeg.output_width >= min_width && jpeg.output_height >= min_height) {
+				break;
+			}
+		}
+	}
+	jpeg.dct_method = JDCT_IFAST;
+
+	uint bpp = 3;
+	US_FRAME_COPY_META(src, dest);
+	switch (layout) {
+		case US_CONVERT_RGB24:
+			jpeg.out_color_space = JCS_RGB;
+			dest->format = V4L2_PIX_FMT_RGB24;
+			break;
+		case US_CONVERT_BGR24:
+#			ifdef JCS_EXTENSIONS
+			jpeg.out_color_space = JCS_EXT_BGR;
+#			else
+			jpeg.out_color_space = JCS_RGB;
+#			endif
+			dest->format = V4L2_PIX_FMT_BGR24;
+			break;
+		case US_CONVERT_XRGB32:
+#			ifdef JCS_EXTENSIONS
+			jpeg.out_color_space = JCS_EXT_BGRX;
+#			else
+			jpeg.out_color_space = JCS_RGB;
+#			endif
+			dest->format = V4L2_PIX_FMT_XBGR32; // B, G, R, X
+			bpp = 4;
+			break;
+	}
+	jpeg_start_decompress(&jpeg);
+
+	dest->width = jpeg.output_width;
+	dest->height = jpeg.output_height;
+	dest->stride = dest->width * bpp;
+	dest->used = (uz)dest->stride * dest->height;
+	us_frame_realloc_data(dest, dest->used);
+
+	while (jpeg.output_scanline < jpeg.output_height) {
+		JSAMPROW rows[16];
+		const uint first = jpeg.output_scanline;
+		const uint count = US_MIN(jpeg.output_height - first, (uint)16);
+		for (uint index = 0; index < count; ++index) {
+			rows[index] = dest->data + (uz)(first + index) * dest->stride;
+		}
+		const uint read = jpeg_read_scanlines(&jpeg, rows, count);
+#		ifndef JCS_EXTENSIONS
+		for (uint index = 0; index < read; ++index) {
+			_jpeg_rgb_to_layout(rows[index], dest->width, layout);
+		}
+#		else
+		(void)read;
+#		endif
+	}
+	jpeg_finish_decompress(&jpeg);
+
+done:
+	jpeg_destroy_decompress(&jpeg);
+	return retval;
+}
+
 static void _jpeg_error_handler(j_common_ptr jpeg) {
 	_jpeg_error_manager_s *jpeg_error = (_jpeg_error_manager_s*)jpeg->err;
 	char msg[JMSG_LENGTH_MAX];
@@ -173,3 +266,19 @@ static void _jpeg_error_handler(j_common_ptr jpeg) {
 	US_LOG_ERROR("Can't decompress JPEG: %s", msg);
 	longjmp(jpeg_error->jmp, -1);
 }
+
+#ifndef JCS_EXTENSIONS
+static void _jpeg_rgb_to_layout(u8 *row, uint width, us_convert_layout_e layout) {
+	// In place from the end, the 32-bit pixel never overwrites the unread ones
+	for (uint x = width; x-- > 0;) {
+		const u8 r = row[x * 3];
+		const u8 g = row[x * 3 + 1];
+		const u8 b = row[x * 3 + 2];
+		switch (layout) {
+			case US_CONVERT_RGB24: break;
+			case US_CONVERT_BGR24: row[x * 3] = b; row[x * 3 + 2] = r; break;
+			case US_CONVERT_XRGB32: row[x * 4] = b; row[x * 4 + 1] = g; row[x * 4 + 2] = r; row[x * 4 + 3] = 0xFF; break;
+		}
+	}
+}
+#endif
@@ -24,6 +24,10 @@
 
 #include "types.h"
 #include "frame.h"
+#include "convert.h"
 
 
 int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode);
+// Decodes to the packed pixels. If min_width and min_height are set, the image is downscaled
+// in the DCT domain to the smallest size that is still not less than requested.
+int us_unjpeg_to_packed(const us_frame_s *src, us_frame_s *dest, us_convert_layout_e layout, uint min_width, uint min_height);
@@ -35,6 +35,7 @@
 #include "../libs/logging.h"
 #include "../libs/frame.h"
 #include "../libs/capture.h"
+#include "../libs/convert.h"
 
 #include "workers.h"
 #include "m2m.h"
@@ -161,6 +162,9 @@ void us_encoder_open(us_encoder_s *enc, us_capture_s *cap) {
 	} else {
 		US_LOG_INFO("Using JPEG quality: %u%%", quality);
 	}
+	if (type == US_ENCODER_TYPE_CPU) {
+		US_LOG_INFO("Using pixel conversion kernels: %s", us_convert_get_kernels_name());
+	}
 
 	US_MUTEX_LOCK(run->mutex);
 	run->type = type;
@@ -40,19 +40,11 @@ static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame);
 static void _jpeg_write_scanlines_yuv(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
 static void _jpeg_write_scanlines_yuv_planar(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
 static void _jpeg_write_scanlines_grey(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
 static void _jpeg_write_scanlines_rgb24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
 #ifndef JCS_EXTENSIONS
 #warning JCS_EXT_BGR is not supported, please use libjpeg-turbo
-static void _jpeg_write_scanlines_bgr24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
 #endif
-static void _jpeg_write_scanlines_nv12(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_nv16(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_nv24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-
-static void _nv12_to_rgb24(const u8 *in, u8 *out, int width, int height);
-static void _nv16_to_rgb24(const u8 *in, u8 *out, int width, int height);
-static void _nv24_to_rgb24(const u8 *in, u8 *out, int width, int height);
+static void _jpeg_write_scanlines_converted(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
 
 static void _jpeg_init_destination(j_compress_ptr jpeg);
 static boolean _jpeg_empty_output_buffer(j_compress_ptr jpeg);
@@ -116,25 +108,16 @@ void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, uint quali
 			break;
 
 		case V4L2_PIX_FMT_NV12:
-			_jpeg_write_scanlines_nv12(&jpeg, src);
-			break;
-
 		case V4L2_PIX_FMT_NV16:
-			_jpeg_write_scanlines_nv16(&jpeg, src);
-			break;
-
 		case V4L2_PIX_FMT_NV24:
-			_jpeg_write_scanlines_nv24(&jpeg, src);
+		case V4L2_PIX_FMT_RGB565:
+			_jpeg_write_scanlines_converted(&jpeg, src);
 			break;
 		
 		case V4L2_PIX_FMT_GREY:
 			_jpeg_write_scanlines_grey(&jpeg, src);
 			break;
 
-		case V4L2_PIX_FMT_RGB565:
-			_jpeg_write_scanlines_rgb565(&jpeg, src);
-			break;
-
 		case V4L2_PIX_FMT_RGB24:
 			_jpeg_write_scanlines_rgb24(&jpeg, src);
 			break;
@@ -143,7 +126,7 @@ void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, uint quali
 #			ifdef JCS_EXTENSIONS
 			_jpeg_write_scanlines_rgb24(&jpeg, src); // Use native JCS_EXT_BGR
 #			else
-			_jpeg_write_scanlines_bgr24(&jpeg, src);
+			_jpeg_write_scanlines_converted(&jpeg, src);
 #			endif
 			break;
 		default: assert(0 && "Unsupported input format for CPU encoder"); return;
@@ -301,35 +284,6 @@ static void _jpeg_write_scanlines_grey(struct jpeg_compress_struct *jpeg, const
 	free(line_buf);
 }
 
-static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	u8 *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
-
-	const uint padding = us_frame_get_padding(frame);
-	const u8 *data = frame->data;
-
-	while (jpeg->next_scanline < frame->height) {
-		u8 *ptr = line_buf;
-
-		for (uint x = 0; x < frame->width; ++x) {
-			const uint two_byte = (data[1] << 8) + data[0];
-
-			ptr[0] = data[1] & 248; // Red
-			ptr[1] = (u8)((two_byte & 2016) >> 3); // Green
-			ptr[2] = (data[0] & 31) * 8; // Blue
-			ptr += 3;
-
-			data += 2;
-		}
-		data += padding;
-
-		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
-	}
-
-	free(line_buf);
-}
-
 static void _jpeg_write_scanlines_rgb24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
 	const uint padding = us_frame_get_padding(frame);
 	u8 *data = frame->data;
@@ -342,35 +296,6 @@ static void _jpeg_write_scanlines_rgb24(struct jpeg_compress_struct *jpeg, const
 	}
 }
 
-#ifndef JCS_EXTENSIONS
-static void _jpeg_write_scanlines_bgr24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	u8 *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
-
-	const uint padding = us_frame_get_padding(frame);
-	u8 *data = frame->data;
-
-	while (jpeg->next_scanline < frame->height) {
-		u8 *ptr = line_buf;
-
-		// swap B and R values
-		for (uint x = 0; x < frame->width * 3; x += 3) {
-			ptr[0] = data[x + 2];
-			ptr[1] = data[x + 1];
-			ptr[2] = data[x];
-			ptr += 3;
-		}
-		
-		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
-
-		data += (frame->width * 3) + padding;
-	}
-
-	free(line_buf);
-}
-#endif
-
 #define JPEG_OUTPUT_BUFFER_SIZE ((size_t)4096)
 
 static void _jpeg_init_destination(j_compress_ptr jpeg) {
@@ -409,144 +334,18 @@ static void _jpeg_term_destination(j_compress_ptr jpeg) {
 	us_frame_append_data(dest->frame, dest->buf, final);
 }
 
-static void _nv12_to_rgb24(const u8 *in, u8 *out, int width, int height) {
-	int frame_size = width * height;
-	int uv_offset = frame_size;
-
-	for (int i = 0; i < height; i++) {
-		for (int j = 0; j < width; j++) {
-			int uv_index = (i / 2) * width + 2 * (j / 2);
-			int Y = in[i * width + j];
-			int U = in[uv_offset + uv_index];
-			int V = in[uv_offset + uv_index + 1];
-
-			// YUV to RGB conversion
-			int C = Y - 16;
-			int D = U - 128;
-			int E = V - 128;
-			int R = (298 * C + 409 * E + 128) >> 8;
-			int G = (298 * C - 100 * D - 208 * E + 128) >> 8;
-			int B = (298 * C + 516 * D + 128) >> 8;
-
-			// Clamp values to [0, 255]
-			R = (R < 0) ? 0 : ((R > 255) ? 255 : R);
-			G = (G < 0) ? 0 : ((G > 255) ? 255 : G);
-			B = (B < 0) ? 0 : ((B > 255) ? 255 : B);
-
-			int rgb_index = (i * width + j) * 3;
-			out[rgb_index] = (u8)R;
-			out[rgb_index + 1] = (u8)G;
-			out[rgb_index + 2] = (u8)B;
-		}
-	}
-}
-
-static void _nv16_to_rgb24(const u8 *in, u8 *out, int width, int height) {
-	int frame_size = width * height;
-	int uv_offset = frame_size;
-
-	for (int i = 0; i < height; i++) {
-		for (int j = 0; j < width; j++) {
-			int y_index = i * width + j;
-			int uv_index = uv_offset + (i * width) + (j & ~1);
-			int Y = in[y_index];
-			int U = in[uv_index] - 128;
-			int V = in[uv_index + 1] - 128;
-
-			// YUV to RGB conversion
-			int R = (298 * (Y - 16) + 409 * V + 128) >> 8;
-			int G = (298 * (Y - 16) - 100 * U - 208 * V + 128) >> 8;
-			int B = (298 * (Y - 16) + 516 * U + 128) >> 8;
-
-			// Clamp values to [0, 255]
-			R = R < 0 ? 0 : (R > 255 ? 255 : R);
-			G = G < 0 ? 0 : (G > 255 ? 255 : G);
-			B = B < 0 ? 0 : (B > 255 ? 255 : B);
-
-			int rgb_index = y_index * 3;
-			out[rgb_index] = (u8)R;
-			out[rgb_index + 1] = (u8)G;
-			out[rgb_index + 2] = (u8)B;
-		}
-	}
-}
-
-static void _nv24_to_rgb24(const u8 *in, u8 *out, int width, int height) {
-	int frame_size = width * height;
-	int uv_offset = frame_size;
-
-	for (int i = 0; i < height; i++) {
-		for (int j = 0; j < width; j++) {
-			int y_index = i * width + j;
-			int uv_index = uv_offset + (2 * j) + (i * width * 2);
-			int Y = in[y_index];
-			int U = in[uv_index] - 128;
-			int V = in[uv_index + 1] - 128;
-
-			// YUV to RGB conversion
-			int R = (298 * (Y - 16) + 409 * V + 128) >> 8;
-			int G = (298 * (Y - 16) - 100 * U - 208 * V + 128) >> 8;
-			int B = (298 * (Y - 16) + 516 * U + 128) >> 8;
-
-			// Clamp values to [0, 255]
-			R = R < 0 ? 0 : (R > 255 ? 255 : R);
-			G = G < 0 ? 0 : (G > 255 ? 255 : G);
-			B = B < 0 ? 0 : (B > 255 ? 255 : B);
-
-			int rgb_index = y_index * 3;
-			out[rgb_index] = (u8)R;
-			out[rgb_index + 1] = (u8)G;
-			out[rgb_index + 2] = (u8)B;
-		}
-	}
-}
-
-static void _jpeg_write_scanlines_nv12(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	const uint padding = us_frame_get_padding(frame);
-	u8 *rgb;
-	US_CALLOC(rgb, frame->width * frame->height * 3);
-	_nv12_to_rgb24(frame->data, rgb, frame->width, frame->height);
-	u8 *data = rgb;
-
-	while (jpeg->next_scanline < frame->height) {
-		JSAMPROW scanlines[1] = {data};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
-
-		data += (frame->width * 3) + padding;
-	}
-
-	free(rgb);
-}
-
-static void _jpeg_write_scanlines_nv16(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	const uint padding = us_frame_get_padding(frame);
-	u8 *rgb;
-	US_CALLOC(rgb, frame->width * frame->height * 3);
-	_nv16_to_rgb24(frame->data, rgb, frame->width, frame->height);
-	u8 *data = rgb;
-
-	while (jpeg->next_scanline < frame->height) {
-		JSAMPROW scanlines[1] = {data};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
-
-		data += (frame->width * 3) + padding;
-	}
-
-	free(rgb);
-}
-
-static void _jpeg_write_scanlines_nv24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	const uint padding = us_frame_get_padding(frame);
+static void _jpeg_write_scanlines_converted(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
+	const uint stride = frame->width * 3;
 	u8 *rgb;
-	US_CALLOC(rgb, frame->width * frame->height * 3);
-	_nv24_to_rgb24(frame->data, rgb, frame->width, frame->height);
+	US_CALLOC(rgb, stride * frame->height);
+	(void)us_convert_to_rgb24(frame, rgb, stride); // The truncated frame remains black
 	u8 *data = rgb;
 
 	while (jpeg->next_scanline < frame->height) {
 		JSAMPROW scanlines[1] = {data};
 		jpeg_write_scanlines(jpeg, scanlines, 1);
 
-		data += (frame->width * 3) + padding;
+		data += stride;
 	}
 
 	free(rgb);
@@ -33,6 +33,7 @@
 
 #include "../../../libs/tools.h"
 #include "../../../libs/frame.h"
+#include "../../../libs/convert.h"
 
 
 void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, uint quality);
@@ -1122,6 +1122,25 @@ us_hwenc_error_e us_ffmpeg_hwenc_get_stats(us_ffmpeg_hwenc_s *encoder, us_hwenc_
 	return US_HWENC_OK;
 }
 
+// 运行时修改码率
+us_hwenc_error_e us_ffmpeg_hwenc_set_bitrate(us_ffmpeg_hwenc_s *encoder, uint bitrate_kbps) {
+	if (!encoder || !encoder->ctx || bitrate_kbps == 0) {
+		return US_HWENC_ERROR_INVALID_PARAM;
+	}
+
+	pthread_mutex_lock(&encoder->mutex);
+	if (encoder->bitrate_kbps != bitrate_kbps) {
+		// libx264 在下一帧编码前检测到 bit_rate 变化并调用 x264_encoder_reconfig()，
+		// 其它编码器在不支持重新配置时会继续使用原来的码率
+		encoder->bitrate_kbps = bitrate_kbps;
+		encoder->ctx->bit_rate = (int64_t)bitrate_kbps * 1000;
+		US_LOG_VERBOSE("HWENC: Bitrate changed to %u Kbps", bitrate_kbps);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return US_HWENC_OK;
+}
+
 // 销毁编码器
 void us_ffmpeg_hwenc_destroy(us_ffmpeg_hwenc_s *encoder) {
     if (!encoder) return;
@@ -1206,6 +1225,11 @@ us_hwenc_error_e us_ffmpeg_hwenc_get_stats(us_ffmpeg_hwenc_s *encoder, us_hwenc_
 	return US_HWENC_ERROR_FFMPEG_ERROR;
 }
 
+us_hwenc_error_e us_ffmpeg_hwenc_set_bitrate(us_ffmpeg_hwenc_s *encoder, uint bitrate_kbps) {
+	US_LOG_ERROR("HWENC: FFmpeg support not compiled");
+	return US_HWENC_ERROR_FFMPEG_ERROR;
+}
+
 void us_ffmpeg_hwenc_destroy(us_ffmpeg_hwenc_s *encoder) {
 	// 空实现
 }
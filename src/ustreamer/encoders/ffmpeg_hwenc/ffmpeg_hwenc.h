@@ -123,6 +123,8 @@ us_hwenc_error_e us_ffmpeg_hwenc_compress(us_ffmpeg_hwenc_s *encoder,
 
 us_hwenc_error_e us_ffmpeg_hwenc_reset(us_ffmpeg_hwenc_s *encoder);
 
+us_hwenc_error_e us_ffmpeg_hwenc_set_bitrate(us_ffmpeg_hwenc_s *encoder, uint bitrate_kbps);
+
 void us_ffmpeg_hwenc_destroy(us_ffmpeg_hwenc_s *encoder);
 
 // 硬件编码器检测和管理
@@ -234,6 +234,7 @@ us_mpp_error_e us_mpp_processor_enable_parallel(us_mpp_processor_s *processor, b
 us_mpp_error_e us_mpp_h264_encoder_set_profile(us_mpp_processor_s *encoder, uint32_t profile);
 us_mpp_error_e us_mpp_h264_encoder_set_rc_mode(us_mpp_processor_s *encoder, uint32_t rc_mode);
 us_mpp_error_e us_mpp_h264_encoder_set_qp_range(us_mpp_processor_s *encoder, uint32_t qp_min, uint32_t qp_max);
+us_mpp_error_e us_mpp_h264_encoder_set_bitrate(us_mpp_processor_s *encoder, uint32_t bitrate_kbps);
 
 // ==== 一体化编解码API ====
 
@@ -265,6 +266,7 @@ us_mpp_error_e us_mpp_transcoder_process(us_mpp_transcoder_s *transcoder,
 
 void us_mpp_transcoder_destroy(us_mpp_transcoder_s *transcoder);
 us_mpp_error_e us_mpp_transcoder_get_stats(us_mpp_transcoder_s *transcoder, us_mpp_stats_s *stats);
+us_mpp_error_e us_mpp_transcoder_set_bitrate(us_mpp_transcoder_s *transcoder, uint32_t bitrate_kbps);
 
 // ==== 内部辅助函数声明 ====
 us_mpp_error_e _us_mpp_processor_init_base(us_mpp_processor_s *proc, us_mpp_codec_type_e type);
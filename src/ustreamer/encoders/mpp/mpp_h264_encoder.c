@@ -508,6 +508,43 @@ us_mpp_error_e us_mpp_h264_encoder_set_rc_mode(us_mpp_processor_s *encoder, uint
     return US_MPP_OK;
 }
 
+us_mpp_error_e us_mpp_h264_encoder_set_bitrate(us_mpp_processor_s *encoder, uint32_t bitrate_kbps) {
+    if (!encoder || bitrate_kbps == 0) {
+        return US_MPP_ERROR_INVALID_PARAM;
+    }
+    
+    if (!atomic_load(&encoder->initialized)) {
+        encoder->bitrate_bps = bitrate_kbps * 1000;
+        return US_MPP_OK;
+    }
+    
+    // 运行时更新配置，MPP在下一帧生效，不需要重建编码器
+    pthread_mutex_lock(&encoder->mutex);
+    if (encoder->bitrate_bps == bitrate_kbps * 1000) {
+        pthread_mutex_unlock(&encoder->mutex);
+        return US_MPP_OK;
+    }
+    encoder->bitrate_bps = bitrate_kbps * 1000;
+    
+    if (encoder->enc_cfg) {
+        MPP_RET ret = mpp_enc_cfg_set_s32(encoder->enc_cfg, "rc:bps_target", encoder->bitrate_bps);
+        ret |= mpp_enc_cfg_set_s32(encoder->enc_cfg, "rc:bps_max", encoder->bitrate_bps * 105 / 100);
+        ret |= mpp_enc_cfg_set_s32(encoder->enc_cfg, "rc:bps_min", encoder->bitrate_bps * 95 / 100);
+        if (ret == MPP_OK) {
+            ret = encoder->mpi->control(encoder->ctx, MPP_ENC_SET_CFG, encoder->enc_cfg);
+        }
+        if (ret != MPP_OK) {
+            US_MPP_H264_LOG_ERROR("Failed to update bitrate: %d", ret);
+            pthread_mutex_unlock(&encoder->mutex);
+            return US_MPP_ERROR_INIT;
+        }
+    }
+    
+    pthread_mutex_unlock(&encoder->mutex);
+    US_MPP_H264_LOG_DEBUG("Bitrate updated to %u kbps", bitrate_kbps);
+    return US_MPP_OK;
+}
+
 us_mpp_error_e us_mpp_h264_encoder_set_qp_range(us_mpp_processor_s *encoder, uint32_t qp_min, uint32_t qp_max) {
     if (!encoder || qp_min > qp_max || qp_max > 51) {
         return US_MPP_ERROR_INVALID_PARAM;
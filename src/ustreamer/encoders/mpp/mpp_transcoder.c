@@ -254,6 +254,18 @@ void us_mpp_transcoder_destroy(us_mpp_transcoder_s *transcoder) {
     free(transcoder);
 }
 
+us_mpp_error_e us_mpp_transcoder_set_bitrate(us_mpp_transcoder_s *transcoder, uint32_t bitrate_kbps) {
+    if (!transcoder) {
+        return US_MPP_ERROR_INVALID_PARAM;
+    }
+    
+    if (!transcoder->initialized) {
+        return US_MPP_ERROR_NOT_INITIALIZED;
+    }
+    
+    return us_mpp_h264_encoder_set_bitrate(transcoder->encoder, bitrate_kbps);
+}
+
 us_mpp_error_e us_mpp_transcoder_get_stats(us_mpp_transcoder_s *transcoder, us_mpp_stats_s *stats) {
     if (!transcoder || !stats) {
         return US_MPP_ERROR_INVALID_PARAM;
@@ -54,6 +54,7 @@
 
 #include "../../libs/types.h"
 #include "../../libs/tools.h"
+#include "../../libs/array.h"
 #include "../../libs/threading.h"
 #include "../../libs/logging.h"
 #include "../../libs/frame.h"
@@ -472,10 +473,25 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 	if (stream->drm != NULL) {
 		us_fpsi_meta_s meta;
 		const uint fps = us_fpsi_get(stream->run->http->drm_fpsi, &meta);
+		const us_drm_stats_s *const st = &stream->drm->run->stats;
+		const ull flips = atomic_load(&st->flips);
+		const ull converted = atomic_load(&st->converted);
 		_A_EVBUFFER_ADD_PRINTF(buf,
-			" \"drm\": {\"live\": %s, \"fps\": %u},",
+			" \"drm\": {\"live\": %s, \"fps\": %u,"
+			" \"flips\": %llu, \"missed_vblanks\": %llu, \"replaced\": %llu, \"dropped\": %llu,"
+			" \"latency_ms\": {\"last\": %.3f, \"avg\": %.3f},"
+			" \"convert_ms\": {\"frames\": %llu, \"last\": %.3f, \"avg\": %.3f}},",
 			us_bool_to_string(meta.online),
-			fps
+			fps,
+			flips,
+			(ull)atomic_load(&st->missed_vblanks),
+			(ull)atomic_load(&st->replaced),
+			(ull)atomic_load(&stream->run->http->drm_dropped),
+			(double)atomic_load(&st->latency_us) / 1000,
+			(flips > 0 ? (double)atomic_load(&st->latency_sum_us) / flips / 1000 : 0),
+			converted,
+			(double)atomic_load(&st->convert_us) / 1000,
+			(converted > 0 ? (double)atomic_load(&st->convert_sum_us) / converted / 1000 : 0)
 		);
 	}
 #	endif
@@ -492,20 +508,29 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 		);
 	}
 
-	if (stream->jpeg_sink != NULL || stream->h264_sink != NULL) {
+	if (stream->jpeg_sink != NULL || stream->h264_sink != NULL || stream->raw_sink != NULL) {
+		const struct {
+			const char		*name;
+			us_memsink_s	*sink;
+		} sinks[] = {
+			{"jpeg", stream->jpeg_sink},
+			{"h264", stream->h264_sink},
+			{"raw", stream->raw_sink},
+		};
 		_A_EVBUFFER_ADD_PRINTF(buf, " \"sinks\": {");
-		if (stream->jpeg_sink != NULL) {
-			_A_EVBUFFER_ADD_PRINTF(buf,
-				"\"jpeg\": {\"has_clients\": %s}",
-				us_bool_to_string(atomic_load(&stream->jpeg_sink->has_clients))
-			);
-		}
-		if (stream->h264_sink != NULL) {
+		bool first = true;
+		for (uint index = 0; index < US_ARRAY_LEN(sinks); ++index) {
+			if (sinks[index].sink == NULL) {
+				continue;
+			}
 			_A_EVBUFFER_ADD_PRINTF(buf,
-				"%s\"h264\": {\"has_clients\": %s}",
-				(stream->jpeg_sink ? ", " : ""),
-				us_bool_to_string(atomic_load(&stream->h264_sink->has_clients))
+				"%s\"%s\": {\"has_clients\": %s, \"oversize_dropped\": %llu}",
+				(first ? "" : ", "),
+				sinks[index].name,
+				us_bool_to_string(atomic_load(&sinks[index].sink->has_clients)),
+				(ull)atomic_load(&sinks[index].sink->oversize_dropped)
 			);
+			first = false;
 		}
 		_A_EVBUFFER_ADD_PRINTF(buf, "},");
 	}
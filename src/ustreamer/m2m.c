@@ -92,6 +92,32 @@ void us_m2m_encoder_destroy(us_m2m_encoder_s *enc) {
 	free(enc);
 }
 
+void us_m2m_encoder_set_bitrate(us_m2m_encoder_s *enc, uint bitrate) {
+	us_m2m_encoder_runtime_s *const run = enc->run;
+	assert(enc->output_format == V4L2_PIX_FMT_H264);
+
+	bitrate *= 1000; // From Kbps
+	if (enc->bitrate == bitrate) {
+		return;
+	}
+	enc->bitrate = bitrate;
+
+	if (!run->ready) {
+		return; // Will be applied on the next configuration
+	}
+	struct v4l2_control ctl = {0};
+	ctl.id = V4L2_CID_MPEG_VIDEO_BITRATE;
+	ctl.value = bitrate;
+	if (us_xioctl(run->fd, VIDIOC_S_CTRL, &ctl) < 0) {
+		// Not every driver allows to change the bitrate while streaming
+		_LOG_PERROR("Can't change bitrate on the fly; encoder will be reconfigured");
+		_m2m_encoder_cleanup(enc);
+		run->p_width = 0; // Force _m2m_encoder_ensure()
+		return;
+	}
+	_LOG_VERBOSE("Bitrate changed to %u Kbps", bitrate / 1000);
+}
+
 int us_m2m_encoder_compress(us_m2m_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, bool force_key) {
 	us_m2m_encoder_runtime_s *const run = enc->run;
 
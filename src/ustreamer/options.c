@@ -818,7 +818,8 @@ static void _help(FILE *fp, const us_capture_s *cap, const us_encoder_s *enc, co
 	SAY("═══════════════════════");
 	SAY("    --drm-device </dev/dri/cardX>  ─ Specify DRM device for centered display output.");
 	SAY("                                    Automatically enables low-priority centered display mode.");
-	SAY("                                    Example: /dev/dri/card1");
+	SAY("                                    The picture is scaled to the display mode with the borders.");
+	SAY("                                    Example: /dev/dri/card1, or the vkms virtual device for tests.");
 	SAY("    --drm-port <connector>         ─ Specify DRM display connector/port.");
 	SAY("                                    Examples: HDMI-A-1, eDP-1, DP-1");
 	SAY("                                    Default: HDMI-A-2\n");
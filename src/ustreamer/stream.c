@@ -106,6 +106,7 @@ static void _stream_drm_ensure_no_signal(us_stream_s *stream);
 static void _stream_expose_jpeg(us_stream_s *stream, const us_frame_s *frame);
 static void _stream_expose_raw(us_stream_s *stream, const us_frame_s *frame);
 static void _stream_encode_expose_h264(us_stream_s *stream, const us_frame_s *frame, bool force_key);
+static void _stream_update_h264_bitrate(us_stream_s *stream);
 static void _stream_check_suicide(us_stream_s *stream);
 
 
@@ -171,6 +172,7 @@ void us_stream_loop(us_stream_s *stream) {
 		run->h264_tmp_src = us_frame_init();
 		run->h264_dest = us_frame_init();
 		run->h264_enc = us_m2m_h264_encoder_init("H264", stream->h264_m2m_path, stream->h264_bitrate, stream->h264_gop);
+		run->h264_bitrate = stream->h264_bitrate;
 	}
 #ifdef WITH_MPP
 	// 初始化MPP transcoder (用于RKMPP硬件加速)
@@ -303,7 +305,7 @@ void us_stream_loop(us_stream_s *stream) {
 					us_capture_hwbuf_incref(hw); \
 					us_queue_put(x_ctx->queue, hw, 0); \
 				}
-#			define QUEUE_HW_DROP_OLD(x_ctx) if (x_ctx != NULL) { \
+#			define QUEUE_HW_DROP_OLD(x_ctx, x_dropped) if (x_ctx != NULL) { \
 					us_capture_hwbuf_incref(hw); \
 					if (us_queue_put(x_ctx->queue, hw, 0) < 0) { \
 						us_capture_hwbuf_s *old_hw = NULL; \
@@ -313,13 +315,14 @@ void us_stream_loop(us_stream_s *stream) {
 						} else { \
 							us_capture_hwbuf_decref(hw); \
 						} \
+						atomic_fetch_add(x_dropped, 1); \
 					} \
 				}
 			QUEUE_HW(jpeg_ctx);
 			QUEUE_HW(raw_ctx);
 			QUEUE_HW(h264_ctx);
 #			if defined(WITH_DRM) || defined(WITH_V4P)
-			QUEUE_HW_DROP_OLD(drm_ctx);
+			QUEUE_HW_DROP_OLD(drm_ctx, &run->http->drm_dropped);
 #			endif
 #			undef QUEUE_HW_DROP_OLD
 #			undef QUEUE_HW
@@ -576,14 +579,8 @@ static void *_drm_thread(void *v_ctx) {
 
 		CHECK(us_drm_open(stream->drm, ctx->stream->cap));
 
-		// Check if platform needs VSync (only RPI V4P)
-		const bool needs_vsync = (stream->drm->run->platform == US_DRM_PLATFORM_RPI);
-
 		while (!atomic_load(ctx->stop)) {
-			// Only wait for VSync on platforms that need it
-			if (needs_vsync) {
-				CHECK(us_drm_wait_for_vsync(stream->drm));
-			}
+			CHECK(us_drm_wait_for_vsync(stream->drm));
 			US_DELETE(prev_hw, us_capture_hwbuf_decref);
 
 			us_capture_hwbuf_s *hw = _get_latest_hw(ctx->queue);
@@ -856,6 +853,7 @@ static void _stream_encode_expose_h264(us_stream_s *stream, const us_frame_s *fr
 		run->h264_key_requested = false;
 		force_key = true;
 	}
+	_stream_update_h264_bitrate(stream);
 
 #ifdef WITH_MPP
 	// MPP transcoder 处理（支持多种输入格式转H264）
@@ -925,6 +923,46 @@ done:
 	us_fpsi_update(run->http->h264_fpsi, meta.online, &meta);
 }
 
+static void _stream_update_h264_bitrate(us_stream_s *stream) {
+	// The sink client (e.g. Janus with REMB from the browsers) can ask for a lower bitrate.
+	// The configured bitrate is the ceiling. Decreases are applied at once to get rid
+	// of the congestion, increases are probed not often than once per 2 seconds.
+	us_stream_runtime_s *const run = stream->run;
+
+	uint bitrate = stream->h264_sink->bitrate_requested;
+	if (bitrate == 0 || bitrate > stream->h264_bitrate) {
+		bitrate = stream->h264_bitrate;
+	}
+	bitrate = US_MAX(bitrate, (uint)25); // The same minimum as for --h264-bitrate
+
+	const uint diff = (bitrate > run->h264_bitrate ? bitrate - run->h264_bitrate : run->h264_bitrate - bitrate);
+	if (diff == 0 || (diff < run->h264_bitrate / 10 && bitrate != stream->h264_bitrate)) {
+		return; // Ignore jitter of the estimation
+	}
+	const ldf now_ts = us_get_now_monotonic();
+	if (bitrate > run->h264_bitrate && run->h264_bitrate_ts + 2 > now_ts) {
+		return;
+	}
+
+	US_LOG_VERBOSE("H264: Changing bitrate: %u -> %u Kbps", run->h264_bitrate, bitrate);
+	run->h264_bitrate = bitrate;
+	run->h264_bitrate_ts = now_ts;
+
+#	ifdef WITH_MPP
+	if (run->mpp_transcoder != NULL) {
+		us_mpp_transcoder_set_bitrate(run->mpp_transcoder, bitrate);
+		return;
+	}
+#	endif
+#	ifdef WITH_FFMPEG
+	if (run->ffmpeg_enc != NULL) {
+		us_ffmpeg_hwenc_set_bitrate(run->ffmpeg_enc, bitrate);
+		return;
+	}
+#	endif
+	us_m2m_encoder_set_bitrate(run->h264_enc, bitrate);
+}
+
 static void _stream_check_suicide(us_stream_s *stream) {
 	if (stream->exit_on_no_clients == 0) {
 		return;
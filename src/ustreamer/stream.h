@@ -54,6 +54,7 @@ typedef struct {
 #	if defined(WITH_DRM) || defined(WITH_V4P)
 	atomic_bool		drm_live;
 	us_fpsi_s		*drm_fpsi;
+	atomic_ullong	drm_dropped; // Replaced in the queue by the newer frames
 #	endif
 
 	atomic_bool		h264_online;
@@ -82,6 +83,8 @@ typedef struct {
 	us_frame_s			*h264_tmp_src;
 	us_frame_s			*h264_dest;
 	bool				h264_key_requested;
+	uint				h264_bitrate; // Current, Kbps
+	ldf					h264_bitrate_ts;
 
 	us_blank_s			*blank;
 